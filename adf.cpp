@@ -0,0 +1,210 @@
+#include "adf.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+namespace
+{
+
+// Index of point (a, b, c) of a cell's 3x3x3 lattice, 0 <= a, b, c <= 2.
+int latticeIndex(const int a, const int b, const int c)
+{
+    return (c*3 + b)*3 + a;
+}
+
+// Index of point (a, b, c) of a cell's 5x5x5 lattice, 0 <= a, b, c <= 4.
+int fineIndex(const int a, const int b, const int c)
+{
+    return (c*5 + b)*5 + a;
+}
+
+// Trilinear reconstruction from the corners (adffield.h order) at fractions 0, 0.5 or 1 along each axis.
+float trilinear(const float* corners, const float tx, const float ty, const float tz)
+{
+    const float x00 = corners[0] + (corners[1] - corners[0])*tx;
+    const float x10 = corners[2] + (corners[3] - corners[2])*tx;
+    const float x01 = corners[4] + (corners[5] - corners[4])*tx;
+    const float x11 = corners[6] + (corners[7] - corners[6])*tx;
+    const float y0 = x00 + (x10 - x00)*ty;
+    const float y1 = x01 + (x11 - x01)*ty;
+    return y0 + (y1 - y0)*tz;
+}
+
+// Stores the 3x3x3 points of a cell as steps from the first, clamped to the step range (a point
+// can only be further if the distances are off by more than float rounding).
+AdaptiveLeaf encodeLeaf(const float* points, const float step)
+{
+    AdaptiveLeaf leaf;
+    leaf.first = points[0];
+    for (int point = 1; point < 27; ++point) {
+        const float steps = std::round((points[point] - points[0]) / step);
+        leaf.steps[point - 1] = static_cast<int16_t>(std::max(-k_adaptiveSteps, std::min(k_adaptiveSteps, steps)));
+    }
+    return leaf;
+}
+
+}
+
+AdaptiveFieldBuilder::AdaptiveFieldBuilder(const DistanceEngine& distance, const SignEvaluator& sign, const int size,
+                                           const bool isSigned, const float tolerance):
+    distance(distance), sign(sign), size(size), isSigned(isSigned), tolerance(tolerance), maxLeafDepth(0)
+{
+}
+
+QueryCounters AdaptiveFieldBuilder::build(ThreadPool& pool)
+{
+    // Cells (and so leaves) are at least two lattice intervals.
+    int topDepth = 0;
+    while (topDepth < k_minDepth && (size >> (topDepth+1)) >= 2)
+        topDepth++;
+    const int topCellSize = size >> topDepth;
+    const size_t numTopCells = static_cast<size_t>(1) << (3*topDepth);
+
+    // The top levels are complete: the children of node n of a level are 8n to 8n+7 of the next.
+    nodes.clear();
+    leaves.clear();
+    size_t levelBegin = 0;
+    for (int depth = 0; depth < topDepth; ++depth) {
+        const size_t levelNodes = static_cast<size_t>(1) << (3*depth);
+        for (size_t n = 0; n < levelNodes; ++n)
+            nodes.push_back(static_cast<uint32_t>(levelBegin + levelNodes + 8*n));
+        levelBegin += levelNodes;
+    }
+    nodes.resize(levelBegin + numTopCells);
+
+    std::vector<Subtree> subtrees(numTopCells);
+    std::atomic<uint64_t> distanceQueries(0), insideTests(0), nodeVisits(0), insideSkipped(0);
+    parallelFor(pool, numTopCells, [&](const size_t cell) {
+        // The octants chosen on the way down, most significant first.
+        int x0 = 0, y0 = 0, z0 = 0;
+        for (int depth = 1; depth <= topDepth; ++depth) {
+            const size_t child = (cell >> (3*(topDepth - depth))) & 7;
+            const int half = size >> depth;
+            x0 += (child & 1) ? half : 0;
+            y0 += (child & 2) ? half : 0;
+            z0 += (child & 4) ? half : 0;
+        }
+
+        EvaluationContext context;
+        context.counters = {0, 0, 0, 0};
+        const int half = topCellSize / 2;
+        float points[27];
+        for (int c = 0; c < 3; ++c) {
+            for (int b = 0; b < 3; ++b) {
+                for (int a = 0; a < 3; ++a)
+                    points[latticeIndex(a, b, c)] = latticeDistance(x0 + a*half, y0 + b*half, z0 + c*half, context);
+            }
+        }
+        Subtree& subtree = subtrees[cell];
+        subtree.nodes.resize(1);
+        subtree.maxLeafDepth = 0;
+        buildCell(x0, y0, z0, topCellSize, topDepth, points, 0, subtree, context);
+
+        distanceQueries += context.counters.distanceQueries;
+        insideTests += context.counters.insideTests;
+        nodeVisits += context.counters.nodeVisits;
+        insideSkipped += context.counters.insideSkipped;
+    });
+
+    // Subtrees follow the top levels in order, their roots are the last top level.
+    maxLeafDepth = 0;
+    for (size_t cell = 0; cell < numTopCells; ++cell) {
+        const Subtree& subtree = subtrees[cell];
+        const uint32_t nodeBase = static_cast<uint32_t>(nodes.size()) - 1; // Subtree node 0 is stored in the top level.
+        const uint32_t leafBase = static_cast<uint32_t>(leaves.size());
+        auto relocate = [nodeBase, leafBase](const uint32_t entry) {
+            return (entry & k_adaptiveLeaf) ? (entry + leafBase) : (entry + nodeBase);
+        };
+        nodes[levelBegin + cell] = relocate(subtree.nodes[0]);
+        for (size_t n = 1; n < subtree.nodes.size(); ++n)
+            nodes.push_back(relocate(subtree.nodes[n]));
+        leaves.insert(leaves.end(), subtree.leaves.begin(), subtree.leaves.end());
+        maxLeafDepth = std::max(maxLeafDepth, subtree.maxLeafDepth);
+    }
+
+    QueryCounters counters = {distanceQueries, insideTests, nodeVisits, insideSkipped};
+    return counters;
+}
+
+float AdaptiveFieldBuilder::sample(const int x, const int y, const int z) const
+{
+    return sampleAdaptiveField(nodes.data(), leaves.data(), static_cast<uint32_t>(size),
+                               static_cast<float>(x), static_cast<float>(y), static_cast<float>(z));
+}
+
+// Signed (or inside zero) distance at a lattice point. Neighbouring queries of a task share the hint.
+float AdaptiveFieldBuilder::latticeDistance(const int x, const int y, const int z, EvaluationContext& context) const
+{
+    context.counters.insideTests++;
+    const bool inside = sign.isInside(x, y, z);
+    if (inside && !isSigned) {
+        context.counters.insideSkipped++;
+        return 0.f;
+    }
+    context.counters.distanceQueries++;
+    const double squaredDistance = distance.hintedSquaredDistance(voxelCenter(x, y, z, size + 1), context.hint,
+                                                                  context.counters.nodeVisits);
+    const float dist = std::sqrt(static_cast<float>(squaredDistance));
+    return inside ? -dist : dist;
+}
+
+void AdaptiveFieldBuilder::buildCell(const int x0, const int y0, const int z0, const int cellSize, const int depth,
+                                     const float* points, const size_t node, Subtree& subtree, EvaluationContext& context) const
+{
+    const float step = adaptiveLeafStep(static_cast<uint32_t>(size), static_cast<float>(cellSize));
+    const AdaptiveLeaf leaf = encodeLeaf(points, step);
+
+    // Cells of two lattice intervals have no points between those stored. Larger ones compare their
+    // 5x5x5 lattice with the reconstruction (from the stored steps) of the octant each point lies in.
+    float finePoints[125];
+    bool split = false;
+    const int quarter = cellSize / 4;
+    if (quarter > 0) {
+        float stored[27];
+        for (int point = 0; point < 27; ++point)
+            stored[point] = adaptiveLeafValue(leaf, step, point);
+        for (int c = 0; c < 5; ++c) {
+        for (int b = 0; b < 5; ++b) {
+        for (int a = 0; a < 5; ++a) {
+            float& point = finePoints[fineIndex(a, b, c)];
+            if (a % 2 == 0 && b % 2 == 0 && c % 2 == 0)
+                point = points[latticeIndex(a/2, b/2, c/2)];
+            else
+                point = latticeDistance(x0 + a*quarter, y0 + b*quarter, z0 + c*quarter, context);
+            const int oa = std::min(a/2, 1), ob = std::min(b/2, 1), oc = std::min(c/2, 1);
+            float corners[8];
+            for (int corner = 0; corner < 8; ++corner)
+                corners[corner] = stored[latticeIndex(oa + (corner & 1), ob + ((corner >> 1) & 1), oc + ((corner >> 2) & 1))];
+            const float error = std::fabs(point - trilinear(corners, 0.5f*static_cast<float>(a - 2*oa), 0.5f*static_cast<float>(b - 2*ob),
+                                                             0.5f*static_cast<float>(c - 2*oc)));
+            split = split || error > tolerance;
+        }
+        }
+        }
+    }
+
+    if (!split) {
+        subtree.nodes[node] = k_adaptiveLeaf | static_cast<uint32_t>(subtree.leaves.size());
+        subtree.leaves.push_back(leaf);
+        subtree.maxLeafDepth = std::max(subtree.maxLeafDepth, depth);
+        return;
+    }
+
+    const int half = cellSize / 2;
+    const size_t firstChild = subtree.nodes.size();
+    subtree.nodes[node] = static_cast<uint32_t>(firstChild);
+    subtree.nodes.resize(firstChild + 8);
+    for (int child = 0; child < 8; ++child) {
+        const int a = 2*(child & 1), b = 2*((child >> 1) & 1), c = 2*((child >> 2) & 1);
+        float childPoints[27];
+        for (int k = 0; k < 3; ++k) {
+            for (int j = 0; j < 3; ++j) {
+                for (int i = 0; i < 3; ++i)
+                    childPoints[latticeIndex(i, j, k)] = finePoints[fineIndex(a + i, b + j, c + k)];
+            }
+        }
+        buildCell(x0 + (a/2)*half, y0 + (b/2)*half, z0 + (c/2)*half, half, depth + 1, childPoints,
+                  firstChild + static_cast<size_t>(child), subtree, context);
+    }
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "adffield.h"
+#include "distance.h"
+#include "field.h"
+#include "sign.h"
+#include "threadpool.h"
+
+// Builds an adaptive distance field (adffield.h) top down. Every cell has the 27 points of its
+// 3x3x3 lattice, as it would store them, and queries the other points of its 5x5x5 lattice to
+// compare them with the reconstruction of the octant they lie in; cells off by more than the
+// tolerance at any point are split, down to cells of two lattice intervals. The 5x5x5 points are
+// the 3x3x3 points of the children, so a cell never queries a point twice. The top k_minDepth
+// levels are always split, their cells are built in parallel and stored in order, so the layout
+// does not depend on the number of threads.
+class AdaptiveFieldBuilder
+{
+public:
+    // The sign evaluator is of the lattice, a (size+1)^3 grid. The tolerance is in unit cube units.
+    AdaptiveFieldBuilder(const DistanceEngine& distance, const SignEvaluator& sign, int size, bool isSigned, float tolerance);
+
+    QueryCounters build(ThreadPool& pool);
+
+    // Distance at lattice point (x, y, z), reconstructed from the leaves.
+    float sample(int x, int y, int z) const;
+
+    int getSize() const { return size; }
+    bool getIsSigned() const { return isSigned; }
+    float getTolerance() const { return tolerance; }
+    const std::vector<uint32_t>& getNodes() const { return nodes; }
+    const std::vector<AdaptiveLeaf>& getLeaves() const { return leaves; }
+    int getMaxLeafDepth() const { return maxLeafDepth; }
+
+    static const int k_minDepth = 3;
+
+private:
+    // Nodes and leaves of a subtree, indexed from the subtree's root (node 0).
+    struct Subtree
+    {
+        std::vector<uint32_t> nodes;
+        std::vector<AdaptiveLeaf> leaves;
+        int maxLeafDepth;
+    };
+
+    float latticeDistance(int x, int y, int z, EvaluationContext& context) const;
+    // Points are the cell's 3x3x3 lattice (adffield.h order).
+    void buildCell(int x0, int y0, int z0, int cellSize, int depth, const float* points, size_t node,
+                   Subtree& subtree, EvaluationContext& context) const;
+
+    const DistanceEngine& distance;
+    const SignEvaluator& sign;
+    const int size;
+    const bool isSigned;
+    const float tolerance;
+    std::vector<uint32_t> nodes;
+    std::vector<AdaptiveLeaf> leaves;
+    int maxLeafDepth;
+};
@@ -0,0 +1,208 @@
+#pragma once
+
+// Adaptive distance field: an octree whose leaves store the distance at the 27 points of their
+// 3x3x3 lattice, reconstructed trilinearly inside each of their octants. Cells are only split
+// where that reconstruction is off by more than a tolerance, so detail gets small cells and smooth
+// or empty regions large ones. Header-only, so viewers can read fields without linking the
+// generator.
+//
+// File layout (little endian):
+//   AdaptiveFieldHeader
+//   nodes at nodesOffset: numNodes uint32_t entries, the root first. An entry with k_adaptiveLeaf
+//     set is a leaf (the low bits are its number), any other entry is the index of the first of
+//     the node's 8 children, which are stored together. Child c is the octant above the middle
+//     of its parent along x, y and z where bits 0, 1 and 2 of c are set.
+//   leaves at leavesOffset: numLeaves AdaptiveLeaf. Point (a, b, c) of a leaf's lattice, 0 <= a,
+//     b, c <= 2 from its smallest corner, is point (c*3 + b)*3 + a: the first is a float, the
+//     other 26 are 16 bit steps away from it. A step is the cell's diagonal over k_adaptiveSteps,
+//     the most the distance can change across the cell, so a leaf takes 56 bytes and its values
+//     are off by at most half a step (1/65534 of its diagonal).
+//
+// Corners lie on a lattice of size+1 points per axis, the voxel centers of a (size+1)^3 grid over
+// the unit cube, and the root covers the whole lattice. A unit cube point u is at lattice
+// coordinates u*(size+1) - 0.5. Distances are in unit cube units, negative inside for signed fields.
+// A unit cube point u maps back to mesh space as (u - 0.5)/meshScale + meshOrigin.
+//
+// The tolerance holds at the points the builder tests, the 5x5x5 points of every leaf (the
+// lattices of its octants). Leaves larger than 4 lattice intervals have lattice points between
+// those, where the error is not bounded by it; the generator reports the error it measures.
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+const char k_adaptiveFieldMagic[8] = {'D', 'F', 'G', 'E', 'N', 'A', 'D', 'F'};
+const uint32_t k_adaptiveFieldVersion = 2;
+const uint32_t k_adaptiveLeaf = 0x80000000u;
+const float k_adaptiveSteps = 32767.f; // Steps of a leaf value per cell diagonal (the int16 range).
+const uint32_t k_adaptiveFieldSigned = 1u; // AdaptiveFieldHeader::flags
+
+struct AdaptiveFieldHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t size; // Lattice intervals per axis (cells of the deepest level), a power of two.
+    uint32_t numNodes;
+    uint32_t numLeaves;
+    uint32_t flags;
+    float tolerance; // Largest reconstruction error at the tested points (see above), in unit cube units.
+    float meshOrigin[3]; // Mesh space to unit cube: (p - meshOrigin)*meshScale + 0.5.
+    float meshScale;
+    uint64_t nodesOffset;
+    uint64_t leavesOffset;
+};
+
+struct AdaptiveLeaf
+{
+    float first;       // Distance at the leaf's smallest corner.
+    int16_t steps[26]; // Of the other lattice points from the first.
+};
+
+static_assert(sizeof(AdaptiveFieldHeader) == 64, "AdaptiveFieldHeader layout");
+static_assert(sizeof(AdaptiveLeaf) == 56, "AdaptiveLeaf layout");
+
+// Size of a leaf step for cells of cellSize lattice intervals, in unit cube units.
+inline float adaptiveLeafStep(const uint32_t size, const float cellSize)
+{
+    return cellSize * 1.7320508f / (static_cast<float>(size + 1) * k_adaptiveSteps);
+}
+
+inline float adaptiveLeafValue(const AdaptiveLeaf& leaf, const float step, const int point)
+{
+    return (point == 0) ? leaf.first : leaf.first + static_cast<float>(leaf.steps[point - 1])*step;
+}
+
+// Distance at lattice coordinates (x, y, z), clamped to the lattice. One root to leaf walk and a
+// trilinear interpolation of the corners of the leaf's octant.
+inline float sampleAdaptiveField(const uint32_t* nodes, const AdaptiveLeaf* leaves, const uint32_t size,
+                                 const float x, const float y, const float z)
+{
+    const float n = static_cast<float>(size);
+    const float p[3] = {(x < 0.f) ? 0.f : ((x > n) ? n : x),
+                        (y < 0.f) ? 0.f : ((y > n) ? n : y),
+                        (z < 0.f) ? 0.f : ((z > n) ? n : z)};
+    float cellMin[3] = {0.f, 0.f, 0.f};
+    float cellSize = n; // Powers of two, exact in float.
+    uint32_t entry = nodes[0];
+    while (!(entry & k_adaptiveLeaf)) {
+        cellSize *= 0.5f;
+        uint32_t child = 0;
+        for (int axis = 0; axis < 3; ++axis) {
+            if (p[axis] >= cellMin[axis] + cellSize) {
+                child |= 1u << axis;
+                cellMin[axis] += cellSize;
+            }
+        }
+        entry = nodes[entry + child];
+    }
+
+    const AdaptiveLeaf& leaf = leaves[entry & ~k_adaptiveLeaf];
+    const float step = adaptiveLeafStep(size, cellSize);
+    const float half = 0.5f*cellSize;
+    int octant[3];
+    float t[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        octant[axis] = (p[axis] >= cellMin[axis] + half) ? 1 : 0;
+        t[axis] = (p[axis] - cellMin[axis] - static_cast<float>(octant[axis])*half) / half;
+    }
+    float corners[8];
+    for (int c = 0; c < 8; ++c) {
+        const int point = ((octant[2] + ((c >> 2) & 1))*3 + octant[1] + ((c >> 1) & 1))*3 + octant[0] + (c & 1);
+        corners[c] = adaptiveLeafValue(leaf, step, point);
+    }
+    const float x00 = corners[0] + (corners[1] - corners[0])*t[0];
+    const float x10 = corners[2] + (corners[3] - corners[2])*t[0];
+    const float x01 = corners[4] + (corners[5] - corners[4])*t[0];
+    const float x11 = corners[6] + (corners[7] - corners[6])*t[0];
+    const float y0 = x00 + (x10 - x00)*t[1];
+    const float y1 = x01 + (x11 - x01)*t[1];
+    return y0 + (y1 - y0)*t[2];
+}
+
+class AdaptiveFieldReader
+{
+public:
+    AdaptiveFieldReader(): header(), nodes(nullptr), leaves(nullptr) {}
+
+    // Reads the whole file into memory.
+    bool load(const std::string& path)
+    {
+        std::ifstream stream(path, std::ios::binary);
+        if (!stream)
+            return false;
+        storage.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+        return attach(storage.data(), storage.size());
+    }
+
+    // Uses the data in place (e.g. a mapped file), it must outlive the reader.
+    bool attach(const uint8_t* data, const size_t bytes)
+    {
+        if (bytes < sizeof(AdaptiveFieldHeader))
+            return false;
+        std::memcpy(&header, data, sizeof(AdaptiveFieldHeader));
+        if (std::memcmp(header.magic, k_adaptiveFieldMagic, sizeof(k_adaptiveFieldMagic)) != 0
+            || header.version != k_adaptiveFieldVersion || header.numNodes == 0)
+            return false;
+        if (header.nodesOffset + static_cast<uint64_t>(header.numNodes) * sizeof(uint32_t) > bytes
+            || header.leavesOffset + static_cast<uint64_t>(header.numLeaves) * sizeof(AdaptiveLeaf) > bytes
+            || header.nodesOffset % sizeof(uint32_t) != 0 || header.leavesOffset % sizeof(float) != 0)
+            return false;
+
+        if (header.size < 2 || (header.size & (header.size - 1)) != 0)
+            return false;
+
+        const uint32_t* entries = reinterpret_cast<const uint32_t*>(data + header.nodesOffset);
+        if (!validateTree(entries))
+            return false;
+        nodes = entries;
+        leaves = reinterpret_cast<const AdaptiveLeaf*>(data + header.leavesOffset);
+        return true;
+    }
+
+    int size() const { return static_cast<int>(header.size); }
+    bool isSigned() const { return (header.flags & k_adaptiveFieldSigned) != 0; }
+    uint32_t numLeaves() const { return header.numLeaves; }
+
+    // Distance at unit cube point (x, y, z).
+    float sample(const float x, const float y, const float z) const
+    {
+        const float scale = static_cast<float>(header.size + 1);
+        return sampleAdaptiveField(nodes, leaves, header.size, x*scale - 0.5f, y*scale - 0.5f, z*scale - 0.5f);
+    }
+
+private:
+    // Walks the whole tree once: children and leaves exist, leaves are at least two lattice
+    // intervals (so no walk is deeper than log2(size) - 1) and no node is reached twice, so
+    // sampleAdaptiveField() stays within the arrays without checks of its own.
+    bool validateTree(const uint32_t* entries) const
+    {
+        std::vector<std::pair<uint32_t, uint32_t>> stack(1, std::make_pair(0u, header.size)); // Node and its cell size.
+        uint64_t numVisited = 0;
+        while (!stack.empty()) {
+            const uint32_t node = stack.back().first, cellSize = stack.back().second;
+            stack.pop_back();
+            if (++numVisited > header.numNodes)
+                return false;
+            const uint32_t entry = entries[node];
+            if (entry & k_adaptiveLeaf) {
+                if ((entry & ~k_adaptiveLeaf) >= header.numLeaves)
+                    return false;
+                continue;
+            }
+            if (cellSize < 4 || static_cast<uint64_t>(entry) + 8 > header.numNodes)
+                return false;
+            for (uint32_t child = 0; child < 8; ++child)
+                stack.push_back(std::make_pair(entry + child, cellSize / 2));
+        }
+        return true;
+    }
+
+    AdaptiveFieldHeader header;
+    std::vector<uint8_t> storage;
+    const uint32_t* nodes;
+    const AdaptiveLeaf* leaves;
+};
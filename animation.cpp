@@ -0,0 +1,199 @@
+#include "animation.h"
+
+#include <algorithm>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+namespace { // Unnamed namespace.
+
+// Index of the last key at or before time (the first key if none is).
+template <typename Key>
+unsigned int keyBefore(const Key* keys, const unsigned int numKeys, const double time)
+{
+    const Key* next = std::upper_bound(keys, keys + numKeys, time, [](const double t, const Key& key) { return t < key.mTime; });
+    return (next == keys) ? 0 : static_cast<unsigned int>(next - keys) - 1;
+}
+
+// How far time is from key i to the next one, 0 past the last key.
+template <typename Key>
+float keyFactor(const Key* keys, const unsigned int numKeys, const unsigned int i, const double time)
+{
+    if (i + 1 >= numKeys)
+        return 0.f;
+    const double span = keys[i+1].mTime - keys[i].mTime;
+    if (span <= 0.0)
+        return 0.f;
+    return static_cast<float>(std::max(0.0, std::min((time - keys[i].mTime) / span, 1.0)));
+}
+
+aiVector3D interpolateVector(const aiVectorKey* keys, const unsigned int numKeys, const double time, const aiVector3D& none)
+{
+    if (numKeys == 0)
+        return none;
+    const unsigned int i = keyBefore(keys, numKeys, time);
+    const float factor = keyFactor(keys, numKeys, i, time);
+    if (factor == 0.f)
+        return keys[i].mValue;
+    return keys[i].mValue + (keys[i+1].mValue - keys[i].mValue) * factor;
+}
+
+aiQuaternion interpolateRotation(const aiQuatKey* keys, const unsigned int numKeys, const double time)
+{
+    if (numKeys == 0)
+        return aiQuaternion();
+    const unsigned int i = keyBefore(keys, numKeys, time);
+    const float factor = keyFactor(keys, numKeys, i, time);
+    if (factor == 0.f)
+        return keys[i].mValue;
+    aiQuaternion rotation;
+    aiQuaternion::Interpolate(rotation, keys[i].mValue, keys[i+1].mValue, factor);
+    rotation.Normalize();
+    return rotation;
+}
+
+} // Unnamed namespace.
+
+AnimatedMesh::AnimatedMesh():
+    scene(nullptr),
+    animation(nullptr),
+    numVertices(0)
+{
+}
+
+bool AnimatedMesh::init(const aiScene* importedScene, std::ostream& log)
+{
+    scene = importedScene;
+    if (!scene->HasAnimations()) {
+        log << "The scene has no animation to take frames of!" << std::endl;
+        return false;
+    }
+    animation = scene->mAnimations[0];
+    addNode(scene->mRootNode, -1);
+
+    // Channels and bones refer to nodes by name.
+    std::unordered_map<std::string, uint32_t> nodeByName;
+    for (size_t n = 0; n < nodes.size(); ++n)
+        nodeByName.insert(std::make_pair(std::string(nodes[n].node->mName.C_Str()), static_cast<uint32_t>(n)));
+    for (unsigned int c = 0; c < animation->mNumChannels; ++c) {
+        const auto found = nodeByName.find(animation->mChannels[c]->mNodeName.C_Str());
+        if (found != nodeByName.end())
+            nodes[found->second].channel = static_cast<int>(c);
+    }
+
+    skins.assign(scene->mNumMeshes, Skin());
+    for (unsigned int m = 0; m < scene->mNumMeshes; ++m) {
+        const aiMesh* mesh = scene->mMeshes[m];
+        if (!mesh->HasBones())
+            continue;
+        Skin& skin = skins[m];
+        std::vector<std::vector<std::pair<uint32_t, float>>> vertexWeights(mesh->mNumVertices);
+        for (unsigned int b = 0; b < mesh->mNumBones; ++b) {
+            const aiBone* bone = mesh->mBones[b];
+            const auto found = nodeByName.find(bone->mName.C_Str());
+            if (found == nodeByName.end()) {
+                log << "Bone " << bone->mName.C_Str() << " has no node, ignoring it." << std::endl;
+                continue;
+            }
+            const uint32_t boneIndex = static_cast<uint32_t>(skin.boneNodes.size());
+            skin.boneNodes.push_back(found->second);
+            skin.boneOffsets.push_back(bone->mOffsetMatrix);
+            for (unsigned int w = 0; w < bone->mNumWeights; ++w) {
+                const aiVertexWeight& weight = bone->mWeights[w];
+                if (weight.mVertexId < mesh->mNumVertices && weight.mWeight > 0.f)
+                    vertexWeights[weight.mVertexId].push_back(std::make_pair(boneIndex, weight.mWeight));
+            }
+        }
+        skin.weightOffsets.push_back(0);
+        for (const auto& weights : vertexWeights) {
+            for (const auto& weight : weights) {
+                skin.weightBones.push_back(weight.first);
+                skin.weights.push_back(weight.second);
+            }
+            skin.weightOffsets.push_back(static_cast<uint32_t>(skin.weights.size()));
+        }
+    }
+
+    // Only triangle faces are kept, instances of meshes without any are dropped.
+    for (size_t n = 0; n < nodes.size(); ++n) {
+        const aiNode* node = nodes[n].node;
+        for (unsigned int i = 0; i < node->mNumMeshes; ++i) {
+            const aiMesh* mesh = scene->mMeshes[node->mMeshes[i]];
+            const size_t numIndices = indices.size();
+            const uint32_t firstVertex = static_cast<uint32_t>(numVertices);
+            for (unsigned int f = 0; f < mesh->mNumFaces; ++f) {
+                const aiFace& face = mesh->mFaces[f];
+                if (face.mNumIndices != 3)
+                    continue;
+                for (unsigned int k = 0; k < 3; ++k)
+                    indices.push_back(firstVertex + face.mIndices[k]);
+            }
+            if (indices.size() == numIndices)
+                continue;
+            instances.push_back(Instance{static_cast<uint32_t>(n), node->mMeshes[i], firstVertex});
+            numVertices += mesh->mNumVertices;
+        }
+    }
+    if (instances.empty()) {
+        log << "The scene has no triangles!" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void AnimatedMesh::addNode(const aiNode* node, const int parent)
+{
+    const int index = static_cast<int>(nodes.size());
+    nodes.push_back(Node{node, parent, -1});
+    for (unsigned int i = 0; i < node->mNumChildren; ++i)
+        addNode(node->mChildren[i], index);
+}
+
+aiMatrix4x4 AnimatedMesh::localTransform(const Node& node, const double time) const
+{
+    if (node.channel < 0)
+        return node.node->mTransformation;
+    const aiNodeAnim* channel = animation->mChannels[node.channel];
+    const aiVector3D position = interpolateVector(channel->mPositionKeys, channel->mNumPositionKeys, time, aiVector3D(0.f, 0.f, 0.f));
+    const aiVector3D scaling = interpolateVector(channel->mScalingKeys, channel->mNumScalingKeys, time, aiVector3D(1.f, 1.f, 1.f));
+    const aiQuaternion rotation = interpolateRotation(channel->mRotationKeys, channel->mNumRotationKeys, time);
+    return aiMatrix4x4(scaling, rotation, position);
+}
+
+void AnimatedMesh::pose(const double time, std::vector<float>& positions) const
+{
+    std::vector<aiMatrix4x4> globals(nodes.size());
+    for (size_t n = 0; n < nodes.size(); ++n) {
+        const aiMatrix4x4 local = localTransform(nodes[n], time);
+        globals[n] = (nodes[n].parent < 0) ? local : globals[static_cast<size_t>(nodes[n].parent)] * local;
+    }
+
+    positions.resize(3 * numVertices);
+    std::vector<aiMatrix4x4> bones;
+    for (const Instance& instance : instances) {
+        const aiMesh* mesh = scene->mMeshes[instance.mesh];
+        const Skin& skin = skins[instance.mesh];
+        const aiMatrix4x4& nodeTransform = globals[instance.node];
+        bones.resize(skin.boneNodes.size());
+        for (size_t b = 0; b < bones.size(); ++b)
+            bones[b] = globals[skin.boneNodes[b]] * skin.boneOffsets[b];
+
+        float* out = positions.data() + 3 * static_cast<size_t>(instance.firstVertex);
+        for (unsigned int v = 0; v < mesh->mNumVertices; ++v) {
+            const aiVector3D& vertex = mesh->mVertices[v];
+            // Skinned vertices blend the poses of their bones, the others follow the node.
+            aiVector3D p;
+            float totalWeight = 0.f;
+            if (!bones.empty()) {
+                for (uint32_t w = skin.weightOffsets[v]; w < skin.weightOffsets[v+1]; ++w) {
+                    p += (bones[skin.weightBones[w]] * vertex) * skin.weights[w];
+                    totalWeight += skin.weights[w];
+                }
+            }
+            p = (totalWeight > 0.f) ? p / totalWeight : nodeTransform * vertex;
+            out[3*v+0] = p.x;
+            out[3*v+1] = p.y;
+            out[3*v+2] = p.z;
+        }
+    }
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+#include <assimp/scene.h>
+
+// Poses the meshes of an imported scene at times of its first animation (--frames). Every mesh a
+// node references is an instance, as for static scenes. Node transforms are interpolated from the
+// animation's channels (position, rotation and scaling keys), nodes without a channel keep their
+// own, and skinned meshes follow their bones. The instances are flattened into one mesh whose
+// triangles, and their order, are the same in every pose: only the vertices move.
+class AnimatedMesh
+{
+public:
+    AnimatedMesh();
+
+    // False (with a message to log) if the scene has no animation or no triangles.
+    bool init(const aiScene* scene, std::ostream& log);
+
+    double getDuration() const { return animation->mDuration; } // In ticks.
+    double getTicksPerSecond() const { return animation->mTicksPerSecond; } // 0 if the file does not say.
+    size_t getNumVertices() const { return numVertices; }
+    const std::vector<uint32_t>& getIndices() const { return indices; }
+
+    // Vertices of every instance at a time in ticks, 3 floats each, in scene space.
+    void pose(double time, std::vector<float>& positions) const;
+
+private:
+    struct Node
+    {
+        const aiNode* node;
+        int parent;  // Index into nodes, -1 for the root.
+        int channel; // Index into the animation's channels, -1 if not animated.
+    };
+
+    struct Instance
+    {
+        uint32_t node;
+        unsigned int mesh;
+        uint32_t firstVertex;
+    };
+
+    // Bone weights of a mesh's vertices, those of vertex v in [weightOffsets[v], weightOffsets[v+1]).
+    struct Skin
+    {
+        std::vector<uint32_t> boneNodes;
+        std::vector<aiMatrix4x4> boneOffsets; // From mesh space to each bone's space, in the bind pose.
+        std::vector<uint32_t> weightOffsets;
+        std::vector<uint32_t> weightBones;
+        std::vector<float> weights;
+    };
+
+    void addNode(const aiNode* node, int parent);
+    aiMatrix4x4 localTransform(const Node& node, double time) const;
+
+    const aiScene* scene;
+    const aiAnimation* animation;
+    std::vector<Node> nodes; // Parents first.
+    std::vector<Instance> instances;
+    std::vector<Skin> skins; // One per mesh of the scene, empty if it has no bones.
+    std::vector<uint32_t> indices;
+    size_t numVertices;
+};
@@ -0,0 +1,581 @@
+// dfgen_bench: throughput and accuracy of the field evaluation on procedural meshes.
+//
+// Every mesh is generated at several triangle counts and evaluated at several grid sizes, signed
+// and unsigned, with the simd engine and scanline signs (the fastest configuration of dfgen).
+// Reports voxels/s and CPU ns per distance query, and the error against the analytic signed
+// distance of the shape where there is one (which includes the tessellation error). A baseline
+// file of voxels/s per case turns the run into a regression gate.
+//
+// Then the voxel layouts are compared: one float field is stored in every layout and sampled with
+// FieldSampler (fieldsampler.h) at random points and along short random walks.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "bvh.h"
+#include "field.h"
+#include "fieldsampler.h"
+#include "geometry.h"
+#include "profile.h"
+#include "sign.h"
+#include "threadpool.h"
+
+namespace
+{
+
+const float k_pi = 3.14159265358979f;
+const uint64_t k_slabBudget = 64ull << 20; // Bytes of float voxels evaluated at once.
+const double k_defaultTolerance = 0.1;
+const int k_defaultRepeats = 3;
+const int k_defaultSamplerSize = 256;
+const size_t k_samplerPoints = 1 << 22;
+const float k_walkStep = 0.25f; // Of a voxel, between consecutive points of a walk.
+const int k_walkLength = 64;
+
+struct BenchMesh
+{
+    std::string name;
+    std::vector<Vec3> vertices;
+    std::vector<uint32_t> indices;
+    std::function<float(const Vec3&)> distance; // Analytic signed distance, empty if there is none.
+
+    TriangleSoup soup() const
+    {
+        const TriangleSoup soup = {reinterpret_cast<const float*>(vertices.data()), indices.data(),
+                                   vertices.size(), indices.size() / 3};
+        return soup;
+    }
+};
+
+struct BenchResult
+{
+    std::string key;
+    size_t numTriangles;
+    double setupSeconds;
+    double voxelsPerSecond;
+    double nsPerQuery;
+    uint64_t distanceQueries;
+    bool hasAccuracy;
+    double maxError, meanError; // In voxels.
+};
+
+static_assert(sizeof(Vec3) == 3*sizeof(float), "Vertices are read as a float array");
+
+void addTriangle(BenchMesh& mesh, const uint32_t a, const uint32_t b, const uint32_t c)
+{
+    mesh.indices.push_back(a);
+    mesh.indices.push_back(b);
+    mesh.indices.push_back(c);
+}
+
+// Radius 0.4 around the center of the unit cube (as dfgen places any mesh), segments around the
+// equator.
+BenchMesh makeSphere(const int segments)
+{
+    const int rings = std::max(segments / 2, 2);
+    const Vec3 center(0.5f, 0.5f, 0.5f);
+    const float radius = 0.4f;
+    BenchMesh mesh;
+    mesh.name = "sphere";
+    mesh.vertices.push_back(center + Vec3(0.f, radius, 0.f));
+    for (int r = 1; r < rings; ++r) {
+        const float theta = k_pi * static_cast<float>(r) / static_cast<float>(rings);
+        for (int s = 0; s < segments; ++s) {
+            const float phi = 2.f * k_pi * static_cast<float>(s) / static_cast<float>(segments);
+            mesh.vertices.push_back(center + Vec3(std::sin(theta)*std::cos(phi), std::cos(theta), std::sin(theta)*std::sin(phi)) * radius);
+        }
+    }
+    mesh.vertices.push_back(center - Vec3(0.f, radius, 0.f));
+
+    const uint32_t south = static_cast<uint32_t>(mesh.vertices.size() - 1);
+    auto ring = [segments](const int r, const int s) { return static_cast<uint32_t>(1 + (r-1)*segments + (s % segments)); };
+    for (int s = 0; s < segments; ++s) {
+        addTriangle(mesh, 0, ring(1, s+1), ring(1, s));
+        addTriangle(mesh, south, ring(rings-1, s), ring(rings-1, s+1));
+        for (int r = 1; r+1 < rings; ++r) {
+            addTriangle(mesh, ring(r, s), ring(r, s+1), ring(r+1, s+1));
+            addTriangle(mesh, ring(r, s), ring(r+1, s+1), ring(r+1, s));
+        }
+    }
+    mesh.distance = [center, radius](const Vec3& p) { return length(p - center) - radius; };
+    return mesh;
+}
+
+// Ring in the xz plane, major radius 0.28 and minor radius 0.12.
+BenchMesh makeTorus(const int segments)
+{
+    const int minorSegments = std::max(segments / 2, 3);
+    const Vec3 center(0.5f, 0.5f, 0.5f);
+    const float majorRadius = 0.28f, minorRadius = 0.12f;
+    BenchMesh mesh;
+    mesh.name = "torus";
+    for (int u = 0; u < segments; ++u) {
+        const float phi = 2.f * k_pi * static_cast<float>(u) / static_cast<float>(segments);
+        for (int v = 0; v < minorSegments; ++v) {
+            const float theta = 2.f * k_pi * static_cast<float>(v) / static_cast<float>(minorSegments);
+            const float ringRadius = majorRadius + minorRadius*std::cos(theta);
+            mesh.vertices.push_back(center + Vec3(ringRadius*std::cos(phi), minorRadius*std::sin(theta), ringRadius*std::sin(phi)));
+        }
+    }
+    auto vertex = [segments, minorSegments](const int u, const int v) {
+        return static_cast<uint32_t>((u % segments)*minorSegments + (v % minorSegments));
+    };
+    for (int u = 0; u < segments; ++u) {
+        for (int v = 0; v < minorSegments; ++v) {
+            addTriangle(mesh, vertex(u, v), vertex(u, v+1), vertex(u+1, v+1));
+            addTriangle(mesh, vertex(u, v), vertex(u+1, v+1), vertex(u+1, v));
+        }
+    }
+    mesh.distance = [center, majorRadius, minorRadius](const Vec3& p) {
+        const Vec3 q = p - center;
+        const float ring = std::sqrt(q.x*q.x + q.z*q.z) - majorRadius;
+        return std::sqrt(ring*ring + q.y*q.y) - minorRadius;
+    };
+    return mesh;
+}
+
+// Closed surface of the occupied cells of an integer grid, vertices shared between faces.
+// position maps grid vertex coordinates to the unit cube.
+BenchMesh makeCellSurface(const std::string& name, const int nx, const int ny, const int nz,
+                          const std::function<bool(int, int, int)>& occupied,
+                          const std::function<Vec3(int, int, int)>& position)
+{
+    BenchMesh mesh;
+    mesh.name = name;
+    std::unordered_map<uint64_t, uint32_t> vertexIndex;
+    auto vertex = [&](const int c[3]) {
+        const uint64_t key = (static_cast<uint64_t>(c[0]) << 42) | (static_cast<uint64_t>(c[1]) << 21) | static_cast<uint64_t>(c[2]);
+        const auto it = vertexIndex.find(key);
+        if (it != vertexIndex.end())
+            return it->second;
+        const uint32_t index = static_cast<uint32_t>(mesh.vertices.size());
+        mesh.vertices.push_back(position(c[0], c[1], c[2]));
+        vertexIndex[key] = index;
+        return index;
+    };
+    auto isOccupied = [&](const int x, const int y, const int z) {
+        return x >= 0 && y >= 0 && z >= 0 && x < nx && y < ny && z < nz && occupied(x, y, z);
+    };
+
+    for (int y = 0; y < ny; ++y) {
+    for (int z = 0; z < nz; ++z) {
+    for (int x = 0; x < nx; ++x) {
+        if (!occupied(x, y, z))
+            continue;
+        for (int axis = 0; axis < 3; ++axis) {
+            for (int side = 0; side < 2; ++side) {
+                int n[3] = {x, y, z};
+                n[axis] += side ? 1 : -1;
+                if (isOccupied(n[0], n[1], n[2]))
+                    continue;
+                // Face corners counter-clockwise seen from outside.
+                const int u = (axis + 1) % 3, v = (axis + 2) % 3;
+                int corners[4][3];
+                for (int k = 0; k < 4; ++k) {
+                    corners[k][0] = x; corners[k][1] = y; corners[k][2] = z;
+                    corners[k][axis] += side;
+                }
+                corners[1][u] += 1;
+                corners[2][u] += 1; corners[2][v] += 1;
+                corners[3][v] += 1;
+                uint32_t quad[4];
+                for (int k = 0; k < 4; ++k)
+                    quad[k] = vertex(corners[side ? k : 3-k]);
+                addTriangle(mesh, quad[0], quad[1], quad[2]);
+                addTriangle(mesh, quad[0], quad[2], quad[3]);
+            }
+        }
+    }
+    }
+    }
+    return mesh;
+}
+
+// Scaffold of bars along all three axes through a lattice of nodes, with jittered vertices: a
+// noisy surface of high genus (every lattice cell adds handles). No analytic distance.
+BenchMesh makeLattice(const int cells)
+{
+    const int spacing = 4;
+    auto occupied = [spacing](const int x, const int y, const int z) {
+        return (x % spacing == 1) + (y % spacing == 1) + (z % spacing == 1) >= 2;
+    };
+    const float cellSize = 0.8f / static_cast<float>(cells);
+    auto position = [cells, cellSize](const int x, const int y, const int z) {
+        // Deterministic jitter, well below half a cell so faces cannot cross.
+        auto jitter = [](uint32_t h) {
+            h ^= h >> 16; h *= 0x7feb352du; h ^= h >> 15; h *= 0x846ca68bu; h ^= h >> 16;
+            return (static_cast<float>(h & 0xffffu) / 65535.f - 0.5f) * 0.3f;
+        };
+        const uint32_t seed = static_cast<uint32_t>((x*(cells+1) + y)*(cells+1) + z) * 3u;
+        return Vec3(0.1f + (static_cast<float>(x) + jitter(seed)) * cellSize,
+                    0.1f + (static_cast<float>(y) + jitter(seed+1)) * cellSize,
+                    0.1f + (static_cast<float>(z) + jitter(seed+2)) * cellSize);
+    };
+    return makeCellSurface("lattice", cells, cells, cells, occupied, position);
+}
+
+// Closed plate 0.8 wide and 0.02 thick (under a voxel at size 32), the broad faces split into
+// cells x cells quads.
+BenchMesh makeThinPlate(const int cells)
+{
+    const Vec3 center(0.5f, 0.5f, 0.5f);
+    const Vec3 halfExtents(0.4f, 0.01f, 0.4f);
+    auto occupied = [](int, int, int) { return true; };
+    auto position = [cells, center, halfExtents](const int x, const int y, const int z) {
+        return center - halfExtents + Vec3(0.8f * static_cast<float>(x) / static_cast<float>(cells),
+                                           0.02f * static_cast<float>(y),
+                                           0.8f * static_cast<float>(z) / static_cast<float>(cells));
+    };
+    BenchMesh mesh = makeCellSurface("plate", cells, 1, cells, occupied, position);
+    mesh.distance = [center, halfExtents](const Vec3& p) {
+        const Vec3 q = p - center;
+        const Vec3 d(std::fabs(q.x) - halfExtents.x, std::fabs(q.y) - halfExtents.y, std::fabs(q.z) - halfExtents.z);
+        const Vec3 outside = vmax(d, Vec3(0.f, 0.f, 0.f));
+        return length(outside) + std::min(std::max(d.x, std::max(d.y, d.z)), 0.f);
+    };
+    return mesh;
+}
+
+// Roughly 1k, 16k and 256k triangles per shape.
+BenchMesh makeMesh(const std::string& shape, const int level)
+{
+    static const int sphereSegments[] = {32, 128, 512};
+    static const int latticeCells[] = {8, 24, 56};
+    static const int plateCells[] = {16, 64, 256};
+    if (shape == "sphere")
+        return makeSphere(sphereSegments[level]);
+    if (shape == "torus")
+        return makeTorus(sphereSegments[level]);
+    if (shape == "lattice")
+        return makeLattice(latticeCells[level]);
+    return makeThinPlate(plateCells[level]);
+}
+
+// Throughput is the best of the repeats, the error is taken from the first.
+BenchResult runCase(ThreadPool& pool, const BenchMesh& mesh, const int size, const bool isSigned, const int repeats)
+{
+    BenchResult result;
+    std::ostringstream key;
+    key << mesh.name << "/" << mesh.indices.size() / 3 << "/" << size << "/" << (isSigned ? "signed" : "unsigned");
+    result.key = key.str();
+    result.numTriangles = mesh.indices.size() / 3;
+
+    const TriangleSoup soup = mesh.soup();
+    Stopwatch setupTime;
+    setupTime.start();
+    const SimdBVH distance(soup);
+    const ScanlineSign sign(soup, size);
+    setupTime.stop();
+    result.setupSeconds = setupTime.getWallSeconds();
+
+    // Float voxels, so the error is not hidden by quantization.
+    const float range = quantizationRange(isSigned);
+    const FieldOptions options = {size, isSigned, true, true, range, VoxelType::F32, {size, size, size}};
+    const uint64_t rowBytes = static_cast<uint64_t>(size) * static_cast<uint64_t>(size) * sizeof(float);
+    const int rootSize = FieldEvaluator::k_rootNodeSize;
+    const int slabRows = std::max(static_cast<int>(k_slabBudget / rowBytes) / rootSize, 1) * rootSize;
+    std::vector<float> slab(static_cast<size_t>(rowBytes / sizeof(float)) * static_cast<size_t>(slabRows));
+
+    result.hasAccuracy = static_cast<bool>(mesh.distance);
+    result.maxError = 0.0;
+    result.voxelsPerSecond = 0.0;
+    double errorSum = 0.0;
+    const double numVoxels = static_cast<double>(size) * size * size;
+    for (int repeat = 0; repeat < repeats; ++repeat) {
+        Stopwatch computeTime;
+        QueryCounters counters = {0, 0, 0, 0};
+        for (int y0 = 0; y0 < size; y0 += slabRows) {
+            const FieldSlab fieldSlab = {reinterpret_cast<uint8_t*>(slab.data()), y0, std::min(y0 + slabRows, size)};
+            const FieldEvaluator evaluator(distance, sign, options, fieldSlab);
+            computeTime.start();
+            const QueryCounters slabCounters = computeField(pool, evaluator);
+            computeTime.stop();
+            counters.distanceQueries += slabCounters.distanceQueries;
+
+            if (!result.hasAccuracy || repeat > 0)
+                continue;
+            size_t i = 0;
+            for (int y = fieldSlab.y0; y < fieldSlab.y1; ++y) {
+            for (int z = 0; z < size; ++z) {
+            for (int x = 0; x < size; ++x, ++i) {
+                float expected = mesh.distance(voxelCenter(x, y, z, size));
+                expected = isSigned ? std::max(-range, std::min(expected, range)) : std::max(0.f, std::min(expected, range));
+                const double error = std::fabs(static_cast<double>(slab[i] - expected)) * size;
+                result.maxError = std::max(result.maxError, error);
+                errorSum += error;
+            }
+            }
+            }
+        }
+
+        const double voxelsPerSecond = numVoxels / std::max(computeTime.getWallSeconds(), 1e-9);
+        if (voxelsPerSecond > result.voxelsPerSecond) {
+            result.voxelsPerSecond = voxelsPerSecond;
+            result.distanceQueries = counters.distanceQueries;
+            result.nsPerQuery = computeTime.getCpuSeconds() * 1e9 / static_cast<double>(std::max<uint64_t>(counters.distanceQueries, 1));
+        }
+    }
+    result.meanError = errorSum / numVoxels;
+    return result;
+}
+
+struct SamplerPoints
+{
+    std::string name;
+    std::vector<float> x, y, z;
+};
+
+// Uniform random points, and random walks whose consecutive points are a fraction of a voxel
+// apart (as the probes of a collision query or the steps of a ray).
+std::vector<SamplerPoints> makeSamplerPoints(const int size)
+{
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> unit(0.f, 1.f);
+    std::vector<SamplerPoints> sets(2);
+    sets[0].name = "random";
+    sets[1].name = "walk";
+    for (size_t i = 0; i < k_samplerPoints; ++i) {
+        sets[0].x.push_back(unit(random));
+        sets[0].y.push_back(unit(random));
+        sets[0].z.push_back(unit(random));
+    }
+    const float step = k_walkStep / static_cast<float>(size);
+    Vec3 p;
+    for (size_t i = 0; i < k_samplerPoints; ++i) {
+        if (i % k_walkLength == 0)
+            p = Vec3(unit(random), unit(random), unit(random));
+        else {
+            const Vec3 direction(unit(random) - 0.5f, unit(random) - 0.5f, unit(random) - 0.5f);
+            p = p + direction * (step / std::max(length(direction), 1e-6f));
+        }
+        sets[1].x.push_back(p.x);
+        sets[1].y.push_back(p.y);
+        sets[1].z.push_back(p.z);
+    }
+    return sets;
+}
+
+// Samples one field stored in every layout, single threaded. Returns false if the layouts disagree.
+bool runSamplerBench(ThreadPool& pool, const int size)
+{
+    const BenchMesh mesh = makeTorus(256);
+    const TriangleSoup soup = mesh.soup();
+    const SimdBVH distance(soup);
+    const ScanlineSign sign(soup, size);
+    const FieldOptions options = {size, true, true, true, quantizationRange(true), VoxelType::F32, {size, size, size}};
+    std::vector<float> linear(static_cast<size_t>(size) * static_cast<size_t>(size) * static_cast<size_t>(size));
+    const FieldSlab slab = {reinterpret_cast<uint8_t*>(linear.data()), 0, size};
+    const FieldEvaluator evaluator(distance, sign, options, slab);
+    computeField(pool, evaluator);
+
+    const std::vector<SamplerPoints> sets = makeSamplerPoints(size);
+    const VoxelLayout layouts[] = {VoxelLayout::Linear, VoxelLayout::Morton, VoxelLayout::Bricks4, VoxelLayout::Bricks8};
+    const char* layoutNames[] = {"linear", "morton", "bricks4", "bricks8"};
+    std::vector<std::vector<float>> reference(sets.size());
+    std::vector<float> voxels(linear.size()), distances(k_samplerPoints);
+    bool identical = true;
+    std::cout << "Sampling the torus field at " << size << "^3 (f32, " << k_samplerPoints << " points per set, single thread):" << std::endl;
+    std::printf("%-10s %-8s %12s %14s\n", "layout", "points", "ns/sample", "samples/s");
+    for (size_t l = 0; l < sizeof(layouts) / sizeof(layouts[0]); ++l) {
+        if (!layoutSupportsSize(layouts[l], static_cast<uint32_t>(size)))
+            continue;
+        size_t i = 0;
+        for (int y = 0; y < size; ++y) {
+        for (int z = 0; z < size; ++z) {
+        for (int x = 0; x < size; ++x, ++i) {
+            voxels[static_cast<size_t>(voxelOffset(layouts[l], static_cast<uint32_t>(size), static_cast<uint32_t>(x),
+                                                   static_cast<uint32_t>(y), static_cast<uint32_t>(z)))] = linear[i];
+        }
+        }
+        }
+        FieldSampler sampler;
+        sampler.attach(reinterpret_cast<const uint8_t*>(voxels.data()), size, VoxelType::F32, layouts[l], 1.f, 0.f);
+
+        for (size_t s = 0; s < sets.size(); ++s) {
+            const SamplerPoints& points = sets[s];
+            Stopwatch sampleTime;
+            sampleTime.start();
+            sampler.sample(points.x.data(), points.y.data(), points.z.data(), k_samplerPoints, distances.data());
+            sampleTime.stop();
+            const double seconds = std::max(sampleTime.getWallSeconds(), 1e-9);
+            std::printf("%-10s %-8s %12.2f %14.4g\n", layoutNames[l], points.name.c_str(),
+                        seconds * 1e9 / static_cast<double>(k_samplerPoints), static_cast<double>(k_samplerPoints) / seconds);
+            if (reference[s].empty())
+                reference[s] = distances;
+            else
+                identical = identical && reference[s] == distances;
+        }
+    }
+    if (!identical)
+        std::cout << "Layouts sampled different distances!" << std::endl;
+    return identical;
+}
+
+std::string getOption(const std::vector<std::string>& args, const std::string& option)
+{
+    auto it = std::find(args.begin(), args.end(), option);
+    if (it != args.end() && ++it != args.end())
+        return *it;
+    return std::string();
+}
+
+std::vector<std::string> splitList(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::istringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ','))
+        items.push_back(item);
+    return items;
+}
+
+// Baseline: one "key voxels_per_second" line per case.
+std::map<std::string, double> readBaseline(const std::string& path)
+{
+    std::map<std::string, double> baseline;
+    std::ifstream stream(path);
+    std::string key;
+    double voxelsPerSecond;
+    while (stream >> key >> voxelsPerSecond)
+        baseline[key] = voxelsPerSecond;
+    return baseline;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> args(argv, argv+argc);
+    if (std::find(args.begin(), args.end(), "-h") != args.end() || std::find(args.begin(), args.end(), "--help") != args.end()) {
+        std::cout << "Example usage: dfgen_bench --meshes sphere,torus,lattice,plate --levels 0,1,2 --sizes 32,64,128,256,512 --threads 8 --repeats 3 --baseline bench.txt --tolerance 0.1 --write-baseline bench.txt --sampler-size 256 (0: skip the layout comparison)" << std::endl;
+        return 0;
+    }
+
+    const std::string meshesArg = getOption(args, "--meshes");
+    const std::string levelsArg = getOption(args, "--levels");
+    const std::string sizesArg = getOption(args, "--sizes");
+    const std::vector<std::string> shapes = splitList(meshesArg.empty() ? "sphere,torus,lattice,plate" : meshesArg);
+    const std::vector<std::string> levels = splitList(levelsArg.empty() ? "0,1,2" : levelsArg);
+    const std::vector<std::string> sizes = splitList(sizesArg.empty() ? "32,64,128,256,512" : sizesArg);
+    unsigned int numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    double tolerance = k_defaultTolerance;
+    int repeats = k_defaultRepeats;
+    int samplerSize = k_defaultSamplerSize;
+    std::vector<int> levelValues, sizeValues;
+    try {
+        const std::string threadsArg = getOption(args, "--threads");
+        if (!threadsArg.empty())
+            numThreads = static_cast<unsigned int>(std::stoul(threadsArg));
+        const std::string repeatsArg = getOption(args, "--repeats");
+        if (!repeatsArg.empty())
+            repeats = std::max(std::stoi(repeatsArg), 1);
+        const std::string samplerSizeArg = getOption(args, "--sampler-size");
+        if (!samplerSizeArg.empty())
+            samplerSize = std::stoi(samplerSizeArg);
+        const std::string toleranceArg = getOption(args, "--tolerance");
+        if (!toleranceArg.empty())
+            tolerance = std::stod(toleranceArg);
+        for (const std::string& level : levels)
+            levelValues.push_back(std::stoi(level));
+        for (const std::string& size : sizes)
+            sizeValues.push_back(std::stoi(size));
+    } catch (const std::exception&) {
+        std::cout << "Failed to parse arguments!" << std::endl;
+        return 1;
+    }
+    for (const std::string& shape : shapes) {
+        if (shape != "sphere" && shape != "torus" && shape != "lattice" && shape != "plate") {
+            std::cout << "Unknown mesh " << shape << " (use sphere, torus, lattice or plate)!" << std::endl;
+            return 1;
+        }
+    }
+    for (const int level : levelValues) {
+        if (level < 0 || level > 2) {
+            std::cout << "Levels are 0, 1 or 2!" << std::endl;
+            return 1;
+        }
+    }
+
+    ThreadPool pool(numThreads);
+    std::cout << "Using " << pool.size() << " thread(s). Errors are in voxels, against the analytic distance." << std::endl;
+    std::printf("%-34s %10s %12s %10s %12s %10s %10s\n", "case", "setup s", "voxels/s", "ns/query", "queries", "max err", "mean err");
+    std::vector<BenchResult> results;
+    for (const std::string& shape : shapes) {
+        for (const int level : levelValues) {
+            const BenchMesh mesh = makeMesh(shape, level);
+            for (const int size : sizeValues) {
+                for (int isSigned = 1; isSigned >= 0; --isSigned) {
+                    const BenchResult result = runCase(pool, mesh, size, isSigned != 0, repeats);
+                    if (result.hasAccuracy) {
+                        std::printf("%-34s %10.4f %12.4g %10.1f %12llu %10.3f %10.4f\n", result.key.c_str(), result.setupSeconds,
+                                    result.voxelsPerSecond, result.nsPerQuery, static_cast<unsigned long long>(result.distanceQueries),
+                                    result.maxError, result.meanError);
+                    }
+                    else {
+                        std::printf("%-34s %10.4f %12.4g %10.1f %12llu %10s %10s\n", result.key.c_str(), result.setupSeconds,
+                                    result.voxelsPerSecond, result.nsPerQuery, static_cast<unsigned long long>(result.distanceQueries),
+                                    "-", "-");
+                    }
+                    std::fflush(stdout);
+                    results.push_back(result);
+                }
+            }
+        }
+    }
+
+    int status = 0;
+    if (samplerSize >= 2 && !runSamplerBench(pool, samplerSize))
+        status = 1;
+
+    // Regression gate: cases slower than the baseline by more than the tolerance fail the run.
+    const std::string baselinePath = getOption(args, "--baseline");
+    if (!baselinePath.empty()) {
+        const std::map<std::string, double> baseline = readBaseline(baselinePath);
+        if (baseline.empty()) {
+            std::cout << "Failed to read baseline!" << std::endl;
+            return 1;
+        }
+        size_t numCompared = 0, numRegressed = 0;
+        for (const BenchResult& result : results) {
+            const auto it = baseline.find(result.key);
+            if (it == baseline.end())
+                continue;
+            numCompared++;
+            const double change = result.voxelsPerSecond / it->second - 1.0;
+            if (change < -tolerance) {
+                numRegressed++;
+                std::printf("REGRESSION %s: %.4g voxels/s, baseline %.4g (%+.1f%%)\n", result.key.c_str(),
+                            result.voxelsPerSecond, it->second, change*100.0);
+            }
+        }
+        std::cout << numRegressed << " of " << numCompared << " case(s) in the baseline regressed by more than "
+                  << tolerance*100.0 << "%." << std::endl;
+        if (numRegressed > 0)
+            status = 2;
+    }
+
+    const std::string writeBaselinePath = getOption(args, "--write-baseline");
+    if (!writeBaselinePath.empty()) {
+        std::ofstream stream(writeBaselinePath, std::ios::out | std::ios::trunc);
+        for (const BenchResult& result : results)
+            stream << result.key << " " << result.voxelsPerSecond << "\n";
+        stream.close();
+        if (!stream) {
+            std::cout << "Failed to write baseline!" << std::endl;
+            return 1;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+// Sparse distance field: the grid is split into bricks of 8x8x8 voxels and only bricks with more
+// than one distinct value are stored. Header-only, so viewers can read fields without linking
+// the generator.
+//
+// File layout (little endian):
+//   BrickFieldHeader
+//   payload: numStoredBricks bricks of 512 voxels each, x fastest, then z, then y
+//   index:   bricksPerAxis^3 uint32_t entries in the same order as the voxels, at indexOffset,
+//            bricksPerAxis = ceil(size/8).
+//            An entry with k_uniformBrick set is a brick of a single value (the low 8 bits),
+//            any other entry is the number of a stored brick.
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+const char k_brickFieldMagic[8] = {'D', 'F', 'B', 'R', 'I', 'C', 'K', 'S'};
+const uint32_t k_brickFieldVersion = 1;
+const int k_brickSize = 8;
+const int k_brickVoxels = k_brickSize * k_brickSize * k_brickSize;
+const uint32_t k_uniformBrick = 0x80000000u;
+const uint32_t k_brickFieldSigned = 1u; // BrickFieldHeader::flags
+
+struct BrickFieldHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t size; // Voxels per axis.
+    uint32_t bricksPerAxis;
+    uint32_t numStoredBricks;
+    uint32_t flags;
+    uint32_t reserved;
+    uint64_t payloadOffset;
+    uint64_t indexOffset;
+};
+
+static_assert(sizeof(BrickFieldHeader) == 48, "BrickFieldHeader layout");
+
+class BrickFieldReader
+{
+public:
+    BrickFieldReader(): header(), index(nullptr), payload(nullptr) {}
+
+    // Reads the whole file into memory.
+    bool load(const std::string& path)
+    {
+        std::ifstream stream(path, std::ios::binary);
+        if (!stream)
+            return false;
+        storage.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+        return attach(storage.data(), storage.size());
+    }
+
+    // Uses the data in place (e.g. a mapped file), it must outlive the reader.
+    bool attach(const uint8_t* data, const size_t bytes)
+    {
+        if (bytes < sizeof(BrickFieldHeader))
+            return false;
+        std::memcpy(&header, data, sizeof(BrickFieldHeader));
+        if (std::memcmp(header.magic, k_brickFieldMagic, sizeof(k_brickFieldMagic)) != 0
+            || header.version != k_brickFieldVersion)
+            return false;
+
+        const uint64_t numBricks = static_cast<uint64_t>(header.bricksPerAxis) * header.bricksPerAxis * header.bricksPerAxis;
+        if (header.size == 0 || header.bricksPerAxis != (header.size + k_brickSize - 1) / k_brickSize
+            || header.payloadOffset + static_cast<uint64_t>(header.numStoredBricks) * k_brickVoxels > bytes
+            || header.indexOffset + numBricks * sizeof(uint32_t) > bytes
+            || header.indexOffset % sizeof(uint32_t) != 0)
+            return false;
+
+        // Every stored brick an entry names exists, so sample() needs no checks.
+        const uint32_t* entries = reinterpret_cast<const uint32_t*>(data + header.indexOffset);
+        for (uint64_t i = 0; i < numBricks; ++i) {
+            if (!(entries[i] & k_uniformBrick) && entries[i] >= header.numStoredBricks)
+                return false;
+        }
+
+        index = entries;
+        payload = data + header.payloadOffset;
+        return true;
+    }
+
+    int size() const { return static_cast<int>(header.size); }
+    bool isSigned() const { return (header.flags & k_brickFieldSigned) != 0; }
+    uint32_t numStoredBricks() const { return header.numStoredBricks; }
+
+    // Quantized value of voxel (x, y, z), 0 <= x, y, z < size().
+    uint8_t sample(const int x, const int y, const int z) const
+    {
+        const uint32_t n = header.bricksPerAxis;
+        const uint32_t entry = index[(static_cast<uint32_t>(y / k_brickSize)*n + static_cast<uint32_t>(z / k_brickSize))*n
+                                     + static_cast<uint32_t>(x / k_brickSize)];
+        if (entry & k_uniformBrick)
+            return static_cast<uint8_t>(entry);
+        const int local = ((y % k_brickSize)*k_brickSize + (z % k_brickSize))*k_brickSize + (x % k_brickSize);
+        return payload[static_cast<size_t>(entry)*k_brickVoxels + static_cast<size_t>(local)];
+    }
+
+private:
+    BrickFieldHeader header;
+    std::vector<uint8_t> storage;
+    const uint32_t* index;
+    const uint8_t* payload;
+};
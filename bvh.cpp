@@ -0,0 +1,480 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace { // Unnamed namespace.
+
+const float k_farAway = 1e18f; // Position of padding triangles, its square still fits a float.
+const int k_maxStackSize = 256;
+
+float safeInverse(const float v)
+{
+    return (v > 0.f) ? 1.f / v : 0.f;
+}
+
+} // Unnamed namespace.
+
+SimdBVH::SimdBVH(const TriangleSoup& mesh):
+    mesh(mesh)
+{
+    const float Inf = std::numeric_limits<float>::infinity();
+    std::vector<BuildItem> items(mesh.numTriangles);
+    for (size_t t = 0; t < mesh.numTriangles; ++t) {
+        const Vec3 a = mesh.corner(t, 0), b = mesh.corner(t, 1), c = mesh.corner(t, 2);
+        items[t].boundsMin = vmin(a, vmin(b, c));
+        items[t].boundsMax = vmax(a, vmax(b, c));
+        items[t].centroid = (a + b + c) * (1.f/3.f);
+        items[t].triangle = static_cast<uint32_t>(t);
+    }
+
+    packetOfTriangle.resize(mesh.numTriangles);
+    nodes.reserve(mesh.numTriangles / (k_simdWidth - 1) + 1);
+    packets.reserve(mesh.numTriangles / (k_simdWidth / 2) + 1);
+    if (items.empty()) {
+        Node root;
+        std::fill(root.minX, root.minX + k_simdWidth, Inf);
+        std::fill(root.minY, root.minY + k_simdWidth, Inf);
+        std::fill(root.minZ, root.minZ + k_simdWidth, Inf);
+        std::fill(root.maxX, root.maxX + k_simdWidth, -Inf);
+        std::fill(root.maxY, root.maxY + k_simdWidth, -Inf);
+        std::fill(root.maxZ, root.maxZ + k_simdWidth, -Inf);
+        std::fill(root.child, root.child + k_simdWidth, 0);
+        nodes.push_back(root);
+        return;
+    }
+    build(items, 0, items.size());
+}
+
+int32_t SimdBVH::build(std::vector<BuildItem>& items, const size_t begin, const size_t end)
+{
+    const int32_t index = static_cast<int32_t>(nodes.size());
+    nodes.push_back(Node());
+
+    // Split the range into (up to) k_simdWidth children, always halving the largest one at the
+    // median of its centroids along the longest axis.
+    std::vector<std::pair<size_t, size_t>> ranges(1, std::make_pair(begin, end));
+    while (ranges.size() < static_cast<size_t>(k_simdWidth)) {
+        size_t largest = 0;
+        for (size_t i = 1; i < ranges.size(); ++i)
+            if (ranges[i].second - ranges[i].first > ranges[largest].second - ranges[largest].first)
+                largest = i;
+        const size_t rangeBegin = ranges[largest].first, rangeEnd = ranges[largest].second;
+        if (rangeEnd - rangeBegin <= static_cast<size_t>(k_simdWidth))
+            break;
+
+        Vec3 centroidMin = items[rangeBegin].centroid, centroidMax = centroidMin;
+        for (size_t i = rangeBegin; i < rangeEnd; ++i) {
+            centroidMin = vmin(centroidMin, items[i].centroid);
+            centroidMax = vmax(centroidMax, items[i].centroid);
+        }
+        const Vec3 extents = centroidMax - centroidMin;
+        const int axis = (extents.x > extents.y && extents.x > extents.z) ? 0 : ((extents.y > extents.z) ? 1 : 2);
+        const size_t mid = rangeBegin + (rangeEnd - rangeBegin) / 2;
+        std::nth_element(items.begin() + static_cast<std::ptrdiff_t>(rangeBegin),
+                         items.begin() + static_cast<std::ptrdiff_t>(mid),
+                         items.begin() + static_cast<std::ptrdiff_t>(rangeEnd),
+                         [axis](const BuildItem& l, const BuildItem& r) { return l.centroid[axis] < r.centroid[axis]; });
+        ranges[largest].second = mid;
+        ranges.push_back(std::make_pair(mid, rangeEnd));
+    }
+
+    const float Inf = std::numeric_limits<float>::infinity();
+    Node node;
+    for (int i = 0; i < k_simdWidth; ++i) {
+        node.minX[i] = node.minY[i] = node.minZ[i] = Inf;
+        node.maxX[i] = node.maxY[i] = node.maxZ[i] = -Inf;
+        node.child[i] = 0;
+    }
+
+    for (size_t i = 0; i < ranges.size(); ++i) {
+        const size_t rangeBegin = ranges[i].first, rangeEnd = ranges[i].second;
+        Vec3 boundsMin = items[rangeBegin].boundsMin, boundsMax = items[rangeBegin].boundsMax;
+        for (size_t j = rangeBegin; j < rangeEnd; ++j) {
+            boundsMin = vmin(boundsMin, items[j].boundsMin);
+            boundsMax = vmax(boundsMax, items[j].boundsMax);
+        }
+        node.minX[i] = boundsMin.x; node.minY[i] = boundsMin.y; node.minZ[i] = boundsMin.z;
+        node.maxX[i] = boundsMax.x; node.maxY[i] = boundsMax.y; node.maxZ[i] = boundsMax.z;
+        node.child[i] = (rangeEnd - rangeBegin <= static_cast<size_t>(k_simdWidth))
+            ? buildPacket(items, rangeBegin, rangeEnd)
+            : build(items, rangeBegin, rangeEnd);
+    }
+
+    nodes[static_cast<size_t>(index)] = node;
+    return index;
+}
+
+int32_t SimdBVH::buildPacket(const std::vector<BuildItem>& items, const size_t begin, const size_t end)
+{
+    TrianglePacket packet;
+    for (int i = 0; i < k_simdWidth; ++i) {
+        const size_t item = begin + static_cast<size_t>(i);
+        setPacketTriangle(packet, i, (item < end) ? items[item].triangle : k_invalidTriangle);
+    }
+
+    for (size_t item = begin; item < end; ++item)
+        packetOfTriangle[items[item].triangle] = static_cast<uint32_t>(packets.size());
+    packets.push_back(packet);
+    return ~static_cast<int32_t>(packets.size() - 1);
+}
+
+void SimdBVH::setPacketTriangle(TrianglePacket& packet, const int i, const uint32_t triangle) const
+{
+    Vec3 a(k_farAway, k_farAway, k_farAway), e0, e1;
+    if (triangle != k_invalidTriangle) {
+        a = mesh.corner(triangle, 0);
+        e0 = mesh.corner(triangle, 1) - a;
+        e1 = mesh.corner(triangle, 2) - a;
+    }
+
+    const Vec3 n = cross(e0, e1);
+    const Vec3 e2 = e1 - e0;
+    packet.ax[i] = a.x; packet.ay[i] = a.y; packet.az[i] = a.z;
+    packet.e0x[i] = e0.x; packet.e0y[i] = e0.y; packet.e0z[i] = e0.z;
+    packet.e1x[i] = e1.x; packet.e1y[i] = e1.y; packet.e1z[i] = e1.z;
+    packet.nx[i] = n.x; packet.ny[i] = n.y; packet.nz[i] = n.z;
+    packet.d00[i] = dot(e0, e0);
+    packet.d01[i] = dot(e0, e1);
+    packet.d11[i] = dot(e1, e1);
+    packet.invNormal2[i] = safeInverse(dot(n, n));
+    packet.invE0[i] = safeInverse(dot(e0, e0));
+    packet.invE1[i] = safeInverse(dot(e1, e1));
+    packet.invE2[i] = safeInverse(dot(e2, e2));
+    packet.triangle[i] = triangle;
+}
+
+void SimdBVH::refit(const TriangleSoup& posed)
+{
+    mesh = posed;
+    for (TrianglePacket& packet : packets) {
+        for (int i = 0; i < k_simdWidth; ++i) {
+            if (packet.triangle[i] != k_invalidTriangle)
+                setPacketTriangle(packet, i, packet.triangle[i]);
+        }
+    }
+
+    // Children always follow their parent, so going backwards visits them first. Empty slots
+    // keep their inverted boxes.
+    const float Inf = std::numeric_limits<float>::infinity();
+    for (size_t index = nodes.size(); index-- > 0;) {
+        Node& node = nodes[index];
+        for (int i = 0; i < k_simdWidth; ++i) {
+            if (node.minX[i] > node.maxX[i])
+                continue;
+            Vec3 boundsMin(Inf, Inf, Inf), boundsMax(-Inf, -Inf, -Inf);
+            if (node.child[i] < 0) {
+                const TrianglePacket& packet = packets[static_cast<size_t>(~node.child[i])];
+                for (int k = 0; k < k_simdWidth && packet.triangle[k] != k_invalidTriangle; ++k) {
+                    for (int corner = 0; corner < 3; ++corner) {
+                        const Vec3 p = mesh.corner(packet.triangle[k], corner);
+                        boundsMin = vmin(boundsMin, p);
+                        boundsMax = vmax(boundsMax, p);
+                    }
+                }
+            }
+            else {
+                const Node& child = nodes[static_cast<size_t>(node.child[i])];
+                for (int k = 0; k < k_simdWidth; ++k) {
+                    if (child.minX[k] > child.maxX[k])
+                        continue;
+                    boundsMin = vmin(boundsMin, Vec3(child.minX[k], child.minY[k], child.minZ[k]));
+                    boundsMax = vmax(boundsMax, Vec3(child.maxX[k], child.maxY[k], child.maxZ[k]));
+                }
+            }
+            node.minX[i] = boundsMin.x; node.minY[i] = boundsMin.y; node.minZ[i] = boundsMin.z;
+            node.maxX[i] = boundsMax.x; node.maxY[i] = boundsMax.y; node.maxZ[i] = boundsMax.z;
+        }
+    }
+}
+
+// Squared distances from the query to all triangles of the packet. If the query projects inside
+// a triangle the distance to its plane is exact, otherwise the closest point lies on an edge.
+vfloat SimdBVH::packetSquaredDistance(const TrianglePacket& packet, const Vec3& query) const
+{
+    const vfloat pax = vbroadcast(query.x) - vload(packet.ax);
+    const vfloat pay = vbroadcast(query.y) - vload(packet.ay);
+    const vfloat paz = vbroadcast(query.z) - vload(packet.az);
+    const vfloat e0x = vload(packet.e0x), e0y = vload(packet.e0y), e0z = vload(packet.e0z);
+    const vfloat e1x = vload(packet.e1x), e1y = vload(packet.e1y), e1z = vload(packet.e1z);
+
+    const vfloat d20 = pax*e0x + pay*e0y + paz*e0z;
+    const vfloat d21 = pax*e1x + pay*e1y + paz*e1z;
+
+    // Edge a-b.
+    const vfloat t0 = vclamp01(d20 * vload(packet.invE0));
+    const vfloat q0x = pax - t0*e0x, q0y = pay - t0*e0y, q0z = paz - t0*e0z;
+    const vfloat dist0 = q0x*q0x + q0y*q0y + q0z*q0z;
+
+    // Edge a-c.
+    const vfloat t1 = vclamp01(d21 * vload(packet.invE1));
+    const vfloat q1x = pax - t1*e1x, q1y = pay - t1*e1y, q1z = paz - t1*e1z;
+    const vfloat dist1 = q1x*q1x + q1y*q1y + q1z*q1z;
+
+    // Edge b-c.
+    const vfloat pbx = pax - e0x, pby = pay - e0y, pbz = paz - e0z;
+    const vfloat e2x = e1x - e0x, e2y = e1y - e0y, e2z = e1z - e0z;
+    const vfloat t2 = vclamp01((pbx*e2x + pby*e2y + pbz*e2z) * vload(packet.invE2));
+    const vfloat q2x = pbx - t2*e2x, q2y = pby - t2*e2y, q2z = pbz - t2*e2z;
+    const vfloat dist2 = q2x*q2x + q2y*q2y + q2z*q2z;
+
+    // Face, using barycentric coordinates of the projected query.
+    const vfloat d00 = vload(packet.d00), d01 = vload(packet.d01), d11 = vload(packet.d11);
+    const vfloat invNormal2 = vload(packet.invNormal2);
+    const vfloat v = (d11*d20 - d01*d21) * invNormal2;
+    const vfloat w = (d00*d21 - d01*d20) * invNormal2;
+    const vfloat zero = vbroadcast(0.f);
+    const vmask inside = (v >= zero) & (w >= zero) & ((v + w) <= vbroadcast(1.f)) & (invNormal2 > zero);
+    const vfloat pn = pax*vload(packet.nx) + pay*vload(packet.ny) + paz*vload(packet.nz);
+    const vfloat distFace = pn*pn*invNormal2;
+
+    return vselect(inside, distFace, vmin(dist0, vmin(dist1, dist2)));
+}
+
+void SimdBVH::seed(const uint32_t hintTriangle, const Vec3& query, float& best, uint32_t& triangle) const
+{
+    // The bound comes from the same kernel the traversal uses, so seeding never changes results.
+    const TrianglePacket& packet = packets[packetOfTriangle[hintTriangle]];
+    float dists[k_simdWidth];
+    vstore(dists, packetSquaredDistance(packet, query));
+    for (int i = 0; i < k_simdWidth; ++i) {
+        if (dists[i] < best) {
+            best = dists[i];
+            triangle = packet.triangle[i];
+        }
+    }
+}
+
+void SimdBVH::traverse(const Vec3& query, float& best, uint32_t& triangle, uint64_t& nodeVisits) const
+{
+    struct Entry
+    {
+        int32_t code;
+        float dist;
+    };
+
+    const vfloat px = vbroadcast(query.x), py = vbroadcast(query.y), pz = vbroadcast(query.z);
+    const vfloat zero = vbroadcast(0.f);
+    Entry stack[k_maxStackSize];
+    int stackSize = 0;
+    stack[stackSize++] = Entry{0, 0.f};
+    while (stackSize > 0) {
+        const Entry entry = stack[--stackSize];
+        if (entry.dist >= best)
+            continue;
+
+        nodeVisits++;
+        if (entry.code < 0) {
+            const TrianglePacket& packet = packets[static_cast<size_t>(~entry.code)];
+            float dists[k_simdWidth];
+            vstore(dists, packetSquaredDistance(packet, query));
+            for (int i = 0; i < k_simdWidth; ++i) {
+                if (dists[i] < best) {
+                    best = dists[i];
+                    triangle = packet.triangle[i];
+                }
+            }
+            continue;
+        }
+
+        // Squared distances to all child boxes at once.
+        const Node& node = nodes[static_cast<size_t>(entry.code)];
+        const vfloat dx = vmax(vmax(vload(node.minX) - px, px - vload(node.maxX)), zero);
+        const vfloat dy = vmax(vmax(vload(node.minY) - py, py - vload(node.maxY)), zero);
+        const vfloat dz = vmax(vmax(vload(node.minZ) - pz, pz - vload(node.maxZ)), zero);
+        const vfloat boxDist = dx*dx + dy*dy + dz*dz;
+        const int hitMask = vmovemask(boxDist < vbroadcast(best));
+        if (hitMask == 0)
+            continue;
+
+        float dists[k_simdWidth];
+        vstore(dists, boxDist);
+
+        // Push the hit children farthest first, so the closest one is processed next.
+        Entry hits[k_simdWidth];
+        int numHits = 0;
+        for (int i = 0; i < k_simdWidth; ++i) {
+            if (!(hitMask & (1 << i)))
+                continue;
+            int j = numHits++;
+            for (; j > 0 && hits[j-1].dist < dists[i]; --j)
+                hits[j] = hits[j-1];
+            hits[j] = Entry{node.child[i], dists[i]};
+        }
+        for (int i = 0; i < numHits; ++i)
+            stack[stackSize++] = hits[i];
+    }
+}
+
+void SimdBVH::traverseBlock(const Vec3* queries, const size_t count, float* best, uint32_t* triangles,
+                            uint64_t& nodeVisits) const
+{
+    struct Entry
+    {
+        int32_t code;
+        uint64_t queryMask; // Queries that may find a closer triangle in the subtree.
+        float dist;         // Smallest box distance among them.
+    };
+
+    const vfloat zero = vbroadcast(0.f);
+    Entry stack[k_maxStackSize];
+    int stackSize = 0;
+    stack[stackSize++] = Entry{0, (count == 64) ? ~uint64_t(0) : ((uint64_t(1) << count) - 1), 0.f};
+    while (stackSize > 0) {
+        const Entry entry = stack[--stackSize];
+        nodeVisits++;
+
+        if (entry.code < 0) {
+            const TrianglePacket& packet = packets[static_cast<size_t>(~entry.code)];
+            for (uint64_t mask = entry.queryMask; mask != 0; mask &= mask - 1) {
+                const size_t q = static_cast<size_t>(__builtin_ctzll(mask));
+                float dists[k_simdWidth];
+                vstore(dists, packetSquaredDistance(packet, queries[q]));
+                for (int i = 0; i < k_simdWidth; ++i) {
+                    if (dists[i] < best[q]) {
+                        best[q] = dists[i];
+                        triangles[q] = packet.triangle[i];
+                    }
+                }
+            }
+            continue;
+        }
+
+        // Which queries need which children (the node is fetched once for the whole block).
+        const Node& node = nodes[static_cast<size_t>(entry.code)];
+        const vfloat minX = vload(node.minX), minY = vload(node.minY), minZ = vload(node.minZ);
+        const vfloat maxX = vload(node.maxX), maxY = vload(node.maxY), maxZ = vload(node.maxZ);
+        uint64_t childMask[k_simdWidth] = {};
+        float childDist[k_simdWidth];
+        std::fill(childDist, childDist + k_simdWidth, std::numeric_limits<float>::infinity());
+        for (uint64_t mask = entry.queryMask; mask != 0; mask &= mask - 1) {
+            const size_t q = static_cast<size_t>(__builtin_ctzll(mask));
+            const vfloat px = vbroadcast(queries[q].x), py = vbroadcast(queries[q].y), pz = vbroadcast(queries[q].z);
+            const vfloat dx = vmax(vmax(minX - px, px - maxX), zero);
+            const vfloat dy = vmax(vmax(minY - py, py - maxY), zero);
+            const vfloat dz = vmax(vmax(minZ - pz, pz - maxZ), zero);
+            const vfloat boxDist = dx*dx + dy*dy + dz*dz;
+            const int hitMask = vmovemask(boxDist < vbroadcast(best[q]));
+            if (hitMask == 0)
+                continue;
+
+            float dists[k_simdWidth];
+            vstore(dists, boxDist);
+            for (int i = 0; i < k_simdWidth; ++i) {
+                if (hitMask & (1 << i)) {
+                    childMask[i] |= uint64_t(1) << q;
+                    childDist[i] = std::min(childDist[i], dists[i]);
+                }
+            }
+        }
+
+        // Push the needed children farthest first, so the closest one is processed next.
+        Entry hits[k_simdWidth];
+        int numHits = 0;
+        for (int i = 0; i < k_simdWidth; ++i) {
+            if (childMask[i] == 0)
+                continue;
+            int j = numHits++;
+            for (; j > 0 && hits[j-1].dist < childDist[i]; --j)
+                hits[j] = hits[j-1];
+            hits[j] = Entry{node.child[i], childMask[i], childDist[i]};
+        }
+        for (int i = 0; i < numHits; ++i)
+            stack[stackSize++] = hits[i];
+    }
+}
+
+float SimdBVH::closestTriangle(const Vec3& query, uint32_t& triangle) const
+{
+    float best = std::numeric_limits<float>::infinity();
+    triangle = k_invalidTriangle;
+    uint64_t nodeVisits = 0;
+    traverse(query, best, triangle, nodeVisits);
+    return best;
+}
+
+void SimdBVH::closestTriangleWithin(const Vec3& query, const uint32_t seedTriangle, float& best, uint32_t& triangle,
+                                    uint64_t& nodeVisits) const
+{
+    if (seedTriangle != k_invalidTriangle)
+        seed(seedTriangle, query, best, triangle);
+    traverse(query, best, triangle, nodeVisits);
+}
+
+void SimdBVH::closestTrianglesWithin(const Vec3* queries, const size_t count, const uint32_t seedTriangle, float* best,
+                                     uint32_t* triangles, uint64_t& nodeVisits) const
+{
+    if (seedTriangle != k_invalidTriangle) {
+        for (size_t i = 0; i < count; ++i)
+            seed(seedTriangle, queries[i], best[i], triangles[i]);
+    }
+    traverseBlock(queries, count, best, triangles, nodeVisits);
+}
+
+double SimdBVH::squaredDistance(const Vec3& query) const
+{
+    uint32_t triangle;
+    return static_cast<double>(closestTriangle(query, triangle));
+}
+
+double SimdBVH::hintedSquaredDistance(const Vec3& query, DistanceHint& hint, uint64_t& nodeVisits) const
+{
+    float best = std::numeric_limits<float>::infinity();
+    uint32_t triangle = k_invalidTriangle;
+    if (hint.valid && hint.triangle != k_invalidTriangle)
+        seed(hint.triangle, query, best, triangle);
+    traverse(query, best, triangle, nodeVisits);
+
+    hint.triangle = triangle;
+    hint.valid = (triangle != k_invalidTriangle);
+    return static_cast<double>(best);
+}
+
+void SimdBVH::closestTriangles(const Vec3* queries, const size_t count, float* best, uint32_t* triangles,
+                               DistanceHint& hint, uint64_t& nodeVisits) const
+{
+    // Without a hint, the first query finds one on its own.
+    if (!hint.valid || hint.triangle == k_invalidTriangle)
+        hintedSquaredDistance(queries[0], hint, nodeVisits);
+
+    for (size_t i = 0; i < count; ++i) {
+        best[i] = std::numeric_limits<float>::infinity();
+        triangles[i] = k_invalidTriangle;
+        if (hint.valid)
+            seed(hint.triangle, queries[i], best[i], triangles[i]);
+    }
+    traverseBlock(queries, count, best, triangles, nodeVisits);
+
+    hint.triangle = triangles[count-1];
+    hint.valid = (hint.triangle != k_invalidTriangle);
+}
+
+void SimdBVH::blockSquaredDistances(const Vec3* queries, const size_t count, double* results,
+                                    DistanceHint& hint, uint64_t& nodeVisits) const
+{
+    for (size_t begin = 0; begin < count; begin += k_maxBlockSize) {
+        const size_t blockSize = std::min(count - begin, k_maxBlockSize);
+        float best[k_maxBlockSize];
+        uint32_t triangles[k_maxBlockSize];
+        closestTriangles(queries + begin, blockSize, best, triangles, hint, nodeVisits);
+        for (size_t i = 0; i < blockSize; ++i)
+            results[begin + i] = static_cast<double>(best[i]);
+    }
+}
+
+// The traversal only finds the closest triangle, the point on it is computed once per query.
+void SimdBVH::blockClosestPoints(const Vec3* queries, const size_t count, double* results, Vec3* points,
+                                 uint32_t* triangles, DistanceHint& hint, uint64_t& nodeVisits) const
+{
+    for (size_t begin = 0; begin < count; begin += k_maxBlockSize) {
+        const size_t blockSize = std::min(count - begin, k_maxBlockSize);
+        float best[k_maxBlockSize];
+        closestTriangles(queries + begin, blockSize, best, triangles + begin, hint, nodeVisits);
+        for (size_t i = begin; i < begin + blockSize; ++i) {
+            results[i] = static_cast<double>(best[i - begin]);
+            const uint32_t triangle = triangles[i];
+            points[i] = (triangle == k_invalidTriangle) ? queries[i]
+                      : closestPointOnTriangle(queries[i], mesh.corner(triangle, 0), mesh.corner(triangle, 1), mesh.corner(triangle, 2));
+        }
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <vector>
+
+#include "distance.h"
+#include "geometry.h"
+#include "simd.h"
+
+// Bounding volume hierarchy for closest point queries, an alternative to CGAL::AABB_tree.
+// Nodes have k_simdWidth children whose boxes are stored SoA and tested with one SIMD
+// instruction per axis; every leaf is a packet of up to k_simdWidth triangles, also stored SoA,
+// with the point-triangle distance evaluated for the whole packet at once. All in float.
+// Blocks of nearby queries are answered by a single traversal that carries a bitmask of the
+// queries still interested in each subtree, seeded with the closest triangle of a neighbour.
+class SimdBVH : public DistanceEngine
+{
+public:
+    explicit SimdBVH(const TriangleSoup& mesh);
+
+    // Takes over moved vertices of the same triangles (a posed frame of an animation): the
+    // packets and boxes are recomputed bottom up in O(n), the hierarchy is kept.
+    void refit(const TriangleSoup& posed);
+
+    double squaredDistance(const Vec3& query) const override;
+    double hintedSquaredDistance(const Vec3& query, DistanceHint& hint, uint64_t& nodeVisits) const override;
+    void blockSquaredDistances(const Vec3* queries, size_t count, double* results,
+                               DistanceHint& hint, uint64_t& nodeVisits) const override;
+    void blockClosestPoints(const Vec3* queries, size_t count, double* results, Vec3* points,
+                            uint32_t* triangles, DistanceHint& hint, uint64_t& nodeVisits) const override;
+
+    // Squared distance to the closest triangle, whose index is stored to `triangle`.
+    float closestTriangle(const Vec3& query, uint32_t& triangle) const;
+    // Looks for a triangle closer than best (squared), first in the packet of seedTriangle unless
+    // it is k_invalidTriangle. Lowers best and sets triangle if there is one.
+    void closestTriangleWithin(const Vec3& query, uint32_t seedTriangle, float& best, uint32_t& triangle,
+                               uint64_t& nodeVisits) const;
+    // Same for a block of up to k_maxBlockSize queries, traversed together.
+    void closestTrianglesWithin(const Vec3* queries, size_t count, uint32_t seedTriangle, float* best, uint32_t* triangles,
+                                uint64_t& nodeVisits) const;
+
+    static const uint32_t k_invalidTriangle = ~0u;
+    static const size_t k_maxBlockSize = 64; // Queries traversed together, one bit each.
+
+private:
+    struct Node
+    {
+        float minX[k_simdWidth], minY[k_simdWidth], minZ[k_simdWidth];
+        float maxX[k_simdWidth], maxY[k_simdWidth], maxZ[k_simdWidth];
+        int32_t child[k_simdWidth]; // >= 0: inner node, < 0: ~packet index. Empty slots have inverted boxes.
+    };
+
+    // Triangle (a, b, c) is stored as a, e0 = b-a, e1 = c-a and the precomputed terms below.
+    struct TrianglePacket
+    {
+        float ax[k_simdWidth], ay[k_simdWidth], az[k_simdWidth];
+        float e0x[k_simdWidth], e0y[k_simdWidth], e0z[k_simdWidth];
+        float e1x[k_simdWidth], e1y[k_simdWidth], e1z[k_simdWidth];
+        float nx[k_simdWidth], ny[k_simdWidth], nz[k_simdWidth]; // e0 x e1.
+        float d00[k_simdWidth], d01[k_simdWidth], d11[k_simdWidth]; // dot(e0, e0), dot(e0, e1), dot(e1, e1).
+        float invNormal2[k_simdWidth]; // 1 / |n|^2, 0 for degenerate triangles.
+        float invE0[k_simdWidth], invE1[k_simdWidth], invE2[k_simdWidth]; // 1 / squared edge lengths (0 if degenerate).
+        uint32_t triangle[k_simdWidth];
+    };
+
+    struct BuildItem
+    {
+        Vec3 boundsMin, boundsMax, centroid;
+        uint32_t triangle;
+    };
+
+    int32_t build(std::vector<BuildItem>& items, size_t begin, size_t end);
+    int32_t buildPacket(const std::vector<BuildItem>& items, size_t begin, size_t end);
+    // Stores a triangle of the mesh (or padding if k_invalidTriangle) in a lane of the packet.
+    void setPacketTriangle(TrianglePacket& packet, int lane, uint32_t triangle) const;
+    vfloat packetSquaredDistance(const TrianglePacket& packet, const Vec3& query) const;
+
+    // Lowers best/triangle to the closest triangle in the packet holding `triangle`.
+    void seed(uint32_t hintTriangle, const Vec3& query, float& best, uint32_t& triangle) const;
+    // Finds triangles closer than best, starting from the root.
+    void traverse(const Vec3& query, float& best, uint32_t& triangle, uint64_t& nodeVisits) const;
+    void traverseBlock(const Vec3* queries, size_t count, float* best, uint32_t* triangles, uint64_t& nodeVisits) const;
+    // Closest triangles of up to k_maxBlockSize queries, seeded with and updating the hint.
+    void closestTriangles(const Vec3* queries, size_t count, float* best, uint32_t* triangles,
+                          DistanceHint& hint, uint64_t& nodeVisits) const;
+
+    TriangleSoup mesh;
+    std::vector<Node> nodes; // Root first.
+    std::vector<TrianglePacket> packets;
+    std::vector<uint32_t> packetOfTriangle;
+};
@@ -0,0 +1,301 @@
+#include "cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace
+{
+
+const uint64_t k_fnvOffset = 14695981039346656037ull;
+const uint64_t k_fnvPrime = 1099511628211ull;
+const int k_floatsPerTriangle = 9;
+
+// FNV-1a.
+uint64_t hashBytes(const void* data, const size_t bytes, uint64_t hash = k_fnvOffset)
+{
+    const uint8_t* p = static_cast<const uint8_t*>(data);
+    for (size_t i = 0; i < bytes; ++i) {
+        hash ^= p[i];
+        hash *= k_fnvPrime;
+    }
+    return hash;
+}
+
+uint64_t hashParameters(const FieldOptions& options, const DistanceEngineType engine, const SignMethod signMethod)
+{
+    uint32_t band;
+    std::memcpy(&band, &options.band, sizeof(band));
+    const uint32_t parameters[] = {k_cacheEntryVersion, static_cast<uint32_t>(options.size), options.isSigned, options.cull,
+                                   options.coherent, band, static_cast<uint32_t>(options.voxelType),
+                                   static_cast<uint32_t>(engine), static_cast<uint32_t>(signMethod)};
+    return hashBytes(parameters, sizeof(parameters));
+}
+
+std::string toHex(const uint64_t value)
+{
+    std::ostringstream stream;
+    stream.width(16);
+    stream.fill('0');
+    stream << std::hex << value;
+    return stream.str();
+}
+
+// Triangle indices ordered by their corners (bytewise), equal triangles end up next to each other.
+std::vector<uint32_t> sortTriangles(const std::vector<float>& triangles)
+{
+    const size_t triangleBytes = k_floatsPerTriangle * sizeof(float);
+    std::vector<uint32_t> order(triangles.size() / k_floatsPerTriangle);
+    for (size_t t = 0; t < order.size(); ++t)
+        order[t] = static_cast<uint32_t>(t);
+    std::sort(order.begin(), order.end(), [&triangles, triangleBytes](const uint32_t a, const uint32_t b) {
+        return std::memcmp(&triangles[a*k_floatsPerTriangle], &triangles[b*k_floatsPerTriangle], triangleBytes) < 0;
+    });
+    return order;
+}
+
+}
+
+FieldCache::FieldCache(const std::string& directory, const std::string& inputPath, const FieldOptions& options,
+                       const DistanceEngineType engine, const SignMethod signMethod):
+    directory(directory), options(options), parametersHash(hashParameters(options, engine, signMethod)),
+    inputHash(hashBytes(inputPath.data(), inputPath.size())), triangles(nullptr), header(), foundVoxelOffset(0),
+    usable(false)
+{
+}
+
+FieldCache::~FieldCache()
+{
+    // An entry still being stored is incomplete.
+    if (storing.is_open()) {
+        storing.close();
+        std::remove(storingTempPath.c_str());
+    }
+}
+
+CacheResult FieldCache::lookup(const std::vector<float>& meshTriangles, const UnitCubeTransform& transform, std::ostream& log)
+{
+    triangles = &meshTriangles;
+    std::memcpy(header.magic, k_cacheEntryMagic, sizeof(k_cacheEntryMagic));
+    header.version = k_cacheEntryVersion;
+    header.numTriangles = static_cast<uint32_t>(meshTriangles.size() / k_floatsPerTriangle);
+    header.parametersHash = parametersHash;
+    header.meshHash = hashBytes(meshTriangles.data(), meshTriangles.size()*sizeof(float));
+    header.meshOrigin[0] = transform.origin.x;
+    header.meshOrigin[1] = transform.origin.y;
+    header.meshOrigin[2] = transform.origin.z;
+    header.meshScale = transform.scale;
+    header.voxelOffset = sizeof(CacheEntryHeader) + meshTriangles.size()*sizeof(float);
+
+    if (mkdir(directory.c_str(), 0777) != 0 && errno != EEXIST) {
+        log << "Failed to create the cache directory, not caching!" << std::endl;
+        return CacheResult::Miss;
+    }
+    usable = true;
+
+    // The same mesh (a different one with the same hash is a miss).
+    CacheEntryHeader entryHeader;
+    if (openEntry(entryPath(header.meshHash), entryHeader)
+        && entryHeader.numTriangles == header.numTriangles) {
+        std::vector<float> entryTriangles(meshTriangles.size());
+        found.read(reinterpret_cast<char*>(entryTriangles.data()), static_cast<std::streamsize>(entryTriangles.size()*sizeof(float)));
+        if (found && entryTriangles == meshTriangles) {
+            log << "Found the field in the cache." << std::endl;
+            return CacheResult::Hit;
+        }
+    }
+
+    // The last mesh generated from the same input, reusable if it was placed in the unit cube alike.
+    std::ifstream latest(latestPath());
+    uint64_t latestHash = 0;
+    if (!(latest >> std::hex >> latestHash) || !openEntry(entryPath(latestHash), entryHeader))
+        return CacheResult::Miss;
+    if (std::memcmp(entryHeader.meshOrigin, header.meshOrigin, sizeof(header.meshOrigin)) != 0
+        || entryHeader.meshScale != header.meshScale) {
+        log << "Mesh bounds changed since the cached field, computing all voxels." << std::endl;
+        return CacheResult::Miss;
+    }
+    std::vector<float> previousTriangles(static_cast<size_t>(entryHeader.numTriangles) * k_floatsPerTriangle);
+    found.read(reinterpret_cast<char*>(previousTriangles.data()), static_cast<std::streamsize>(previousTriangles.size()*sizeof(float)));
+    if (!found)
+        return CacheResult::Miss;
+
+    markChangedTriangles(previousTriangles, log);
+    return CacheResult::Partial;
+}
+
+bool FieldCache::read(const FieldSlab& slab)
+{
+    const uint64_t rowBytes = static_cast<uint64_t>(options.size) * static_cast<uint64_t>(options.size) * voxelBytes(options.voxelType);
+    found.clear();
+    found.seekg(static_cast<std::streamoff>(foundVoxelOffset + static_cast<uint64_t>(slab.y0) * rowBytes));
+    found.read(reinterpret_cast<char*>(slab.voxels), static_cast<std::streamsize>(static_cast<uint64_t>(slab.y1 - slab.y0) * rowBytes));
+    return static_cast<bool>(found);
+}
+
+bool FieldCache::beginStore(std::ostream& log)
+{
+    if (!usable || !triangles)
+        return false;
+
+    // Written under a name of its own, other runs may be storing the same entry.
+    static std::atomic<unsigned int> numStored(0);
+    storingPath = entryPath(header.meshHash);
+    storingTempPath = storingPath + "." + std::to_string(getpid()) + "." + std::to_string(numStored++) + ".tmp";
+    storing.open(storingTempPath, std::ios::out | std::ios::trunc | std::ios::binary);
+    storing.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    storing.write(reinterpret_cast<const char*>(triangles->data()), static_cast<std::streamsize>(triangles->size()*sizeof(float)));
+    if (!storing) {
+        log << "Failed to write the cache entry!" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool FieldCache::store(const FieldSlab& slab)
+{
+    const uint64_t rowBytes = static_cast<uint64_t>(options.size) * static_cast<uint64_t>(options.size) * voxelBytes(options.voxelType);
+    storing.write(reinterpret_cast<const char*>(slab.voxels), static_cast<std::streamsize>(static_cast<uint64_t>(slab.y1 - slab.y0) * rowBytes));
+    return static_cast<bool>(storing);
+}
+
+bool FieldCache::endStore(std::ostream& log)
+{
+    storing.close();
+    if (!storing || std::rename(storingTempPath.c_str(), storingPath.c_str()) != 0) {
+        std::remove(storingTempPath.c_str());
+        log << "Failed to write the cache entry!" << std::endl;
+        return false;
+    }
+
+    const std::string latest = latestPath();
+    const std::string latestTemp = storingTempPath + ".latest";
+    std::ofstream latestStream(latestTemp, std::ios::out | std::ios::trunc);
+    latestStream << toHex(header.meshHash) << std::endl;
+    latestStream.close();
+    if (!latestStream || std::rename(latestTemp.c_str(), latest.c_str()) != 0) {
+        std::remove(latestTemp.c_str());
+        log << "Failed to write the cache entry!" << std::endl;
+        return false;
+    }
+    log << "Stored the field in the cache." << std::endl;
+    return true;
+}
+
+std::string FieldCache::entryPath(const uint64_t meshHash) const
+{
+    return directory + "/" + toHex(parametersHash) + "-" + toHex(meshHash) + ".dfcache";
+}
+
+std::string FieldCache::latestPath() const
+{
+    return directory + "/" + toHex(parametersHash) + "-" + toHex(inputHash) + ".latest";
+}
+
+// Opens an entry of the same parameters for reading, positioned after the header.
+bool FieldCache::openEntry(const std::string& path, CacheEntryHeader& entryHeader)
+{
+    found.close();
+    found.clear();
+    found.open(path, std::ios::in | std::ios::binary);
+    found.read(reinterpret_cast<char*>(&entryHeader), sizeof(entryHeader));
+    if (!found
+        || std::memcmp(entryHeader.magic, k_cacheEntryMagic, sizeof(k_cacheEntryMagic)) != 0
+        || entryHeader.version != k_cacheEntryVersion
+        || entryHeader.parametersHash != parametersHash
+        || entryHeader.voxelOffset != sizeof(CacheEntryHeader) + static_cast<uint64_t>(entryHeader.numTriangles) * k_floatsPerTriangle * sizeof(float))
+        return false;
+
+    const uint64_t size = static_cast<uint64_t>(options.size);
+    found.seekg(0, std::ios::end);
+    const uint64_t entryBytes = static_cast<uint64_t>(std::max<std::streamoff>(found.tellg(), 0));
+    if (entryBytes != entryHeader.voxelOffset + size*size*size*voxelBytes(options.voxelType))
+        return false;
+    found.seekg(sizeof(entryHeader));
+    foundVoxelOffset = entryHeader.voxelOffset;
+    return true;
+}
+
+// Flags the nodes that may differ from the previous field. A voxel further than the clamped range
+// from all changed triangles keeps its distance, and for a closed mesh its side only changes if
+// it lies between the removed and the added triangles, so all of them share one bounding box.
+void FieldCache::markChangedTriangles(const std::vector<float>& previousTriangles, std::ostream& log)
+{
+    const std::vector<float>& current = *triangles;
+    const std::vector<uint32_t> previousOrder = sortTriangles(previousTriangles);
+    const std::vector<uint32_t> currentOrder = sortTriangles(current);
+    const size_t triangleBytes = k_floatsPerTriangle * sizeof(float);
+    const float inf = std::numeric_limits<float>::infinity();
+    Vec3 lo(inf, inf, inf), hi(-inf, -inf, -inf);
+    size_t numChanged = 0;
+    auto addTriangle = [&](const float* corners) {
+        for (int k = 0; k < 3; ++k) {
+            const Vec3 p(corners[3*k], corners[3*k+1], corners[3*k+2]);
+            lo = vmin(lo, p);
+            hi = vmax(hi, p);
+        }
+        numChanged++;
+    };
+
+    // Merge the sorted triangles, the ones in only one of the meshes changed.
+    size_t i = 0, j = 0;
+    while (i < previousOrder.size() || j < currentOrder.size()) {
+        const float* previous = (i < previousOrder.size()) ? &previousTriangles[previousOrder[i]*k_floatsPerTriangle] : nullptr;
+        const float* next = (j < currentOrder.size()) ? &current[currentOrder[j]*k_floatsPerTriangle] : nullptr;
+        const int order = (!previous) ? 1 : (!next) ? -1 : std::memcmp(previous, next, triangleBytes);
+        if (order == 0) {
+            i++;
+            j++;
+        }
+        else if (order < 0) {
+            addTriangle(previous);
+            i++;
+        }
+        else {
+            addTriangle(next);
+            j++;
+        }
+    }
+
+    const int size = options.size;
+    const int patchSize = FieldEvaluator::k_patchNodeSize;
+    const int nodesPerAxis = (size + patchSize - 1) / patchSize;
+    nodeMask.assign(static_cast<size_t>(nodesPerAxis) * static_cast<size_t>(nodesPerAxis) * static_cast<size_t>(nodesPerAxis), 0);
+    size_t numMarked = 0;
+    if (numChanged > 0) {
+        // To unit cube voxels, padded by one voxel for rounding.
+        UnitCubeTransform transform;
+        transform.origin = Vec3(header.meshOrigin[0], header.meshOrigin[1], header.meshOrigin[2]);
+        transform.scale = header.meshScale;
+        const float margin = std::min(options.band, quantizationRange(options.isSigned)) + 1.f / static_cast<float>(size);
+        const Vec3 first = toUnitCube(transform, lo) - Vec3(margin, margin, margin);
+        const Vec3 last = toUnitCube(transform, hi) + Vec3(margin, margin, margin);
+        auto toNode = [size, patchSize](const float u, const bool roundUp) {
+            const float voxel = u*static_cast<float>(size) - 0.5f;
+            const float clamped = std::max(0.f, std::min(roundUp ? std::ceil(voxel) : std::floor(voxel), static_cast<float>(size - 1)));
+            return static_cast<int>(clamped) / patchSize;
+        };
+        const int x0 = toNode(first.x, false), x1 = toNode(last.x, true);
+        const int y0 = toNode(first.y, false), y1 = toNode(last.y, true);
+        const int z0 = toNode(first.z, false), z1 = toNode(last.z, true);
+        for (int y = y0; y <= y1; ++y) {
+        for (int z = z0; z <= z1; ++z) {
+        for (int x = x0; x <= x1; ++x) {
+            nodeMask[(static_cast<size_t>(y)*nodesPerAxis + static_cast<size_t>(z))*nodesPerAxis + static_cast<size_t>(x)] = 1;
+            numMarked++;
+        }
+        }
+        }
+    }
+    log << "Reusing the cached field of a previous mesh: " << numChanged << " triangle(s) changed, recomputing "
+        << numMarked << " of " << nodeMask.size() << " node(s)." << std::endl;
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <iosfwd>
+#include <string>
+#include <vector>
+
+#include "distance.h"
+#include "field.h"
+#include "geometry.h"
+#include "sign.h"
+
+// On-disk cache of computed fields (--cache DIR). An entry is keyed by the triangles of the mesh,
+// as imported, and every option that affects the voxels, so regenerating an unchanged mesh only
+// copies the entry to the output. When the mesh of an input path changed since its last entry,
+// only the voxels within the clamped range of the changed triangles are recomputed and the rest
+// is taken over from that entry.
+//
+// Entry layout (little endian):
+//   CacheEntryHeader
+//   numTriangles triangles of 3 corners (9 floats), in mesh space
+//   the voxels at voxelOffset, laid out as in the raw format
+
+const char k_cacheEntryMagic[8] = {'D', 'F', 'G', 'C', 'A', 'C', 'H', 'E'};
+const uint32_t k_cacheEntryVersion = 1;
+
+struct CacheEntryHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t numTriangles;
+    uint64_t parametersHash;
+    uint64_t meshHash;
+    float meshOrigin[3];
+    float meshScale;
+    uint64_t voxelOffset;
+    uint64_t reserved;
+};
+
+static_assert(sizeof(CacheEntryHeader) == 64, "CacheEntryHeader layout");
+
+enum class CacheResult
+{
+    Miss,    // Compute everything.
+    Hit,     // The whole field is cached.
+    Partial  // A previous field of the input is cached, recompute the nodes of getNodeMask().
+};
+
+// Problems with the cache are reported and treated as a miss, they never fail a generation.
+class FieldCache
+{
+public:
+    FieldCache(const std::string& directory, const std::string& inputPath, const FieldOptions& options,
+               DistanceEngineType engine, SignMethod signMethod);
+    ~FieldCache();
+
+    // Looks up the mesh given as triangle corners in mesh space (they must outlive the cache).
+    CacheResult lookup(const std::vector<float>& triangles, const UnitCubeTransform& transform, std::ostream& log);
+
+    // Nodes of FieldEvaluator::k_patchNodeSize voxels affected by the changed triangles (Partial).
+    const std::vector<uint8_t>& getNodeMask() const { return nodeMask; }
+
+    // Copies the rows of the slab from the entry found by lookup (Hit or Partial).
+    bool read(const FieldSlab& slab);
+
+    // Stores the field of the looked up mesh as a new entry, given slab by slab from row 0.
+    // The entry only becomes visible once it is complete.
+    bool beginStore(std::ostream& log);
+    bool store(const FieldSlab& slab);
+    bool endStore(std::ostream& log);
+
+private:
+    std::string entryPath(uint64_t meshHash) const;
+    std::string latestPath() const;
+    bool openEntry(const std::string& path, CacheEntryHeader& entryHeader);
+    void markChangedTriangles(const std::vector<float>& previousTriangles, std::ostream& log);
+
+    const std::string directory;
+    const FieldOptions options;
+    const uint64_t parametersHash;
+    const uint64_t inputHash;
+    const std::vector<float>* triangles;
+    CacheEntryHeader header; // Of the looked up mesh.
+    std::ifstream found;
+    uint64_t foundVoxelOffset;
+    std::vector<uint8_t> nodeMask;
+    bool usable; // The directory exists.
+    std::ofstream storing;
+    std::string storingPath, storingTempPath;
+};
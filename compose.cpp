@@ -0,0 +1,292 @@
+#include "compose.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+#include "threadpool.h"
+
+namespace { // Unnamed namespace.
+
+const float k_pi = 3.14159265358979f;
+
+// Rotation by degrees about an axis (Rodrigues' formula).
+AffineTransform rotation(const Vec3& axis, const float degrees)
+{
+    const Vec3 k = axis * (1.f / length(axis));
+    const float radians = degrees * k_pi / 180.f;
+    const float c = std::cos(radians), s = std::sin(radians), t = 1.f - c;
+    AffineTransform r;
+    r.rows[0] = Vec3(c + t*k.x*k.x, t*k.x*k.y - s*k.z, t*k.x*k.z + s*k.y);
+    r.rows[1] = Vec3(t*k.x*k.y + s*k.z, c + t*k.y*k.y, t*k.y*k.z - s*k.x);
+    r.rows[2] = Vec3(t*k.x*k.z - s*k.y, t*k.y*k.z + s*k.x, c + t*k.z*k.z);
+    return r;
+}
+
+bool parseComposeOp(const std::string& name, ComposeOp& op)
+{
+    if (name == "union")
+        op = ComposeOp::Union;
+    else if (name == "intersect")
+        op = ComposeOp::Intersection;
+    else if (name == "subtract")
+        op = ComposeOp::Subtraction;
+    else if (name == "smooth-union")
+        op = ComposeOp::SmoothUnion;
+    else
+        return false;
+    return true;
+}
+
+// Quadratic smooth minimum: min(a, b) lowered by at most blend/4 where the two are within blend.
+float smoothMin(const float a, const float b, const float blend)
+{
+    const float h = std::max(blend - std::fabs(a - b), 0.f) / blend;
+    return std::min(a, b) - h*h*blend*0.25f;
+}
+
+} // Unnamed namespace.
+
+bool readComposeRecipe(const std::string& path, std::vector<ComposeStep>& steps)
+{
+    std::ifstream stream(path);
+    if (!stream) {
+        std::cout << "Failed to open compose recipe!" << std::endl;
+        return false;
+    }
+
+    std::string line;
+    for (int lineNumber = 1; std::getline(stream, line); ++lineNumber) {
+        std::istringstream fields(line);
+        std::string opField;
+        if (!(fields >> opField) || opField[0] == '#')
+            continue;
+        ComposeStep step;
+        step.op = ComposeOp::Union;
+        step.blend = 0.f;
+        const bool isFirst = steps.empty();
+        bool valid = (isFirst == (opField == "field")) && (isFirst || parseComposeOp(opField, step.op)) && (fields >> step.path);
+        Vec3 translation;
+        AffineTransform rotate;
+        std::string keyword;
+        while (valid && fields >> keyword) {
+            if (keyword == "translate") {
+                valid = static_cast<bool>(fields >> translation.x >> translation.y >> translation.z);
+            }
+            else if (keyword == "rotate") {
+                Vec3 axis;
+                float degrees;
+                valid = (fields >> axis.x >> axis.y >> axis.z >> degrees) && length(axis) > 0.f;
+                if (valid)
+                    rotate = rotation(axis, degrees) * rotate;
+            }
+            else if (keyword == "blend") {
+                valid = (fields >> step.blend) && step.blend > 0.f;
+            }
+            else {
+                valid = false;
+            }
+        }
+        if (!valid || (step.op == ComposeOp::SmoothUnion) != (step.blend > 0.f)) {
+            std::cout << "Invalid compose recipe entry on line " << lineNumber << "!" << std::endl;
+            return false;
+        }
+        step.placement = rotate;
+        step.placement.translation = translation;
+        steps.push_back(step);
+    }
+    if (steps.empty()) {
+        std::cout << "The compose recipe has no fields!" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool FieldComposer::load(const std::vector<ComposeStep>& steps, std::ostream& log)
+{
+    inputs.clear();
+    inputs.resize(steps.size());
+    band = std::numeric_limits<float>::infinity();
+    resamplingBound = 0.f;
+    blendBound = 0.f;
+    for (size_t i = 0; i < steps.size(); ++i) {
+        Input& input = inputs[i];
+        input.step = steps[i];
+        input.toMesh = steps[i].placement.inverse();
+        input.view.reset(new DistanceFieldView());
+        const DistanceFieldView& view = *input.view;
+        if (!input.view->load(steps[i].path) || !input.sampler.attach(view)) {
+            log << "Failed to read " << steps[i].path << " as a container field!" << std::endl;
+            return false;
+        }
+        if (!view.isSigned()) {
+            log << steps[i].path << " is not signed, composition needs inside and outside!" << std::endl;
+            return false;
+        }
+
+        const DistanceFieldHeader& header = view.getHeader();
+        input.transform.origin = Vec3(header.meshOrigin[0], header.meshOrigin[1], header.meshOrigin[2]);
+        input.transform.scale = header.meshScale;
+        const float voxel = 1.f / static_cast<float>(view.cubeSize());
+        input.centersMin = Vec3(0.5f*voxel, 0.5f*voxel, 0.5f*voxel);
+        input.centersMax = Vec3((view.size(0) - 0.5f)*voxel, (view.size(1) - 0.5f)*voxel, (view.size(2) - 0.5f)*voxel);
+
+        // Trilinear weights average corners at most sqrt(3)/2 voxels away, plus a quantization step.
+        const float step = (view.type() == VoxelType::F32) ? 0.f : header.valueScale;
+        resamplingBound = std::max(resamplingBound, (0.5f*std::sqrt(3.f)*voxel + step) / header.meshScale);
+        band = std::min(band, header.band / header.meshScale);
+        if (steps[i].op == ComposeOp::SmoothUnion && i > 0)
+            blendBound = std::max(blendBound, 0.25f*steps[i].blend);
+        log << "Input " << steps[i].path << ": " << view.size(0) << "x" << view.size(1) << "x" << view.size(2)
+            << " voxels of " << voxel / header.meshScale << " mesh unit(s)." << std::endl;
+    }
+    return true;
+}
+
+void FieldComposer::getBounds(Vec3& boundsMin, Vec3& boundsMax) const
+{
+    const float Inf = std::numeric_limits<float>::infinity();
+    boundsMin = Vec3(Inf, Inf, Inf);
+    boundsMax = Vec3(-Inf, -Inf, -Inf);
+    for (const Input& input : inputs) {
+        // Corners of the grid (its voxels, not only their centers), from its unit cube to the scene.
+        const float voxel = 1.f / static_cast<float>(input.view->cubeSize());
+        const Vec3 extent(voxel*input.view->size(0), voxel*input.view->size(1), voxel*input.view->size(2));
+        for (int corner = 0; corner < 8; ++corner) {
+            const Vec3 u((corner & 1) ? extent.x : 0.f, (corner & 2) ? extent.y : 0.f, (corner & 4) ? extent.z : 0.f);
+            const Vec3 p = input.step.placement.apply((u - Vec3(0.5f, 0.5f, 0.5f)) * (1.f / input.transform.scale) + input.transform.origin);
+            boundsMin = vmin(boundsMin, p);
+            boundsMax = vmax(boundsMax, p);
+        }
+    }
+}
+
+ComposeCounters FieldComposer::composeSlab(ThreadPool& pool, const FieldOptions& options, const UnitCubeTransform& transform,
+                                           const FieldSlab& slab) const
+{
+    const int bricksX = (options.dims[0] + k_brickSize - 1) / k_brickSize;
+    const int bricksZ = (options.dims[2] + k_brickSize - 1) / k_brickSize;
+    const int bricksY = (slab.y1 - slab.y0 + k_brickSize - 1) / k_brickSize;
+    const size_t numBricks = static_cast<size_t>(bricksX) * static_cast<size_t>(bricksY) * static_cast<size_t>(bricksZ);
+    std::vector<ComposeCounters> brickCounters(numBricks, ComposeCounters{0, 0, 0});
+    parallelFor(pool, numBricks, [&](const size_t b) {
+        const int x0 = static_cast<int>(b % static_cast<size_t>(bricksX)) * k_brickSize;
+        const int z0 = static_cast<int>((b / static_cast<size_t>(bricksX)) % static_cast<size_t>(bricksZ)) * k_brickSize;
+        const int y0 = slab.y0 + static_cast<int>(b / (static_cast<size_t>(bricksX)*static_cast<size_t>(bricksZ))) * k_brickSize;
+        composeBrick(options, transform, slab, x0, y0, z0, brickCounters[b]);
+    });
+
+    ComposeCounters counters = {0, 0, 0};
+    for (const ComposeCounters& brick : brickCounters) {
+        counters.boundVoxels += brick.boundVoxels;
+        counters.blendedVoxels += brick.blendedVoxels;
+        counters.extrapolatedVoxels += brick.extrapolatedVoxels;
+    }
+    return counters;
+}
+
+void FieldComposer::composeBrick(const FieldOptions& options, const UnitCubeTransform& transform, const FieldSlab& slab,
+                                 const int x0, const int y0, const int z0, ComposeCounters& counters) const
+{
+    const int k_brickVoxels = k_brickSize*k_brickSize*k_brickSize;
+    const int x1 = std::min(x0 + k_brickSize, options.dims[0]);
+    const int y1 = std::min(y0 + k_brickSize, slab.y1);
+    const int z1 = std::min(z0 + k_brickSize, options.dims[2]);
+
+    // Voxel centers of the brick in scene space.
+    Vec3 points[k_brickVoxels];
+    int count = 0;
+    const float invScale = 1.f / transform.scale;
+    for (int y = y0; y < y1; ++y) {
+    for (int z = z0; z < z1; ++z) {
+    for (int x = x0; x < x1; ++x) {
+        points[count++] = (voxelCenter(x, y, z, options.size) - Vec3(0.5f, 0.5f, 0.5f)) * invScale + transform.origin;
+    }
+    }
+    }
+
+    float result[k_brickVoxels], sampled[k_brickVoxels], beyond[k_brickVoxels];
+    float ux[k_brickVoxels], uy[k_brickVoxels], uz[k_brickVoxels];
+    bool bound[k_brickVoxels], blended[k_brickVoxels], outside[k_brickVoxels];
+    std::fill(bound, bound + count, false);
+    std::fill(blended, blended + count, false);
+    for (size_t i = 0; i < inputs.size(); ++i) {
+        const Input& input = inputs[i];
+        // Into the input's unit cube. Beyond its outermost voxel centers the border is sampled: a
+        // surface within the grid is at least sqrt(border^2 + beyond^2) away, the distance taken
+        // there (a lower bound, exact straight out of the border).
+        const float voxel = 1.f / static_cast<float>(input.view->cubeSize());
+        for (int v = 0; v < count; ++v) {
+            const Vec3 u = toUnitCube(input.transform, input.toMesh.apply(points[v]));
+            ux[v] = u.x;
+            uy[v] = u.y;
+            uz[v] = u.z;
+            beyond[v] = length(vmax(vmax(input.centersMin - u, u - input.centersMax), Vec3(0.f, 0.f, 0.f)));
+        }
+        input.sampler.sample(ux, uy, uz, static_cast<size_t>(count), sampled);
+
+        const float toScene = 1.f / input.transform.scale;
+        const ComposeOp op = input.step.op;
+        for (int v = 0; v < count; ++v) {
+            const float border = sampled[v];
+            const float d = ((border > 0.f) ? std::sqrt(border*border + beyond[v]*beyond[v]) : border + beyond[v]) * toScene;
+            // Whether the result is extrapolated, blended or only a bound follows the operand it is
+            // taken from (both within a blend). The new operand is exact where it is not extrapolated.
+            const bool isOutside = beyond[v] > 0.5f*voxel;
+            if (i == 0) {
+                result[v] = d;
+                outside[v] = isOutside;
+                continue;
+            }
+            const float a = result[v];
+            bool takesNew;
+            if (op == ComposeOp::Union) {
+                result[v] = std::min(a, d);
+                takesNew = d < a;
+            }
+            else if (op == ComposeOp::Intersection) {
+                result[v] = std::max(a, d);
+                takesNew = d > a;
+            }
+            else if (op == ComposeOp::Subtraction) {
+                result[v] = std::max(a, -d);
+                takesNew = -d > a;
+            }
+            else {
+                result[v] = smoothMin(a, d, input.step.blend);
+                takesNew = d < a;
+            }
+            if (op == ComposeOp::SmoothUnion && std::fabs(a - d) < input.step.blend) {
+                blended[v] = true;
+                outside[v] = outside[v] || isOutside;
+            }
+            else if (takesNew) {
+                bound[v] = false;
+                blended[v] = false;
+                outside[v] = isOutside;
+            }
+            // Unions are exact outside, intersections and subtractions inside.
+            bound[v] = bound[v] || ((op == ComposeOp::Union || op == ComposeOp::SmoothUnion) ? result[v] < 0.f : result[v] > 0.f);
+        }
+    }
+
+    const float clampRange = std::min(options.band, quantizationRange(true));
+    const size_t bytesPerVoxel = voxelBytes(options.voxelType);
+    const size_t dimX = static_cast<size_t>(options.dims[0]), dimZ = static_cast<size_t>(options.dims[2]);
+    int v = 0;
+    for (int y = y0; y < y1; ++y) {
+    for (int z = z0; z < z1; ++z) {
+        uint8_t* row = slab.voxels + ((static_cast<size_t>(y - slab.y0)*dimZ + static_cast<size_t>(z))*dimX + static_cast<size_t>(x0))*bytesPerVoxel;
+        for (int x = x0; x < x1; ++x, ++v, row += bytesPerVoxel) {
+            const float d = result[v] * transform.scale;
+            encodeVoxel(std::min(std::fabs(d), clampRange), d < 0.f, options, row);
+            counters.boundVoxels += bound[v];
+            counters.blendedVoxels += blended[v];
+            counters.extrapolatedVoxels += outside[v];
+        }
+    }
+    }
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <iosfwd>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "field.h"
+#include "fieldfile.h"
+#include "fieldsampler.h"
+#include "geometry.h"
+
+class ThreadPool;
+
+enum class ComposeOp
+{
+    Union,
+    Intersection,
+    Subtraction, // Of the input from everything before it.
+    SmoothUnion  // Polynomial smooth minimum, blended within blend (mesh units) of both surfaces.
+};
+
+// One input of a composition: a signed field placed in the scene by a rigid transform, combined
+// with everything before it (the first input is taken as it is).
+struct ComposeStep
+{
+    ComposeOp op;
+    std::string path;
+    float blend;
+    AffineTransform placement; // Input mesh space to scene space.
+};
+
+// Recipe of a composition (dfgen compose): one input per line as "op path [translate x y z]
+// [rotate x y z degrees] [blend k]", op one of field (the first line), union, intersect, subtract
+// and smooth-union (which needs blend, in mesh units). Rotations are about an axis through the
+// input's mesh space origin and apply before translations. Empty lines and lines starting with #
+// are skipped. Errors go to stdout.
+bool readComposeRecipe(const std::string& path, std::vector<ComposeStep>& steps);
+
+// Where a composition is not exact, over the voxels composed so far.
+struct ComposeCounters
+{
+    uint64_t boundVoxels;        // Minimum or maximum of distances where it is only a bound on the distance.
+    uint64_t blendedVoxels;      // Within the blend of a smooth union.
+    uint64_t extrapolatedVoxels; // Taken from beyond the grid of an input, a lower bound from its border.
+};
+
+// Combines previously generated fields without their meshes: every output voxel center is taken
+// into each input's unit cube, sampled trilinearly (FieldSampler, in SIMD batches) and the
+// distances, in scene units, folded left by the steps' operations. Minimum and maximum are exact
+// outside unions and inside intersections and subtractions; elsewhere they only bound the distance
+// from below, which is all sphere tracing and collision need. Every input contributes its
+// resampling error, and the operations never increase it (they are 1-Lipschitz in each input).
+class FieldComposer
+{
+public:
+    static const int k_brickSize = 8; // Voxels per axis of the bricks composed as one task.
+
+    // Loads the inputs, false (with a message to log) unless all are signed containers.
+    bool load(const std::vector<ComposeStep>& steps, std::ostream& log);
+
+    // Scene space bounds of the inputs' placed grids.
+    void getBounds(Vec3& boundsMin, Vec3& boundsMax) const;
+    // Band of valid distances common to all inputs, in scene units.
+    float getBand() const { return band; }
+    // Largest error of resampling an input (trilinear interpolation and quantization), in scene units.
+    float getResamplingBound() const { return resamplingBound; }
+    // Largest shift of a smooth union, in scene units.
+    float getBlendBound() const { return blendBound; }
+
+    // Fills a slab of the output grid (options in the unit cube of transform, signed) with the
+    // composed distances, brick by brick on the pool.
+    ComposeCounters composeSlab(ThreadPool& pool, const FieldOptions& options, const UnitCubeTransform& transform,
+                                const FieldSlab& slab) const;
+
+private:
+    struct Input
+    {
+        ComposeStep step;
+        AffineTransform toMesh; // Scene space to the input's mesh space.
+        UnitCubeTransform transform;
+        std::unique_ptr<DistanceFieldView> view;
+        FieldSampler sampler;
+        Vec3 centersMin, centersMax; // Outermost voxel centers in the input's unit cube.
+    };
+
+    void composeBrick(const FieldOptions& options, const UnitCubeTransform& transform, const FieldSlab& slab,
+                      int x0, int y0, int z0, ComposeCounters& counters) const;
+
+    std::vector<Input> inputs;
+    float band;
+    float resamplingBound;
+    float blendBound;
+};
@@ -0,0 +1,227 @@
+#include "dfgen.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <utility>
+
+#include "brickfield.h"
+
+static_assert(FieldEvaluator::k_rootNodeSize % k_brickSize == 0, "Slabs must hold whole bricks");
+
+namespace
+{
+
+const uint64_t k_brickSlabBudget = 64ull << 20; // Bytes of voxels computed at once when streaming bricks.
+const uint32_t k_pointOrderCells = 1024; // Per axis of the unit cube, when sorting point queries in Z-order.
+
+}
+
+DistanceFieldGenerator::DistanceFieldGenerator(const float* meshPositions, const size_t numVertices, const uint32_t* meshIndices,
+                                               const size_t numTriangles, const unsigned int numThreads):
+    positions(meshPositions, meshPositions + 3*numVertices), indices(meshIndices, meshIndices + 3*numTriangles),
+    valid(false), pool(numThreads)
+{
+    soup.positions = positions.data();
+    soup.indices = indices.data();
+    soup.numVertices = 0;
+    soup.numTriangles = 0;
+    transform.origin = Vec3(0.f, 0.f, 0.f);
+    transform.scale = 1.f;
+    // Nothing is built for a mesh the tree cannot take, every call then fails.
+    if (numTriangles == 0 || !std::all_of(indices.begin(), indices.end(), [numVertices](const uint32_t index) { return index < numVertices; })
+        || !std::all_of(positions.begin(), positions.end(), [](const float coordinate) { return std::isfinite(coordinate); }))
+        return;
+
+    const float inf = std::numeric_limits<float>::infinity();
+    Vec3 boundsMin(inf, inf, inf), boundsMax(-inf, -inf, -inf);
+    for (size_t i = 0; i < numVertices; ++i) {
+        const Vec3 p(positions[3*i], positions[3*i+1], positions[3*i+2]);
+        boundsMin = vmin(boundsMin, p);
+        boundsMax = vmax(boundsMax, p);
+    }
+    transform = fitUnitCube(boundsMin, boundsMax);
+    for (size_t i = 0; i < numVertices; ++i) {
+        const Vec3 u = toUnitCube(transform, Vec3(positions[3*i], positions[3*i+1], positions[3*i+2]));
+        positions[3*i] = u.x;
+        positions[3*i+1] = u.y;
+        positions[3*i+2] = u.z;
+    }
+
+    soup.numVertices = numVertices;
+    soup.numTriangles = numTriangles;
+    bvh.reset(new SimdBVH(soup));
+    valid = true;
+}
+
+size_t DistanceFieldGenerator::bytesNeeded(const GridSpec& grid)
+{
+    const size_t size = static_cast<size_t>(std::max(grid.size, 0));
+    return size*size*size*voxelBytes(grid.voxelType);
+}
+
+bool DistanceFieldGenerator::generate(const GridSpec& grid, uint8_t* voxels, const size_t bytes, QueryCounters* counters)
+{
+    FieldOptions options;
+    if (!makeOptions(grid, options) || !voxels || bytes < bytesNeeded(grid))
+        return false;
+
+    const std::unique_ptr<SignEvaluator> sign = makeSign(grid);
+    const FieldSlab slab = {voxels, 0, grid.size};
+    const FieldEvaluator evaluator(*bvh, *sign, options, slab);
+    const QueryCounters fieldCounters = computeField(pool, evaluator);
+    if (counters)
+        *counters = fieldCounters;
+    return true;
+}
+
+bool DistanceFieldGenerator::generate(const GridSpec& grid, const BrickCallback& callback, QueryCounters* counters)
+{
+    FieldOptions options;
+    if (!makeOptions(grid, options) || !callback)
+        return false;
+
+    const int size = grid.size;
+    const size_t bytesPerVoxel = voxelBytes(grid.voxelType);
+    const size_t rowBytes = static_cast<size_t>(size) * static_cast<size_t>(size) * bytesPerVoxel;
+    const int rootSize = FieldEvaluator::k_rootNodeSize;
+    int slabRows = std::max(static_cast<int>(k_brickSlabBudget / rowBytes) / rootSize, 1) * rootSize;
+    slabRows = std::min(slabRows, (size + rootSize - 1) / rootSize * rootSize);
+    std::vector<uint8_t> slabVoxels(rowBytes * static_cast<size_t>(slabRows));
+    std::vector<uint8_t> brick(k_brickVoxels * bytesPerVoxel);
+    const int bricksPerAxis = (size + k_brickSize - 1) / k_brickSize;
+
+    const std::unique_ptr<SignEvaluator> sign = makeSign(grid);
+    QueryCounters total = {0, 0, 0, 0};
+    for (int y0 = 0; y0 < size; y0 += slabRows) {
+        const FieldSlab slab = {slabVoxels.data(), y0, std::min(y0 + slabRows, size)};
+        const FieldEvaluator evaluator(*bvh, *sign, options, slab);
+        const QueryCounters slabCounters = computeField(pool, evaluator);
+        total.distanceQueries += slabCounters.distanceQueries;
+        total.insideTests += slabCounters.insideTests;
+        total.nodeVisits += slabCounters.nodeVisits;
+        total.insideSkipped += slabCounters.insideSkipped;
+
+        for (int by = slab.y0 / k_brickSize; by*k_brickSize < slab.y1; ++by) {
+        for (int bz = 0; bz < bricksPerAxis; ++bz) {
+        for (int bx = 0; bx < bricksPerAxis; ++bx) {
+            FieldBrick fieldBrick = {bx*k_brickSize, by*k_brickSize, bz*k_brickSize, brick.data(), true};
+            uint8_t* voxel = brick.data();
+            for (int y = fieldBrick.y0; y < fieldBrick.y0 + k_brickSize; ++y) {
+            for (int z = fieldBrick.z0; z < fieldBrick.z0 + k_brickSize; ++z) {
+            for (int x = fieldBrick.x0; x < fieldBrick.x0 + k_brickSize; ++x, voxel += bytesPerVoxel) {
+                const size_t cy = static_cast<size_t>(std::min(y, slab.y1-1) - slab.y0);
+                const size_t cz = static_cast<size_t>(std::min(z, size-1));
+                const size_t cx = static_cast<size_t>(std::min(x, size-1));
+                std::memcpy(voxel, slabVoxels.data() + cy*rowBytes + (cz*static_cast<size_t>(size) + cx)*bytesPerVoxel, bytesPerVoxel);
+                fieldBrick.isUniform = fieldBrick.isUniform && std::memcmp(voxel, brick.data(), bytesPerVoxel) == 0;
+            }
+            }
+            }
+            if (!callback(fieldBrick))
+                return false;
+        }
+        }
+        }
+    }
+    if (counters)
+        *counters = total;
+    return true;
+}
+
+float DistanceFieldGenerator::distance(const Vec3& point) const
+{
+    if (!valid)
+        return std::numeric_limits<float>::infinity();
+    const double squaredDistance = bvh->squaredDistance(toUnitCube(transform, point));
+    return static_cast<float>(std::sqrt(squaredDistance)) / transform.scale;
+}
+
+void DistanceFieldGenerator::query(const Vec3* points, const size_t count, PointQueryResult* results)
+{
+    query(pool, points, count, results);
+}
+
+void DistanceFieldGenerator::prepareQueries() const
+{
+    if (!valid)
+        return;
+    std::call_once(windingBuilt, [this]() { winding.reset(new WindingNumberSign(soup, 2)); });
+}
+
+void DistanceFieldGenerator::query(ThreadPool& queryPool, const Vec3* points, const size_t count, PointQueryResult* results) const
+{
+    if (!valid) {
+        for (size_t i = 0; i < count; ++i) {
+            results[i].distance = std::numeric_limits<float>::infinity();
+            results[i].closest = points[i];
+            results[i].triangle = std::numeric_limits<uint32_t>::max();
+        }
+        return;
+    }
+    prepareQueries();
+
+    // Blocks of points close in Z-order share most of their traversal.
+    std::vector<std::pair<uint64_t, size_t>> order(count);
+    for (size_t i = 0; i < count; ++i) {
+        const Vec3 u = toUnitCube(transform, points[i]);
+        uint64_t code = 0;
+        for (int axis = 0; axis < 3; ++axis) {
+            const float cell = std::min(std::max(u[axis], 0.f), 1.f) * static_cast<float>(k_pointOrderCells - 1);
+            code |= spreadBits3(static_cast<uint32_t>(cell)) << axis;
+        }
+        order[i] = std::make_pair(code, i);
+    }
+    std::sort(order.begin(), order.end());
+
+    const size_t blockSize = SimdBVH::k_maxBlockSize;
+    const size_t numBlocks = (count + blockSize - 1) / blockSize;
+    parallelFor(queryPool, numBlocks, [&](const size_t block) {
+        const size_t begin = block*blockSize;
+        const size_t blockCount = std::min(blockSize, count - begin);
+        Vec3 queries[SimdBVH::k_maxBlockSize], closest[SimdBVH::k_maxBlockSize];
+        double squaredDistances[SimdBVH::k_maxBlockSize];
+        uint32_t triangles[SimdBVH::k_maxBlockSize];
+        for (size_t i = 0; i < blockCount; ++i)
+            queries[i] = toUnitCube(transform, points[order[begin + i].second]);
+        DistanceHint hint;
+        uint64_t nodeVisits = 0;
+        bvh->blockClosestPoints(queries, blockCount, squaredDistances, closest, triangles, hint, nodeVisits);
+
+        const float toMesh = 1.f / transform.scale;
+        for (size_t i = 0; i < blockCount; ++i) {
+            const float distance = static_cast<float>(std::sqrt(squaredDistances[i])) * toMesh;
+            const bool inside = distance > 0.f && std::abs(winding->windingNumber(queries[i])) > 0.5;
+            PointQueryResult& result = results[order[begin + i].second];
+            result.distance = inside ? -distance : distance;
+            result.closest = (closest[i] - Vec3(0.5f, 0.5f, 0.5f)) * toMesh + transform.origin;
+            result.triangle = triangles[i];
+        }
+    });
+}
+
+bool DistanceFieldGenerator::makeOptions(const GridSpec& grid, FieldOptions& options) const
+{
+    if (!valid || grid.size < 2 || grid.bandVoxels < 0.f || grid.signMethod == SignMethod::Domain)
+        return false;
+
+    float band = quantizationRange(grid.isSigned);
+    if (grid.bandVoxels > 0.f)
+        band = std::min(band, grid.bandVoxels / static_cast<float>(grid.size));
+    options.size = grid.size;
+    options.isSigned = grid.isSigned;
+    options.cull = true;
+    options.coherent = true;
+    options.band = band;
+    options.voxelType = grid.voxelType;
+    std::fill(options.dims, options.dims + 3, grid.size);
+    return true;
+}
+
+std::unique_ptr<SignEvaluator> DistanceFieldGenerator::makeSign(const GridSpec& grid) const
+{
+    if (grid.signMethod == SignMethod::Winding)
+        return std::unique_ptr<SignEvaluator>(new WindingNumberSign(soup, grid.size));
+    return std::unique_ptr<SignEvaluator>(new ScanlineSign(soup, grid.size));
+}
@@ -0,0 +1,103 @@
+#pragma once
+
+// libdfgen: distance fields of triangle meshes in memory, without mesh files or the dfgen process.
+// The mesh is fitted into the unit cube as dfgen does and its BVH is built once, every grid
+// generated afterwards (of any size or precision) and every point query reuse it. Distances come
+// from the simd engine; the CGAL engine and the domain sign method are only available in dfgen.
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "bvh.h"
+#include "field.h"
+#include "fieldfile.h"
+#include "geometry.h"
+#include "sign.h"
+#include "threadpool.h"
+
+// The field to compute, over the unit cube the mesh was fitted into.
+struct GridSpec
+{
+    GridSpec(): size(64), isSigned(false), bandVoxels(0.f), voxelType(VoxelType::U8), signMethod(SignMethod::Scanline) {}
+
+    int size;               // Voxels per axis.
+    bool isSigned;
+    float bandVoxels;       // Distances are clamped to this many voxels from the surface, 0: only by the quantization range.
+    VoxelType voxelType;
+    SignMethod signMethod;  // Scanline or Winding.
+};
+
+// A cube of k_brickSize^3 voxels (brickfield.h) of GridSpec::voxelType, x fastest, then z, then y.
+// Bricks crossing the end of the grid repeat its last voxels.
+struct FieldBrick
+{
+    int x0, y0, z0; // First voxel.
+    const uint8_t* voxels;
+    bool isUniform; // All voxels are equal.
+};
+
+// Receives the bricks in the order of the voxels (x fastest, then z, then y), returns false to stop.
+typedef std::function<bool(const FieldBrick& brick)> BrickCallback;
+
+// Exact answer to a point query, in mesh space.
+struct PointQueryResult
+{
+    float distance;    // To the surface in mesh units, negative inside.
+    Vec3 closest;      // Closest point on the surface.
+    uint32_t triangle; // Index of the triangle the closest point lies on.
+};
+
+class DistanceFieldGenerator
+{
+public:
+    // Copies the mesh: xyz per vertex and three vertex indices per triangle. numThreads counts the
+    // calling thread, 0 means all hardware threads. A mesh of no triangles, an index of no vertex or
+    // a coordinate that is not finite leave the generator invalid (see isValid()).
+    DistanceFieldGenerator(const float* positions, size_t numVertices, const uint32_t* indices, size_t numTriangles,
+                           unsigned int numThreads = 0);
+
+    DistanceFieldGenerator(const DistanceFieldGenerator&) = delete;
+    DistanceFieldGenerator& operator=(const DistanceFieldGenerator&) = delete;
+
+    // False if the mesh was rejected: nothing was built, generate() fails and queries find no
+    // surface (infinite distances, triangle UINT32_MAX).
+    bool isValid() const { return valid; }
+    const UnitCubeTransform& getTransform() const { return transform; }
+    static size_t bytesNeeded(const GridSpec& grid);
+
+    // Fills voxels with the whole field, laid out as dfgen's raw output. Returns false if the spec
+    // is invalid or the buffer holds less than bytesNeeded(grid).
+    bool generate(const GridSpec& grid, uint8_t* voxels, size_t bytes, QueryCounters* counters = nullptr);
+    // Streams the field as bricks, computed in slabs so only one slab is held in memory. Returns
+    // false if the spec is invalid or the callback stopped the generation.
+    bool generate(const GridSpec& grid, const BrickCallback& callback, QueryCounters* counters = nullptr);
+
+    // Unsigned distance from a mesh space point to the surface, in mesh units.
+    float distance(const Vec3& point) const;
+    // Signed distances and closest points of mesh space points, evaluated in blocks of nearby
+    // points (sorted in Z-order) on the pool. Inside is decided by the generalized winding number,
+    // whose tree is built by prepareQueries() or else the first call. Safe to call from several
+    // threads at once.
+    void query(const Vec3* points, size_t count, PointQueryResult* results);
+    void query(ThreadPool& queryPool, const Vec3* points, size_t count, PointQueryResult* results) const;
+    // Builds the winding number tree of query() now, so the first query does not pay for it.
+    void prepareQueries() const;
+
+private:
+    bool makeOptions(const GridSpec& grid, FieldOptions& options) const;
+    std::unique_ptr<SignEvaluator> makeSign(const GridSpec& grid) const;
+
+    std::vector<float> positions; // In the unit cube.
+    std::vector<uint32_t> indices;
+    TriangleSoup soup;
+    UnitCubeTransform transform;
+    std::unique_ptr<SimdBVH> bvh;
+    bool valid;
+    mutable std::unique_ptr<WindingNumberSign> winding; // Of point queries, built once.
+    mutable std::once_flag windingBuilt;
+    ThreadPool pool;
+};
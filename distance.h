@@ -0,0 +1,65 @@
+#pragma once
+
+#include <string>
+
+#include "geometry.h"
+
+enum class DistanceEngineType
+{
+    CGAL, // CGAL::AABB_tree, double precision. The reference.
+    Simd  // In-project wide BVH with float SIMD kernels (bvh.h).
+};
+
+inline bool parseDistanceEngine(const std::string& name, DistanceEngineType& type)
+{
+    if (name == "cgal")
+        type = DistanceEngineType::CGAL;
+    else if (name == "simd")
+        type = DistanceEngineType::Simd;
+    else
+        return false;
+    return true;
+}
+
+inline const char* distanceEngineName(const DistanceEngineType type)
+{
+    return (type == DistanceEngineType::CGAL) ? "cgal" : "simd";
+}
+
+// Closest point found by a previous query. Seeds (bounds) the search of a following query nearby,
+// neighbouring voxels almost always share the closest triangle or have adjacent ones.
+struct DistanceHint
+{
+    Vec3 point;
+    uint32_t triangle; // Index of the triangle the point lies on, if the engine reports it.
+    bool valid;
+
+    DistanceHint(): triangle(~0u), valid(false) {}
+};
+
+// Unsigned distance from a point to the closest triangle of a mesh.
+// Implementations must be safe to query from several threads at once.
+class DistanceEngine
+{
+public:
+    virtual ~DistanceEngine() {}
+    virtual double squaredDistance(const Vec3& query) const = 0;
+
+    // Seeded with the hint (if valid), which is then updated to this query's closest point.
+    // Engines that can count visited tree nodes add them to nodeVisits.
+    virtual double hintedSquaredDistance(const Vec3& query, DistanceHint& hint, uint64_t& nodeVisits) const = 0;
+
+    // Squared distances of a coherent block of queries (e.g. neighbouring voxels), seeded with
+    // and updating the hint like above.
+    virtual void blockSquaredDistances(const Vec3* queries, size_t count, double* results,
+                                       DistanceHint& hint, uint64_t& nodeVisits) const
+    {
+        for (size_t i = 0; i < count; ++i)
+            results[i] = hintedSquaredDistance(queries[i], hint, nodeVisits);
+    }
+
+    // Like blockSquaredDistances, and also reports the closest point of every query and the index
+    // of the triangle it lies on, found by the same search.
+    virtual void blockClosestPoints(const Vec3* queries, size_t count, double* results, Vec3* points,
+                                    uint32_t* triangles, DistanceHint& hint, uint64_t& nodeVisits) const = 0;
+};
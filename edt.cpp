@@ -0,0 +1,323 @@
+#include "edt.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+
+namespace { // Unnamed namespace.
+
+const int k_voxelizeBlockRows = 16;  // Triangles are binned into blocks of y rows, one task each.
+const float k_boxMargin = 1e-3f;     // Grows the voxel cells, so triangles on a cell face mark both cells.
+const float k_infinity = std::numeric_limits<float>::infinity();
+const size_t k_transformBlockRows = 16; // Rows along y and z transformed together, neighbours in memory.
+
+enum Label : uint8_t
+{
+    Unknown = 0,
+    Surface,
+    Outside,
+    Inside
+};
+
+// Separating axis test of a triangle (relative to the box center) against a cube of the given
+// half size (Akenine-Moeller): the box axes, the triangle normal and the 9 edge cross products.
+bool triangleOverlapsBox(const Vec3& v0, const Vec3& v1, const Vec3& v2, const float half)
+{
+    const Vec3 corners[3] = {v0, v1, v2};
+    for (int axis = 0; axis < 3; ++axis) {
+        if (std::fmin(v0[axis], std::fmin(v1[axis], v2[axis])) > half
+            || std::fmax(v0[axis], std::fmax(v1[axis], v2[axis])) < -half)
+            return false;
+    }
+
+    const Vec3 edges[3] = {v1 - v0, v2 - v1, v0 - v2};
+    const Vec3 normal = cross(edges[0], edges[1]);
+    const float planeRadius = half * (std::fabs(normal.x) + std::fabs(normal.y) + std::fabs(normal.z));
+    if (std::fabs(dot(normal, v0)) > planeRadius)
+        return false;
+
+    const Vec3 boxAxes[3] = {Vec3(1.f, 0.f, 0.f), Vec3(0.f, 1.f, 0.f), Vec3(0.f, 0.f, 1.f)};
+    for (const Vec3& edge : edges) {
+        for (const Vec3& boxAxis : boxAxes) {
+            const Vec3 axis = cross(boxAxis, edge);
+            const float radius = half * (std::fabs(axis.x) + std::fabs(axis.y) + std::fabs(axis.z));
+            float projectedMin = k_infinity, projectedMax = -k_infinity;
+            for (const Vec3& corner : corners) {
+                const float projected = dot(axis, corner);
+                projectedMin = std::fmin(projectedMin, projected);
+                projectedMax = std::fmax(projectedMax, projected);
+            }
+            if (projectedMin > radius || projectedMax < -radius)
+                return false;
+        }
+    }
+    return true;
+}
+
+// Lower envelope of the parabolas (q - p)^2 + f[p] over all samples p, evaluated at every q
+// (Felzenszwalb and Huttenlocher). Infinite samples are skipped. v and z hold n and n+1 values.
+void distanceTransform1D(const float* f, const int n, float* d, int* v, float* z)
+{
+    int k = -1;
+    for (int q = 0; q < n; ++q) {
+        if (f[q] == k_infinity)
+            continue;
+        const float fq = f[q] + static_cast<float>(q)*static_cast<float>(q);
+        float s = -k_infinity;
+        while (k >= 0) {
+            const float fv = f[v[k]] + static_cast<float>(v[k])*static_cast<float>(v[k]);
+            s = (fq - fv) / (2.f*static_cast<float>(q - v[k]));
+            if (s > z[k])
+                break;
+            --k;
+        }
+        if (k < 0)
+            s = -k_infinity;
+        ++k;
+        v[k] = q;
+        z[k] = s;
+    }
+    if (k < 0) {
+        std::fill(d, d + n, k_infinity);
+        return;
+    }
+
+    z[k+1] = k_infinity;
+    for (int q = 0, j = 0; q < n; ++q) {
+        while (z[j+1] < static_cast<float>(q))
+            ++j;
+        const float dq = static_cast<float>(q - v[j]);
+        d[q] = dq*dq + f[v[j]];
+    }
+}
+
+// Marks unknown voxels next to outside ones along a row, forward and backward. Returns whether any changed.
+bool propagateAlongRow(uint8_t* row, const int n)
+{
+    bool changed = false;
+    for (int i = 1; i < n; ++i) {
+        if (row[i] == Unknown && row[i-1] == Outside) {
+            row[i] = Outside;
+            changed = true;
+        }
+    }
+    for (int i = n-2; i >= 0; --i) {
+        if (row[i] == Unknown && row[i+1] == Outside) {
+            row[i] = Outside;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+// Marks unknown voxels of a row next to outside voxels of a neighbouring row. Branch free, so it vectorizes.
+bool propagateFromRow(uint8_t* row, const uint8_t* neighbour, const int n)
+{
+    uint8_t changed = 0;
+    for (int i = 0; i < n; ++i) {
+        const uint8_t spreads = static_cast<uint8_t>(row[i] == Unknown) & static_cast<uint8_t>(neighbour[i] == Outside);
+        row[i] = spreads ? static_cast<uint8_t>(Outside) : row[i];
+        changed |= spreads;
+    }
+    return changed != 0;
+}
+
+} // Unnamed namespace.
+
+DistanceTransform::DistanceTransform(const int size):
+    size(size)
+{
+    const size_t numVoxels = static_cast<size_t>(size)*static_cast<size_t>(size)*static_cast<size_t>(size);
+    labels.assign(numVoxels, Unknown);
+    squaredDistances.resize(numVoxels);
+}
+
+void DistanceTransform::voxelize(ThreadPool& pool, const TriangleSoup& mesh)
+{
+    // In grid coordinates voxel centers are integers and cells span +-0.5 around them.
+    const float gridScale = static_cast<float>(size);
+    auto toGrid = [gridScale](const Vec3& p) { return p*gridScale - Vec3(0.5f, 0.5f, 0.5f); };
+    const float half = 0.5f + k_boxMargin;
+    auto firstVoxel = [half](const float coordinate) { return std::max(static_cast<int>(std::ceil(coordinate - half)), 0); };
+    auto lastVoxel = [this, half](const float coordinate) { return std::min(static_cast<int>(std::floor(coordinate + half)), size-1); };
+
+    // Every block rasterizes the triangles overlapping its rows, clipped to them, so no two tasks write the same voxel.
+    const int numBlocks = (size + k_voxelizeBlockRows - 1) / k_voxelizeBlockRows;
+    std::vector<std::vector<uint32_t>> blockTriangles(static_cast<size_t>(numBlocks));
+    for (size_t t = 0; t < mesh.numTriangles; ++t) {
+        const float y0 = toGrid(mesh.corner(t, 0)).y, y1 = toGrid(mesh.corner(t, 1)).y, y2 = toGrid(mesh.corner(t, 2)).y;
+        const int first = firstVoxel(std::fmin(y0, std::fmin(y1, y2)));
+        const int last = lastVoxel(std::fmax(y0, std::fmax(y1, y2)));
+        for (int block = first / k_voxelizeBlockRows; block <= last / k_voxelizeBlockRows && first <= last; ++block)
+            blockTriangles[static_cast<size_t>(block)].push_back(static_cast<uint32_t>(t));
+    }
+
+    parallelFor(pool, static_cast<size_t>(numBlocks), [&](const size_t block) {
+        const int blockFirstRow = static_cast<int>(block) * k_voxelizeBlockRows;
+        const int blockLastRow = std::min(blockFirstRow + k_voxelizeBlockRows, size) - 1;
+        for (const uint32_t t : blockTriangles[block]) {
+            const Vec3 p0 = toGrid(mesh.corner(t, 0)), p1 = toGrid(mesh.corner(t, 1)), p2 = toGrid(mesh.corner(t, 2));
+            const Vec3 boundsMin = vmin(p0, vmin(p1, p2)), boundsMax = vmax(p0, vmax(p1, p2));
+            int lo[3], hi[3];
+            for (int axis = 0; axis < 3; ++axis) {
+                lo[axis] = firstVoxel(boundsMin[axis]);
+                hi[axis] = lastVoxel(boundsMax[axis]);
+            }
+            lo[1] = std::max(lo[1], blockFirstRow);
+            hi[1] = std::min(hi[1], blockLastRow);
+
+            // Walk the cells of the two minor axes of the normal, along the major one only the
+            // few cells whose centers lie close enough to the triangle's plane.
+            const Vec3 normal = cross(p1 - p0, p2 - p0);
+            const float normalAbs[3] = {std::fabs(normal.x), std::fabs(normal.y), std::fabs(normal.z)};
+            const int a = (normalAbs[0] >= normalAbs[1] && normalAbs[0] >= normalAbs[2]) ? 0 : ((normalAbs[1] >= normalAbs[2]) ? 1 : 2);
+            const int b = (a + 1) % 3, c = (a + 2) % 3;
+            const float planeOffset = dot(normal, p0);
+            const float planeRadius = half * (normalAbs[0] + normalAbs[1] + normalAbs[2]);
+            int voxel[3];
+            for (voxel[b] = lo[b]; voxel[b] <= hi[b]; ++voxel[b]) {
+            for (voxel[c] = lo[c]; voxel[c] <= hi[c]; ++voxel[c]) {
+                int first = lo[a], last = hi[a];
+                if (normalAbs[a] > 0.f) {
+                    const float rest = planeOffset - normal[b]*static_cast<float>(voxel[b]) - normal[c]*static_cast<float>(voxel[c]);
+                    float t0 = (rest - planeRadius) / normal[a], t1 = (rest + planeRadius) / normal[a];
+                    if (t0 > t1)
+                        std::swap(t0, t1);
+                    t0 = std::fmax(t0, static_cast<float>(first));
+                    t1 = std::fmin(t1, static_cast<float>(last));
+                    if (t0 > t1)
+                        continue;
+                    first = static_cast<int>(std::ceil(t0));
+                    last = static_cast<int>(std::floor(t1));
+                }
+                for (voxel[a] = first; voxel[a] <= last; ++voxel[a]) {
+                    const Vec3 center(static_cast<float>(voxel[0]), static_cast<float>(voxel[1]), static_cast<float>(voxel[2]));
+                    if (triangleOverlapsBox(p0 - center, p1 - center, p2 - center, half))
+                        labels[index(voxel[0], voxel[1], voxel[2])] = Surface;
+                }
+            }
+            }
+        }
+    });
+}
+
+void DistanceTransform::floodFill(ThreadPool& pool)
+{
+    // Seed the boundary of the grid, then sweep outside labels along x, z and y rows until
+    // nothing changes. Every row is written by a single task. Each round also turns one corner
+    // of cavities winding through the grid, usual meshes settle in a few rounds.
+    parallelFor(pool, static_cast<size_t>(size), [this](const size_t y) {
+        for (int z = 0; z < size; ++z) {
+        for (int x = 0; x < size; ++x) {
+            uint8_t& label = labels[index(x, static_cast<int>(y), z)];
+            const bool boundary = x == 0 || y == 0 || z == 0 || x == size-1 || static_cast<int>(y) == size-1 || z == size-1;
+            if (boundary && label == Unknown)
+                label = Outside;
+        }
+        }
+    });
+
+    const size_t planeStride = static_cast<size_t>(size)*static_cast<size_t>(size);
+    bool changed = true;
+    while (changed) {
+        std::atomic<bool> anyChanged(false);
+        // Along x and z, a task per y plane.
+        parallelFor(pool, static_cast<size_t>(size), [&](const size_t y) {
+            auto row = [this, y](const int z) { return &labels[index(0, static_cast<int>(y), z)]; };
+            bool planeChanged = false;
+            for (int z = 0; z < size; ++z)
+                planeChanged |= propagateAlongRow(row(z), size);
+            for (int z = 1; z < size; ++z)
+                planeChanged |= propagateFromRow(row(z), row(z-1), size);
+            for (int z = size-2; z >= 0; --z)
+                planeChanged |= propagateFromRow(row(z), row(z+1), size);
+            if (planeChanged)
+                anyChanged = true;
+        });
+        // Along y, a task per z plane.
+        parallelFor(pool, static_cast<size_t>(size), [&](const size_t z) {
+            auto row = [this, z](const int y) { return &labels[index(0, y, static_cast<int>(z))]; };
+            bool planeChanged = false;
+            for (int y = 1; y < size; ++y)
+                planeChanged |= propagateFromRow(row(y), row(y-1), size);
+            for (int y = size-2; y >= 0; --y)
+                planeChanged |= propagateFromRow(row(y), row(y+1), size);
+            if (planeChanged)
+                anyChanged = true;
+        });
+        changed = anyChanged;
+    }
+
+    parallelFor(pool, static_cast<size_t>(size), [&](const size_t y) {
+        uint8_t* plane = &labels[index(0, static_cast<int>(y), 0)];
+        std::replace(plane, plane + planeStride, static_cast<uint8_t>(Unknown), static_cast<uint8_t>(Inside));
+    });
+}
+
+void DistanceTransform::transform(ThreadPool& pool)
+{
+    const size_t rowStride = static_cast<size_t>(size);
+    const size_t planeStride = rowStride*rowStride;
+    parallelFor(pool, static_cast<size_t>(size), [&](const size_t y) {
+        const size_t begin = static_cast<size_t>(y)*planeStride;
+        for (size_t i = begin; i < begin + planeStride; ++i)
+            squaredDistances[i] = (labels[i] == Surface) ? 0.f : k_infinity;
+    });
+
+    // One pass per axis, rows are gathered into scratch buffers of their task. Rows along z and y
+    // are strided, blocks of rows neighbouring in x are gathered together to use whole cache lines.
+    const size_t n = static_cast<size_t>(size);
+    auto pass = [this, &pool, n](const size_t taskStride, const size_t rowOffsetStride, const size_t stride) {
+        const size_t blockRows = (rowOffsetStride == 1) ? k_transformBlockRows : 1;
+        parallelFor(pool, n, [&](const size_t task) {
+            std::vector<float> f(blockRows*n), d(n), z(n+1);
+            std::vector<int> v(n);
+            for (size_t firstRow = 0; firstRow < n; firstRow += blockRows) {
+                const size_t numRows = std::min(blockRows, n - firstRow);
+                float* values = &squaredDistances[task*taskStride + firstRow*rowOffsetStride];
+                for (size_t i = 0; i < n; ++i) {
+                    for (size_t r = 0; r < numRows; ++r)
+                        f[r*n + i] = values[i*stride + r*rowOffsetStride];
+                }
+                for (size_t r = 0; r < numRows; ++r) {
+                    distanceTransform1D(&f[r*n], size, d.data(), v.data(), z.data());
+                    std::copy(d.begin(), d.end(), f.begin() + static_cast<std::ptrdiff_t>(r*n));
+                }
+                for (size_t i = 0; i < n; ++i) {
+                    for (size_t r = 0; r < numRows; ++r)
+                        values[i*stride + r*rowOffsetStride] = f[r*n + i];
+                }
+            }
+        });
+    };
+    pass(planeStride, rowStride, 1); // Along x, a task per y plane.
+    pass(planeStride, 1, rowStride); // Along z, a task per y plane.
+    pass(rowStride, 1, planeStride); // Along y, a task per z plane.
+}
+
+float DistanceTransform::signedDistance(const int x, const int y, const int z) const
+{
+    const size_t i = index(x, y, z);
+    const float dist = std::sqrt(squaredDistances[i]) / static_cast<float>(size);
+    return (labels[i] == Inside) ? -dist : dist;
+}
+
+void DistanceTransform::encodeSlab(ThreadPool& pool, const FieldOptions& options, const FieldSlab& slab) const
+{
+    const size_t bytesPerVoxel = voxelBytes(options.voxelType);
+    const size_t planeVoxels = static_cast<size_t>(size)*static_cast<size_t>(size);
+    parallelFor(pool, static_cast<size_t>(slab.y1 - slab.y0), [&](const size_t row) {
+        const size_t begin = index(0, slab.y0 + static_cast<int>(row), 0);
+        uint8_t* voxel = slab.voxels + row*planeVoxels*bytesPerVoxel;
+        for (size_t i = begin; i < begin + planeVoxels; ++i, voxel += bytesPerVoxel) {
+            const float dist = std::min(std::sqrt(squaredDistances[i]) / static_cast<float>(size), options.band);
+            encodeVoxel(dist, labels[i] == Inside, options, voxel);
+        }
+    });
+}
+
+uint64_t DistanceTransform::getNumSurfaceVoxels() const
+{
+    return static_cast<uint64_t>(std::count(labels.begin(), labels.end(), static_cast<uint8_t>(Surface)));
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "field.h"
+#include "geometry.h"
+#include "threadpool.h"
+
+enum class FieldMode
+{
+    Exact, // Distance query (or octree culling) per voxel, field.h.
+    EDT,   // Voxelization and Euclidean distance transform, approximate.
+    ADF    // Adaptive octree with error bounded subdivision (adf.h), its own output format.
+};
+
+inline bool parseFieldMode(const std::string& name, FieldMode& mode)
+{
+    if (name == "exact")
+        mode = FieldMode::Exact;
+    else if (name == "edt")
+        mode = FieldMode::EDT;
+    else if (name == "adf")
+        mode = FieldMode::ADF;
+    else
+        return false;
+    return true;
+}
+
+inline const char* fieldModeName(const FieldMode mode)
+{
+    return (mode == FieldMode::Exact) ? "exact" : ((mode == FieldMode::EDT) ? "edt" : "adf");
+}
+
+// Approximate field of a whole grid, for previews and LODs. Voxels whose cell touches a triangle
+// are marked as surface (conservative voxelization), the others are outside if they connect to the
+// grid boundary and inside otherwise (flood fill, expects a closed mesh). An exact Euclidean
+// distance transform (Felzenszwalb and Huttenlocher) then gives every voxel the distance to the
+// closest surface voxel center, one pass along x, z and y rows each, linear in the voxels.
+// Distances are off by up to about a voxel; surface voxels are at distance 0.
+// Holds size^3 labels and float distances.
+class DistanceTransform
+{
+public:
+    explicit DistanceTransform(int size);
+
+    // The stages, in this order. Each one runs in parallel on the pool.
+    void voxelize(ThreadPool& pool, const TriangleSoup& mesh);
+    void floodFill(ThreadPool& pool);
+    void transform(ThreadPool& pool);
+
+    // Distance of a voxel center to the surface in the unit cube, negative inside.
+    float signedDistance(int x, int y, int z) const;
+    // Stores the voxels of a slab as FieldEvaluator does (clamped to options.band).
+    void encodeSlab(ThreadPool& pool, const FieldOptions& options, const FieldSlab& slab) const;
+
+    uint64_t getNumSurfaceVoxels() const;
+
+private:
+    // Same layout as the field: x fastest, then z, then y.
+    size_t index(const int x, const int y, const int z) const
+    {
+        return (static_cast<size_t>(y)*static_cast<size_t>(size) + static_cast<size_t>(z))*static_cast<size_t>(size) + static_cast<size_t>(x);
+    }
+
+    int size;
+    std::vector<uint8_t> labels; // Surface, outside or inside.
+    std::vector<float> squaredDistances; // In voxels squared.
+};
@@ -5,6 +5,9 @@
 #include <sstream>
 #include <cassert>
 #include <cmath>
+#include <cstring>
+
+#include "fieldfile.h"
 
 #ifndef __EMSCRIPTEN__
 #define __EMSCRIPTEN__ 0
@@ -29,7 +32,7 @@ namespace { // Unnamed namespace (everything except main is in it).
 const char* k_windowTitle = "Distance Field Example";
 const int k_windowWidth = 1280;
 const int k_windowHeight = 720;
-const int k_distTexSize = 64;
+const int k_rawDistTexSize = 64; // Raw (headerless) fields carry no size.
 
 const float PI = static_cast<float>(M_PI);
 const float TwoPI = 2.f * PI;
@@ -51,6 +54,7 @@ struct OrbitalCamera
 };
 
 int fbWidth, fbHeight;
+int distTexSize = k_rawDistTexSize;
 bool windowFocused = true;
 GLuint distanceFieldShader;
 GLuint distanceFieldTex;
@@ -58,6 +62,7 @@ GLuint fullVertexBuffer;
 GLint canvasSizeLoc;
 GLint originLoc;
 GLint distFieldSamLoc;
+GLint distFieldSizeLoc;
 GLint timeLoc;
 double mouseStartX, mouseStartY;
 OrbitalCamera orbiCam;
@@ -86,7 +91,8 @@ bool setup(GLFWwindow* window)
     originLoc       = glGetUniformLocation(distanceFieldShader, "origin");
     distFieldSamLoc = glGetUniformLocation(distanceFieldShader, "distFieldSam");
     timeLoc         = glGetUniformLocation(distanceFieldShader, "time");
-    ASSERT(canvasSizeLoc != -1 && originLoc != -1 && distFieldSamLoc != -1 && timeLoc != -1);
+    distFieldSizeLoc = glGetUniformLocation(distanceFieldShader, "distFieldSize");
+    ASSERT(canvasSizeLoc != -1 && originLoc != -1 && distFieldSamLoc != -1 && timeLoc != -1 && distFieldSizeLoc != -1);
 
     // Two triangles in normalized device coordinates, covering the entire framebuffer.
     float fullVertices[] = {
@@ -102,15 +108,46 @@ bool setup(GLFWwindow* window)
     glBindBuffer(GL_ARRAY_BUFFER, fullVertexBuffer);
     glBufferData(GL_ARRAY_BUFFER, sizeof(fullVertices), fullVertices, GL_STATIC_DRAW);
 
-    std::vector<uint8_t> distanceField = readFile("armadillo_dist.bin");
+    const std::string distanceFieldPath = "armadillo_dist.bin";
+    std::vector<uint8_t> distanceField = readFile(distanceFieldPath);
     std::cout << "Read " << distanceField.size() << " bytes from distance field data file." << std::endl;
 
+    // Containers describe themselves (load() decompresses them), any precision is converted to the
+    // 8 bit signed encoding the shader expects (distance + 0.5). Anything else is a raw 64^3 field.
+    DistanceFieldView view;
+    const bool isContainer = distanceField.size() >= sizeof(k_fieldFileMagic)
+                             && std::memcmp(distanceField.data(), k_fieldFileMagic, sizeof(k_fieldFileMagic)) == 0;
+    if (isContainer && !view.load(distanceFieldPath)) {
+        std::cout << "Failed to load the container " << distanceFieldPath
+                  << " (malformed, or compressed without LZ4/zstd support built in)!" << std::endl;
+        return false;
+    }
+    if (isContainer) {
+        distTexSize = view.size(0);
+        if (view.size(1) != distTexSize || view.size(2) != distTexSize) {
+            std::cout << "The viewer needs a cubic field, " << distanceFieldPath << " is a box!" << std::endl;
+            return false;
+        }
+        std::vector<uint8_t> voxels(static_cast<size_t>(view.numVoxels()));
+        size_t i = 0;
+        for (int y = 0; y < distTexSize; ++y) {
+        for (int z = 0; z < distTexSize; ++z) {
+        for (int x = 0; x < distTexSize; ++x) {
+            const float value = std::min(std::max(view.distance(x, y, z) + 0.5f, 0.f), 1.f);
+            voxels[i++] = static_cast<uint8_t>(std::round(value*255.f));
+        }
+        }
+        }
+        distanceField.swap(voxels);
+    }
+    ASSERT(distanceField.size() == static_cast<size_t>(distTexSize*distTexSize*distTexSize));
+
     glGenTextures(1, &distanceFieldTex);
     glBindTexture(GL_TEXTURE_2D, distanceFieldTex);
 #if __EMSCRIPTEN__
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, k_distTexSize*k_distTexSize, k_distTexSize, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, distanceField.data());
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, distTexSize*distTexSize, distTexSize, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, distanceField.data());
 #else
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, k_distTexSize*k_distTexSize, k_distTexSize, 0, GL_RED, GL_UNSIGNED_BYTE, distanceField.data());
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, distTexSize*distTexSize, distTexSize, 0, GL_RED, GL_UNSIGNED_BYTE, distanceField.data());
 #endif
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -135,6 +172,7 @@ void drawFrame()
     glUniform2f(canvasSizeLoc, fbWidth, fbHeight);
     glUniform3f(originLoc, origin[0], origin[1], origin[2]);
     glUniform1f(timeLoc, static_cast<float>(glfwGetTime()));
+    glUniform1f(distFieldSizeLoc, static_cast<float>(distTexSize));
 
     glActiveTexture(GL_TEXTURE0+0);
     glBindTexture(GL_TEXTURE_2D, distanceFieldTex);
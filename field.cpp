@@ -0,0 +1,427 @@
+#include "field.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+#include "threadpool.h"
+
+namespace
+{
+
+const double k_radiusMargin = 1e-5;
+const int k_maxBlockVoxels = FieldEvaluator::k_leafNodeSize * FieldEvaluator::k_leafNodeSize * FieldEvaluator::k_leafNodeSize;
+
+float clamp(const float v, const float min, const float max)
+{
+    if (v < min)
+        return min;
+    if (v > max)
+        return max;
+    return v;
+}
+
+}
+
+uint8_t quantizeDistance(const float dist, const bool inside, const bool isSigned)
+{
+    if (isSigned) {
+        const float sign = inside ? -1.f : 1.f; // Negative inside.
+        const float signedClampedDist = clamp(sign*dist + 0.5f, 0.f, 1.f); // 0.f to 1.f (from max negative distance -0.5 to max positive 0.5).
+        return static_cast<uint8_t>(signedClampedDist*255.f);
+    }
+
+    if (inside)
+        return 0;
+    return static_cast<uint8_t>(std::min(dist, 1.f)*255.f);
+}
+
+void encodeVoxel(const float dist, const bool inside, const FieldOptions& options, uint8_t* voxel)
+{
+    if (options.voxelType == VoxelType::U8) {
+        *voxel = quantizeDistance(dist, inside, options.isSigned);
+    }
+    else if (options.voxelType == VoxelType::U16) {
+        const float normalized = options.isSigned ? clamp((inside ? -dist : dist) + 0.5f, 0.f, 1.f)
+                                                  : (inside ? 0.f : std::min(dist, 1.f));
+        const uint16_t value = static_cast<uint16_t>(normalized*65535.f);
+        std::memcpy(voxel, &value, sizeof(value));
+    }
+    else {
+        const float value = inside ? (options.isSigned ? -dist : 0.f) : dist;
+        std::memcpy(voxel, &value, sizeof(value));
+    }
+}
+
+void voxelDecoding(const FieldOptions& options, float& scale, float& bias)
+{
+    if (options.voxelType == VoxelType::F32) {
+        scale = 1.f;
+        bias = 0.f;
+        return;
+    }
+    scale = 1.f / ((options.voxelType == VoxelType::U8) ? 255.f : 65535.f);
+    bias = options.isSigned ? -0.5f : 0.f;
+}
+
+float decodeVoxel(const uint8_t* voxel, const FieldOptions& options)
+{
+    float value;
+    if (options.voxelType == VoxelType::U8) {
+        value = *voxel;
+    }
+    else if (options.voxelType == VoxelType::U16) {
+        uint16_t v;
+        std::memcpy(&v, voxel, sizeof(v));
+        value = v;
+    }
+    else {
+        std::memcpy(&value, voxel, sizeof(value));
+    }
+    float scale, bias;
+    voxelDecoding(options, scale, bias);
+    return value*scale + bias;
+}
+
+size_t channelBytes(const FieldChannels& channels)
+{
+    return (channels.gradient ? 3*sizeof(float) : 0) + (channels.closest ? 3*sizeof(float) : 0)
+         + (channels.primitive ? sizeof(uint32_t) : 0);
+}
+
+ChannelSlab makeChannelSlab(const FieldChannels& channels, uint8_t* buffer, const size_t numVoxels)
+{
+    const size_t recordBytes = channelBytes(channels);
+    ChannelSlab slab = {nullptr, nullptr, nullptr, 0, 0, 0};
+    // Interleaved channels start at their offset in the record, planes after the previous plane.
+    uint8_t* next = buffer;
+    if (channels.gradient) {
+        slab.gradients = next;
+        slab.gradientStride = channels.interleaved ? recordBytes : 3*sizeof(float);
+        next += channels.interleaved ? 3*sizeof(float) : numVoxels*slab.gradientStride;
+    }
+    if (channels.closest) {
+        slab.closest = next;
+        slab.closestStride = channels.interleaved ? recordBytes : 3*sizeof(float);
+        next += channels.interleaved ? 3*sizeof(float) : numVoxels*slab.closestStride;
+    }
+    if (channels.primitive) {
+        slab.primitives = next;
+        slab.primitiveStride = channels.interleaved ? recordBytes : sizeof(uint32_t);
+    }
+    return slab;
+}
+
+FieldEvaluator::FieldEvaluator(const DistanceEngine& distance, const SignEvaluator& sign,
+                               const FieldOptions& options, const FieldSlab& slab,
+                               const FieldBounds* coarse, FieldBounds* bounds, const ChannelSlab* channels):
+    distance(distance), sign(sign), options(options), slab(slab), coarse(coarse), bounds(bounds), channels(channels),
+    coarseMargin(coarse ? std::sqrt(3.f) / (4.f*static_cast<float>(coarse->size)) + static_cast<float>(k_radiusMargin) : 0.f)
+{
+}
+
+void FieldEvaluator::evaluateNode(const int x0, const int y0, const int z0, const int nodeSize,
+                                  const Side side, EvaluationContext& context) const
+{
+    const int size = options.size;
+    const int x1 = std::min(x0+nodeSize, options.dims[0]);
+    const int y1 = std::min(y0+nodeSize, slab.y1);
+    const int z1 = std::min(z0+nodeSize, options.dims[2]);
+    if (x0 >= x1 || y0 >= y1 || z0 >= z1)
+        return;
+
+    if (nodeSize <= k_leafNodeSize) {
+        evaluateBlock(x0, y0, z0, x1, y1, z1, side, context);
+        return;
+    }
+
+    Side nodeSide = side;
+    if (options.cull) {
+        // With channels every voxel needs its closest point, culling only saves inside tests.
+        const bool fillNodes = !channels;
+        const float clampRange = std::min(options.band, quantizationRange(options.isSigned));
+        if (coarse) {
+            // The coarse level may already tell the node is single sided or saturated.
+            float bound;
+            const Side boundSide = coarseSide(x0, y0, z0, x1, y1, z1, bound);
+            if (boundSide != Side::Unknown) {
+                nodeSide = boundSide;
+                if (fillNodes && !options.isSigned && nodeSide == Side::Inside) {
+                    fill(x0, y0, z0, x1, y1, z1, 0.f, true);
+                    recordBounds(x0, y0, z0, x1, y1, z1, bound, true);
+                    context.counters.insideSkipped += static_cast<uint64_t>(x1-x0) * static_cast<uint64_t>(y1-y0) * static_cast<uint64_t>(z1-z0);
+                    return;
+                }
+                if (fillNodes && bound > clampRange) {
+                    fill(x0, y0, z0, x1, y1, z1, clampRange, nodeSide == Side::Inside);
+                    recordBounds(x0, y0, z0, x1, y1, z1, bound, nodeSide == Side::Inside);
+                    return;
+                }
+            }
+        }
+
+        // Bounding sphere of the voxel centers inside the node (padded for rounding errors).
+        const Vec3 first = voxelCenter(x0, y0, z0, size);
+        const Vec3 last = voxelCenter(x1-1, y1-1, z1-1, size);
+        const Vec3 center = (first + last) * 0.5f;
+        const double radius = 0.5*length(last - first) + k_radiusMargin;
+        const double centerDist = std::sqrt(squaredDistance(center, context));
+
+        if (centerDist > radius) {
+            // The surface does not pass through the node, all voxels lie on the same side.
+            if (nodeSide == Side::Unknown)
+                nodeSide = isInside(x0, y0, z0, context.counters) ? Side::Inside : Side::Outside;
+
+            const float bound = static_cast<float>(centerDist - radius);
+            if (fillNodes && !options.isSigned && nodeSide == Side::Inside) {
+                fill(x0, y0, z0, x1, y1, z1, 0.f, true);
+                recordBounds(x0, y0, z0, x1, y1, z1, bound, true);
+                context.counters.insideSkipped += static_cast<uint64_t>(x1-x0) * static_cast<uint64_t>(y1-y0) * static_cast<uint64_t>(z1-z0);
+                return;
+            }
+
+            if (fillNodes && bound > clampRange) {
+                fill(x0, y0, z0, x1, y1, z1, clampRange, nodeSide == Side::Inside);
+                recordBounds(x0, y0, z0, x1, y1, z1, bound, nodeSide == Side::Inside);
+                return;
+            }
+        }
+    }
+
+    const int childSize = nodeSize / 2;
+    for (int i = 0; i < 8; ++i)
+        evaluateNode(x0 + (i&1)*childSize, y0 + ((i>>1)&1)*childSize, z0 + ((i>>2)&1)*childSize,
+                     childSize, nodeSide, context);
+}
+
+bool FieldEvaluator::isInside(const int x, const int y, const int z, QueryCounters& counters) const
+{
+    counters.insideTests++;
+    return sign.isInside(x, y, z);
+}
+
+// Single query. Coherent evaluation carries the hint over from the previous query of the task.
+double FieldEvaluator::squaredDistance(const Vec3& query, EvaluationContext& context) const
+{
+    context.counters.distanceQueries++;
+    if (options.coherent)
+        return distance.hintedSquaredDistance(query, context.hint, context.counters.nodeVisits);
+    DistanceHint hint;
+    return distance.hintedSquaredDistance(query, hint, context.counters.nodeVisits);
+}
+
+void FieldEvaluator::evaluateBlock(const int x0, const int y0, const int z0, const int x1, const int y1, const int z1,
+                                   const Side side, EvaluationContext& context) const
+{
+    const int size = options.size;
+    Vec3 queries[k_maxBlockVoxels];
+    double squaredDistances[k_maxBlockVoxels];
+    uint8_t* voxels[k_maxBlockVoxels];
+    bool insides[k_maxBlockVoxels];
+    std::array<int, 3> positions[k_maxBlockVoxels]; // Only needed to record bounds and store channels.
+    int numQueries = 0;
+
+    for (int y = y0; y < y1; ++y) {
+    for (int z = z0; z < z1; ++z) {
+    for (int x = x0; x < x1; ++x) {
+        uint8_t* voxel = row(y, z) + static_cast<size_t>(x)*voxelBytes(options.voxelType);
+        Side voxelSide = side;
+        float bound = 0.f;
+        if (voxelSide == Side::Unknown && coarse)
+            voxelSide = coarseSide(x, y, z, x+1, y+1, z+1, bound);
+        const bool inside = (voxelSide == Side::Unknown) ? isInside(x, y, z, context.counters) : (voxelSide == Side::Inside);
+        if (!options.isSigned && inside && !channels) {
+            // Inside or on boundary. We don't want signed distance, so we just set the field to 0.
+            // We don't need to actually issue a distance query in this special case.
+            encodeVoxel(0.f, true, options, voxel);
+            context.counters.insideSkipped++;
+            recordBounds(x, y, z, x+1, y+1, z+1, 0.f, true);
+            continue;
+        }
+
+        queries[numQueries] = voxelCenter(x, y, z, size);
+        voxels[numQueries] = voxel;
+        insides[numQueries] = inside;
+        positions[numQueries] = {x, y, z};
+        numQueries++;
+    }
+    }
+    }
+
+    Vec3 points[k_maxBlockVoxels];
+    uint32_t triangles[k_maxBlockVoxels];
+    if (channels) {
+        // The same queries, which also report the closest points the channels are computed from.
+        if (options.coherent) {
+            distance.blockClosestPoints(queries, static_cast<size_t>(numQueries), squaredDistances, points, triangles,
+                                        context.hint, context.counters.nodeVisits);
+        }
+        else {
+            for (int i = 0; i < numQueries; ++i) {
+                DistanceHint hint;
+                distance.blockClosestPoints(queries + i, 1, squaredDistances + i, points + i, triangles + i,
+                                            hint, context.counters.nodeVisits);
+            }
+        }
+        context.counters.distanceQueries += static_cast<uint64_t>(numQueries);
+    }
+    else if (options.coherent) {
+        distance.blockSquaredDistances(queries, static_cast<size_t>(numQueries), squaredDistances,
+                                       context.hint, context.counters.nodeVisits);
+        context.counters.distanceQueries += static_cast<uint64_t>(numQueries);
+    }
+    else {
+        for (int i = 0; i < numQueries; ++i)
+            squaredDistances[i] = squaredDistance(queries[i], context);
+    }
+
+    for (int i = 0; i < numQueries; ++i) {
+        const float exactDist = std::sqrt(static_cast<float>(squaredDistances[i]));
+        const std::array<int, 3>& p = positions[i];
+        encodeVoxel(std::min(exactDist, options.band), insides[i], options, voxels[i]);
+        if (bounds)
+            recordBounds(p[0], p[1], p[2], p[0]+1, p[1]+1, p[2]+1, exactDist, insides[i]);
+        if (channels)
+            storeChannels(p[0], p[1], p[2], queries[i], points[i], triangles[i], insides[i]);
+    }
+}
+
+void FieldEvaluator::fill(const int x0, const int y0, const int z0, const int x1, const int y1, const int z1,
+                          const float dist, const bool inside) const
+{
+    const size_t bytes = voxelBytes(options.voxelType);
+    uint8_t value[sizeof(float)];
+    encodeVoxel(dist, inside, options, value);
+    for (int y = y0; y < y1; ++y) {
+    for (int z = z0; z < z1; ++z) {
+        uint8_t* voxels = row(y, z);
+        if (bytes == 1) {
+            std::fill(voxels + x0, voxels + x1, value[0]);
+            continue;
+        }
+        for (int x = x0; x < x1; ++x)
+            std::memcpy(voxels + static_cast<size_t>(x)*bytes, value, bytes);
+    }
+    }
+}
+
+uint8_t* FieldEvaluator::row(const int y, const int z) const
+{
+    const size_t dimX = static_cast<size_t>(options.dims[0]), dimZ = static_cast<size_t>(options.dims[2]);
+    return slab.voxels + (static_cast<size_t>(y - slab.y0)*dimZ + static_cast<size_t>(z))*dimX*voxelBytes(options.voxelType);
+}
+
+// Lower bound of the distance over the voxel centers of a box from the coarse bounds. Returns their
+// side, or unknown if the surface may pass through the box.
+Side FieldEvaluator::coarseSide(const int x0, const int y0, const int z0, const int x1, const int y1, const int z1, float& bound) const
+{
+    const size_t coarseSize = static_cast<size_t>(coarse->size);
+    float minBound = std::numeric_limits<float>::infinity();
+    bool anyInside = false, anyOutside = false;
+    for (int y = y0/2; y <= (y1-1)/2; ++y) {
+    for (int z = z0/2; z <= (z1-1)/2; ++z) {
+        const float* distances = coarse->distances.data() + (static_cast<size_t>(y)*coarseSize + static_cast<size_t>(z))*coarseSize;
+        for (int x = x0/2; x <= (x1-1)/2; ++x) {
+            const float d = distances[x];
+            minBound = std::min(minBound, std::fabs(d));
+            anyInside = anyInside || d < 0.f;
+            anyOutside = anyOutside || d > 0.f;
+        }
+    }
+    }
+    bound = minBound - coarseMargin;
+    if (bound <= 0.f || anyInside == anyOutside)
+        return Side::Unknown;
+    return anyInside ? Side::Inside : Side::Outside;
+}
+
+void FieldEvaluator::recordBounds(const int x0, const int y0, const int z0, const int x1, const int y1, const int z1,
+                                  const float bound, const bool inside) const
+{
+    if (!bounds)
+        return;
+    const size_t size = static_cast<size_t>(options.size);
+    const float value = inside ? -bound : bound;
+    for (int y = y0; y < y1; ++y) {
+    for (int z = z0; z < z1; ++z) {
+        float* distances = bounds->distances.data() + (static_cast<size_t>(y)*size + static_cast<size_t>(z))*size;
+        std::fill(distances + x0, distances + x1, value);
+    }
+    }
+}
+
+void FieldEvaluator::storeChannels(const int x, const int y, const int z, const Vec3& query, const Vec3& point,
+                                   const uint32_t triangle, const bool inside) const
+{
+    const size_t dimX = static_cast<size_t>(options.dims[0]), dimZ = static_cast<size_t>(options.dims[2]);
+    const size_t voxel = (static_cast<size_t>(y - slab.y0)*dimZ + static_cast<size_t>(z))*dimX + static_cast<size_t>(x);
+    const Vec3 offset = point - query;
+    if (channels->gradients) {
+        // Away from the closest point, towards it inside a signed field. Undefined on the surface.
+        const float dist = length(offset);
+        const float scale = (dist > 0.f) ? ((options.isSigned && inside) ? 1.f : -1.f) / dist : 0.f;
+        const float gradient[3] = {offset.x*scale, offset.y*scale, offset.z*scale};
+        std::memcpy(channels->gradients + voxel*channels->gradientStride, gradient, sizeof(gradient));
+    }
+    if (channels->closest) {
+        const float closest[3] = {offset.x, offset.y, offset.z};
+        std::memcpy(channels->closest + voxel*channels->closestStride, closest, sizeof(closest));
+    }
+    if (channels->primitives)
+        std::memcpy(channels->primitives + voxel*channels->primitiveStride, &triangle, sizeof(triangle));
+}
+
+namespace
+{
+
+// Evaluates the nodes of nodeSize voxels of the evaluator's slab, all of them or only those
+// flagged in nodeMask (over the whole grid).
+QueryCounters computeNodes(ThreadPool& pool, const FieldEvaluator& evaluator, const int nodeSize,
+                           const std::vector<uint8_t>* nodeMask)
+{
+    const int* dims = evaluator.getOptions().dims;
+    const FieldSlab& slab = evaluator.getSlab();
+    const int nodesX = (dims[0] + nodeSize - 1) / nodeSize, nodesZ = (dims[2] + nodeSize - 1) / nodeSize;
+    const int nodesPerSlab = (slab.y1 - slab.y0 + nodeSize - 1) / nodeSize;
+    const size_t firstNode = static_cast<size_t>(slab.y0 / nodeSize) * static_cast<size_t>(nodesX*nodesZ);
+    std::vector<uint32_t> nodes;
+    for (int n = 0; n < nodesX*nodesZ*nodesPerSlab; ++n) {
+        if (!nodeMask || (*nodeMask)[firstNode + static_cast<size_t>(n)])
+            nodes.push_back(static_cast<uint32_t>(n));
+    }
+
+    std::atomic<uint64_t> distanceQueries(0), insideTests(0), nodeVisits(0), insideSkipped(0);
+    auto computeNode = [&](const size_t i) {
+        const int n = static_cast<int>(nodes[i]);
+        EvaluationContext context;
+        context.counters = {0, 0, 0, 0};
+        evaluator.evaluateNode((n % nodesX) * nodeSize,
+                               slab.y0 + (n / (nodesX*nodesZ)) * nodeSize,
+                               ((n / nodesX) % nodesZ) * nodeSize,
+                               nodeSize, Side::Unknown, context);
+        distanceQueries += context.counters.distanceQueries;
+        insideTests += context.counters.insideTests;
+        nodeVisits += context.counters.nodeVisits;
+        insideSkipped += context.counters.insideSkipped;
+    };
+    parallelFor(pool, nodes.size(), computeNode);
+
+    QueryCounters counters = {distanceQueries, insideTests, nodeVisits, insideSkipped};
+    return counters;
+}
+
+}
+
+QueryCounters computeField(ThreadPool& pool, const FieldEvaluator& evaluator)
+{
+    return computeNodes(pool, evaluator, FieldEvaluator::k_rootNodeSize, nullptr);
+}
+
+QueryCounters computeField(ThreadPool& pool, const FieldEvaluator& evaluator, const std::vector<uint8_t>& nodeMask)
+{
+    static_assert(FieldEvaluator::k_rootNodeSize % FieldEvaluator::k_patchNodeSize == 0, "Slabs must hold whole patches");
+    return computeNodes(pool, evaluator, FieldEvaluator::k_patchNodeSize, &nodeMask);
+}
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+#include "distance.h"
+#include "fieldfile.h"
+#include "geometry.h"
+#include "sign.h"
+
+class ThreadPool;
+
+struct QueryCounters
+{
+    uint64_t distanceQueries;
+    uint64_t insideTests;
+    uint64_t nodeVisits; // Tree nodes visited by distance queries (if the engine counts them).
+    uint64_t insideSkipped; // Voxels of unsigned fields set to 0 without a query, being inside.
+};
+
+enum class Side
+{
+    Unknown,
+    Inside,
+    Outside
+};
+
+// The grid is the unit cube split into size^3 voxels, or a box of dims voxels in its corner (a
+// tightly fitted mesh): voxel centers are at (i + 0.5)/size along every axis either way.
+struct FieldOptions
+{
+    int size;      // Voxels per unit cube edge, the largest of dims.
+    bool isSigned;
+    bool cull;     // Fill saturated and single sided octree nodes without per voxel queries.
+    bool coherent; // Query voxels in blocks, seeded with the closest triangle of a neighbour.
+    float band;    // Distances are clamped to this narrow band around the surface (at most the quantization range).
+    VoxelType voxelType;
+    int dims[3];   // Voxels along x, y and z, all size for the whole cube.
+
+    uint64_t numVoxels() const { return static_cast<uint64_t>(dims[0]) * static_cast<uint64_t>(dims[1]) * static_cast<uint64_t>(dims[2]); }
+};
+
+// Largest distance that quantizes to distinct values, 0.5 if signed, 1 if unsigned.
+inline float quantizationRange(const bool isSigned) { return isSigned ? 0.5f : 1.f; }
+
+// Rows y0 <= y < y1 of the grid, laid out like the whole field (x fastest, then z, then y).
+// Voxels are FieldOptions::voxelType.
+struct FieldSlab
+{
+    uint8_t* voxels;
+    int y0, y1;
+};
+
+// Lower bounds of the distance from every voxel center to the surface, negative inside and 0 where
+// the side is not known. Recorded while a field is evaluated, they steer the evaluation of the
+// next level of a pyramid at twice the resolution.
+struct FieldBounds
+{
+    int size;
+    std::vector<float> distances; // Laid out like the whole field.
+};
+
+// Channels computed next to the distance, from the closest point its query found (no second query).
+struct FieldChannels
+{
+    bool gradient;    // Unit gradient of the distance (of the signed distance if signed), 3 floats. 0 on the surface.
+    bool closest;     // Closest surface point minus the voxel center, in the unit cube, 3 floats.
+    bool primitive;   // Index of the triangle the closest point lies on, uint32.
+    bool interleaved; // One record of the channels per voxel (in the order above), or one plane per channel.
+
+    bool any() const { return gradient || closest || primitive; }
+};
+
+// Bytes of all channels of a voxel.
+size_t channelBytes(const FieldChannels& channels);
+
+// The channels of a slab's voxels, ordered like FieldSlab::voxels. Absent channels are null, the
+// strides are the bytes from one voxel to the next.
+struct ChannelSlab
+{
+    uint8_t* gradients;
+    uint8_t* closest;
+    uint8_t* primitives;
+    size_t gradientStride, closestStride, primitiveStride;
+};
+
+// Lays the channels of numVoxels voxels out in buffer (numVoxels*channelBytes(channels) bytes).
+ChannelSlab makeChannelSlab(const FieldChannels& channels, uint8_t* buffer, size_t numVoxels);
+
+// Per task state of FieldEvaluator.
+struct EvaluationContext
+{
+    QueryCounters counters;
+    DistanceHint hint;
+};
+
+// Distance quantized to 256 values. Max distance is either 1 unit (if unsigned) or 0.5 (signed).
+// If unsigned distance field is requested, values inside the mesh are set to 0.
+uint8_t quantizeDistance(const float dist, const bool inside, const bool isSigned);
+
+// Stores a distance as options.voxelType: uint8 as quantizeDistance, uint16 alike with 65536
+// values, float32 as is (negative inside if signed, 0 inside if unsigned).
+void encodeVoxel(const float dist, const bool inside, const FieldOptions& options, uint8_t* voxel);
+// Stored values decode to the distance value*scale + bias.
+void voxelDecoding(const FieldOptions& options, float& scale, float& bias);
+float decodeVoxel(const uint8_t* voxel, const FieldOptions& options);
+
+// Fills a grid with quantized distances. The grid is traversed as an octree, coarse to fine.
+// Distance is a 1-Lipschitz function, so a single query at a node's center bounds the distance
+// of all voxels in the node: nodes that are entirely saturated (further away than the clamped
+// range) are filled without any further queries, and nodes not touched by the surface share
+// a single inside/outside test. Leaf nodes are queried as coherent blocks of voxels.
+// Only the voxels of a slab are evaluated, so a grid can be computed (and stored) slab by slab;
+// slabs starting at multiples of k_rootNodeSize give the same voxels as a single pass.
+// Given the bounds of the field at half the resolution (coarse), nodes those bounds show to be
+// saturated or single sided need no query at all, and voxels whose coarse voxel is far enough from
+// the surface take its side without an inside test. The voxels are the same either way. Given
+// bounds, the evaluator records them for every voxel of the slab. Given channels, every voxel is
+// queried (nodes are only culled to save inside tests) and its channels stored.
+class FieldEvaluator
+{
+public:
+    FieldEvaluator(const DistanceEngine& distance, const SignEvaluator& sign,
+                   const FieldOptions& options, const FieldSlab& slab,
+                   const FieldBounds* coarse = nullptr, FieldBounds* bounds = nullptr,
+                   const ChannelSlab* channels = nullptr);
+
+    // Computes all voxels of a cubic node, clipped to the grid (its dims). Nodes may be evaluated concurrently.
+    void evaluateNode(int x0, int y0, int z0, int nodeSize, Side side, EvaluationContext& context) const;
+
+    const FieldOptions& getOptions() const { return options; }
+    const FieldSlab& getSlab() const { return slab; }
+
+    static const int k_rootNodeSize = 16; // Size of the top level octree nodes (tasks) in voxels.
+    static const int k_patchNodeSize = 8;  // Granularity of partial recomputation (computeField with a node mask).
+    static const int k_leafNodeSize = 4;
+
+private:
+    bool isInside(int x, int y, int z, QueryCounters& counters) const;
+    double squaredDistance(const Vec3& query, EvaluationContext& context) const;
+    void evaluateBlock(int x0, int y0, int z0, int x1, int y1, int z1, Side side, EvaluationContext& context) const;
+    void fill(int x0, int y0, int z0, int x1, int y1, int z1, float dist, bool inside) const;
+    uint8_t* row(int y, int z) const;
+    Side coarseSide(int x0, int y0, int z0, int x1, int y1, int z1, float& bound) const;
+    void recordBounds(int x0, int y0, int z0, int x1, int y1, int z1, float bound, bool inside) const;
+    void storeChannels(int x, int y, int z, const Vec3& query, const Vec3& point, uint32_t triangle, bool inside) const;
+
+    const DistanceEngine& distance;
+    const SignEvaluator& sign;
+    const FieldOptions options;
+    const FieldSlab slab;
+    const FieldBounds* coarse;
+    FieldBounds* bounds;
+    const ChannelSlab* channels;
+    float coarseMargin; // Voxel centers lie within this distance of their coarse voxel's center (padded).
+};
+
+// Evaluates all top level octree nodes of the evaluator's slab on the pool. Voxels are computed exactly as in
+// a serial loop, so the output does not depend on the number of threads (nor on culling).
+QueryCounters computeField(ThreadPool& pool, const FieldEvaluator& evaluator);
+// Evaluates only the nodes of k_patchNodeSize voxels flagged in nodeMask and leaves the other
+// voxels of the slab as they are. The mask covers the whole grid, one entry per node ordered
+// like the voxels (x fastest, then z, then y), nodesAlong(dims[axis]) along each axis.
+QueryCounters computeField(ThreadPool& pool, const FieldEvaluator& evaluator, const std::vector<uint8_t>& nodeMask);
+inline int nodesAlong(const int voxels) { return (voxels + FieldEvaluator::k_patchNodeSize - 1) / FieldEvaluator::k_patchNodeSize; }
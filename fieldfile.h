@@ -0,0 +1,267 @@
+#pragma once
+
+// Distance field container: a fixed 128 byte header followed by the voxels, 64 byte aligned.
+// Header-only, so viewers can read fields without linking the generator. Uncompressed files can
+// be mapped and sampled in place, DistanceFieldView::attach does no parsing beyond validation.
+//
+// File layout (little endian):
+//   DistanceFieldHeader
+//   payload at payloadOffset: size[0]*size[1]*size[2] voxels, ordered by layout (voxelOffset),
+//     linear by default: x fastest, then z, then y.
+//     Compressed files store the payload in chunks of chunkRows y rows, each compressed on its
+//     own; the chunk table at chunkTableOffset holds numChunks+1 uint64_t offsets of the chunks
+//     relative to payloadOffset (the last one is the end of the payload).
+//
+// A stored value v decodes to the distance v*valueScale + valueBias (in unit cube units, negative
+// inside for signed fields). A unit cube point u maps back to mesh space as (u - 0.5)/meshScale + meshOrigin.
+// The unit cube is split into the largest of size[] voxels per edge (cubeSize()): voxel i is centered
+// at (i + 0.5)/cubeSize() along every axis. Grids fitted to a mesh (dfgen --dims, --voxel-size) may
+// be boxes, linear only, in the corner of the unit cube; the others are cubes covering it.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#ifdef DFGEN_WITH_LZ4
+#include <lz4.h>
+#endif
+#ifdef DFGEN_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+enum class VoxelType : uint32_t
+{
+    U8 = 0,
+    U16 = 1,
+    F32 = 2
+};
+
+enum class Compression : uint32_t
+{
+    None = 0,
+    LZ4 = 1,
+    Zstd = 2
+};
+
+inline size_t voxelBytes(const VoxelType type)
+{
+    return (type == VoxelType::U8) ? 1 : (type == VoxelType::U16) ? 2 : 4;
+}
+
+// Order of the voxels of a cubic grid. The other layouts keep voxels that are close in all three
+// axes close in memory, so trilinear samples touch fewer cache lines than in the linear order.
+enum class VoxelLayout : uint32_t
+{
+    Linear = 0,  // x fastest, then z, then y.
+    Morton = 1,  // Z-order: the bits of x, z and y interleaved (x lowest). Size a power of two.
+    Bricks4 = 2, // 4^3 bricks in linear order, voxels within a brick in linear order. Size a multiple of 4.
+    Bricks8 = 3  // Same with 8^3 bricks. Size a multiple of 8.
+};
+
+inline int layoutBrickSize(const VoxelLayout layout)
+{
+    return (layout == VoxelLayout::Bricks4) ? 4 : ((layout == VoxelLayout::Bricks8) ? 8 : 1);
+}
+
+inline bool layoutSupportsSize(const VoxelLayout layout, const uint32_t size)
+{
+    if (layout == VoxelLayout::Morton)
+        return size > 0 && (size & (size - 1)) == 0;
+    return size % static_cast<uint32_t>(layoutBrickSize(layout)) == 0;
+}
+
+// Spreads the low 21 bits of v to every third bit.
+inline uint64_t spreadBits3(const uint32_t v)
+{
+    uint64_t x = v & 0x1fffffu;
+    x = (x | x << 32) & 0x1f00000000ffffull;
+    x = (x | x << 16) & 0x1f0000ff0000ffull;
+    x = (x | x << 8) & 0x100f00f00f00f00full;
+    x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+    x = (x | x << 2) & 0x1249249249249249ull;
+    return x;
+}
+
+// All layouts are sums of a term per axis (axis 0 is x, 1 y, 2 z), which samplers can tabulate.
+inline uint64_t layoutAxisOffset(const VoxelLayout layout, const uint32_t size, const int axis, const uint32_t coordinate)
+{
+    const uint64_t n = size;
+    if (layout == VoxelLayout::Linear)
+        return coordinate * ((axis == 0) ? 1 : ((axis == 1) ? n*n : n));
+    if (layout == VoxelLayout::Morton)
+        return spreadBits3(coordinate) << ((axis == 0) ? 0 : ((axis == 1) ? 2 : 1));
+    const uint64_t brick = static_cast<uint64_t>(layoutBrickSize(layout));
+    const uint64_t bricks = n / brick, brickVoxels = brick*brick*brick;
+    const uint64_t outer = coordinate / brick, inner = coordinate % brick;
+    if (axis == 0)
+        return outer*brickVoxels + inner;
+    if (axis == 1)
+        return outer*bricks*bricks*brickVoxels + inner*brick*brick;
+    return outer*bricks*brickVoxels + inner*brick;
+}
+
+inline uint64_t voxelOffset(const VoxelLayout layout, const uint32_t size, const uint32_t x, const uint32_t y, const uint32_t z)
+{
+    return layoutAxisOffset(layout, size, 0, x) + layoutAxisOffset(layout, size, 1, y) + layoutAxisOffset(layout, size, 2, z);
+}
+
+const char k_fieldFileMagic[8] = {'D', 'F', 'G', 'E', 'N', 'F', 'L', 'D'};
+const uint32_t k_fieldFileVersion = 1;
+const uint64_t k_fieldFileAlignment = 64;
+const uint32_t k_fieldFileSigned = 1u; // DistanceFieldHeader::flags
+
+struct DistanceFieldHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t headerBytes;
+    uint32_t size[3]; // Voxels along x, y and z.
+    uint32_t voxelType; // VoxelType
+    uint32_t flags;
+    uint32_t compression; // Compression
+    uint32_t chunkRows;
+    uint32_t numChunks;
+    float valueScale, valueBias;
+    float band; // Distances further than this (from the surface) are clamped.
+    float meshOrigin[3]; // Mesh space to unit cube: (p - meshOrigin)*meshScale + 0.5.
+    float meshScale;
+    uint32_t layout; // VoxelLayout, 0 (linear) in files written before there were layouts.
+    uint64_t payloadOffset;
+    uint64_t payloadBytes; // As stored (compressed).
+    uint64_t chunkTableOffset;
+    uint8_t reserved[24];
+};
+
+static_assert(sizeof(DistanceFieldHeader) == 128, "DistanceFieldHeader layout");
+
+class DistanceFieldView
+{
+public:
+    DistanceFieldView(): header(), voxels(nullptr) {}
+
+    // Uses uncompressed data in place (e.g. a mapped file), it must outlive the view.
+    bool attach(const uint8_t* data, const size_t bytes)
+    {
+        if (!readHeader(data, bytes) || header.compression != static_cast<uint32_t>(Compression::None))
+            return false;
+        if (header.payloadOffset + numVoxels()*voxelBytes(type()) > bytes)
+            return false;
+        voxels = data + header.payloadOffset;
+        return true;
+    }
+
+    // Reads the whole file into memory, decompressing it if needed.
+    bool load(const std::string& path)
+    {
+        std::ifstream stream(path, std::ios::binary);
+        if (!stream)
+            return false;
+        storage.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+        if (!readHeader(storage.data(), storage.size()))
+            return false;
+        if (header.compression == static_cast<uint32_t>(Compression::None))
+            return attach(storage.data(), storage.size());
+        return decompress();
+    }
+
+    const DistanceFieldHeader& getHeader() const { return header; }
+    int size(const int axis) const { return static_cast<int>(header.size[axis]); }
+    bool isSigned() const { return (header.flags & k_fieldFileSigned) != 0; }
+    VoxelType type() const { return static_cast<VoxelType>(header.voxelType); }
+    VoxelLayout layout() const { return static_cast<VoxelLayout>(header.layout); }
+    uint64_t numVoxels() const { return static_cast<uint64_t>(header.size[0]) * header.size[1] * header.size[2]; }
+    int cubeSize() const { return static_cast<int>(std::max(header.size[0], std::max(header.size[1], header.size[2]))); }
+    const uint8_t* data() const { return voxels; }
+
+    // Distance at voxel (x, y, z), in unit cube units.
+    float distance(const int x, const int y, const int z) const
+    {
+        const size_t index = (layout() == VoxelLayout::Linear)
+            ? (static_cast<size_t>(y)*header.size[2] + static_cast<size_t>(z))*header.size[0] + static_cast<size_t>(x)
+            : static_cast<size_t>(voxelOffset(layout(), header.size[0], static_cast<uint32_t>(x), static_cast<uint32_t>(y), static_cast<uint32_t>(z)));
+        float value;
+        if (type() == VoxelType::U8) {
+            value = voxels[index];
+        }
+        else if (type() == VoxelType::U16) {
+            uint16_t v;
+            std::memcpy(&v, voxels + 2*index, sizeof(v));
+            value = v;
+        }
+        else {
+            std::memcpy(&value, voxels + 4*index, sizeof(value));
+        }
+        return value*header.valueScale + header.valueBias;
+    }
+
+private:
+    bool readHeader(const uint8_t* data, const size_t bytes)
+    {
+        if (bytes < sizeof(DistanceFieldHeader))
+            return false;
+        std::memcpy(&header, data, sizeof(DistanceFieldHeader));
+        return std::memcmp(header.magic, k_fieldFileMagic, sizeof(k_fieldFileMagic)) == 0
+               && header.version == k_fieldFileVersion
+               && header.headerBytes == sizeof(DistanceFieldHeader)
+               && header.voxelType <= static_cast<uint32_t>(VoxelType::F32)
+               && header.layout <= static_cast<uint32_t>(VoxelLayout::Bricks8)
+               && (header.layout == static_cast<uint32_t>(VoxelLayout::Linear)
+                   || (header.size[0] == header.size[1] && header.size[0] == header.size[2]
+                       && layoutSupportsSize(layout(), header.size[0])))
+               && (header.layout != static_cast<uint32_t>(VoxelLayout::Morton) || header.compression == static_cast<uint32_t>(Compression::None))
+               && header.payloadOffset % k_fieldFileAlignment == 0;
+    }
+
+    bool decompress()
+    {
+        const uint64_t chunkTableEnd = header.chunkTableOffset + (static_cast<uint64_t>(header.numChunks) + 1)*sizeof(uint64_t);
+        // The chunks cover every row, none left zero (which would read as the surface).
+        if (header.chunkRows == 0 || chunkTableEnd > storage.size()
+            || static_cast<uint64_t>(header.numChunks) * header.chunkRows < header.size[1])
+            return false;
+        std::vector<uint64_t> chunks(header.numChunks + 1);
+        std::memcpy(chunks.data(), storage.data() + header.chunkTableOffset, chunks.size()*sizeof(uint64_t));
+        if (chunks.back() > header.payloadBytes || header.payloadOffset + header.payloadBytes > storage.size())
+            return false;
+
+        const size_t rowBytes = static_cast<size_t>(header.size[0]) * header.size[2] * voxelBytes(type());
+        decompressed.resize(rowBytes * header.size[1]);
+        for (uint32_t c = 0; c < header.numChunks; ++c) {
+            const size_t row = static_cast<size_t>(c) * header.chunkRows;
+            if (chunks[c+1] < chunks[c] || row >= header.size[1])
+                return false;
+            const uint8_t* src = storage.data() + header.payloadOffset + chunks[c];
+            const size_t srcBytes = static_cast<size_t>(chunks[c+1] - chunks[c]);
+            uint8_t* dst = decompressed.data() + row*rowBytes;
+            const size_t dstBytes = std::min<size_t>(header.chunkRows, header.size[1] - row) * rowBytes;
+            if (!decompressChunk(src, srcBytes, dst, dstBytes))
+                return false;
+        }
+        voxels = decompressed.data();
+        return true;
+    }
+
+    bool decompressChunk(const uint8_t* src, const size_t srcBytes, uint8_t* dst, const size_t dstBytes) const
+    {
+#ifdef DFGEN_WITH_LZ4
+        if (header.compression == static_cast<uint32_t>(Compression::LZ4)) {
+            return LZ4_decompress_safe(reinterpret_cast<const char*>(src), reinterpret_cast<char*>(dst),
+                                       static_cast<int>(srcBytes), static_cast<int>(dstBytes)) == static_cast<int>(dstBytes);
+        }
+#endif
+#ifdef DFGEN_WITH_ZSTD
+        if (header.compression == static_cast<uint32_t>(Compression::Zstd))
+            return ZSTD_decompress(dst, dstBytes, src, srcBytes) == dstBytes;
+#endif
+        (void)src; (void)srcBytes; (void)dst; (void)dstBytes;
+        return false; // Not compiled in.
+    }
+
+    DistanceFieldHeader header;
+    std::vector<uint8_t> storage, decompressed;
+    const uint8_t* voxels;
+};
@@ -0,0 +1,185 @@
+#pragma once
+
+// Trilinear sampling of a distance field on the CPU, in any VoxelLayout (fieldfile.h), e.g. for
+// collision queries. Header-only like fieldfile.h. Every layout is a sum of one offset per axis,
+// so the sampler tabulates those and a lookup is three table reads per corner whatever the
+// layout; the layout only decides which cache lines the 8 corners fall into. Points are sampled
+// in batches of the SIMD width: coordinates and interpolation are vectorized, the corner loads
+// (a gather) are scalar. Box grids fitted to a mesh (linear only) are sampled the same way, in the
+// corner of the unit cube they leave partly uncovered.
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "fieldfile.h"
+#include "simd.h"
+
+class FieldSampler
+{
+public:
+    FieldSampler(): voxels(nullptr), size(0), dims{0, 0, 0}, type(VoxelType::F32), layout(VoxelLayout::Linear), valueScale(1.f), valueBias(0.f) {}
+
+    // Samples a view's voxels in place, the view must outlive the sampler. Fails for fields with
+    // fewer than 2 voxels along an axis.
+    bool attach(const DistanceFieldView& view)
+    {
+        const int viewDims[3] = {view.size(0), view.size(1), view.size(2)};
+        if (viewDims[0] < 2 || viewDims[1] < 2 || viewDims[2] < 2 || !view.data())
+            return false;
+        attach(view.data(), viewDims, view.type(), view.layout(), view.getHeader().valueScale, view.getHeader().valueBias);
+        return true;
+    }
+
+    // Samples size^3 voxels in place (e.g. raw output, which decodes like a container written with
+    // the same options). Stored values decode to value*scale + bias.
+    void attach(const uint8_t* data, const int voxelsPerAxis, const VoxelType voxelType, const VoxelLayout voxelLayout,
+                const float scale, const float bias)
+    {
+        const int cubeDims[3] = {voxelsPerAxis, voxelsPerAxis, voxelsPerAxis};
+        attach(data, cubeDims, voxelType, voxelLayout, scale, bias);
+    }
+
+    // Same for a grid of gridDims voxels, a box if the layout is linear (else a cube).
+    void attach(const uint8_t* data, const int gridDims[3], const VoxelType voxelType, const VoxelLayout voxelLayout,
+                const float scale, const float bias)
+    {
+        voxels = data;
+        size = std::max(gridDims[0], std::max(gridDims[1], gridDims[2]));
+        type = voxelType;
+        layout = voxelLayout;
+        valueScale = scale;
+        valueBias = bias;
+        // Linear strides are those of the box, the other layouts only hold cubes.
+        const uint64_t strides[3] = {1, static_cast<uint64_t>(gridDims[0]) * static_cast<uint64_t>(gridDims[2]),
+                                     static_cast<uint64_t>(gridDims[0])};
+        for (int axis = 0; axis < 3; ++axis) {
+            dims[axis] = gridDims[axis];
+            axisOffsets[axis].resize(static_cast<size_t>(dims[axis]));
+            for (int i = 0; i < dims[axis]; ++i) {
+                axisOffsets[axis][static_cast<size_t>(i)] = (layout == VoxelLayout::Linear)
+                    ? static_cast<uint64_t>(i) * strides[axis]
+                    : layoutAxisOffset(layout, static_cast<uint32_t>(size), axis, static_cast<uint32_t>(i));
+            }
+        }
+    }
+
+    int getSize() const { return size; } // Voxels per unit cube edge, the largest of the dims.
+    int getDim(const int axis) const { return dims[axis]; }
+    VoxelLayout getLayout() const { return layout; }
+
+    // Distances at count unit cube points given as separate x, y and z arrays. Voxel centers are
+    // at (i + 0.5)/size, points beyond the outermost centers take the value at the border.
+    void sample(const float* x, const float* y, const float* z, const size_t count, float* distances) const
+    {
+        if (type == VoxelType::U8)
+            sampleAll<uint8_t>(x, y, z, count, distances);
+        else if (type == VoxelType::U16)
+            sampleAll<uint16_t>(x, y, z, count, distances);
+        else
+            sampleAll<float>(x, y, z, count, distances);
+    }
+
+    // Same for count points stored as xyz triplets.
+    void sample(const float* points, const size_t count, float* distances) const
+    {
+        const size_t k_batch = 256;
+        float x[k_batch], y[k_batch], z[k_batch];
+        for (size_t first = 0; first < count; first += k_batch) {
+            const size_t n = (count - first < k_batch) ? count - first : k_batch;
+            for (size_t i = 0; i < n; ++i) {
+                x[i] = points[3*(first + i)];
+                y[i] = points[3*(first + i) + 1];
+                z[i] = points[3*(first + i) + 2];
+            }
+            sample(x, y, z, n, distances + first);
+        }
+    }
+
+    float sample(const float x, const float y, const float z) const
+    {
+        float distance;
+        sample(&x, &y, &z, 1, &distance);
+        return distance;
+    }
+
+private:
+    template <typename T>
+    float voxel(const uint64_t index) const
+    {
+        T value;
+        std::memcpy(&value, voxels + index*sizeof(T), sizeof(T));
+        return static_cast<float>(value);
+    }
+
+    template <typename T>
+    void sampleAll(const float* x, const float* y, const float* z, const size_t count, float* distances) const
+    {
+        size_t i = 0;
+        for (; i + k_simdWidth <= count; i += k_simdWidth)
+            sampleBatch<T>(x + i, y + i, z + i, distances + i);
+        if (i < count) {
+            // The tail is padded with copies of its last point.
+            float tx[k_simdWidth], ty[k_simdWidth], tz[k_simdWidth], td[k_simdWidth];
+            for (int lane = 0; lane < k_simdWidth; ++lane) {
+                const size_t j = (i + static_cast<size_t>(lane) < count) ? i + static_cast<size_t>(lane) : count - 1;
+                tx[lane] = x[j];
+                ty[lane] = y[j];
+                tz[lane] = z[j];
+            }
+            sampleBatch<T>(tx, ty, tz, td);
+            std::memcpy(distances + i, td, (count - i)*sizeof(float));
+        }
+    }
+
+    template <typename T>
+    void sampleBatch(const float* x, const float* y, const float* z, float* distances) const
+    {
+        // Continuous voxel coordinates, clamped to the outermost centers.
+        const vfloat n = vbroadcast(static_cast<float>(size));
+        const vfloat half = vbroadcast(0.5f);
+        const vfloat zero = vbroadcast(0.f);
+        float c[3][k_simdWidth];
+        vstore(c[0], vmin(vmax(vload(x)*n - half, zero), vbroadcast(static_cast<float>(dims[0] - 1))));
+        vstore(c[1], vmin(vmax(vload(y)*n - half, zero), vbroadcast(static_cast<float>(dims[1] - 1))));
+        vstore(c[2], vmin(vmax(vload(z)*n - half, zero), vbroadcast(static_cast<float>(dims[2] - 1))));
+
+        // Corner values (bit 0 of the corner: +x, bit 1: +y, bit 2: +z) and fractions per lane.
+        float corners[8][k_simdWidth];
+        float t[3][k_simdWidth];
+        for (int lane = 0; lane < k_simdWidth; ++lane) {
+            uint64_t offsets[3][2];
+            for (int axis = 0; axis < 3; ++axis) {
+                int i0 = static_cast<int>(c[axis][lane]);
+                i0 = (i0 > dims[axis] - 2) ? dims[axis] - 2 : i0;
+                t[axis][lane] = c[axis][lane] - static_cast<float>(i0);
+                offsets[axis][0] = axisOffsets[axis][static_cast<size_t>(i0)];
+                offsets[axis][1] = axisOffsets[axis][static_cast<size_t>(i0 + 1)];
+            }
+            for (int corner = 0; corner < 8; ++corner) {
+                corners[corner][lane] = voxel<T>(offsets[0][corner & 1] + offsets[1][(corner >> 1) & 1]
+                                                 + offsets[2][(corner >> 2) & 1]);
+            }
+        }
+
+        const vfloat tx = vload(t[0]), ty = vload(t[1]), tz = vload(t[2]);
+        vfloat x0[4];
+        for (int i = 0; i < 4; ++i) {
+            const vfloat a = vload(corners[2*i]);
+            x0[i] = a + (vload(corners[2*i + 1]) - a)*tx;
+        }
+        const vfloat lowZ = x0[0] + (x0[1] - x0[0])*ty;
+        const vfloat highZ = x0[2] + (x0[3] - x0[2])*ty;
+        const vfloat value = lowZ + (highZ - lowZ)*tz;
+        vstore(distances, value*vbroadcast(valueScale) + vbroadcast(valueBias));
+    }
+
+    const uint8_t* voxels;
+    int size;
+    int dims[3];
+    VoxelType type;
+    VoxelLayout layout;
+    float valueScale, valueBias;
+    std::vector<uint64_t> axisOffsets[3]; // Per axis (x, y, z): layout offset of every coordinate.
+};
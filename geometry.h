@@ -0,0 +1,181 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+struct Vec3
+{
+    float x, y, z;
+
+    Vec3(): x(0.f), y(0.f), z(0.f) {}
+    Vec3(const float x, const float y, const float z): x(x), y(y), z(z) {}
+
+    Vec3 operator+(const Vec3& v) const { return Vec3(x+v.x, y+v.y, z+v.z); }
+    Vec3 operator-(const Vec3& v) const { return Vec3(x-v.x, y-v.y, z-v.z); }
+    Vec3 operator*(const float s) const { return Vec3(x*s, y*s, z*s); }
+    float operator[](const int i) const { return (i == 0) ? x : ((i == 1) ? y : z); }
+};
+
+inline float dot(const Vec3& a, const Vec3& b) { return a.x*b.x + a.y*b.y + a.z*b.z; }
+inline Vec3 cross(const Vec3& a, const Vec3& b) { return Vec3(a.y*b.z - a.z*b.y, a.z*b.x - a.x*b.z, a.x*b.y - a.y*b.x); }
+inline float length(const Vec3& v) { return std::sqrt(dot(v, v)); }
+inline Vec3 vmin(const Vec3& a, const Vec3& b) { return Vec3(std::fmin(a.x, b.x), std::fmin(a.y, b.y), std::fmin(a.z, b.z)); }
+inline Vec3 vmax(const Vec3& a, const Vec3& b) { return Vec3(std::fmax(a.x, b.x), std::fmax(a.y, b.y), std::fmax(a.z, b.z)); }
+
+// Maps mesh space to the unit cube the field is computed in: (p - origin)*scale + 0.5.
+struct UnitCubeTransform
+{
+    Vec3 origin;
+    float scale;
+};
+
+// Centers the bounds at (0.5, 0.5, 0.5) with the longest side 0.8, leaving a margin around the mesh.
+inline UnitCubeTransform fitUnitCube(const Vec3& boundsMin, const Vec3& boundsMax)
+{
+    const Vec3 extents = boundsMax - boundsMin;
+    UnitCubeTransform transform;
+    transform.origin = (boundsMax + boundsMin) * 0.5f;
+    transform.scale = 0.8f / std::fmax(extents.x, std::fmax(extents.y, extents.z));
+    return transform;
+}
+
+// Centers the bounds in a box grid of dims voxels of voxelSize (in mesh units) along every axis.
+// The box sits in the corner of the unit cube, which is split into the largest of dims voxels per
+// edge, so voxel i is centered at (i + 0.5)/size in the unit cube either way.
+inline UnitCubeTransform fitGrid(const Vec3& boundsMin, const Vec3& boundsMax, const float voxelSize, const int dims[3])
+{
+    const int size = std::max(dims[0], std::max(dims[1], dims[2]));
+    const Vec3 boxCenter(0.5f*dims[0], 0.5f*dims[1], 0.5f*dims[2]);
+    const Vec3 cubeCenter(0.5f*size, 0.5f*size, 0.5f*size);
+    UnitCubeTransform transform;
+    transform.origin = (boundsMax + boundsMin) * 0.5f + (cubeCenter - boxCenter) * voxelSize;
+    transform.scale = 1.f / (static_cast<float>(size) * voxelSize);
+    return transform;
+}
+
+inline Vec3 toUnitCube(const UnitCubeTransform& transform, const Vec3& p)
+{
+    return (p - transform.origin)*transform.scale + Vec3(0.5f, 0.5f, 0.5f);
+}
+
+// Affine map p -> linear*p + translation, the linear part stored by rows.
+struct AffineTransform
+{
+    Vec3 rows[3];
+    Vec3 translation;
+
+    AffineTransform(): rows{Vec3(1.f, 0.f, 0.f), Vec3(0.f, 1.f, 0.f), Vec3(0.f, 0.f, 1.f)} {}
+
+    Vec3 applyLinear(const Vec3& v) const { return Vec3(dot(rows[0], v), dot(rows[1], v), dot(rows[2], v)); }
+    Vec3 apply(const Vec3& p) const { return applyLinear(p) + translation; }
+
+    // Applies other first, then this.
+    AffineTransform operator*(const AffineTransform& other) const
+    {
+        AffineTransform result;
+        for (int r = 0; r < 3; ++r) {
+            result.rows[r] = Vec3(dot(rows[r], Vec3(other.rows[0].x, other.rows[1].x, other.rows[2].x)),
+                                  dot(rows[r], Vec3(other.rows[0].y, other.rows[1].y, other.rows[2].y)),
+                                  dot(rows[r], Vec3(other.rows[0].z, other.rows[1].z, other.rows[2].z)));
+        }
+        result.translation = apply(other.translation);
+        return result;
+    }
+
+    float determinant() const { return dot(rows[0], cross(rows[1], rows[2])); }
+
+    // Undefined if the determinant is 0.
+    AffineTransform inverse() const
+    {
+        // The inverse of the linear part is the transposed cofactors over the determinant.
+        const float invDet = 1.f / determinant();
+        const Vec3 c0 = cross(rows[1], rows[2]) * invDet;
+        const Vec3 c1 = cross(rows[2], rows[0]) * invDet;
+        const Vec3 c2 = cross(rows[0], rows[1]) * invDet;
+        AffineTransform result;
+        result.rows[0] = Vec3(c0.x, c1.x, c2.x);
+        result.rows[1] = Vec3(c0.y, c1.y, c2.y);
+        result.rows[2] = Vec3(c0.z, c1.z, c2.z);
+        result.translation = result.applyLinear(translation) * -1.f;
+        return result;
+    }
+
+    // Scale s if the map is a similarity (rotation or reflection times s, and a translation),
+    // which scales every distance by s. 0 otherwise.
+    float similarityScale() const
+    {
+        const Vec3 columns[3] = {Vec3(rows[0].x, rows[1].x, rows[2].x), Vec3(rows[0].y, rows[1].y, rows[2].y),
+                                 Vec3(rows[0].z, rows[1].z, rows[2].z)};
+        const float scale2 = (dot(columns[0], columns[0]) + dot(columns[1], columns[1]) + dot(columns[2], columns[2])) / 3.f;
+        const float tolerance = 1e-5f * scale2;
+        for (int i = 0; i < 3; ++i) {
+            for (int j = 0; j < 3; ++j) {
+                if (std::fabs(dot(columns[i], columns[j]) - ((i == j) ? scale2 : 0.f)) > tolerance)
+                    return 0.f;
+            }
+        }
+        return std::sqrt(scale2);
+    }
+};
+
+// Triangle mesh as flat arrays: xyz per vertex and three vertex indices per triangle.
+// Does not own the data.
+struct TriangleSoup
+{
+    const float* positions;
+    const uint32_t* indices;
+    size_t numVertices;
+    size_t numTriangles;
+
+    Vec3 vertex(const size_t i) const { return Vec3(positions[3*i], positions[3*i+1], positions[3*i+2]); }
+    Vec3 corner(const size_t triangle, const int k) const { return vertex(indices[3*triangle + static_cast<size_t>(k)]); }
+};
+
+// Center of voxel (x, y, z) of a size^3 grid covering the unit cube.
+inline Vec3 voxelCenter(const int x, const int y, const int z, const int size)
+{
+    const float step = 1.f / static_cast<float>(size);
+    const float off = step / 2.f;
+    return Vec3(x*step + off,
+                y*step + off,
+                z*step + off);
+}
+
+// Closest point of triangle (a, b, c) to p, by the Voronoi region of p (Ericson, Real-Time
+// Collision Detection 5.1.5). Degenerate triangles with no face region fall back to a.
+inline Vec3 closestPointOnTriangle(const Vec3& p, const Vec3& a, const Vec3& b, const Vec3& c)
+{
+    const Vec3 ab = b - a, ac = c - a, ap = p - a;
+    const float d1 = dot(ab, ap), d2 = dot(ac, ap);
+    if (d1 <= 0.f && d2 <= 0.f)
+        return a;
+
+    const Vec3 bp = p - b;
+    const float d3 = dot(ab, bp), d4 = dot(ac, bp);
+    if (d3 >= 0.f && d4 <= d3)
+        return b;
+
+    const float vc = d1*d4 - d3*d2;
+    if (vc <= 0.f && d1 >= 0.f && d3 <= 0.f)
+        return a + ab*(d1 / (d1 - d3));
+
+    const Vec3 cp = p - c;
+    const float d5 = dot(ab, cp), d6 = dot(ac, cp);
+    if (d6 >= 0.f && d5 <= d6)
+        return c;
+
+    const float vb = d5*d2 - d1*d6;
+    if (vb <= 0.f && d2 >= 0.f && d6 <= 0.f)
+        return a + ac*(d2 / (d2 - d6));
+
+    const float va = d3*d6 - d5*d4;
+    if (va <= 0.f && (d4 - d3) >= 0.f && (d5 - d6) >= 0.f)
+        return b + (c - b)*((d4 - d3) / ((d4 - d3) + (d5 - d6)));
+
+    const float denom = va + vb + vc;
+    if (!(denom > 0.f))
+        return a;
+    return a + ab*(vb / denom) + ac*(vc / denom);
+}
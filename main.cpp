@@ -4,7 +4,15 @@
 #include <string>
 #include <fstream>
 #include <limits>
+#include <cmath>
+#include <cstring>
 #include <cassert>
+#include <memory>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <sstream>
+#include <functional>
 
 #include <assimp/Importer.hpp>
 #include <assimp/DefaultLogger.hpp>
@@ -14,41 +22,150 @@
 #include <CGAL/Simple_cartesian.h>
 #include <CGAL/AABB_tree.h>
 #include <CGAL/AABB_traits.h>
-#include <CGAL/boost/graph/graph_traits_Polyhedron_3.h>
-#include <CGAL/AABB_face_graph_triangle_primitive.h>
 #include <CGAL/Polyhedron_incremental_builder_3.h>
 #include <CGAL/Polyhedral_mesh_domain_3.h>
+#include <boost/iterator/counting_iterator.hpp>
+
+#include "animation.h"
+#include "brickfield.h"
+#include "bvh.h"
+#include "cache.h"
+#include "compose.h"
+#include "distance.h"
+#include "edt.h"
+#include "field.h"
+#include "geometry.h"
+#include "output.h"
+#include "profile.h"
+#include "scene.h"
+#include "serve.h"
+#include "sign.h"
+#include "threadpool.h"
 
 #define ASSERT(expr) assert(expr)
 #define EXIT_STATUS_INC __COUNTER__
 #define STATIC_ASSERT(expr) static_assert(expr, #expr)
 
+const uint64_t k_slabMemoryBudget = 256ull << 20; // Default size of the slabs held in memory (two), in bytes.
+const int k_errorSamples = 64; // Voxels per axis compared against exact distances in EDT and ADF modes (at most).
+const float k_defaultAdfTolerance = 0.1f; // Reconstruction error allowed at the tested points in ADF mode, in voxels.
+const float k_defaultPaddingVoxels = 2.f; // Around the mesh in box grids (--dims, --voxel-size).
+const int k_maxBoxSize = 16384; // Voxels along any axis of a box grid, guards against a voxel size far too small for the mesh.
+const size_t k_defaultResidentMeshes = 8; // Meshes the query service keeps with their trees (--serve).
+
 typedef CGAL::Simple_cartesian<double> Kernel;
 typedef Kernel::Point_3 Point_3;
 typedef CGAL::Polyhedron_3<Kernel> Polyhedron;
 typedef CGAL::Polyhedral_mesh_domain_3<Polyhedron, Kernel> PolyhedralMeshDomain;
-typedef CGAL::AABB_face_graph_triangle_primitive<Polyhedron> AABBPrimitive;
-typedef CGAL::AABB_traits<Kernel, AABBPrimitive> AABBTraits;
-typedef CGAL::AABB_tree<AABBTraits> AABBTree;
 
 struct AABB
 {
     aiVector3D min, max;
 };
 
+// Mesh referenced by a node of the imported scene, with the transforms from the root to the node.
+struct NodeInstance
+{
+    unsigned int mesh;
+    aiMatrix4x4 transform;
+};
+
+// Everything needed to generate the field of one mesh.
+struct GenerationSettings
+{
+    std::string inputMeshPath;
+    std::string outputPath;
+    int size;
+    bool isSigned;
+    bool cull;
+    bool coherent;
+    bool validate;
+    bool resume;
+    bool verbose;
+    int levels;       // Pyramid levels, each half the size of the next.
+    int slabRows;     // 0: as many as fit k_slabMemoryBudget.
+    float bandVoxels; // 0: distances are only clamped by the quantization.
+    OutputFormat format;
+    VoxelLayout layout;
+    VoxelType voxelType;
+    Compression compression;
+    DistanceEngineType engine;
+    SignMethod signMethod;
+    FieldMode mode;
+    float adfTolerance;         // Voxels of the deepest level, ADF mode only.
+    FieldChannels channels;     // Stored next to the field (--channels), none by default.
+    std::string cacheDirectory; // Empty: no cache.
+    int frames;                 // Of the mesh's animation (--frames), 0: the mesh as imported.
+    int dims[3];                // Voxels of a box grid fitted to the mesh (--dims), all 0 otherwise.
+    float voxelSize;            // Of a box grid in mesh units (--voxel-size), 0 otherwise.
+    float paddingVoxels;        // Around the mesh in a box grid, along every axis.
+};
+
+// Structures shared by all levels of a field, built once per mesh.
+struct MeshStructures
+{
+    const TriangleSoup* soup;           // Of a scene: the flattened copy if needed (CGAL engine, EDT), else empty.
+    const Scene* scene;                 // Instances of a scene of several meshes, null for a single mesh.
+    const DistanceEngine* distance;     // Of --engine.
+    const DistanceEngine* cgalDistance; // Reference for --validate, null if not needed.
+    const PolyhedralMeshDomain* domain; // For domain signs and --validate, null if not needed.
+};
+
+// The previous frame of an animation, whose voxels are reused where no triangle moved enough to
+// change them by more than a quantization step.
+struct FrameHistory
+{
+    int frame;
+    std::vector<uint8_t> voxels;      // Of the whole grid, empty before the first frame.
+    std::vector<uint8_t> nodeMask;    // Nodes to recompute, ordered like FieldCache::getNodeMask().
+    std::vector<float> basePositions; // Vertices (unit cube) as of the last recomputation around them.
+};
+
 AABB computeAABB(const aiMesh* mesh);
+bool isBoxGrid(const GenerationSettings& settings);
+UnitCubeTransform fitMeshBounds(const GenerationSettings& settings, const Vec3& boundsMin, const Vec3& boundsMax, int gridDims[3]);
+TriangleSoup buildUnitCubeMesh(const GenerationSettings& settings, aiMesh* mesh, std::vector<uint32_t>& indices,
+                               UnitCubeTransform& transform, int gridDims[3]);
+std::vector<float> meshTriangles(const aiMesh* mesh);
+void collectInstances(const aiNode* node, const aiMatrix4x4& parentTransform, std::vector<NodeInstance>& instances);
+AffineTransform toAffine(const aiMatrix4x4& m);
+Scene buildUnitCubeScene(const GenerationSettings& settings, const aiScene* scene, const std::vector<NodeInstance>& nodeInstances,
+                         std::vector<std::vector<uint32_t>>& meshIndices, UnitCubeTransform& transform, int gridDims[3],
+                         std::vector<float>* triangles);
+Point_3 toPoint(const Vec3& v);
 std::string getCmdOption(const std::vector<std::string>& args, const std::string& option);
 bool cmdOptionExists(const std::vector<std::string>& args, const std::string& option);
-float clamp(const float v, const float min, const float max);
-
-float clamp(const float v, const float min, const float max)
-{
-    if (v < min)
-        return min;
-    if (v > max)
-        return max;
-    return v;
-}
+void reportApproximationError(ThreadPool& pool, const char* name, const std::function<float(int, int, int)>& approximate,
+                              const DistanceEngine& distance, const SignEvaluator& sign, const FieldOptions& options,
+                              std::ostream& log, GenerationProfile& profile, const std::string& stageName);
+FieldOptions makeFieldOptions(const GenerationSettings& settings, const int dims[3]);
+int slabRowsFor(const GenerationSettings& settings, const FieldOptions& fieldOptions);
+bool reportBoxGrid(const FieldOptions& fieldOptions, const UnitCubeTransform& transform, std::ostream& log, GenerationProfile& profile);
+std::string insertBeforeExtension(const std::string& outputPath, const std::string& suffix);
+std::string levelOutputPath(const std::string& outputPath, int fieldSize);
+std::string frameOutputPath(const std::string& outputPath, int frame);
+std::unique_ptr<FieldWriter> makeFieldWriter(const GenerationSettings& settings, const FieldOptions& fieldOptions,
+                                             const UnitCubeTransform& transform);
+std::unique_ptr<SignEvaluator> makeSignEvaluator(SignMethod method, const MeshStructures& mesh, int size);
+bool generateField(const GenerationSettings& settings, ThreadPool& pool, std::ostream& log, GenerationProfile& profile);
+bool runGenerationStages(const GenerationSettings& settings, ThreadPool& pool, std::ostream& log, GenerationProfile& profile);
+bool generateLevel(const GenerationSettings& settings, const FieldOptions& fieldOptions, const MeshStructures& mesh,
+                   FieldWriter& writer, ChannelWriter* channelWriter, int firstRow, FieldCache* cache, CacheResult cacheResult,
+                   const FieldBounds* coarse, FieldBounds* bounds, FrameHistory* history, ThreadPool& pool, std::ostream& log,
+                   GenerationProfile& profile);
+size_t markMovedTriangles(const TriangleSoup& posed, const FieldOptions& options, FrameHistory& history, size_t& numMarked);
+bool generateFrames(const GenerationSettings& settings, const aiScene* scene, ThreadPool& pool, std::ostream& log,
+                    GenerationProfile& profile);
+bool generateAdaptiveField(const GenerationSettings& settings, const MeshStructures& mesh, const UnitCubeTransform& transform,
+                           ThreadPool& pool, std::ostream& log, GenerationProfile& profile);
+bool composeFields(const GenerationSettings& settings, const std::string& recipePath, ThreadPool& pool, std::ostream& log,
+                   GenerationProfile& profile);
+bool runComposition(const GenerationSettings& settings, const std::string& recipePath, ThreadPool& pool, std::ostream& log,
+                    GenerationProfile& profile);
+bool loadQueryMesh(const std::string& path, std::vector<float>& positions, std::vector<uint32_t>& indices, std::ostream& log);
+bool readManifest(const std::string& path, const GenerationSettings& defaults, std::vector<GenerationSettings>& jobs);
+bool layoutSupportsLevels(VoxelLayout layout, int size, int levels);
+bool parseDims(const std::string& text, int dims[3]);
 
 AABB computeAABB(const aiMesh* mesh)
 {
@@ -71,11 +188,173 @@ AABB computeAABB(const aiMesh* mesh)
     return ab;
 }
 
+bool isBoxGrid(const GenerationSettings& settings)
+{
+    return settings.dims[0] > 0 || settings.voxelSize > 0.f;
+}
+
+// Transform of a mesh's bounds into the unit cube. By default they are centered in it (and the grid
+// is settings.size voxels along every axis), box grids are fitted to them: --voxel-size sets the
+// dims, --dims the voxel size (the axis with the least room sets it, the others get more padding).
+UnitCubeTransform fitMeshBounds(const GenerationSettings& settings, const Vec3& boundsMin, const Vec3& boundsMax, int gridDims[3])
+{
+    if (!isBoxGrid(settings)) {
+        std::fill(gridDims, gridDims + 3, settings.size);
+        return fitUnitCube(boundsMin, boundsMax);
+    }
+    const Vec3 extents = boundsMax - boundsMin;
+    const float padding = 2.f * settings.paddingVoxels;
+    float voxelSize = settings.voxelSize;
+    if (voxelSize > 0.f) {
+        for (int axis = 0; axis < 3; ++axis) {
+            const float voxels = std::ceil(extents[axis] / voxelSize + padding);
+            gridDims[axis] = static_cast<int>(std::max(2.f, std::min(voxels, static_cast<float>(k_maxBoxSize + 1))));
+        }
+    }
+    else {
+        for (int axis = 0; axis < 3; ++axis)
+            voxelSize = std::max(voxelSize, extents[axis] / (static_cast<float>(settings.dims[axis]) - padding));
+        std::copy(settings.dims, settings.dims + 3, gridDims);
+    }
+    return fitGrid(boundsMin, boundsMax, voxelSize, gridDims);
+}
+
+// Scale down the mesh to fit unit cube [0-1] (and a bit more). Center around (0.5, 0.5, 0.5), or
+// fit a box grid to it. Vertices are transformed in place and referenced by the returned soup.
+// Faces are copied to indices (Assimp allocates every face on its own) and released from the mesh.
+TriangleSoup buildUnitCubeMesh(const GenerationSettings& settings, aiMesh* mesh, std::vector<uint32_t>& indices,
+                               UnitCubeTransform& transform, int gridDims[3])
+{
+    STATIC_ASSERT(sizeof(aiVector3D) == 3*sizeof(float));
+
+    const AABB ab = computeAABB(mesh);
+    transform = fitMeshBounds(settings, Vec3(ab.min.x, ab.min.y, ab.min.z), Vec3(ab.max.x, ab.max.y, ab.max.z), gridDims);
+
+    for (unsigned int i = 0; i < mesh->mNumVertices; ++i) {
+        aiVector3D& v = mesh->mVertices[i];
+        const Vec3 u = toUnitCube(transform, Vec3(v.x, v.y, v.z));
+        v = aiVector3D(u.x, u.y, u.z);
+    }
+
+    indices.resize(3 * mesh->mNumFaces);
+    for (unsigned int f = 0; f < mesh->mNumFaces; ++f) {
+        const aiFace& face = mesh->mFaces[f];
+        ASSERT(face.mNumIndices == 3);
+        indices[3*f+0] = face.mIndices[0];
+        indices[3*f+1] = face.mIndices[1];
+        indices[3*f+2] = face.mIndices[2];
+    }
+    delete [] mesh->mFaces;
+    mesh->mFaces = nullptr;
+
+    const TriangleSoup soup = {reinterpret_cast<const float*>(mesh->mVertices), indices.data(),
+                               mesh->mNumVertices, indices.size() / 3};
+    mesh->mNumFaces = 0;
+    return soup;
+}
+
+// Corners of every triangle, 9 floats each, as imported (the key of the field cache).
+std::vector<float> meshTriangles(const aiMesh* mesh)
+{
+    std::vector<float> triangles;
+    triangles.reserve(9 * static_cast<size_t>(mesh->mNumFaces));
+    for (unsigned int f = 0; f < mesh->mNumFaces; ++f) {
+        const aiFace& face = mesh->mFaces[f];
+        ASSERT(face.mNumIndices == 3);
+        for (unsigned int k = 0; k < 3; ++k) {
+            const aiVector3D& v = mesh->mVertices[face.mIndices[k]];
+            triangles.push_back(v.x);
+            triangles.push_back(v.y);
+            triangles.push_back(v.z);
+        }
+    }
+    return triangles;
+}
+
+void collectInstances(const aiNode* node, const aiMatrix4x4& parentTransform, std::vector<NodeInstance>& instances)
+{
+    const aiMatrix4x4 transform = parentTransform * node->mTransformation;
+    for (unsigned int i = 0; i < node->mNumMeshes; ++i)
+        instances.push_back(NodeInstance{node->mMeshes[i], transform});
+    for (unsigned int i = 0; i < node->mNumChildren; ++i)
+        collectInstances(node->mChildren[i], transform, instances);
+}
+
+AffineTransform toAffine(const aiMatrix4x4& m)
+{
+    AffineTransform affine;
+    affine.rows[0] = Vec3(m.a1, m.a2, m.a3);
+    affine.rows[1] = Vec3(m.b1, m.b2, m.b3);
+    affine.rows[2] = Vec3(m.c1, m.c2, m.c3);
+    affine.translation = Vec3(m.a4, m.b4, m.c4);
+    return affine;
+}
+
+// Scene of the meshes the nodes reference, fitted into the unit cube (or a box grid) as a whole (by
+// the exact bounds of the transformed vertices). Meshes stay in their own space, where the soups reference
+// their vertices; only triangle faces are kept and instances of meshes without any are dropped.
+// Fills triangles with the transformed corners of every instance's triangles if given (the key
+// of the field cache).
+Scene buildUnitCubeScene(const GenerationSettings& settings, const aiScene* scene, const std::vector<NodeInstance>& nodeInstances,
+                         std::vector<std::vector<uint32_t>>& meshIndices, UnitCubeTransform& transform, int gridDims[3],
+                         std::vector<float>* triangles)
+{
+    STATIC_ASSERT(sizeof(aiVector3D) == 3*sizeof(float));
+
+    Scene result;
+    meshIndices.assign(scene->mNumMeshes, std::vector<uint32_t>());
+    for (unsigned int m = 0; m < scene->mNumMeshes; ++m) {
+        const aiMesh* mesh = scene->mMeshes[m];
+        for (unsigned int f = 0; f < mesh->mNumFaces; ++f) {
+            const aiFace& face = mesh->mFaces[f];
+            if (face.mNumIndices == 3)
+                meshIndices[m].insert(meshIndices[m].end(), face.mIndices, face.mIndices + 3);
+        }
+        const TriangleSoup soup = {reinterpret_cast<const float*>(mesh->mVertices), meshIndices[m].data(),
+                                   mesh->mNumVertices, meshIndices[m].size() / 3};
+        result.meshes.push_back(soup);
+    }
+
+    const float Inf = std::numeric_limits<float>::infinity();
+    Vec3 boundsMin(Inf, Inf, Inf), boundsMax(-Inf, -Inf, -Inf);
+    for (const NodeInstance& nodeInstance : nodeInstances) {
+        const TriangleSoup& mesh = result.meshes[nodeInstance.mesh];
+        if (mesh.numTriangles == 0)
+            continue;
+        const AffineTransform toScene = toAffine(nodeInstance.transform);
+        for (size_t v = 0; v < mesh.numVertices; ++v) {
+            const Vec3 p = toScene.apply(mesh.vertex(v));
+            boundsMin = vmin(boundsMin, p);
+            boundsMax = vmax(boundsMax, p);
+        }
+        if (triangles) {
+            for (size_t t = 0; t < mesh.numTriangles; ++t) {
+                for (int k = 0; k < 3; ++k) {
+                    const Vec3 p = toScene.apply(mesh.corner(t, k));
+                    triangles->insert(triangles->end(), {p.x, p.y, p.z});
+                }
+            }
+        }
+        result.instances.push_back(MeshInstance{nodeInstance.mesh, toScene});
+    }
+
+    transform = fitMeshBounds(settings, boundsMin, boundsMax, gridDims);
+    const AffineTransform sceneToUnitCube = unitCubeAffine(transform);
+    for (MeshInstance& instance : result.instances)
+        instance.toUnitCube = sceneToUnitCube * instance.toUnitCube;
+    return result;
+}
+
+Point_3 toPoint(const Vec3& v)
+{
+    return Point_3(v.x, v.y, v.z);
+}
+
 template <class HalfedgeDataStructure>
 class CGALBuilder : public CGAL::Modifier_base<HalfedgeDataStructure>
 {
 public:
-    CGALBuilder(const aiMesh* m): mesh(m) {}
+    CGALBuilder(const TriangleSoup& m): mesh(m) {}
 
     void operator()(HalfedgeDataStructure& hds)
     {
@@ -84,24 +363,16 @@ public:
 
         CGAL::Polyhedron_incremental_builder_3<HalfedgeDataStructure> B(hds, true);
 
-        // Scale down the mesh to fit unit cube [0-1] (and a bit more). Center around (0.5, 0.5, 0.5).
-        const AABB ab = computeAABB(mesh);
-        const aiVector3D origin = (ab.max+ab.min) * 0.5f;
-        const aiVector3D extents = ab.max-ab.min;
-        const float scale = 0.8f / std::max(extents.x, std::max(extents.y, extents.z));
-
-        B.begin_surface(mesh->mNumVertices, mesh->mNumFaces);
-        for (unsigned int i = 0; i < mesh->mNumVertices; ++i) {
-            aiVector3D v = mesh->mVertices[i];
-            v = (v-origin)*scale + aiVector3D(0.5f, 0.5f, 0.5f);
+        B.begin_surface(mesh.numVertices, mesh.numTriangles);
+        for (size_t i = 0; i < mesh.numVertices; ++i) {
+            const Vec3 v = mesh.vertex(i);
             B.add_vertex(Point(v.x, v.y, v.z));
         }
-        for (unsigned int f = 0; f < mesh->mNumFaces; ++f) {
-            const aiFace& face = mesh->mFaces[f];
+        for (size_t f = 0; f < mesh.numTriangles; ++f) {
             B.begin_facet();
-            B.add_vertex_to_facet(face.mIndices[0]);
-            B.add_vertex_to_facet(face.mIndices[1]);
-            B.add_vertex_to_facet(face.mIndices[2]);
+            B.add_vertex_to_facet(mesh.indices[3*f+0]);
+            B.add_vertex_to_facet(mesh.indices[3*f+1]);
+            B.add_vertex_to_facet(mesh.indices[3*f+2]);
             B.end_facet();
         }
         B.end_surface();
@@ -109,7 +380,102 @@ public:
     }
 
 private:
-    const aiMesh* mesh;
+    const TriangleSoup& mesh;
+};
+
+// AABB tree primitive referencing a triangle of the soup by index. The triangle is assembled
+// from the (shared) mesh buffers whenever the tree needs it, nothing is copied.
+class SoupTrianglePrimitive
+{
+public:
+    typedef uint32_t Id;
+    typedef Kernel::Point_3 Point;
+    typedef Kernel::Triangle_3 Datum;
+    typedef boost::counting_iterator<uint32_t> Iterator;
+
+    SoupTrianglePrimitive(): triangle(0), mesh(nullptr) {}
+    SoupTrianglePrimitive(const Iterator it, const TriangleSoup& mesh): triangle(*it), mesh(&mesh) {}
+
+    const Id& id() const { return triangle; }
+    Datum datum() const { return Datum(corner(0), corner(1), corner(2)); }
+    Point reference_point() const { return corner(0); }
+
+private:
+    Point corner(const int k) const { return toPoint(mesh->corner(triangle, k)); }
+
+    Id triangle;
+    const TriangleSoup* mesh;
+};
+
+typedef CGAL::AABB_traits<Kernel, SoupTrianglePrimitive> AABBTraits;
+typedef CGAL::AABB_tree<AABBTraits> AABBTree;
+
+// Distance queries against CGAL's AABB tree (in double precision).
+class CGALDistance : public DistanceEngine
+{
+public:
+    CGALDistance(const TriangleSoup& mesh):
+        tree(SoupTrianglePrimitive::Iterator(0), SoupTrianglePrimitive::Iterator(static_cast<uint32_t>(mesh.numTriangles)), mesh)
+    {
+        tree.accelerate_distance_queries();
+
+        // The tree may finish its construction lazily on the first query. Issue one here, so
+        // concurrent queries only ever read shared data.
+        tree.squared_distance(Point_3(0.5, 0.5, 0.5));
+    }
+
+    double squaredDistance(const Vec3& query) const override
+    {
+        return tree.squared_distance(toPoint(query));
+    }
+
+    // CGAL does not report visited nodes. The closest point and its triangle are the hint.
+    double hintedSquaredDistance(const Vec3& query, DistanceHint& hint, uint64_t&) const override
+    {
+        const Point_3 q = toPoint(query);
+        const AABBTree::Point_and_primitive_id closest = hint.valid
+            ? tree.closest_point_and_primitive(q, AABBTree::Point_and_primitive_id(toPoint(hint.point), hint.triangle))
+            : tree.closest_point_and_primitive(q);
+        hint.point = Vec3(static_cast<float>(closest.first.x()), static_cast<float>(closest.first.y()), static_cast<float>(closest.first.z()));
+        hint.triangle = closest.second;
+        hint.valid = true;
+        return CGAL::squared_distance(q, closest.first);
+    }
+
+    void blockClosestPoints(const Vec3* queries, const size_t count, double* results, Vec3* points,
+                            uint32_t* triangles, DistanceHint& hint, uint64_t& nodeVisits) const override
+    {
+        for (size_t i = 0; i < count; ++i) {
+            results[i] = hintedSquaredDistance(queries[i], hint, nodeVisits);
+            points[i] = hint.point;
+            triangles[i] = hint.triangle;
+        }
+    }
+
+private:
+    AABBTree tree;
+};
+
+// Inside test of CGAL's mesh domain, shoots a ray into the polyhedron from every voxel center.
+class DomainSign : public SignEvaluator
+{
+public:
+    DomainSign(const PolyhedralMeshDomain& domain, const int size):
+        isInDomain(domain.is_in_domain_object()), size(size)
+    {
+        // The domain may finish building its internal tree lazily on the first query. Issue one
+        // here, so concurrent queries only ever read shared data.
+        isInDomain(Point_3(0.5, 0.5, 0.5));
+    }
+
+    bool isInside(const int x, const int y, const int z) const override
+    {
+        return isInDomain(toPoint(voxelCenter(x, y, z, size))).get_value_or(0) == 1;
+    }
+
+private:
+    const PolyhedralMeshDomain::Is_in_domain isInDomain;
+    const int size;
 };
 
 std::string getCmdOption(const std::vector<std::string>& args, const std::string& option)
@@ -125,6 +491,1079 @@ bool cmdOptionExists(const std::vector<std::string>& args, const std::string& op
     return std::find(args.begin(), args.end(), option) != args.end();
 }
 
+// Compares an approximate field (signed distances of voxels, EDT or ADF) with the exact one
+// (distance engine and sign evaluator) on a lattice of at most k_errorSamples^3 voxels. Both are
+// clamped to the band, errors are in voxels.
+void reportApproximationError(ThreadPool& pool, const char* name, const std::function<float(int, int, int)>& approximate,
+                              const DistanceEngine& distance, const SignEvaluator& sign, const FieldOptions& options,
+                              std::ostream& log, GenerationProfile& profile, const std::string& stageName)
+{
+    Stopwatch errorTime;
+    errorTime.start();
+    const int size = options.size;
+    const int stride = std::max((size + k_errorSamples - 1) / k_errorSamples, 1);
+    const int numSamples = (size - stride/2 + stride - 1) / stride; // Per axis, at stride/2 + i*stride.
+    std::vector<float> planeMax(static_cast<size_t>(numSamples), 0.f);
+    std::vector<double> planeSum(static_cast<size_t>(numSamples), 0.0);
+    parallelFor(pool, static_cast<size_t>(numSamples), [&](const size_t sy) {
+        const int y = stride/2 + static_cast<int>(sy)*stride;
+        for (int z = stride/2; z < size; z += stride) {
+        for (int x = stride/2; x < size; x += stride) {
+            const float exact = std::min(static_cast<float>(std::sqrt(distance.squaredDistance(voxelCenter(x, y, z, size)))), options.band);
+            const bool inside = sign.isInside(x, y, z);
+            const float value = approximate(x, y, z);
+            const float clamped = std::min(std::fabs(value), options.band);
+            float error;
+            if (options.isSigned)
+                error = std::fabs((value < 0.f ? -clamped : clamped) - (inside ? -exact : exact));
+            else
+                error = std::fabs((value < 0.f ? 0.f : clamped) - (inside ? 0.f : exact));
+            error *= static_cast<float>(size);
+            planeMax[sy] = std::max(planeMax[sy], error);
+            planeSum[sy] += static_cast<double>(error);
+        }
+        }
+    });
+    errorTime.stop();
+    profile.addStage(stageName, errorTime);
+
+    const uint64_t numCompared = static_cast<uint64_t>(numSamples)*static_cast<uint64_t>(numSamples)*static_cast<uint64_t>(numSamples);
+    double sum = 0.0;
+    for (const double planeError : planeSum)
+        sum += planeError;
+    log << name << " error against exact distances (" << numCompared << " voxels sampled): max "
+        << *std::max_element(planeMax.begin(), planeMax.end()) << ", mean " << sum / static_cast<double>(numCompared)
+        << " voxel(s)." << std::endl;
+}
+
+// Options of a grid of dims voxels, whose size (voxels per unit cube edge) is the largest of them.
+FieldOptions makeFieldOptions(const GenerationSettings& settings, const int dims[3])
+{
+    const int fieldSize = std::max(dims[0], std::max(dims[1], dims[2]));
+    float band = quantizationRange(settings.isSigned);
+    if (settings.bandVoxels > 0.f)
+        band = std::min(band, settings.bandVoxels / static_cast<float>(fieldSize));
+    const FieldOptions options = {fieldSize, settings.isSigned, settings.cull, settings.coherent, band, settings.voxelType,
+                                  {dims[0], dims[1], dims[2]}};
+    return options;
+}
+
+// Rows of the slabs a field is computed in: as many as fit the memory budget by default (two slabs
+// are held, with their channels), always whole top level octree nodes.
+int slabRowsFor(const GenerationSettings& settings, const FieldOptions& fieldOptions)
+{
+    const int numRows = fieldOptions.dims[1];
+    const uint64_t rowBytes = static_cast<uint64_t>(fieldOptions.dims[0]) * static_cast<uint64_t>(fieldOptions.dims[2])
+                              * (voxelBytes(settings.voxelType) + channelBytes(settings.channels));
+    int slabRows = settings.slabRows;
+    if (slabRows <= 0)
+        slabRows = static_cast<int>(std::min<uint64_t>(k_slabMemoryBudget / (2*rowBytes), static_cast<uint64_t>(numRows)));
+    const int rootSize = FieldEvaluator::k_rootNodeSize;
+    slabRows = std::max((slabRows + rootSize - 1) / rootSize, 1) * rootSize;
+    return std::min(slabRows, (numRows + rootSize - 1) / rootSize * rootSize);
+}
+
+// Logs the box grid fitted to a mesh and where it lies in mesh space (the transform a container
+// stores). False if it is too large.
+bool reportBoxGrid(const FieldOptions& fieldOptions, const UnitCubeTransform& transform, std::ostream& log, GenerationProfile& profile)
+{
+    const float voxelSize = 1.f / (static_cast<float>(fieldOptions.size) * transform.scale);
+    const Vec3 corner = transform.origin - Vec3(0.5f, 0.5f, 0.5f) * (1.f / transform.scale);
+    log << "Using a box grid of " << fieldOptions.dims[0] << "x" << fieldOptions.dims[1] << "x" << fieldOptions.dims[2]
+        << " voxels of " << voxelSize << " mesh unit(s), from (" << corner.x << ", " << corner.y << ", " << corner.z << ") to ("
+        << corner.x + voxelSize*fieldOptions.dims[0] << ", " << corner.y + voxelSize*fieldOptions.dims[1] << ", "
+        << corner.z + voxelSize*fieldOptions.dims[2] << ")." << std::endl;
+    profile.size = fieldOptions.size;
+    if (fieldOptions.size > k_maxBoxSize) {
+        log << "The box grid is too large (more than " << k_maxBoxSize << " voxels along an axis)!" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Inserts suffix before the extension of an output path (if it has one).
+std::string insertBeforeExtension(const std::string& outputPath, const std::string& suffix)
+{
+    const size_t slash = outputPath.find_last_of("/\\");
+    size_t dot = outputPath.find_last_of('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        dot = outputPath.length();
+    return outputPath.substr(0, dot) + suffix + outputPath.substr(dot);
+}
+
+// Output of a pyramid level: the size goes before the extension, "field.bin" becomes "field_64.bin".
+std::string levelOutputPath(const std::string& outputPath, const int fieldSize)
+{
+    return insertBeforeExtension(outputPath, "_" + std::to_string(fieldSize));
+}
+
+// Output of an animation frame, numbered before the extension: "field.bin" becomes "field_f0003.bin".
+std::string frameOutputPath(const std::string& outputPath, const int frame)
+{
+    std::string number = std::to_string(frame);
+    number.insert(0, (number.length() < 4) ? 4 - number.length() : 0, '0');
+    return insertBeforeExtension(outputPath, "_f" + number);
+}
+
+std::unique_ptr<FieldWriter> makeFieldWriter(const GenerationSettings& settings, const FieldOptions& fieldOptions,
+                                             const UnitCubeTransform& transform)
+{
+    std::unique_ptr<FieldWriter> writer;
+    if (settings.format == OutputFormat::Bricks)
+        writer.reset(new BrickFieldWriter(fieldOptions));
+    else if (settings.format == OutputFormat::Container)
+        writer.reset(new ContainerFieldWriter(fieldOptions, transform, settings.compression, settings.layout));
+    else
+        writer.reset(new RawFieldWriter(fieldOptions, settings.layout));
+    return writer;
+}
+
+// Inside/outside tests of a size^3 grid, of the scene if there is one.
+std::unique_ptr<SignEvaluator> makeSignEvaluator(const SignMethod method, const MeshStructures& mesh, const int size)
+{
+    std::unique_ptr<SignEvaluator> sign;
+    if (method == SignMethod::Scanline && mesh.scene)
+        sign.reset(new ScanlineSign(*mesh.scene, size));
+    else if (method == SignMethod::Scanline)
+        sign.reset(new ScanlineSign(*mesh.soup, size));
+    else if (method == SignMethod::Winding && mesh.scene)
+        sign.reset(new InstancedWindingSign(*mesh.scene, size));
+    else if (method == SignMethod::Winding)
+        sign.reset(new WindingNumberSign(*mesh.soup, size));
+    else
+        sign.reset(new DomainSign(*mesh.domain, size));
+    return sign;
+}
+
+// Generates (and writes) the field of one mesh, progress goes to log. Computation runs on the
+// pool, which may be shared with other generations running at the same time (batch mode).
+bool generateField(const GenerationSettings& settings, ThreadPool& pool, std::ostream& log, GenerationProfile& profile)
+{
+    profile.inputPath = settings.inputMeshPath;
+    profile.outputPath = settings.outputPath;
+    profile.size = settings.size;
+    profile.isSigned = settings.isSigned;
+    Stopwatch total;
+    total.start();
+    profile.succeeded = runGenerationStages(settings, pool, log, profile);
+    total.stop();
+    profile.wallSeconds = total.getWallSeconds();
+    profile.peakMemoryMegabytes = peakResidentMegabytes();
+    return profile.succeeded;
+}
+
+bool runGenerationStages(const GenerationSettings& settings, ThreadPool& pool, std::ostream& log, GenerationProfile& profile)
+{
+    // Pyramid levels halve the size, coarsest first. Each level steers the evaluation of the next.
+    std::vector<int> levelSizes;
+    for (int level = settings.levels - 1; level >= 0; --level)
+        levelSizes.push_back(settings.size >> level);
+    const size_t numLevels = levelSizes.size();
+    // Box grids are fitted to the mesh once it is imported.
+    if (!isBoxGrid(settings))
+        log << "Using distance field size: " << settings.size << "x" << settings.size << "x" << settings.size << std::endl;
+    if (numLevels > 1) {
+        log << "Generating " << numLevels << " levels:";
+        for (const int levelSize : levelSizes)
+            log << " " << levelSize;
+        log << "." << std::endl;
+    }
+
+    if (settings.bandVoxels > 0.f)
+        log << "Clamping distances to a band of " << settings.bandVoxels << " voxel(s)." << std::endl;
+    log << "Distace field will be " << (settings.isSigned ? "signed." : "unsigned.") << std::endl;
+    if (settings.channels.any()) {
+        log << "Storing channels" << (settings.channels.gradient ? " grad" : "") << (settings.channels.closest ? " closest" : "")
+            << (settings.channels.primitive ? " primid" : "") << (settings.channels.interleaved ? " interleaved." : " as planes.") << std::endl;
+    }
+
+    // Importers are reused by the thread, they are costly to set up for every mesh of a batch.
+    const auto setupStartTime = std::chrono::steady_clock::now();
+    Stopwatch importTime;
+    importTime.start();
+    static thread_local Assimp::Importer assImport;
+    const aiScene* assScene = assImport.ReadFile(settings.inputMeshPath,
+                                                 aiProcess_Triangulate | aiProcess_JoinIdenticalVertices);
+    if (!assScene) {
+        log << "Assimp failed to import mesh: " << assImport.GetErrorString() << std::endl;
+        return false;
+    }
+
+    // Every mesh a node references is an instance. A single one is prepared as before, several
+    // make a scene: each mesh is kept once and placed by its instances' transforms.
+    std::vector<NodeInstance> nodeInstances;
+    collectInstances(assScene->mRootNode, aiMatrix4x4(), nodeInstances);
+    if (nodeInstances.empty()) {
+        log << "The scene references no mesh!" << std::endl;
+        return false;
+    }
+    const bool isScene = nodeInstances.size() > 1;
+    if (isScene && (settings.signMethod == SignMethod::Domain || settings.validate)) {
+        log << "Scenes of several meshes need --sign-method scanline or winding and cannot be validated!" << std::endl;
+        return false;
+    }
+
+    // The mesh is scaled in place, so take the scene over from the importer.
+    std::unique_ptr<aiScene> scene(assImport.GetOrphanedScene());
+    importTime.stop();
+    profile.addStage("import", importTime);
+    if (settings.frames > 0)
+        return generateFrames(settings, scene.get(), pool, log, profile);
+
+    Stopwatch meshTime;
+    meshTime.start();
+    std::vector<float> triangles;
+    std::vector<uint32_t> indices;
+    UnitCubeTransform transform;
+    int gridDims[3];
+    TriangleSoup soup = {nullptr, nullptr, 0, 0};
+    Scene meshScene;
+    std::vector<std::vector<uint32_t>> sceneIndices;
+    std::vector<float> flatPositions;
+    if (!isScene) {
+        aiMesh* mesh = scene->mMeshes[nodeInstances[0].mesh];
+        // Most formats leave the node untransformed, others place the mesh with it.
+        if (!nodeInstances[0].transform.IsIdentity()) {
+            for (unsigned int i = 0; i < mesh->mNumVertices; ++i)
+                mesh->mVertices[i] = nodeInstances[0].transform * mesh->mVertices[i];
+        }
+        if (!settings.cacheDirectory.empty())
+            triangles = meshTriangles(mesh);
+        soup = buildUnitCubeMesh(settings, mesh, indices, transform, gridDims);
+    }
+    else {
+        meshScene = buildUnitCubeScene(settings, scene.get(), nodeInstances, sceneIndices, transform, gridDims,
+                                       settings.cacheDirectory.empty() ? nullptr : &triangles);
+        if (meshScene.instances.empty()) {
+            log << "The scene has no triangles!" << std::endl;
+            return false;
+        }
+        // The CGAL tree and the voxelization of EDT take the triangles of all instances as one soup.
+        if (settings.engine == DistanceEngineType::CGAL || settings.mode == FieldMode::EDT)
+            soup = flattenScene(meshScene, flatPositions, indices);
+        log << "Scene of " << meshScene.instances.size() << " instance(s) of " << scene->mNumMeshes << " mesh(es), "
+            << meshScene.numTriangles() << " triangles." << std::endl;
+    }
+    meshTime.stop();
+    profile.addStage("mesh", meshTime);
+
+    // A box grid is a single level (no pyramid), of the dims fitted to the mesh.
+    std::vector<FieldOptions> levelOptions;
+    for (const int levelSize : levelSizes) {
+        const int cubeDims[3] = {levelSize, levelSize, levelSize};
+        levelOptions.push_back(makeFieldOptions(settings, isBoxGrid(settings) ? gridDims : cubeDims));
+    }
+    if (isBoxGrid(settings) && !reportBoxGrid(levelOptions[0], transform, log, profile))
+        return false;
+
+    // Only single level fields are cached.
+    std::unique_ptr<FieldCache> cache;
+    CacheResult cacheResult = CacheResult::Miss;
+    if (!settings.cacheDirectory.empty()) {
+        Stopwatch lookupTime;
+        lookupTime.start();
+        cache.reset(new FieldCache(settings.cacheDirectory, settings.inputMeshPath, levelOptions[0], settings.engine, settings.signMethod));
+        cacheResult = cache->lookup(triangles, transform, log);
+        lookupTime.stop();
+        profile.addStage("cache_lookup", lookupTime);
+    }
+
+    // Opened before the (expensive) acceleration structures are built, the container stores the transform.
+    Stopwatch openTime;
+    openTime.start();
+    std::vector<std::unique_ptr<FieldWriter>> writers(numLevels);
+    std::vector<std::unique_ptr<ChannelWriter>> channelWriters(numLevels);
+    std::vector<int> firstRows(numLevels, 0);
+    profile.voxels = 0;
+    // Adaptive fields are written at once when built.
+    const size_t numWriters = (settings.mode == FieldMode::ADF) ? 0 : numLevels;
+    for (size_t level = 0; level < numWriters; ++level) {
+        const FieldOptions& fieldOptions = levelOptions[level];
+        std::unique_ptr<FieldWriter>& writer = writers[level];
+        writer = makeFieldWriter(settings, fieldOptions, transform);
+        const std::string outputPath = (numLevels > 1) ? levelOutputPath(settings.outputPath, fieldOptions.size) : settings.outputPath;
+        if (!writer->open(outputPath, settings.resume, firstRows[level]))
+            return false;
+        if (settings.channels.any()) {
+            channelWriters[level].reset(new ChannelWriter(settings.channels));
+            if (!channelWriters[level]->open(outputPath))
+                return false;
+        }
+        const uint64_t rowVoxels = static_cast<uint64_t>(fieldOptions.dims[0]) * static_cast<uint64_t>(fieldOptions.dims[2]);
+        profile.voxels += (static_cast<uint64_t>(fieldOptions.dims[1]) - static_cast<uint64_t>(firstRows[level])) * rowVoxels;
+    }
+    openTime.stop();
+    profile.addStage("open_output", openTime);
+
+    if (cacheResult == CacheResult::Hit) {
+        if (settings.validate)
+            log << "Field taken from the cache, not validating." << std::endl;
+        profile.cacheHit = true;
+        const int fieldSize = settings.size;
+        const int slabRows = slabRowsFor(settings, levelOptions[0]);
+        Stopwatch readTime, writeTime;
+        std::vector<uint8_t> slab(static_cast<size_t>(slabRows) * static_cast<size_t>(fieldSize) * static_cast<size_t>(fieldSize)
+                                  * voxelBytes(settings.voxelType));
+        for (int y0 = firstRows[0]; y0 < fieldSize; y0 += slabRows) {
+            const FieldSlab fieldSlab = {slab.data(), y0, std::min(y0 + slabRows, fieldSize)};
+            readTime.start();
+            const bool read = cache->read(fieldSlab);
+            readTime.stop();
+            if (!read) {
+                log << "Failed to read the cache entry!" << std::endl;
+                return false;
+            }
+            writeTime.start();
+            const bool written = writers[0]->write(fieldSlab);
+            writeTime.stop();
+            if (!written)
+                return false;
+        }
+        profile.addStage("cache_read", readTime);
+        profile.addStage("write", writeTime);
+        Stopwatch closeTime;
+        closeTime.start();
+        const bool closed = writers[0]->close();
+        closeTime.stop();
+        profile.addStage("close", closeTime);
+        return closed;
+    }
+
+    // Build polyhedron structure out of triangles. Only needed by the mesh domain (which is also
+    // the reference for --validate), all other structures index the soup.
+    const bool needsCGALTree = settings.engine == DistanceEngineType::CGAL || settings.validate;
+    const bool needsDomain = settings.signMethod == SignMethod::Domain || settings.validate;
+    Polyhedron polyhedron;
+    if (needsDomain) {
+        Stopwatch polyhedronTime;
+        polyhedronTime.start();
+        CGALBuilder<Polyhedron::HalfedgeDS> builder(soup);
+        polyhedron.delegate(builder);
+        polyhedronTime.stop();
+        profile.addStage("polyhedron", polyhedronTime);
+    }
+
+    // Construct the acceleration structure for distance queries.
+    Stopwatch treeTime;
+    treeTime.start();
+    std::unique_ptr<DistanceEngine> cgalDistance;
+    if (needsCGALTree)
+        cgalDistance.reset(new CGALDistance(soup));
+    std::unique_ptr<DistanceEngine> simdDistance;
+    InstancedDistance* instancedDistance = nullptr;
+    if (settings.engine == DistanceEngineType::Simd && isScene) {
+        instancedDistance = new InstancedDistance(meshScene);
+        simdDistance.reset(instancedDistance);
+    }
+    else if (settings.engine == DistanceEngineType::Simd)
+        simdDistance.reset(new SimdBVH(soup));
+    treeTime.stop();
+    profile.addStage("distance_engine", treeTime);
+    log << "Distance engine (" << distanceEngineName(settings.engine) << ") built in " << treeTime.getWallSeconds() << " s." << std::endl;
+    if (instancedDistance) {
+        log << "Built " << instancedDistance->getNumTrees() << " tree(s) for " << meshScene.instances.size() << " instance(s), "
+            << instancedDistance->getNumCopiedInstances() << " copied (not a similarity)." << std::endl;
+    }
+
+    // The mesh domain (one ray per voxel) is also the reference for --validate.
+    std::unique_ptr<PolyhedralMeshDomain> pmd;
+    if (needsDomain) {
+        Stopwatch domainTime;
+        domainTime.start();
+        pmd.reset(new PolyhedralMeshDomain(polyhedron));
+        domainTime.stop();
+        profile.addStage("domain", domainTime);
+    }
+    const std::chrono::duration<double> setupElapsed = std::chrono::steady_clock::now() - setupStartTime;
+    log << "Setup took " << setupElapsed.count() << " s, peak resident memory "
+        << peakResidentMegabytes() << " MB." << std::endl;
+
+    // Every level but the finest records the bounds steering the next one. Bounds come from
+    // culled octree nodes and queries, so EDT fields and --no-cull record none.
+    const MeshStructures mesh = {&soup, isScene ? &meshScene : nullptr, simdDistance ? simdDistance.get() : cgalDistance.get(),
+                                 cgalDistance.get(), pmd.get()};
+    if (settings.mode == FieldMode::ADF)
+        return generateAdaptiveField(settings, mesh, transform, pool, log, profile);
+    const bool steer = numLevels > 1 && settings.mode == FieldMode::Exact && settings.cull;
+    FieldBounds levelBounds[2];
+    for (size_t level = 0; level < numLevels; ++level) {
+        const FieldBounds* coarse = (steer && level > 0) ? &levelBounds[(level-1) % 2] : nullptr;
+        FieldBounds* bounds = nullptr;
+        if (steer && level+1 < numLevels) {
+            bounds = &levelBounds[level % 2];
+            const size_t levelSize = static_cast<size_t>(levelSizes[level]);
+            bounds->size = levelSizes[level];
+            bounds->distances.assign(levelSize*levelSize*levelSize, 0.f);
+        }
+        if (numLevels > 1)
+            log << "Level " << levelSizes[level] << ":" << std::endl;
+        if (!generateLevel(settings, levelOptions[level], mesh, *writers[level], channelWriters[level].get(), firstRows[level],
+                           cache.get(), cacheResult, coarse, bounds, nullptr, pool, log, profile))
+            return false;
+    }
+    return true;
+}
+
+// Computes and writes one level of a field (all of it, or the only one). Bounds are recorded when given,
+// channels written when there is a channel writer. Frames of an animation pass their history: the
+// marked nodes are recomputed over the previous frame's voxels, and the history takes the new ones.
+bool generateLevel(const GenerationSettings& settings, const FieldOptions& fieldOptions, const MeshStructures& mesh,
+                   FieldWriter& writer, ChannelWriter* channelWriter, const int firstRow, FieldCache* cache, const CacheResult cacheResult,
+                   const FieldBounds* coarse, FieldBounds* bounds, FrameHistory* history, ThreadPool& pool, std::ostream& log,
+                   GenerationProfile& profile)
+{
+    const int fieldSize = fieldOptions.size;
+    const DistanceEngine& distance = *mesh.distance;
+    // Stages of pyramid levels are told apart by the level's size, those of frames by their number.
+    std::string stageSuffix = (settings.levels > 1) ? "_" + std::to_string(fieldSize) : std::string();
+    if (history)
+        stageSuffix = "_f" + std::to_string(history->frame);
+
+    // The field is computed and written in slabs of whole y rows. One slab is being computed while
+    // the previous one is written, so two are held in memory.
+    const int numRows = fieldOptions.dims[1];
+    const uint64_t rowVoxels = static_cast<uint64_t>(fieldOptions.dims[0]) * static_cast<uint64_t>(fieldOptions.dims[2]);
+    const uint64_t rowBytes = rowVoxels * voxelBytes(settings.voxelType);
+    const int slabRows = slabRowsFor(settings, fieldOptions);
+    log << "Computing " << slabRows << " y row(s) at a time." << std::endl;
+
+    // Inside/outside tests depend on the size of the grid.
+    Stopwatch signTime;
+    signTime.start();
+    std::unique_ptr<SignEvaluator> domainSign;
+    if (mesh.domain)
+        domainSign.reset(new DomainSign(*mesh.domain, fieldSize));
+    std::unique_ptr<SignEvaluator> sign;
+    if (settings.signMethod != SignMethod::Domain)
+        sign = makeSignEvaluator(settings.signMethod, mesh, fieldSize);
+    const SignEvaluator& signEvaluator = sign ? *sign : *domainSign;
+    signTime.stop();
+    profile.addStage("sign" + stageSuffix, signTime);
+    log << "Sign stage (" << signMethodName(settings.signMethod) << ") prepared in " << signTime.getWallSeconds() << " s." << std::endl;
+
+    // Compute the distance field on a 3D grid in the unit cube.
+    // Can be stored in a e.g. 4096x64 2D texture (64x64 y slices side by side horizontally).
+
+    std::vector<uint8_t> slabs[2];
+    slabs[0].resize(static_cast<size_t>(rowBytes) * static_cast<size_t>(slabRows));
+    slabs[1].resize(slabs[0].size());
+    std::vector<uint8_t> channelSlabs[2];
+    if (channelWriter) {
+        channelSlabs[0].resize(static_cast<size_t>(rowVoxels) * static_cast<size_t>(slabRows) * channelBytes(settings.channels));
+        channelSlabs[1].resize(channelSlabs[0].size());
+    }
+    std::vector<uint8_t> reference(settings.validate ? slabs[0].size() : 0);
+    // Reference for --validate: every voxel evaluated on its own, CGAL distances and signs from the mesh domain.
+    const FieldOptions referenceOptions = {fieldSize, settings.isSigned, false, false, fieldOptions.band, settings.voxelType,
+                                           {fieldOptions.dims[0], fieldOptions.dims[1], fieldOptions.dims[2]}};
+    const size_t bytesPerVoxel = voxelBytes(settings.voxelType);
+    const bool reuseFrame = history && !history->voxels.empty();
+    if (history)
+        history->voxels.resize(static_cast<size_t>(rowBytes) * static_cast<size_t>(numRows));
+    uint64_t numDiffering = 0;
+    float maxDifference = 0.f;
+
+    log << "In progress..." << std::endl;
+    const auto startTime = std::chrono::steady_clock::now();
+    QueryCounters counters = {0, 0, 0, 0};
+    // EDT mode computes the whole grid up front, the slabs only encode it.
+    std::unique_ptr<DistanceTransform> distanceTransform;
+    if (settings.mode == FieldMode::EDT) {
+        distanceTransform.reset(new DistanceTransform(fieldSize));
+        Stopwatch voxelizeTime, floodFillTime, transformTime;
+        voxelizeTime.start();
+        distanceTransform->voxelize(pool, *mesh.soup);
+        voxelizeTime.stop();
+        floodFillTime.start();
+        distanceTransform->floodFill(pool);
+        floodFillTime.stop();
+        transformTime.start();
+        distanceTransform->transform(pool);
+        transformTime.stop();
+        profile.addStage("voxelize" + stageSuffix, voxelizeTime);
+        profile.addStage("flood_fill" + stageSuffix, floodFillTime);
+        profile.addStage("distance_transform" + stageSuffix, transformTime);
+        log << "Voxelized in " << voxelizeTime.getWallSeconds() << " s (" << distanceTransform->getNumSurfaceVoxels()
+            << " surface voxels), flood filled in " << floodFillTime.getWallSeconds() << " s, distance transform took "
+            << transformTime.getWallSeconds() << " s." << std::endl;
+    }
+    // Slabs are written while the next one is computed, the write stage is timed on its own threads.
+    Stopwatch computeTime, readTime, validateTime, writeTime(true);
+    TaskGroup writeGroup;
+    bool writeFailed = false;
+    // Only complete fields are cached.
+    const bool storeInCache = cache && firstRow == 0 && cache->beginStore(log);
+    for (int y0 = firstRow, slabIndex = 0; y0 < numRows; y0 += slabRows, slabIndex ^= 1) {
+        const int y1 = std::min(y0 + slabRows, numRows);
+        std::vector<uint8_t>& slab = slabs[slabIndex];
+        const FieldSlab fieldSlab = {slab.data(), y0, y1};
+        const size_t slabVoxels = static_cast<size_t>(rowVoxels) * static_cast<size_t>(y1 - y0);
+        const ChannelSlab channelSlab = makeChannelSlab(settings.channels, channelSlabs[slabIndex].data(), slabVoxels);
+        const FieldEvaluator evaluator(distance, signEvaluator, fieldOptions, fieldSlab, coarse, bounds,
+                                       channelWriter ? &channelSlab : nullptr);
+        if (cacheResult == CacheResult::Partial) {
+            readTime.start();
+            const bool read = cache->read(fieldSlab);
+            readTime.stop();
+            if (!read) {
+                log << "Failed to read the cache entry!" << std::endl;
+                return false;
+            }
+        }
+        uint8_t* historySlab = history ? history->voxels.data() + static_cast<size_t>(rowBytes) * static_cast<size_t>(y0) : nullptr;
+        computeTime.start();
+        QueryCounters slabCounters = {0, 0, 0, 0};
+        if (reuseFrame)
+            std::memcpy(slab.data(), historySlab, slabVoxels * bytesPerVoxel);
+        if (distanceTransform)
+            distanceTransform->encodeSlab(pool, fieldOptions, fieldSlab);
+        else if (cacheResult == CacheResult::Partial)
+            slabCounters = computeField(pool, evaluator, cache->getNodeMask());
+        else if (reuseFrame)
+            slabCounters = computeField(pool, evaluator, history->nodeMask);
+        else
+            slabCounters = computeField(pool, evaluator);
+        if (history)
+            std::memcpy(historySlab, slab.data(), slabVoxels * bytesPerVoxel);
+        computeTime.stop();
+        counters.distanceQueries += slabCounters.distanceQueries;
+        counters.insideTests += slabCounters.insideTests;
+        counters.nodeVisits += slabCounters.nodeVisits;
+        counters.insideSkipped += slabCounters.insideSkipped;
+
+        if (settings.validate) {
+            validateTime.start();
+            const FieldSlab referenceSlab = {reference.data(), y0, y1};
+            const FieldEvaluator referenceEvaluator(*mesh.cgalDistance, *domainSign, referenceOptions, referenceSlab);
+            computeField(pool, referenceEvaluator);
+            for (size_t i = 0; i < slabVoxels; ++i) {
+                const uint8_t* voxel = slab.data() + i*bytesPerVoxel;
+                const uint8_t* referenceVoxel = reference.data() + i*bytesPerVoxel;
+                if (std::memcmp(voxel, referenceVoxel, bytesPerVoxel) == 0)
+                    continue;
+                // In steps of the 8 bit quantization, whatever the precision.
+                const float difference = std::fabs(decodeVoxel(voxel, fieldOptions) - decodeVoxel(referenceVoxel, fieldOptions)) * 255.f;
+                numDiffering++;
+                maxDifference = std::max(maxDifference, difference);
+            }
+            validateTime.stop();
+        }
+
+        // Write this slab while the next one is computed (into the other buffer).
+        pool.wait(writeGroup);
+        if (writeFailed)
+            return false;
+        pool.submit(writeGroup, [&writer, channelWriter, cache, storeInCache, fieldSlab, channelSlab, slabVoxels,
+                                 &writeFailed, &writeTime, &log, &settings]() {
+            writeTime.start();
+            writeFailed = !writer.write(fieldSlab) || (channelWriter && !channelWriter->write(channelSlab, slabVoxels));
+            if (storeInCache)
+                cache->store(fieldSlab); // Failures are reported by endStore.
+            writeTime.stop();
+            if (!writeFailed && settings.verbose)
+                log << "Rows " << fieldSlab.y0 << " to " << fieldSlab.y1-1 << " written." << std::endl;
+        });
+    }
+    pool.wait(writeGroup);
+    if (writeFailed)
+        return false;
+    profile.addStage("voxels" + stageSuffix, computeTime);
+    if (cacheResult == CacheResult::Partial)
+        profile.addStage("cache_read", readTime);
+    if (settings.validate)
+        profile.addStage("validate" + stageSuffix, validateTime);
+    profile.addStage("write" + stageSuffix, writeTime, true);
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - startTime;
+    log << "Voxels computed in " << elapsed.count() << " s using " << pool.size() << " thread(s)." << std::endl;
+    profile.counters.distanceQueries += counters.distanceQueries;
+    profile.counters.insideTests += counters.insideTests;
+    profile.counters.nodeVisits += counters.nodeVisits;
+    profile.counters.insideSkipped += counters.insideSkipped;
+    if (distanceTransform) {
+        const DistanceTransform& transformed = *distanceTransform;
+        reportApproximationError(pool, "EDT", [&transformed](const int x, const int y, const int z) { return transformed.signedDistance(x, y, z); },
+                                 distance, signEvaluator, fieldOptions, log, profile, "edt_error" + stageSuffix);
+    }
+    else {
+        log << "Issued " << counters.distanceQueries << " distance queries and " << counters.insideTests
+            << " inside tests for " << (static_cast<uint64_t>(numRows - firstRow) * rowVoxels) << " voxels";
+        if (!settings.isSigned)
+            log << " (" << counters.insideSkipped << " inside, needing no query)";
+        log << "." << std::endl;
+    }
+    if (counters.nodeVisits > 0) {
+        log << "Visited " << counters.nodeVisits << " tree nodes ("
+            << static_cast<double>(counters.nodeVisits) / static_cast<double>(std::max<uint64_t>(counters.distanceQueries, 1))
+            << " per distance query)." << std::endl;
+    }
+
+    if (settings.validate) {
+        log << "Validation: " << numDiffering << " voxel(s) differ from the reference, max difference "
+            << maxDifference << " quantization step(s)." << std::endl;
+    }
+
+    Stopwatch closeTime;
+    closeTime.start();
+    if (!writer.close() || (channelWriter && !channelWriter->close()))
+        return false;
+    if (storeInCache)
+        cache->endStore(log);
+    closeTime.stop();
+    profile.addStage("close" + stageSuffix, closeTime);
+    if (settings.format == OutputFormat::Bricks) {
+        const BrickFieldWriter& brickWriter = static_cast<const BrickFieldWriter&>(writer);
+        log << "Stored " << brickWriter.numStoredBricks() << " of " << brickWriter.numBricks() << " bricks." << std::endl;
+    }
+    if (settings.format == OutputFormat::Container && settings.compression != Compression::None) {
+        const ContainerFieldWriter& containerWriter = static_cast<const ContainerFieldWriter&>(writer);
+        log << "Compressed " << fieldOptions.numVoxels() * bytesPerVoxel << " bytes of voxels to "
+            << containerWriter.payloadBytes() << "." << std::endl;
+    }
+    return true;
+}
+
+// Marks the nodes of the next frame whose voxels may change by more than a quantization step. A
+// vertex has moved once it is more than a quarter step from where it was when the nodes around it
+// were last computed, and the vertex starts over from where it is. A voxel only changes if one of
+// the triangles of moved vertices comes closer than its distance, was its closest triangle or
+// passed it (flipping its sign), so at its old or new position, or in between, it is within the
+// voxel's distance: nodes are recomputed where the box of such a triangle's old and new positions
+// is within the largest distance of the node's voxels in the previous frame. Any other triangle is
+// within half a step of where it was when a reused voxel was computed, which changes neither its
+// distance nor a sign flipped by it by more than a step. Returns the number of moved triangles.
+size_t markMovedTriangles(const TriangleSoup& posed, const FieldOptions& options, FrameHistory& history, size_t& numMarked)
+{
+    float scale, bias;
+    voxelDecoding(options, scale, bias);
+    // Floats keep distances as they are, only vertices that did not move at all are reused.
+    const bool isQuantized = options.voxelType != VoxelType::F32;
+    const float threshold = isQuantized ? 0.25f * scale : 0.f;
+    std::vector<uint8_t> moved(posed.numVertices, 0);
+    for (size_t v = 0; v < posed.numVertices; ++v) {
+        const float* base = &history.basePositions[3*v];
+        const Vec3 offset = posed.vertex(v) - Vec3(base[0], base[1], base[2]);
+        moved[v] = dot(offset, offset) > threshold*threshold;
+    }
+
+    const int size = options.size;
+    const int patchSize = FieldEvaluator::k_patchNodeSize;
+    const int* dims = options.dims;
+    const size_t nodesX = static_cast<size_t>(nodesAlong(dims[0])), nodesZ = static_cast<size_t>(nodesAlong(dims[2]));
+    history.nodeMask.assign(nodesX * static_cast<size_t>(nodesAlong(dims[1])) * nodesZ, 0);
+
+    // Largest distance of every node's voxels in the previous frame (clamped ones at the clamp), in
+    // unit cube units. Voxels are within a step of their distance, reused ones within another.
+    const float slack = isQuantized ? 2.f*scale : 0.f;
+    std::vector<float> nodeReach(history.nodeMask.size(), 0.f);
+    const size_t bytesPerVoxel = voxelBytes(options.voxelType);
+    const uint8_t* voxel = history.voxels.data();
+    for (int y = 0; y < dims[1]; ++y) {
+    for (int z = 0; z < dims[2]; ++z) {
+    for (int x = 0; x < dims[0]; ++x, voxel += bytesPerVoxel) {
+        float& reach = nodeReach[(static_cast<size_t>(y/patchSize)*nodesZ + static_cast<size_t>(z/patchSize))*nodesX + static_cast<size_t>(x/patchSize)];
+        reach = std::max(reach, std::fabs(decodeVoxel(voxel, options)));
+    }
+    }
+    }
+    const float maxReach = *std::max_element(nodeReach.begin(), nodeReach.end()) + slack;
+
+    auto toNode = [size, patchSize](const float u, const int dim, const bool roundUp) {
+        const float voxel = u*static_cast<float>(size) - 0.5f;
+        const float clamped = std::max(0.f, std::min(roundUp ? std::ceil(voxel) : std::floor(voxel), static_cast<float>(dim - 1)));
+        return static_cast<int>(clamped) / patchSize;
+    };
+    // Voxel centers of a node along an axis.
+    auto nodeCenters = [size, patchSize](const int node, const int dim, float& lo, float& hi) {
+        lo = (static_cast<float>(node*patchSize) + 0.5f) / static_cast<float>(size);
+        hi = (static_cast<float>(std::min((node + 1)*patchSize, dim) - 1) + 0.5f) / static_cast<float>(size);
+    };
+    size_t numMoved = 0;
+    for (size_t t = 0; t < posed.numTriangles; ++t) {
+        const uint32_t* corners = posed.indices + 3*t;
+        if (!moved[corners[0]] && !moved[corners[1]] && !moved[corners[2]])
+            continue;
+        numMoved++;
+        Vec3 lo = posed.vertex(corners[0]), hi = lo;
+        for (int k = 0; k < 3; ++k) {
+            const float* base = &history.basePositions[3*static_cast<size_t>(corners[k])];
+            const Vec3 p = posed.vertex(corners[k]), q(base[0], base[1], base[2]);
+            lo = vmin(lo, vmin(p, q));
+            hi = vmax(hi, vmax(p, q));
+        }
+        const int x0 = toNode(lo.x - maxReach, dims[0], false), x1 = toNode(hi.x + maxReach, dims[0], true);
+        const int y0 = toNode(lo.y - maxReach, dims[1], false), y1 = toNode(hi.y + maxReach, dims[1], true);
+        const int z0 = toNode(lo.z - maxReach, dims[2], false), z1 = toNode(hi.z + maxReach, dims[2], true);
+        for (int y = y0; y <= y1; ++y) {
+        for (int z = z0; z <= z1; ++z) {
+        for (int x = x0; x <= x1; ++x) {
+            const size_t node = (static_cast<size_t>(y)*nodesZ + static_cast<size_t>(z))*nodesX + static_cast<size_t>(x);
+            if (history.nodeMask[node])
+                continue;
+            Vec3 nodeLo, nodeHi;
+            nodeCenters(x, dims[0], nodeLo.x, nodeHi.x);
+            nodeCenters(y, dims[1], nodeLo.y, nodeHi.y);
+            nodeCenters(z, dims[2], nodeLo.z, nodeHi.z);
+            const Vec3 gap = vmax(vmax(nodeLo - hi, lo - nodeHi), Vec3(0.f, 0.f, 0.f));
+            const float reach = nodeReach[node] + slack;
+            history.nodeMask[node] = dot(gap, gap) <= reach*reach;
+        }
+        }
+        }
+    }
+    numMarked = static_cast<size_t>(std::count(history.nodeMask.begin(), history.nodeMask.end(), 1));
+
+    for (size_t v = 0; v < posed.numVertices; ++v) {
+        if (moved[v])
+            std::copy(posed.positions + 3*v, posed.positions + 3*v + 3, &history.basePositions[3*v]);
+    }
+    return numMoved;
+}
+
+// Generates the fields of frames of the mesh's first animation (--frames), taken evenly over its
+// duration and written to numbered outputs. The posed mesh keeps its triangles, so the tree of the
+// first frame is refit to the others, and the voxels of the previous frame are reused wherever no
+// triangle moved enough to change them. All frames share one transform into the unit cube (or grid).
+bool generateFrames(const GenerationSettings& settings, const aiScene* scene, ThreadPool& pool, std::ostream& log,
+                    GenerationProfile& profile)
+{
+    Stopwatch meshTime;
+    meshTime.start();
+    AnimatedMesh animated;
+    if (!animated.init(scene, log))
+        return false;
+    const double duration = animated.getDuration();
+    std::vector<double> times(static_cast<size_t>(settings.frames), 0.0);
+    for (int frame = 1; frame < settings.frames; ++frame)
+        times[static_cast<size_t>(frame)] = duration * frame / (settings.frames - 1);
+
+    // The unit cube holds the mesh in every frame.
+    const float Inf = std::numeric_limits<float>::infinity();
+    Vec3 boundsMin(Inf, Inf, Inf), boundsMax(-Inf, -Inf, -Inf);
+    std::vector<float> positions;
+    for (const double time : times) {
+        animated.pose(time, positions);
+        for (size_t v = 0; v < animated.getNumVertices(); ++v) {
+            const Vec3 p(positions[3*v], positions[3*v+1], positions[3*v+2]);
+            boundsMin = vmin(boundsMin, p);
+            boundsMax = vmax(boundsMax, p);
+        }
+    }
+    int gridDims[3];
+    const UnitCubeTransform transform = fitMeshBounds(settings, boundsMin, boundsMax, gridDims);
+    const FieldOptions fieldOptions = makeFieldOptions(settings, gridDims);
+    // Every pose has as many vertices, the soup keeps referencing the same buffer.
+    const std::vector<uint32_t>& indices = animated.getIndices();
+    const TriangleSoup soup = {positions.data(), indices.data(), animated.getNumVertices(), indices.size() / 3};
+    meshTime.stop();
+    profile.addStage("mesh", meshTime);
+    log << "Animation of " << duration << " ticks";
+    if (animated.getTicksPerSecond() > 0.0)
+        log << " (" << duration / animated.getTicksPerSecond() << " s)";
+    log << ", generating " << settings.frames << " frame(s) of " << soup.numTriangles << " triangles." << std::endl;
+
+    if (isBoxGrid(settings) && !reportBoxGrid(fieldOptions, transform, log, profile))
+        return false;
+
+    const uint64_t gridVoxels = fieldOptions.numVoxels();
+    profile.voxels = 0;
+    FrameHistory history;
+    std::unique_ptr<SimdBVH> tree;
+    double refitSeconds = 0.0;
+    uint64_t numRecomputed = 0, numNodes = 0;
+    for (int frame = 0; frame < settings.frames; ++frame) {
+        const std::string stageSuffix = "_f" + std::to_string(frame);
+        log << "Frame " << frame << " at " << times[static_cast<size_t>(frame)] << " ticks:" << std::endl;
+        Stopwatch poseTime;
+        poseTime.start();
+        animated.pose(times[static_cast<size_t>(frame)], positions);
+        for (size_t v = 0; v < soup.numVertices; ++v) {
+            const Vec3 u = toUnitCube(transform, soup.vertex(v));
+            positions[3*v+0] = u.x;
+            positions[3*v+1] = u.y;
+            positions[3*v+2] = u.z;
+        }
+        poseTime.stop();
+        profile.addStage("pose" + stageSuffix, poseTime);
+
+        Stopwatch treeTime;
+        treeTime.start();
+        if (tree)
+            tree->refit(soup);
+        else
+            tree.reset(new SimdBVH(soup));
+        treeTime.stop();
+        if (frame == 0) {
+            profile.addStage("distance_engine", treeTime);
+            log << "Distance engine (simd) built in " << treeTime.getWallSeconds() << " s." << std::endl;
+        }
+        else {
+            profile.addStage("refit" + stageSuffix, treeTime);
+            refitSeconds += treeTime.getWallSeconds();
+            log << "Refit in " << treeTime.getWallSeconds() << " s." << std::endl;
+        }
+
+        history.frame = frame;
+        if (frame == 0) {
+            history.basePositions = positions;
+        }
+        else {
+            size_t numMarked = 0;
+            const size_t numMoved = markMovedTriangles(soup, fieldOptions, history, numMarked);
+            log << numMoved << " triangle(s) moved, recomputing " << numMarked << " of " << history.nodeMask.size() << " node(s)." << std::endl;
+            numRecomputed += numMarked;
+            numNodes += history.nodeMask.size();
+        }
+
+        std::unique_ptr<FieldWriter> writer = makeFieldWriter(settings, fieldOptions, transform);
+        int firstRow = 0;
+        if (!writer->open(frameOutputPath(settings.outputPath, frame), false, firstRow))
+            return false;
+        profile.voxels += gridVoxels;
+        const MeshStructures mesh = {&soup, nullptr, tree.get(), nullptr, nullptr};
+        if (!generateLevel(settings, fieldOptions, mesh, *writer, nullptr, 0, nullptr, CacheResult::Miss, nullptr, nullptr,
+                           &history, pool, log, profile))
+            return false;
+    }
+    if (settings.frames > 1) {
+        log << "Refits took " << refitSeconds << " s in all, " << numRecomputed << " of " << numNodes
+            << " node(s) recomputed after the first frame." << std::endl;
+    }
+    return true;
+}
+
+// Builds and writes the adaptive field of a mesh. Its lattice has size+1 points per axis, the voxel
+// centers of a (size+1)^3 grid, so the usual sign evaluators apply.
+bool generateAdaptiveField(const GenerationSettings& settings, const MeshStructures& mesh, const UnitCubeTransform& transform,
+                           ThreadPool& pool, std::ostream& log, GenerationProfile& profile)
+{
+    const int latticeSize = settings.size + 1;
+    Stopwatch signTime;
+    signTime.start();
+    const std::unique_ptr<SignEvaluator> sign = makeSignEvaluator(settings.signMethod, mesh, latticeSize);
+    signTime.stop();
+    profile.addStage("sign", signTime);
+    log << "Sign stage (" << signMethodName(settings.signMethod) << ") prepared in " << signTime.getWallSeconds() << " s." << std::endl;
+
+    log << "In progress..." << std::endl;
+    Stopwatch buildTime;
+    buildTime.start();
+    const float tolerance = settings.adfTolerance / static_cast<float>(settings.size);
+    AdaptiveFieldBuilder builder(*mesh.distance, *sign, settings.size, settings.isSigned, tolerance);
+    const QueryCounters counters = builder.build(pool);
+    buildTime.stop();
+    profile.addStage("adf", buildTime);
+    profile.counters = counters;
+    const uint64_t numLeaves = builder.getLeaves().size();
+    profile.voxels = 27*numLeaves;
+    log << "Adaptive field built in " << buildTime.getWallSeconds() << " s using " << pool.size() << " thread(s): "
+        << builder.getNodes().size() << " nodes, " << numLeaves << " leaves (deepest at level " << builder.getMaxLeafDepth() << ")." << std::endl;
+    log << "Issued " << counters.distanceQueries << " distance queries and " << counters.insideTests << " inside tests." << std::endl;
+
+    Stopwatch writeTime;
+    writeTime.start();
+    if (!writeAdaptiveField(settings.outputPath, builder, transform))
+        return false;
+    writeTime.stop();
+    profile.addStage("write", writeTime);
+    const uint64_t bytes = sizeof(AdaptiveFieldHeader) + builder.getNodes().size()*sizeof(uint32_t) + builder.getLeaves().size()*sizeof(AdaptiveLeaf);
+    const uint64_t denseBytes = static_cast<uint64_t>(latticeSize)*static_cast<uint64_t>(latticeSize)*static_cast<uint64_t>(latticeSize)*sizeof(float);
+    log << "Stored " << bytes << " bytes, " << static_cast<double>(bytes) / static_cast<double>(denseBytes)
+        << " of the dense float lattice." << std::endl;
+
+    // Unclamped floats, compared without a band.
+    const FieldOptions errorOptions = {latticeSize, settings.isSigned, false, false, std::numeric_limits<float>::infinity(), VoxelType::F32,
+                                       {latticeSize, latticeSize, latticeSize}};
+    reportApproximationError(pool, "ADF", [&builder](const int x, const int y, const int z) { return builder.sample(x, y, z); },
+                             *mesh.distance, *sign, errorOptions, log, profile, "adf_error");
+    return true;
+}
+
+// Composes the fields of a recipe (--compose) into a new signed field, without their meshes. The
+// grid is fitted to the inputs' placed grids like a mesh's bounds, so --size, --dims and
+// --voxel-size apply as in generation. Where the result is not exact, the bounds are reported.
+bool composeFields(const GenerationSettings& settings, const std::string& recipePath, ThreadPool& pool, std::ostream& log,
+                   GenerationProfile& profile)
+{
+    profile.inputPath = recipePath;
+    profile.outputPath = settings.outputPath;
+    profile.isSigned = true;
+    Stopwatch total;
+    total.start();
+    profile.succeeded = runComposition(settings, recipePath, pool, log, profile);
+    total.stop();
+    profile.wallSeconds = total.getWallSeconds();
+    profile.peakMemoryMegabytes = peakResidentMegabytes();
+    return profile.succeeded;
+}
+
+bool runComposition(const GenerationSettings& settings, const std::string& recipePath, ThreadPool& pool, std::ostream& log,
+                    GenerationProfile& profile)
+{
+    Stopwatch loadTime;
+    loadTime.start();
+    std::vector<ComposeStep> steps;
+    FieldComposer composer;
+    if (!readComposeRecipe(recipePath, steps) || !composer.load(steps, log))
+        return false;
+    loadTime.stop();
+    profile.addStage("load", loadTime);
+
+    Vec3 boundsMin, boundsMax;
+    composer.getBounds(boundsMin, boundsMax);
+    int gridDims[3];
+    const UnitCubeTransform transform = fitMeshBounds(settings, boundsMin, boundsMax, gridDims);
+    FieldOptions fieldOptions = makeFieldOptions(settings, gridDims);
+    // Beyond the inputs' bands their distances are only known to be further.
+    fieldOptions.band = std::min(fieldOptions.band, composer.getBand() * transform.scale);
+    profile.size = fieldOptions.size;
+    if (isBoxGrid(settings) && !reportBoxGrid(fieldOptions, transform, log, profile))
+        return false;
+    if (!isBoxGrid(settings))
+        log << "Using distance field size: " << settings.size << "x" << settings.size << "x" << settings.size << std::endl;
+
+    std::unique_ptr<FieldWriter> writer = makeFieldWriter(settings, fieldOptions, transform);
+    int firstRow = 0;
+    if (!writer->open(settings.outputPath, false, firstRow))
+        return false;
+
+    const int numRows = fieldOptions.dims[1];
+    const uint64_t rowVoxels = static_cast<uint64_t>(fieldOptions.dims[0]) * static_cast<uint64_t>(fieldOptions.dims[2]);
+    const int slabRows = slabRowsFor(settings, fieldOptions);
+    std::vector<uint8_t> slab(static_cast<size_t>(rowVoxels * voxelBytes(settings.voxelType)) * static_cast<size_t>(slabRows));
+    log << "Composing " << steps.size() << " field(s), " << slabRows << " y row(s) at a time..." << std::endl;
+    Stopwatch composeTime, writeTime;
+    ComposeCounters counters = {0, 0, 0};
+    for (int y0 = 0; y0 < numRows; y0 += slabRows) {
+        const FieldSlab fieldSlab = {slab.data(), y0, std::min(y0 + slabRows, numRows)};
+        composeTime.start();
+        const ComposeCounters slabCounters = composer.composeSlab(pool, fieldOptions, transform, fieldSlab);
+        composeTime.stop();
+        counters.boundVoxels += slabCounters.boundVoxels;
+        counters.blendedVoxels += slabCounters.blendedVoxels;
+        counters.extrapolatedVoxels += slabCounters.extrapolatedVoxels;
+        writeTime.start();
+        const bool written = writer->write(fieldSlab);
+        writeTime.stop();
+        if (!written)
+            return false;
+    }
+    writeTime.start();
+    if (!writer->close())
+        return false;
+    writeTime.stop();
+    profile.addStage("compose", composeTime);
+    profile.addStage("write", writeTime);
+    profile.voxels = fieldOptions.numVoxels();
+
+    const double seconds = std::max(composeTime.getWallSeconds(), 1e-9);
+    log << "Composed " << profile.voxels << " voxels in " << composeTime.getWallSeconds() << " s using " << pool.size()
+        << " thread(s) (" << static_cast<double>(profile.voxels) / seconds << " voxels/s)." << std::endl;
+    // Errors in voxels of the output, next to its own quantization step.
+    const float toVoxels = transform.scale * static_cast<float>(fieldOptions.size);
+    float outputStep, outputBias;
+    voxelDecoding(fieldOptions, outputStep, outputBias);
+    if (settings.voxelType == VoxelType::F32)
+        outputStep = 0.f;
+    outputStep *= static_cast<float>(fieldOptions.size);
+    log << "Resampling error at most " << composer.getResamplingBound() * toVoxels << " voxel(s) (plus the output quantization step of "
+        << outputStep << " voxel(s)) wherever the result is exact." << std::endl;
+    log << "Not exact: " << counters.boundVoxels << " voxel(s) where a union or intersection only bounds the distance from below, "
+        << counters.blendedVoxels << " voxel(s) within a smooth union's blend (lowered by at most " << composer.getBlendBound() * toVoxels
+        << " voxel(s)), " << counters.extrapolatedVoxels << " voxel(s) extrapolated beyond an input's grid (lower bounds)." << std::endl;
+    return true;
+}
+
+// Meshes of the query service (--serve): every instance of the file's nodes flattened into one soup
+// in scene space, the triangles in the order of the instances.
+bool loadQueryMesh(const std::string& path, std::vector<float>& positions, std::vector<uint32_t>& indices, std::ostream& log)
+{
+    static thread_local Assimp::Importer assImport;
+    const aiScene* scene = assImport.ReadFile(path, aiProcess_Triangulate | aiProcess_JoinIdenticalVertices);
+    if (!scene) {
+        log << "Assimp failed to import mesh: " << assImport.GetErrorString() << std::endl;
+        return false;
+    }
+    std::vector<NodeInstance> nodeInstances;
+    collectInstances(scene->mRootNode, aiMatrix4x4(), nodeInstances);
+    for (const NodeInstance& nodeInstance : nodeInstances) {
+        const aiMesh* mesh = scene->mMeshes[nodeInstance.mesh];
+        const AffineTransform toScene = toAffine(nodeInstance.transform);
+        const uint32_t firstVertex = static_cast<uint32_t>(positions.size() / 3);
+        for (unsigned int v = 0; v < mesh->mNumVertices; ++v) {
+            const Vec3 p = toScene.apply(Vec3(mesh->mVertices[v].x, mesh->mVertices[v].y, mesh->mVertices[v].z));
+            positions.insert(positions.end(), {p.x, p.y, p.z});
+        }
+        for (unsigned int f = 0; f < mesh->mNumFaces; ++f) {
+            const aiFace& face = mesh->mFaces[f];
+            if (face.mNumIndices == 3) {
+                for (unsigned int k = 0; k < 3; ++k)
+                    indices.push_back(firstVertex + face.mIndices[k]);
+            }
+        }
+    }
+    assImport.FreeScene();
+    return true;
+}
+
+// Whether every level of a pyramid (each half the size of the next) can be stored in the layout.
+bool layoutSupportsLevels(const VoxelLayout layout, const int size, const int levels)
+{
+    for (int level = 0; level < levels; ++level) {
+        if (!layoutSupportsSize(layout, static_cast<uint32_t>(size >> level)))
+            return false;
+    }
+    return true;
+}
+
+// Box grid dims as "X,Y,Z", each at least 2.
+bool parseDims(const std::string& text, int dims[3])
+{
+    std::istringstream fields(text);
+    char separators[2];
+    if (!(fields >> dims[0] >> separators[0] >> dims[1] >> separators[1] >> dims[2]) || separators[0] != ',' || separators[1] != ','
+        || !fields.eof())
+        return false;
+    return dims[0] >= 2 && dims[1] >= 2 && dims[2] >= 2;
+}
+
+// Batch manifest: one mesh per line as "input output size [signed|unsigned]", all other settings
+// come from the command line. Empty lines and lines starting with # are skipped.
+bool readManifest(const std::string& path, const GenerationSettings& defaults, std::vector<GenerationSettings>& jobs)
+{
+    std::ifstream stream(path);
+    if (!stream) {
+        std::cout << "Failed to open batch manifest!" << std::endl;
+        return false;
+    }
+
+    std::string line;
+    for (int lineNumber = 1; std::getline(stream, line); ++lineNumber) {
+        std::istringstream fields(line);
+        GenerationSettings job = defaults;
+        std::string sizeField, signedField;
+        if (!(fields >> job.inputMeshPath) || job.inputMeshPath[0] == '#')
+            continue;
+        fields >> job.outputPath >> sizeField >> signedField;
+        try {
+            job.size = std::stoi(sizeField);
+        } catch (const std::exception&) {
+            job.size = 0;
+        }
+        if (job.outputPath.empty() || job.size < 2 || (job.size >> (job.levels-1)) < 2 || job.size % (1 << (job.levels-1)) != 0
+            || (job.mode == FieldMode::ADF && (job.size & (job.size - 1)) != 0)
+            || !layoutSupportsLevels(job.layout, job.size, job.levels)
+            || (!signedField.empty() && signedField != "signed" && signedField != "unsigned")) {
+            std::cout << "Invalid batch manifest entry on line " << lineNumber << "!" << std::endl;
+            return false;
+        }
+        if (!signedField.empty())
+            job.isSigned = (signedField == "signed");
+        jobs.push_back(job);
+    }
+    return true;
+}
+
 int main(int argc, char** argv)
 {
     STATIC_ASSERT(EXIT_STATUS_INC == 0);
@@ -133,116 +1572,380 @@ int main(int argc, char** argv)
     if (args.size() == 1
         || cmdOptionExists(args, "-h")
         || cmdOptionExists(args, "--help")) {
-        std::cout << "Example usage: dfgen -i path/to/mesh.obj -o distfield.bin --size 64 --signed --verbose" << std::endl;
+        std::cout << "Example usage: dfgen -i path/to/mesh.obj -o distfield.bin --size 64 --signed --threads 8 --sign-method scanline --engine simd --no-coherence --slab-rows 32 --resume --format container --precision u16 --compression zstd --band 4 --cache path/to/cache --profile profile.json --verbose" << std::endl;
+        std::cout << "Pyramid usage: dfgen -i path/to/mesh.obj -o distfield.bin --size 256 --levels 4 (writes distfield_32.bin to distfield_256.bin)" << std::endl;
+        std::cout << "Layout usage:  dfgen -i path/to/mesh.obj -o distfield.bin --size 256 --format container --precision f32 --layout morton (or linear, bricks4, bricks8)" << std::endl;
+        std::cout << "Channel usage: dfgen -i path/to/mesh.obj -o distfield.bin --size 64 --signed --channels dist,grad,closest,primid --channel-layout interleaved" << std::endl;
+        std::cout << "Adaptive usage: dfgen -i path/to/mesh.obj -o distfield.adf --size 512 --signed --mode adf --adf-tolerance 0.1 (voxels)" << std::endl;
+        std::cout << "Animation usage: dfgen -i path/to/animated.fbx -o distfield.bin --size 128 --signed --engine simd --sign-method scanline --frames 60 (writes distfield_f0000.bin to distfield_f0059.bin)" << std::endl;
+        std::cout << "Box grid usage: dfgen -i path/to/mesh.obj -o distfield.bin --signed --format container --voxel-size 0.01 --padding 2 (or --dims 256,64,128, instead of --size)" << std::endl;
+        std::cout << "Preview usage: dfgen -i path/to/mesh.obj -o preview.bin --size 512 --signed --mode edt (approximate, reports its error)" << std::endl;
+        std::cout << "Compose usage: dfgen --compose recipe.txt -o composed.dfc --size 128 --format container --precision u16 (one \"op field.dfc [translate x y z] [rotate x y z degrees] [blend k]\" per line)" << std::endl;
+        std::cout << "Serve usage:   dfgen --serve /tmp/dfgen.sock --threads 8 --max-meshes 8 (point queries of resident meshes, see dfquery)" << std::endl;
+        std::cout << "Batch usage:   dfgen --batch manifest.txt --threads 8 (one \"input output size [signed|unsigned]\" per line)" << std::endl;
         return EXIT_STATUS_INC;
     }
 
-    const std::string inputMeshPath = getCmdOption(args, "-i");
-    if (inputMeshPath.length() == 0) {
+    GenerationSettings settings;
+    const std::string batchManifestPath = getCmdOption(args, "--batch");
+    const std::string composeRecipePath = getCmdOption(args, "--compose");
+    const std::string serveSocketPath = getCmdOption(args, "--serve");
+    settings.inputMeshPath = getCmdOption(args, "-i");
+    if (batchManifestPath.length() == 0 && composeRecipePath.length() == 0 && serveSocketPath.length() == 0
+        && settings.inputMeshPath.length() == 0) {
         std::cout << "Input mesh file must be specified (-i)!" << std::endl;
         return EXIT_STATUS_INC;
     }
 
-    const std::string outDistanceFieldPath = getCmdOption(args, "-o");
-    if (outDistanceFieldPath.length() == 0) {
+    settings.outputPath = getCmdOption(args, "-o");
+    if (batchManifestPath.length() == 0 && serveSocketPath.length() == 0 && settings.outputPath.length() == 0) {
         std::cout << "Output file must be specified (-o)!" << std::endl;
         return EXIT_STATUS_INC;
     }
 
-    std::ofstream outStream(outDistanceFieldPath, std::ios::binary);
-    if (!outStream) {
-        std::cout << "Failed to open output file!" << std::endl;
+    settings.format = OutputFormat::Raw;
+    const std::string formatArg = getCmdOption(args, "--format");
+    if (formatArg.length() > 0 && !parseOutputFormat(formatArg, settings.format)) {
+        std::cout << "Unknown --format (use raw, bricks or container)!" << std::endl;
+        return EXIT_STATUS_INC;
+    }
+
+    settings.layout = VoxelLayout::Linear;
+    const std::string layoutArg = getCmdOption(args, "--layout");
+    if (layoutArg.length() > 0 && !parseVoxelLayout(layoutArg, settings.layout)) {
+        std::cout << "Unknown --layout (use linear, morton, bricks4 or bricks8)!" << std::endl;
+        return EXIT_STATUS_INC;
+    }
+    if (settings.layout != VoxelLayout::Linear && settings.format == OutputFormat::Bricks) {
+        std::cout << "The bricks format has its own layout (drop --layout)!" << std::endl;
         return EXIT_STATUS_INC;
     }
 
-    int k_distanceFieldSize = 64;
+    settings.voxelType = VoxelType::U8;
+    const std::string precisionArg = getCmdOption(args, "--precision");
+    if (precisionArg.length() > 0 && !parseVoxelType(precisionArg, settings.voxelType)) {
+        std::cout << "Unknown --precision (use u8, u16 or f32)!" << std::endl;
+        return EXIT_STATUS_INC;
+    }
+
+    settings.compression = Compression::None;
+    const std::string compressionArg = getCmdOption(args, "--compression");
+    if (compressionArg.length() > 0 && !parseCompression(compressionArg, settings.compression)) {
+        std::cout << "Unknown --compression (use none, lz4 or zstd)!" << std::endl;
+        return EXIT_STATUS_INC;
+    }
+    if (settings.compression != Compression::None && settings.format != OutputFormat::Container) {
+        std::cout << "Only the container format can be compressed!" << std::endl;
+        return EXIT_STATUS_INC;
+    }
+
+    settings.size = 64;
     const std::string sizeArg = getCmdOption(args, "--size");
     if (sizeArg.length() > 0) {
         try {
-            k_distanceFieldSize = std::stoi(sizeArg);
+            settings.size = std::stoi(sizeArg);
         } catch (const std::exception&) {
             std::cout << "Failed to parse --size arg!" << std::endl;
         }
-        ASSERT(k_distanceFieldSize >= 2);
+        ASSERT(settings.size >= 2);
     }
-    std::cout << "Using distance field size: " << k_distanceFieldSize << "x"
-                                               << k_distanceFieldSize << "x"
-                                               << k_distanceFieldSize << std::endl;
 
-    const bool optionVerbose = cmdOptionExists(args, "--verbose");
-    const bool optionSigned = cmdOptionExists(args, "--signed");
+    settings.levels = 1;
+    const std::string levelsArg = getCmdOption(args, "--levels");
+    if (levelsArg.length() > 0) {
+        try {
+            settings.levels = std::stoi(levelsArg);
+        } catch (const std::exception&) {
+            std::cout << "Failed to parse --levels arg!" << std::endl;
+        }
+        ASSERT(settings.levels >= 1);
+    }
+    if (settings.levels > 1 && (settings.levels > 30 || (settings.size >> (settings.levels-1)) < 2
+                                || settings.size % (1 << (settings.levels-1)) != 0)) {
+        std::cout << "--size must be a multiple of 2^(levels-1), with the coarsest level at least 2!" << std::endl;
+        return EXIT_STATUS_INC;
+    }
 
-    std::cout << "Distace field will be " << (optionSigned ? "signed." : "unsigned.") << std::endl;
-    if (optionVerbose) {
-        Assimp::DefaultLogger::create("", Assimp::Logger::VERBOSE, aiDefaultLogStream_STDOUT);
+    unsigned int numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    const std::string threadsArg = getCmdOption(args, "--threads");
+    if (threadsArg.length() > 0) {
+        try {
+            numThreads = static_cast<unsigned int>(std::stoul(threadsArg));
+        } catch (const std::exception&) {
+            std::cout << "Failed to parse --threads arg!" << std::endl;
+        }
+        ASSERT(numThreads >= 1);
     }
+    std::cout << "Using " << numThreads << " thread(s)." << std::endl;
 
-    Assimp::Importer assImport;
-    const aiScene* assScene = assImport.ReadFile(inputMeshPath,
-                                                 aiProcess_Triangulate | aiProcess_JoinIdenticalVertices);
-    if (!assScene) {
-        std::cout << "Assimp failed to import mesh: " << assImport.GetErrorString() << std::endl;
+    settings.slabRows = 0;
+    const std::string slabRowsArg = getCmdOption(args, "--slab-rows");
+    if (slabRowsArg.length() > 0) {
+        try {
+            settings.slabRows = std::stoi(slabRowsArg);
+        } catch (const std::exception&) {
+            std::cout << "Failed to parse --slab-rows arg!" << std::endl;
+        }
+        ASSERT(settings.slabRows >= 1);
+    }
+
+    settings.verbose = cmdOptionExists(args, "--verbose");
+    settings.resume = cmdOptionExists(args, "--resume");
+    settings.isSigned = cmdOptionExists(args, "--signed");
+    settings.cull = !cmdOptionExists(args, "--no-cull");
+    settings.validate = cmdOptionExists(args, "--validate");
+    settings.coherent = !cmdOptionExists(args, "--no-coherence");
+
+    settings.engine = DistanceEngineType::CGAL;
+    const std::string engineArg = getCmdOption(args, "--engine");
+    if (engineArg.length() > 0 && !parseDistanceEngine(engineArg, settings.engine)) {
+        std::cout << "Unknown --engine (use cgal or simd)!" << std::endl;
         return EXIT_STATUS_INC;
     }
 
-    if (assScene->mNumMeshes != 1) {
-        std::cout << "Only a single mesh currently supported!" << std::endl;
+    settings.signMethod = SignMethod::Domain;
+    const std::string signMethodArg = getCmdOption(args, "--sign-method");
+    if (signMethodArg.length() > 0 && !parseSignMethod(signMethodArg, settings.signMethod)) {
+        std::cout << "Unknown --sign-method (use domain, scanline or winding)!" << std::endl;
         return EXIT_STATUS_INC;
     }
 
-    const aiMesh* mesh = assScene->mMeshes[0];
+    // Narrow band around the surface in voxels, distances further away are clamped. Makes most
+    // bricks uniform, so the bricks format uses one brick by default.
+    settings.bandVoxels = (settings.format == OutputFormat::Bricks) ? static_cast<float>(k_brickSize) : 0.f;
+    const std::string bandArg = getCmdOption(args, "--band");
+    if (bandArg.length() > 0) {
+        try {
+            settings.bandVoxels = std::stof(bandArg);
+        } catch (const std::exception&) {
+            std::cout << "Failed to parse --band arg!" << std::endl;
+        }
+        ASSERT(settings.bandVoxels > 0.f);
+    }
 
-    // Build polyhedron structure out of triangles.
-    CGALBuilder<Polyhedron::HalfedgeDS> builder(mesh);
-    Polyhedron polyhedron;
-    polyhedron.delegate(builder);
-    PolyhedralMeshDomain pmd(polyhedron);
-    PolyhedralMeshDomain::Is_in_domain isInDomain = pmd.is_in_domain_object();
+    settings.cacheDirectory = getCmdOption(args, "--cache");
 
-    // Construct AABB tree.
-    AABBTree tree(polyhedron.facets_begin(), polyhedron.facets_end(), polyhedron);
-    tree.accelerate_distance_queries();
+    settings.mode = FieldMode::Exact;
+    const std::string modeArg = getCmdOption(args, "--mode");
+    if (modeArg.length() > 0 && !parseFieldMode(modeArg, settings.mode)) {
+        std::cout << "Unknown --mode (use exact, edt or adf)!" << std::endl;
+        return EXIT_STATUS_INC;
+    }
+    settings.channels = {false, false, false, false};
+    const std::string channelsArg = getCmdOption(args, "--channels");
+    if (channelsArg.length() > 0 && !parseChannels(channelsArg, settings.channels)) {
+        std::cout << "Unknown --channels (a comma separated list of dist, grad, closest and primid)!" << std::endl;
+        return EXIT_STATUS_INC;
+    }
+    const std::string channelLayoutArg = getCmdOption(args, "--channel-layout");
+    if (channelLayoutArg.length() > 0 && !parseChannelLayout(channelLayoutArg, settings.channels.interleaved)) {
+        std::cout << "Unknown --channel-layout (use planar or interleaved)!" << std::endl;
+        return EXIT_STATUS_INC;
+    }
+    if (settings.channels.any() && (settings.mode == FieldMode::EDT || settings.resume || !settings.cacheDirectory.empty())) {
+        std::cout << "Channels need exact distances and are neither resumed nor cached (drop --mode edt, --resume and --cache)!" << std::endl;
+        return EXIT_STATUS_INC;
+    }
+    settings.adfTolerance = k_defaultAdfTolerance;
+    const std::string adfToleranceArg = getCmdOption(args, "--adf-tolerance");
+    if (adfToleranceArg.length() > 0) {
+        try {
+            settings.adfTolerance = std::stof(adfToleranceArg);
+        } catch (const std::exception&) {
+            std::cout << "Failed to parse --adf-tolerance arg!" << std::endl;
+        }
+        ASSERT(settings.adfTolerance > 0.f);
+    }
+    if (settings.mode == FieldMode::ADF && (settings.levels > 1 || settings.validate || settings.resume || settings.channels.any()
+                                            || !settings.cacheDirectory.empty() || formatArg.length() > 0)) {
+        std::cout << "ADF mode writes its own format and reports its own error (drop --levels, --validate, --resume, --channels, --cache and --format)!" << std::endl;
+        return EXIT_STATUS_INC;
+    }
+    if (settings.mode == FieldMode::ADF && (settings.size & (settings.size - 1)) != 0) {
+        std::cout << "ADF mode needs a power of two --size!" << std::endl;
+        return EXIT_STATUS_INC;
+    }
+    if (settings.mode == FieldMode::ADF && settings.layout != VoxelLayout::Linear) {
+        std::cout << "ADF mode writes its own format (drop --layout)!" << std::endl;
+        return EXIT_STATUS_INC;
+    }
+    if (batchManifestPath.length() == 0 && !layoutSupportsLevels(settings.layout, settings.size, settings.levels)) {
+        std::cout << "The morton layout needs power of two sizes, bricks4 and bricks8 multiples of 4 and 8 (at every level)!" << std::endl;
+        return EXIT_STATUS_INC;
+    }
+    if (settings.layout == VoxelLayout::Morton && (settings.resume || settings.compression != Compression::None)) {
+        std::cout << "The morton layout is written block by block out of order (drop --resume and --compression)!" << std::endl;
+        return EXIT_STATUS_INC;
+    }
+    if (settings.levels > 1 && !settings.cacheDirectory.empty()) {
+        std::cout << "Pyramids (--levels) are not cached (drop --cache)!" << std::endl;
+        return EXIT_STATUS_INC;
+    }
+    if (settings.mode == FieldMode::EDT && (settings.validate || !settings.cacheDirectory.empty())) {
+        std::cout << "EDT mode reports its own error and is not cached (drop --validate and --cache)!" << std::endl;
+        return EXIT_STATUS_INC;
+    }
 
-    // Compute the distance field on a 3D grid in the unit cube.
-    // Can be stored in a e.g. 4096x64 2D texture (64x64 y slices side by side horizontally).
-    // Distance quantized to 256 values. Max distance is either 1 unit (if unsigned) or 0.5 (signed).
-    // If unsigned distance field is requested, values inside the mesh are set to 0.
-    uint8_t* distanceField = new uint8_t[k_distanceFieldSize * k_distanceFieldSize * k_distanceFieldSize];
-
-    std::cout << "In progress..." << std::endl;
-    for (int y = 0; y < k_distanceFieldSize; ++y) {
-    for (int z = 0; z < k_distanceFieldSize; ++z) {
-    for (int x = 0; x < k_distanceFieldSize; ++x) {
-        const float step = 1.f / static_cast<float>(k_distanceFieldSize);
-        const float off = step / 2.f;
-        const Point_3 query(x*step + off,
-                            y*step + off,
-                            z*step + off);
-        const int index = y*k_distanceFieldSize*k_distanceFieldSize + z*k_distanceFieldSize + x;
-        const int domain = isInDomain(query).get_value_or(0);
-        if (!optionSigned && domain == 1) {
-            // Inside or on boundary. We don't want signed distance, so we just set the field to 0.
-            // We don't need to actually issue a distance query in this special case.
-            distanceField[index] = 0;
-            continue;
+    settings.frames = 0;
+    const std::string framesArg = getCmdOption(args, "--frames");
+    if (framesArg.length() > 0) {
+        try {
+            settings.frames = std::stoi(framesArg);
+        } catch (const std::exception&) {
+            std::cout << "Failed to parse --frames arg!" << std::endl;
         }
+        ASSERT(settings.frames >= 1);
+    }
+    if (settings.frames > 0 && (settings.engine != DistanceEngineType::Simd || settings.signMethod == SignMethod::Domain
+                                || settings.mode != FieldMode::Exact || settings.levels > 1 || settings.validate || settings.resume
+                                || settings.channels.any() || !settings.cacheDirectory.empty())) {
+        std::cout << "Frames refit the simd tree and reuse the previous frame's voxels (use --engine simd, --sign-method scanline or winding,"
+                  << " and drop --mode, --levels, --validate, --resume, --channels and --cache)!" << std::endl;
+        return EXIT_STATUS_INC;
+    }
 
-        const float dist = std::sqrt(static_cast<float>(tree.squared_distance(query)));
-        if (optionSigned) {
-            const float sign = (domain == 1) ? -1.f : 1.f; // Negative inside.
-            const float signedClampedDist = clamp(sign*dist + 0.5f, 0.f, 1.f); // 0.f to 1.f (from max negative distance -0.5 to max positive 0.5).
-            distanceField[index] = static_cast<uint8_t>(signedClampedDist*255.f);
+    // Box grids fit the mesh with cubic voxels, the grid's dims or the voxel size follow from the other.
+    std::fill(settings.dims, settings.dims + 3, 0);
+    const std::string dimsArg = getCmdOption(args, "--dims");
+    if (dimsArg.length() > 0 && !parseDims(dimsArg, settings.dims)) {
+        std::cout << "Failed to parse --dims arg (X,Y,Z, each at least 2)!" << std::endl;
+        return EXIT_STATUS_INC;
+    }
+    settings.voxelSize = 0.f;
+    const std::string voxelSizeArg = getCmdOption(args, "--voxel-size");
+    if (voxelSizeArg.length() > 0) {
+        try {
+            settings.voxelSize = std::stof(voxelSizeArg);
+        } catch (const std::exception&) {
+            std::cout << "Failed to parse --voxel-size arg!" << std::endl;
         }
-        else
-            distanceField[index] = static_cast<uint8_t>(std::min(dist, 1.f)*255.f);
+        ASSERT(settings.voxelSize > 0.f);
     }
+    settings.paddingVoxels = k_defaultPaddingVoxels;
+    const std::string paddingArg = getCmdOption(args, "--padding");
+    if (paddingArg.length() > 0) {
+        try {
+            settings.paddingVoxels = std::stof(paddingArg);
+        } catch (const std::exception&) {
+            std::cout << "Failed to parse --padding arg!" << std::endl;
+        }
+        ASSERT(settings.paddingVoxels >= 0.f);
     }
+    if (isBoxGrid(settings)) {
+        if ((settings.dims[0] > 0 && settings.voxelSize > 0.f) || sizeArg.length() > 0) {
+            std::cout << "A box grid is sized by either --dims or --voxel-size (drop the other and --size)!" << std::endl;
+            return EXIT_STATUS_INC;
+        }
+        const int minDim = std::min(settings.dims[0], std::min(settings.dims[1], settings.dims[2]));
+        if (settings.dims[0] > 0 && 2.f*settings.paddingVoxels >= static_cast<float>(minDim)) {
+            std::cout << "--padding leaves no room for the mesh in --dims!" << std::endl;
+            return EXIT_STATUS_INC;
+        }
+        if (settings.mode != FieldMode::Exact || settings.levels > 1 || !settings.cacheDirectory.empty()
+            || settings.format == OutputFormat::Bricks || settings.layout != VoxelLayout::Linear || batchManifestPath.length() > 0) {
+            std::cout << "Box grids are exact single level fields in the linear layout (drop --mode, --levels, --cache, --format bricks, --layout and --batch)!" << std::endl;
+            return EXIT_STATUS_INC;
+        }
+    }
+    else if (paddingArg.length() > 0) {
+        std::cout << "--padding applies to box grids (add --dims or --voxel-size)!" << std::endl;
+        return EXIT_STATUS_INC;
+    }
+    // Composition reads signed fields and writes one, it never meshes.
+    if (composeRecipePath.length() > 0) {
+        if (settings.inputMeshPath.length() > 0 || batchManifestPath.length() > 0 || settings.mode != FieldMode::Exact
+            || settings.levels > 1 || settings.frames > 0 || settings.validate || settings.resume || settings.channels.any()
+            || !settings.cacheDirectory.empty()) {
+            std::cout << "Composition reads fields, not meshes (drop -i, --batch, --mode, --levels, --frames, --validate, --resume, --channels and --cache)!" << std::endl;
+            return EXIT_STATUS_INC;
+        }
+        settings.isSigned = true;
+    }
+    // The service answers point queries of any mesh, it takes no generation options.
+    size_t maxResidentMeshes = k_defaultResidentMeshes;
+    const std::string maxMeshesArg = getCmdOption(args, "--max-meshes");
+    if (maxMeshesArg.length() > 0) {
+        try {
+            maxResidentMeshes = static_cast<size_t>(std::stoul(maxMeshesArg));
+        } catch (const std::exception&) {
+            std::cout << "Failed to parse --max-meshes arg!" << std::endl;
+        }
+        ASSERT(maxResidentMeshes >= 1);
+    }
+    if (serveSocketPath.length() > 0 && (settings.inputMeshPath.length() > 0 || settings.outputPath.length() > 0
+                                         || batchManifestPath.length() > 0 || composeRecipePath.length() > 0)) {
+        std::cout << "The query service takes meshes with every request (drop -i, -o, --batch and --compose)!" << std::endl;
+        return EXIT_STATUS_INC;
+    }
+    const std::string profilePath = getCmdOption(args, "--profile");
+
+    if (settings.verbose) {
+        Assimp::DefaultLogger::create("", Assimp::Logger::VERBOSE, aiDefaultLogStream_STDOUT);
+    }
+
+    ThreadPool pool(numThreads);
+    if (serveSocketPath.length() > 0) {
+        QueryService service(loadQueryMesh, pool, maxResidentMeshes);
+        if (!service.run(serveSocketPath, std::cout))
+            return EXIT_STATUS_INC;
+        return 0;
+    }
+    if (batchManifestPath.length() == 0) {
+        std::vector<GenerationProfile> profiles(1);
+        const bool succeeded = (composeRecipePath.length() > 0) ? composeFields(settings, composeRecipePath, pool, std::cout, profiles[0])
+                                                                : generateField(settings, pool, std::cout, profiles[0]);
+        if (profilePath.length() > 0 && !writeProfile(profilePath, profiles, pool.size(), profiles[0].wallSeconds))
+            return EXIT_STATUS_INC;
+        if (!succeeded)
+            return EXIT_STATUS_INC;
+        std::cout << "Computation complete (peak resident memory " << peakResidentMegabytes() << " MB)." << std::endl;
+        return 0;
     }
 
-    outStream.write(reinterpret_cast<char*>(distanceField),
-                    k_distanceFieldSize * k_distanceFieldSize * k_distanceFieldSize * 1);
-    outStream.close();
-    delete [] distanceField;
-    std::cout << "Computation complete." << std::endl;
-    return 0;
+    std::vector<GenerationSettings> jobs;
+    if (!readManifest(batchManifestPath, settings, jobs))
+        return EXIT_STATUS_INC;
+
+    // All meshes share the pool: every mesh is a task whose voxels are tasks as well, so threads
+    // left idle by one mesh (its setup, its writes, its last slab) work on the others. The
+    // largest grids start first, the small ones fill the gaps.
+    std::vector<size_t> order(jobs.size());
+    for (size_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    std::stable_sort(order.begin(), order.end(), [&jobs](const size_t a, const size_t b) { return jobs[a].size > jobs[b].size; });
+
+    std::cout << "Processing " << jobs.size() << " mesh(es)..." << std::endl;
+    const auto batchStartTime = std::chrono::steady_clock::now();
+    std::mutex logMutex;
+    std::atomic<uint64_t> batchVoxels(0);
+    std::atomic<size_t> numFailed(0);
+    std::vector<GenerationProfile> profiles(jobs.size()); // In manifest order.
+    auto runJob = [&](const size_t orderIndex) {
+        const GenerationSettings& job = jobs[order[orderIndex]];
+        GenerationProfile& profile = profiles[order[orderIndex]];
+        std::ostringstream log;
+        const bool succeeded = generateField(job, pool, log, profile);
+        if (succeeded)
+            batchVoxels += profile.voxels;
+        else
+            numFailed++;
+
+        std::lock_guard<std::mutex> lock(logMutex);
+        std::cout << (succeeded ? "Done " : "FAILED ") << job.inputMeshPath << " -> " << job.outputPath
+                  << " in " << profile.wallSeconds << " s." << std::endl;
+        if (settings.verbose || !succeeded)
+            std::cout << log.str();
+    };
+    parallelFor(pool, jobs.size(), runJob);
+
+    const std::chrono::duration<double> batchElapsed = std::chrono::steady_clock::now() - batchStartTime;
+    const double seconds = std::max(batchElapsed.count(), 1e-9);
+    std::cout << "Batch complete: " << jobs.size() - numFailed << " of " << jobs.size() << " mesh(es), "
+              << batchVoxels << " voxels in " << batchElapsed.count() << " s ("
+              << static_cast<double>(jobs.size() - numFailed) / seconds << " meshes/s, "
+              << static_cast<double>(batchVoxels) / seconds << " voxels/s), peak resident memory "
+              << peakResidentMegabytes() << " MB." << std::endl;
+    if (profilePath.length() > 0 && !writeProfile(profilePath, profiles, pool.size(), batchElapsed.count()))
+        return EXIT_STATUS_INC;
+    return (numFailed > 0) ? EXIT_STATUS_INC : 0;
 }
@@ -0,0 +1,533 @@
+#include "output.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+
+#include "brickfield.h"
+
+#ifdef DFGEN_WITH_LZ4
+#include <lz4.h>
+#endif
+#ifdef DFGEN_WITH_ZSTD
+#include <zstd.h>
+#endif
+
+static_assert(FieldEvaluator::k_rootNodeSize % k_brickSize == 0, "Slabs must hold whole bricks");
+
+namespace
+{
+
+const int k_zstdLevel = 3;
+
+uint64_t alignUp(const uint64_t offset, const uint64_t alignment)
+{
+    return (offset + alignment - 1) / alignment * alignment;
+}
+
+// Resets dst to the compressed src. Only called with a supported compression.
+bool compressChunk(const Compression compression, const uint8_t* src, const size_t bytes, std::vector<uint8_t>& dst)
+{
+#ifdef DFGEN_WITH_LZ4
+    if (compression == Compression::LZ4) {
+        dst.resize(static_cast<size_t>(LZ4_compressBound(static_cast<int>(bytes))));
+        const int compressedBytes = LZ4_compress_default(reinterpret_cast<const char*>(src), reinterpret_cast<char*>(dst.data()),
+                                                         static_cast<int>(bytes), static_cast<int>(dst.size()));
+        dst.resize(static_cast<size_t>(std::max(compressedBytes, 0)));
+        return compressedBytes > 0;
+    }
+#endif
+#ifdef DFGEN_WITH_ZSTD
+    if (compression == Compression::Zstd) {
+        dst.resize(ZSTD_compressBound(bytes));
+        const size_t compressedBytes = ZSTD_compress(dst.data(), dst.size(), src, bytes, k_zstdLevel);
+        if (ZSTD_isError(compressedBytes))
+            return false;
+        dst.resize(compressedBytes);
+        return true;
+    }
+#endif
+    (void)compression; (void)src; (void)bytes; (void)dst;
+    return false;
+}
+
+// "field.bin" with the channel: "field.grad.bin".
+std::string channelPath(const std::string& fieldPath, const std::string& channel)
+{
+    const size_t slash = fieldPath.find_last_of("/\\");
+    size_t dot = fieldPath.find_last_of('.');
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        dot = fieldPath.length();
+    return fieldPath.substr(0, dot) + "." + channel + fieldPath.substr(dot);
+}
+
+}
+
+bool isCompressionSupported(const Compression compression)
+{
+    switch (compression) {
+    case Compression::None:
+        return true;
+    case Compression::LZ4:
+#ifdef DFGEN_WITH_LZ4
+        return true;
+#else
+        return false;
+#endif
+    case Compression::Zstd:
+#ifdef DFGEN_WITH_ZSTD
+        return true;
+#else
+        return false;
+#endif
+    }
+    return false;
+}
+
+LayoutReorder::LayoutReorder(const int size, const VoxelType voxelType, const VoxelLayout layout):
+    size(size), bytesPerVoxel(voxelBytes(voxelType)), layout(layout)
+{
+    for (int axis = 0; axis < 3; ++axis) {
+        for (int i = 0; i < size; ++i)
+            axisOffsets[axis].push_back(layoutAxisOffset(layout, static_cast<uint32_t>(size), axis, static_cast<uint32_t>(i)));
+    }
+}
+
+size_t LayoutReorder::runVoxels() const
+{
+    const size_t block = static_cast<size_t>(std::min(size, FieldEvaluator::k_rootNodeSize));
+    return block*block*block;
+}
+
+const uint8_t* LayoutReorder::reorder(const FieldSlab& slab)
+{
+    const size_t rowVoxels = static_cast<size_t>(size) * static_cast<size_t>(size);
+    voxels.resize(rowVoxels * static_cast<size_t>(slab.y1 - slab.y0) * bytesPerVoxel);
+    runs.clear();
+    const uint8_t* src = slab.voxels;
+    const std::vector<uint64_t>& xOffsets = axisOffsets[0];
+    if (layout != VoxelLayout::Morton) {
+        const uint64_t first = axisOffsets[1][static_cast<size_t>(slab.y0)];
+        runs.push_back(first);
+        for (int y = slab.y0; y < slab.y1; ++y) {
+        for (int z = 0; z < size; ++z) {
+            uint8_t* dst = voxels.data() + static_cast<size_t>(axisOffsets[1][static_cast<size_t>(y)] + axisOffsets[2][static_cast<size_t>(z)] - first)*bytesPerVoxel;
+            for (int x = 0; x < size; ++x, src += bytesPerVoxel)
+                std::memcpy(dst + static_cast<size_t>(xOffsets[static_cast<size_t>(x)])*bytesPerVoxel, src, bytesPerVoxel);
+        }
+        }
+        return voxels.data();
+    }
+
+    const int block = std::min(size, FieldEvaluator::k_rootNodeSize);
+    uint8_t* dst = voxels.data();
+    for (int by = slab.y0; by < slab.y1; by += block) {
+    for (int bz = 0; bz < size; bz += block) {
+    for (int bx = 0; bx < size; bx += block, dst += runVoxels()*bytesPerVoxel) {
+        const uint64_t first = voxelOffset(layout, static_cast<uint32_t>(size), static_cast<uint32_t>(bx), static_cast<uint32_t>(by), static_cast<uint32_t>(bz));
+        runs.push_back(first);
+        for (int y = by; y < by + block; ++y) {
+        for (int z = bz; z < bz + block; ++z) {
+            const uint8_t* row = src + (static_cast<size_t>(y - slab.y0)*static_cast<size_t>(size) + static_cast<size_t>(z))*static_cast<size_t>(size)*bytesPerVoxel;
+            const uint64_t rowOffset = axisOffsets[1][static_cast<size_t>(y)] + axisOffsets[2][static_cast<size_t>(z)] - first;
+            for (int x = bx; x < bx + block; ++x) {
+                std::memcpy(dst + static_cast<size_t>(rowOffset + xOffsets[static_cast<size_t>(x)])*bytesPerVoxel,
+                            row + static_cast<size_t>(x)*bytesPerVoxel, bytesPerVoxel);
+            }
+        }
+        }
+    }
+    }
+    }
+    return voxels.data();
+}
+
+bool RawFieldWriter::open(const std::string& path, const bool resume, int& firstRow)
+{
+    if (resume && layout == VoxelLayout::Morton) {
+        std::cout << "Resuming is not supported for the morton layout!" << std::endl;
+        return false;
+    }
+
+    // When resuming, keep the rows computed by an interrupted run (the file is created if missing).
+    if (resume)
+        stream.open(path, std::ios::in | std::ios::out | std::ios::binary);
+    if (!stream.is_open())
+        stream.open(path, std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!stream) {
+        std::cout << "Failed to open output file!" << std::endl;
+        return false;
+    }
+
+    // Rows are written in order, so every whole row in the file is final. Restart at the top level
+    // octree node containing the first missing row, the result is the same as of a single run.
+    const uint64_t rowBytes = rowVoxels * voxelBytes(voxelType);
+    firstRow = 0;
+    if (resume) {
+        stream.seekg(0, std::ios::end);
+        const uint64_t existingBytes = static_cast<uint64_t>(std::max<std::streamoff>(stream.tellg(), 0));
+        if (existingBytes > rowBytes * static_cast<uint64_t>(numRows)) {
+            std::cout << "Existing output is larger than the requested field, cannot resume!" << std::endl;
+            return false;
+        }
+        const int completeRows = static_cast<int>(existingBytes / rowBytes);
+        firstRow = completeRows - completeRows % FieldEvaluator::k_rootNodeSize;
+        std::cout << "Resuming at row " << firstRow << " (" << completeRows << " complete row(s) found)." << std::endl;
+    }
+    stream.seekp(static_cast<std::streamoff>(static_cast<uint64_t>(firstRow) * rowBytes));
+    return true;
+}
+
+bool RawFieldWriter::write(const FieldSlab& slab)
+{
+    const size_t slabBytes = static_cast<size_t>(rowVoxels) * static_cast<size_t>(slab.y1 - slab.y0) * voxelBytes(voxelType);
+    if (layout == VoxelLayout::Linear) {
+        stream.write(reinterpret_cast<const char*>(slab.voxels), static_cast<std::streamsize>(slabBytes));
+    }
+    else {
+        // Bricks follow the previous slab, Morton blocks are scattered over the file.
+        const uint8_t* voxels = reorder.reorder(slab);
+        if (layout != VoxelLayout::Morton) {
+            stream.write(reinterpret_cast<const char*>(voxels), static_cast<std::streamsize>(slabBytes));
+        }
+        else {
+            const size_t runBytes = reorder.runVoxels() * voxelBytes(voxelType);
+            for (size_t i = 0; i < reorder.getRuns().size(); ++i) {
+                stream.seekp(static_cast<std::streamoff>(reorder.getRuns()[i] * voxelBytes(voxelType)));
+                stream.write(reinterpret_cast<const char*>(voxels + i*runBytes), static_cast<std::streamsize>(runBytes));
+            }
+        }
+    }
+    stream.flush();
+    if (!stream) {
+        std::cout << "Failed to write output file!" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool RawFieldWriter::close()
+{
+    stream.close();
+    return true;
+}
+
+bool BrickFieldWriter::open(const std::string& path, const bool resume, int& firstRow)
+{
+    if (resume) {
+        std::cout << "Resuming is not supported by the bricks format!" << std::endl;
+        return false;
+    }
+    if (voxelType != VoxelType::U8) {
+        std::cout << "The bricks format only stores u8 voxels!" << std::endl;
+        return false;
+    }
+
+    stream.open(path, std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!stream) {
+        std::cout << "Failed to open output file!" << std::endl;
+        return false;
+    }
+
+    bricksPerAxis = (size + k_brickSize - 1) / k_brickSize;
+    numStored = 0;
+    index.assign(static_cast<size_t>(bricksPerAxis) * static_cast<size_t>(bricksPerAxis) * static_cast<size_t>(bricksPerAxis), 0);
+    firstRow = 0;
+
+    // Placeholder, rewritten once the number of stored bricks is known.
+    const BrickFieldHeader header = {};
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    return static_cast<bool>(stream);
+}
+
+bool BrickFieldWriter::write(const FieldSlab& slab)
+{
+    const size_t rowStride = static_cast<size_t>(size);
+    const size_t sliceStride = rowStride * rowStride;
+    uint8_t brick[k_brickVoxels];
+
+    for (int by = slab.y0 / k_brickSize; by*k_brickSize < slab.y1; ++by) {
+    for (int bz = 0; bz < bricksPerAxis; ++bz) {
+    for (int bx = 0; bx < bricksPerAxis; ++bx) {
+        // Bricks crossing the end of the grid repeat its last voxels.
+        bool uniform = true;
+        int i = 0;
+        for (int y = by*k_brickSize; y < (by+1)*k_brickSize; ++y) {
+        for (int z = bz*k_brickSize; z < (bz+1)*k_brickSize; ++z) {
+        for (int x = bx*k_brickSize; x < (bx+1)*k_brickSize; ++x) {
+            const size_t cy = static_cast<size_t>(std::min(y, slab.y1-1) - slab.y0);
+            const size_t cz = static_cast<size_t>(std::min(z, size-1));
+            const size_t cx = static_cast<size_t>(std::min(x, size-1));
+            brick[i] = slab.voxels[cy*sliceStride + cz*rowStride + cx];
+            uniform = uniform && brick[i] == brick[0];
+            i++;
+        }
+        }
+        }
+
+        uint32_t& entry = index[(static_cast<size_t>(by)*static_cast<size_t>(bricksPerAxis) + static_cast<size_t>(bz))
+                                *static_cast<size_t>(bricksPerAxis) + static_cast<size_t>(bx)];
+        if (uniform) {
+            entry = k_uniformBrick | brick[0];
+            continue;
+        }
+        entry = numStored++;
+        stream.write(reinterpret_cast<const char*>(brick), k_brickVoxels);
+    }
+    }
+    }
+
+    if (!stream) {
+        std::cout << "Failed to write output file!" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool BrickFieldWriter::close()
+{
+    BrickFieldHeader header = {};
+    std::copy(k_brickFieldMagic, k_brickFieldMagic + sizeof(k_brickFieldMagic), header.magic);
+    header.version = k_brickFieldVersion;
+    header.size = static_cast<uint32_t>(size);
+    header.bricksPerAxis = static_cast<uint32_t>(bricksPerAxis);
+    header.numStoredBricks = numStored;
+    header.flags = isSigned ? k_brickFieldSigned : 0;
+    header.payloadOffset = sizeof(BrickFieldHeader);
+    header.indexOffset = header.payloadOffset + static_cast<uint64_t>(numStored) * k_brickVoxels;
+
+    stream.write(reinterpret_cast<const char*>(index.data()), static_cast<std::streamsize>(index.size() * sizeof(uint32_t)));
+    stream.seekp(0);
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    stream.close();
+    if (!stream) {
+        std::cout << "Failed to write output file!" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+DistanceFieldHeader ContainerFieldWriter::makeHeader() const
+{
+    DistanceFieldHeader header = {};
+    std::copy(k_fieldFileMagic, k_fieldFileMagic + sizeof(k_fieldFileMagic), header.magic);
+    header.version = k_fieldFileVersion;
+    header.headerBytes = sizeof(DistanceFieldHeader);
+    for (int axis = 0; axis < 3; ++axis)
+        header.size[axis] = static_cast<uint32_t>(options.dims[axis]);
+    header.voxelType = static_cast<uint32_t>(options.voxelType);
+    header.flags = options.isSigned ? k_fieldFileSigned : 0;
+    header.compression = static_cast<uint32_t>(compression);
+    header.chunkRows = (compression == Compression::None) ? 0 : static_cast<uint32_t>(FieldEvaluator::k_rootNodeSize);
+    voxelDecoding(options, header.valueScale, header.valueBias);
+    header.band = options.band;
+    header.meshOrigin[0] = transform.origin.x;
+    header.meshOrigin[1] = transform.origin.y;
+    header.meshOrigin[2] = transform.origin.z;
+    header.meshScale = transform.scale;
+    header.layout = static_cast<uint32_t>(layout);
+    header.payloadOffset = alignUp(sizeof(DistanceFieldHeader), k_fieldFileAlignment);
+    if (compression == Compression::None)
+        header.payloadBytes = options.numVoxels() * voxelBytes(options.voxelType);
+    return header;
+}
+
+bool ContainerFieldWriter::open(const std::string& path, const bool resume, int& firstRow)
+{
+    if (!isCompressionSupported(compression)) {
+        std::cout << "This build does not support the requested compression!" << std::endl;
+        return false;
+    }
+    if (resume && compression != Compression::None) {
+        std::cout << "Resuming is not supported for compressed containers!" << std::endl;
+        return false;
+    }
+    if ((resume || compression != Compression::None) && layout == VoxelLayout::Morton) {
+        std::cout << "Containers in the morton layout can neither be resumed nor compressed!" << std::endl;
+        return false;
+    }
+
+    if (resume)
+        stream.open(path, std::ios::in | std::ios::out | std::ios::binary);
+    if (!stream.is_open())
+        stream.open(path, std::ios::out | std::ios::trunc | std::ios::binary);
+    if (!stream) {
+        std::cout << "Failed to open output file!" << std::endl;
+        return false;
+    }
+
+    const DistanceFieldHeader header = makeHeader();
+    firstRow = 0;
+    if (resume) {
+        stream.seekg(0, std::ios::end);
+        const uint64_t existingBytes = static_cast<uint64_t>(std::max<std::streamoff>(stream.tellg(), 0));
+        if (existingBytes >= header.payloadOffset) {
+            // Rows are written in order after a complete header, resume like the raw format.
+            DistanceFieldHeader existing;
+            stream.seekg(0);
+            stream.read(reinterpret_cast<char*>(&existing), sizeof(existing));
+            if (!stream || std::memcmp(&existing, &header, sizeof(header)) != 0
+                || existingBytes > header.payloadOffset + header.payloadBytes) {
+                std::cout << "Existing output was generated with different options, cannot resume!" << std::endl;
+                return false;
+            }
+            const uint64_t rowBytes = static_cast<uint64_t>(options.dims[0]) * options.dims[2] * voxelBytes(options.voxelType);
+            const int completeRows = static_cast<int>((existingBytes - header.payloadOffset) / rowBytes);
+            firstRow = completeRows - completeRows % FieldEvaluator::k_rootNodeSize;
+            std::cout << "Resuming at row " << firstRow << " (" << completeRows << " complete row(s) found)." << std::endl;
+            stream.seekp(static_cast<std::streamoff>(header.payloadOffset + static_cast<uint64_t>(firstRow) * rowBytes));
+            return static_cast<bool>(stream);
+        }
+        stream.seekp(0);
+    }
+
+    // Uncompressed, the header is final. Otherwise a placeholder, completed by close().
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    const std::vector<char> padding(static_cast<size_t>(header.payloadOffset - sizeof(header)), 0);
+    stream.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+    chunkOffsets.assign(1, 0);
+    return static_cast<bool>(stream);
+}
+
+bool ContainerFieldWriter::write(const FieldSlab& slab)
+{
+    const size_t rowBytes = static_cast<size_t>(options.dims[0]) * static_cast<size_t>(options.dims[2]) * voxelBytes(options.voxelType);
+    // In the brick layouts chunks of k_rootNodeSize rows are contiguous as well.
+    const uint8_t* voxels = (layout == VoxelLayout::Linear) ? slab.voxels : reorder.reorder(slab);
+    if (layout == VoxelLayout::Morton) {
+        const size_t runBytes = reorder.runVoxels() * voxelBytes(options.voxelType);
+        const uint64_t payloadOffset = alignUp(sizeof(DistanceFieldHeader), k_fieldFileAlignment);
+        for (size_t i = 0; i < reorder.getRuns().size(); ++i) {
+            stream.seekp(static_cast<std::streamoff>(payloadOffset + reorder.getRuns()[i] * voxelBytes(options.voxelType)));
+            stream.write(reinterpret_cast<const char*>(voxels + i*runBytes), static_cast<std::streamsize>(runBytes));
+        }
+    }
+    else if (compression == Compression::None) {
+        stream.write(reinterpret_cast<const char*>(voxels), static_cast<std::streamsize>(rowBytes * static_cast<size_t>(slab.y1 - slab.y0)));
+    }
+    else {
+        for (int y0 = slab.y0; y0 < slab.y1; y0 += FieldEvaluator::k_rootNodeSize) {
+            const int y1 = std::min(y0 + FieldEvaluator::k_rootNodeSize, slab.y1);
+            const uint8_t* chunk = voxels + rowBytes * static_cast<size_t>(y0 - slab.y0);
+            if (!compressChunk(compression, chunk, rowBytes * static_cast<size_t>(y1 - y0), compressed)) {
+                std::cout << "Failed to compress output!" << std::endl;
+                return false;
+            }
+            stream.write(reinterpret_cast<const char*>(compressed.data()), static_cast<std::streamsize>(compressed.size()));
+            chunkOffsets.push_back(chunkOffsets.back() + compressed.size());
+        }
+    }
+
+    stream.flush();
+    if (!stream) {
+        std::cout << "Failed to write output file!" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool ContainerFieldWriter::close()
+{
+    if (compression != Compression::None) {
+        DistanceFieldHeader header = makeHeader();
+        header.numChunks = static_cast<uint32_t>(chunkOffsets.size() - 1);
+        header.payloadBytes = chunkOffsets.back();
+        header.chunkTableOffset = alignUp(header.payloadOffset + header.payloadBytes, sizeof(uint64_t));
+
+        const std::vector<char> padding(static_cast<size_t>(header.chunkTableOffset - header.payloadOffset - header.payloadBytes), 0);
+        stream.write(padding.data(), static_cast<std::streamsize>(padding.size()));
+        stream.write(reinterpret_cast<const char*>(chunkOffsets.data()), static_cast<std::streamsize>(chunkOffsets.size() * sizeof(uint64_t)));
+        stream.seekp(0);
+        stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+
+    stream.close();
+    if (!stream) {
+        std::cout << "Failed to write output file!" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool ChannelWriter::open(const std::string& fieldPath)
+{
+    const bool present[3] = {channels.gradient, channels.closest, channels.primitive};
+    const char* names[3] = {"grad", "closest", "primid"};
+    for (int i = 0; i < 3; ++i) {
+        if (channels.interleaved ? i > 0 : !present[i])
+            continue;
+        const std::string path = channelPath(fieldPath, channels.interleaved ? "channels" : names[i]);
+        streams[i].open(path, std::ios::out | std::ios::trunc | std::ios::binary);
+        if (!streams[i]) {
+            std::cout << "Failed to open channel output file " << path << "!" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ChannelWriter::write(const ChannelSlab& slab, const size_t numVoxels)
+{
+    if (channels.interleaved) {
+        // The records start at the first channel.
+        const uint8_t* records = slab.gradients ? slab.gradients : (slab.closest ? slab.closest : slab.primitives);
+        streams[0].write(reinterpret_cast<const char*>(records), static_cast<std::streamsize>(numVoxels*channelBytes(channels)));
+    }
+    else {
+        const uint8_t* planes[3] = {slab.gradients, slab.closest, slab.primitives};
+        const size_t strides[3] = {slab.gradientStride, slab.closestStride, slab.primitiveStride};
+        for (int i = 0; i < 3; ++i) {
+            if (planes[i])
+                streams[i].write(reinterpret_cast<const char*>(planes[i]), static_cast<std::streamsize>(numVoxels*strides[i]));
+        }
+    }
+    for (std::ofstream& stream : streams) {
+        if (!stream.is_open())
+            continue;
+        stream.flush();
+        if (!stream) {
+            std::cout << "Failed to write channel output file!" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ChannelWriter::close()
+{
+    for (std::ofstream& stream : streams)
+        stream.close();
+    return true;
+}
+
+bool writeAdaptiveField(const std::string& path, const AdaptiveFieldBuilder& field, const UnitCubeTransform& transform)
+{
+    const std::vector<uint32_t>& nodes = field.getNodes();
+    const std::vector<AdaptiveLeaf>& leaves = field.getLeaves();
+    AdaptiveFieldHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, k_adaptiveFieldMagic, sizeof(k_adaptiveFieldMagic));
+    header.version = k_adaptiveFieldVersion;
+    header.size = static_cast<uint32_t>(field.getSize());
+    header.numNodes = static_cast<uint32_t>(nodes.size());
+    header.numLeaves = static_cast<uint32_t>(leaves.size());
+    header.flags = field.getIsSigned() ? k_adaptiveFieldSigned : 0u;
+    header.tolerance = field.getTolerance();
+    header.meshOrigin[0] = transform.origin.x;
+    header.meshOrigin[1] = transform.origin.y;
+    header.meshOrigin[2] = transform.origin.z;
+    header.meshScale = transform.scale;
+    header.nodesOffset = sizeof(header);
+    header.leavesOffset = header.nodesOffset + nodes.size()*sizeof(uint32_t);
+
+    std::ofstream stream(path, std::ios::out | std::ios::trunc | std::ios::binary);
+    stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    stream.write(reinterpret_cast<const char*>(nodes.data()), static_cast<std::streamsize>(nodes.size()*sizeof(uint32_t)));
+    stream.write(reinterpret_cast<const char*>(leaves.data()), static_cast<std::streamsize>(leaves.size()*sizeof(AdaptiveLeaf)));
+    stream.close();
+    if (!stream) {
+        std::cout << "Failed to write output file!" << std::endl;
+        return false;
+    }
+    return true;
+}
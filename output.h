@@ -0,0 +1,244 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "adf.h"
+#include "field.h"
+
+enum class OutputFormat
+{
+    Raw,       // size^3 voxels, x fastest, then z, then y (or another VoxelLayout). No header.
+    Bricks,    // Sparse 8^3 bricks (brickfield.h).
+    Container  // Header and 64 byte aligned voxels, optionally compressed (fieldfile.h).
+};
+
+inline bool parseOutputFormat(const std::string& name, OutputFormat& format)
+{
+    if (name == "raw")
+        format = OutputFormat::Raw;
+    else if (name == "bricks")
+        format = OutputFormat::Bricks;
+    else if (name == "container")
+        format = OutputFormat::Container;
+    else
+        return false;
+    return true;
+}
+
+inline bool parseVoxelLayout(const std::string& name, VoxelLayout& layout)
+{
+    if (name == "linear")
+        layout = VoxelLayout::Linear;
+    else if (name == "morton")
+        layout = VoxelLayout::Morton;
+    else if (name == "bricks4")
+        layout = VoxelLayout::Bricks4;
+    else if (name == "bricks8")
+        layout = VoxelLayout::Bricks8;
+    else
+        return false;
+    return true;
+}
+
+inline bool parseVoxelType(const std::string& name, VoxelType& type)
+{
+    if (name == "u8")
+        type = VoxelType::U8;
+    else if (name == "u16")
+        type = VoxelType::U16;
+    else if (name == "f32")
+        type = VoxelType::F32;
+    else
+        return false;
+    return true;
+}
+
+inline bool parseCompression(const std::string& name, Compression& compression)
+{
+    if (name == "none")
+        compression = Compression::None;
+    else if (name == "lz4")
+        compression = Compression::LZ4;
+    else if (name == "zstd")
+        compression = Compression::Zstd;
+    else
+        return false;
+    return true;
+}
+
+// Comma separated list of dist, grad, closest and primid. The distance is always stored (it is the
+// field itself), naming it is optional. The layout is left as it is.
+inline bool parseChannels(const std::string& list, FieldChannels& channels)
+{
+    channels.gradient = channels.closest = channels.primitive = false;
+    size_t begin = 0;
+    while (begin <= list.length()) {
+        size_t end = list.find(',', begin);
+        if (end == std::string::npos)
+            end = list.length();
+        const std::string name = list.substr(begin, end - begin);
+        if (name == "grad")
+            channels.gradient = true;
+        else if (name == "closest")
+            channels.closest = true;
+        else if (name == "primid")
+            channels.primitive = true;
+        else if (name != "dist")
+            return false;
+        begin = end + 1;
+    }
+    return true;
+}
+
+inline bool parseChannelLayout(const std::string& name, bool& interleaved)
+{
+    if (name == "interleaved")
+        interleaved = true;
+    else if (name == "planar")
+        interleaved = false;
+    else
+        return false;
+    return true;
+}
+
+// Whether the compression is compiled in (DFGEN_WITH_LZ4, DFGEN_WITH_ZSTD).
+bool isCompressionSupported(Compression compression);
+
+// Voxels of slabs in a VoxelLayout. Slabs start at multiples of FieldEvaluator::k_rootNodeSize
+// rows and hold whole bricks, so in the brick layouts a slab is one contiguous range. In Morton
+// order only aligned blocks are: the slab is reordered block by block (k_rootNodeSize^3 voxels, the
+// whole grid if smaller), and each block is written at its own offset.
+class LayoutReorder
+{
+public:
+    LayoutReorder(int size, VoxelType voxelType, VoxelLayout layout);
+
+    // Reorders the slab. Returns the reordered voxels, which start at voxel runs[0] of the layout
+    // and are contiguous unless the layout is Morton (then run i, of runVoxels(), starts at runs[i]).
+    const uint8_t* reorder(const FieldSlab& slab);
+
+    const std::vector<uint64_t>& getRuns() const { return runs; }
+    size_t runVoxels() const;
+
+private:
+    const int size;
+    const size_t bytesPerVoxel;
+    const VoxelLayout layout;
+    std::vector<uint64_t> axisOffsets[3];
+    std::vector<uint8_t> voxels;
+    std::vector<uint64_t> runs;
+};
+
+// Receives the computed field slab by slab, in order of increasing y. Failures are reported on
+// stdout and returned as false.
+class FieldWriter
+{
+public:
+    virtual ~FieldWriter() {}
+
+    // Creates the output. When resuming, keeps what an interrupted run has completed and sets
+    // firstRow to the first row still to be computed (a multiple of FieldEvaluator::k_rootNodeSize).
+    virtual bool open(const std::string& path, bool resume, int& firstRow) = 0;
+    virtual bool write(const FieldSlab& slab) = 0;
+    virtual bool close() = 0;
+};
+
+class RawFieldWriter : public FieldWriter
+{
+public:
+    RawFieldWriter(const FieldOptions& options, const VoxelLayout layout):
+        rowVoxels(static_cast<uint64_t>(options.dims[0]) * static_cast<uint64_t>(options.dims[2])), numRows(options.dims[1]),
+        voxelType(options.voxelType), layout(layout), reorder(options.size, options.voxelType, layout) {}
+
+    bool open(const std::string& path, bool resume, int& firstRow) override;
+    bool write(const FieldSlab& slab) override;
+    bool close() override;
+
+private:
+    const uint64_t rowVoxels; // Of a y row, all of the grid's (x, z).
+    const int numRows;
+    const VoxelType voxelType;
+    const VoxelLayout layout;
+    LayoutReorder reorder;
+    std::fstream stream;
+};
+
+// Bricks are complete within a slab (slabs start at multiples of the brick size), so every slab
+// is reduced to its bricks right away: uniform bricks become an index entry, the others are
+// appended to the payload. The index is written last.
+class BrickFieldWriter : public FieldWriter
+{
+public:
+    explicit BrickFieldWriter(const FieldOptions& options):
+        size(options.size), isSigned(options.isSigned), voxelType(options.voxelType) {}
+
+    bool open(const std::string& path, bool resume, int& firstRow) override;
+    bool write(const FieldSlab& slab) override;
+    bool close() override;
+
+    uint32_t numStoredBricks() const { return numStored; }
+    size_t numBricks() const { return index.size(); }
+
+private:
+    const int size;
+    const bool isSigned;
+    const VoxelType voxelType;
+    int bricksPerAxis;
+    uint32_t numStored;
+    std::vector<uint32_t> index;
+    std::ofstream stream;
+};
+
+// The header describes everything needed to use the field. Uncompressed, it is complete from the
+// start and the voxels follow as in the raw format, so interrupted runs can be resumed (if the
+// header matches). Compressed, every k_rootNodeSize rows are compressed as a chunk and the header
+// and chunk table are completed at the end.
+class ContainerFieldWriter : public FieldWriter
+{
+public:
+    ContainerFieldWriter(const FieldOptions& options, const UnitCubeTransform& transform, const Compression compression,
+                         const VoxelLayout layout):
+        options(options), transform(transform), compression(compression), layout(layout),
+        reorder(options.size, options.voxelType, layout) {}
+
+    bool open(const std::string& path, bool resume, int& firstRow) override;
+    bool write(const FieldSlab& slab) override;
+    bool close() override;
+
+    uint64_t payloadBytes() const { return chunkOffsets.empty() ? 0 : chunkOffsets.back(); }
+
+private:
+    DistanceFieldHeader makeHeader() const;
+
+    const FieldOptions options;
+    const UnitCubeTransform transform;
+    const Compression compression;
+    const VoxelLayout layout;
+    LayoutReorder reorder;
+    std::vector<uint64_t> chunkOffsets; // Compressed only.
+    std::vector<uint8_t> compressed;
+    std::fstream stream;
+};
+
+// Stores the channels of a field next to it, raw (no header) and ordered like the voxels of the raw
+// format. Planar channels go to a file each, "field.bin" gets "field.grad.bin", "field.closest.bin"
+// and "field.primid.bin"; interleaved ones to "field.channels.bin". Not resumable.
+class ChannelWriter
+{
+public:
+    explicit ChannelWriter(const FieldChannels& channels): channels(channels) {}
+
+    bool open(const std::string& fieldPath);
+    bool write(const ChannelSlab& slab, size_t numVoxels);
+    bool close();
+
+private:
+    const FieldChannels channels;
+    std::ofstream streams[3]; // Gradients, closest points and primitives, or the interleaved records first.
+};
+
+// Writes a built adaptive field (adffield.h) at once.
+bool writeAdaptiveField(const std::string& path, const AdaptiveFieldBuilder& field, const UnitCubeTransform& transform);
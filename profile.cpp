@@ -0,0 +1,112 @@
+#include "profile.h"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+#include <sys/resource.h>
+#include <time.h>
+
+namespace
+{
+
+double wallNow()
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+std::string escapeJson(const std::string& text)
+{
+    std::string escaped;
+    for (const char c : text) {
+        if (c == '"' || c == '\\')
+            escaped += '\\';
+        if (static_cast<unsigned char>(c) < 0x20)
+            continue;
+        escaped += c;
+    }
+    return escaped;
+}
+
+}
+
+double peakResidentMegabytes()
+{
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0.0;
+#ifdef __APPLE__
+    return static_cast<double>(usage.ru_maxrss) / (1024.0*1024.0); // Bytes.
+#else
+    return static_cast<double>(usage.ru_maxrss) / 1024.0; // Kilobytes.
+#endif
+}
+
+void Stopwatch::start()
+{
+    wallStart = wallNow();
+    cpuStart = cpuNow();
+}
+
+void Stopwatch::stop()
+{
+    wallSeconds += wallNow() - wallStart;
+    cpuSeconds += cpuNow() - cpuStart;
+}
+
+double Stopwatch::cpuNow() const
+{
+    struct timespec time;
+    if (clock_gettime(threadCpu ? CLOCK_THREAD_CPUTIME_ID : CLOCK_PROCESS_CPUTIME_ID, &time) != 0)
+        return 0.0;
+    return static_cast<double>(time.tv_sec) + static_cast<double>(time.tv_nsec) * 1e-9;
+}
+
+void GenerationProfile::addStage(const std::string& name, const Stopwatch& stopwatch, const bool overlapped)
+{
+    const StageProfile stage = {name, stopwatch.getWallSeconds(), stopwatch.getCpuSeconds(), overlapped};
+    stages.push_back(stage);
+}
+
+bool writeProfile(const std::string& path, const std::vector<GenerationProfile>& generations,
+                  const unsigned int numThreads, const double wallSeconds)
+{
+    std::ofstream stream(path, std::ios::out | std::ios::trunc);
+    stream << "{\n"
+           << "  \"threads\": " << numThreads << ",\n"
+           << "  \"wall_seconds\": " << wallSeconds << ",\n"
+           << "  \"peak_resident_mb\": " << peakResidentMegabytes() << ",\n"
+           << "  \"generations\": [";
+    for (size_t g = 0; g < generations.size(); ++g) {
+        const GenerationProfile& profile = generations[g];
+        const QueryCounters& counters = profile.counters;
+        stream << (g > 0 ? "," : "") << "\n    {\n"
+               << "      \"input\": \"" << escapeJson(profile.inputPath) << "\",\n"
+               << "      \"output\": \"" << escapeJson(profile.outputPath) << "\",\n"
+               << "      \"size\": " << profile.size << ",\n"
+               << "      \"signed\": " << (profile.isSigned ? "true" : "false") << ",\n"
+               << "      \"succeeded\": " << (profile.succeeded ? "true" : "false") << ",\n"
+               << "      \"cache_hit\": " << (profile.cacheHit ? "true" : "false") << ",\n"
+               << "      \"wall_seconds\": " << profile.wallSeconds << ",\n"
+               << "      \"peak_resident_mb\": " << profile.peakMemoryMegabytes << ",\n"
+               << "      \"voxels\": " << profile.voxels << ",\n"
+               << "      \"distance_queries\": " << counters.distanceQueries << ",\n"
+               << "      \"inside_tests\": " << counters.insideTests << ",\n"
+               << "      \"node_visits\": " << counters.nodeVisits << ",\n"
+               << "      \"unsigned_inside_skipped\": " << counters.insideSkipped << ",\n"
+               << "      \"stages\": [";
+        for (size_t s = 0; s < profile.stages.size(); ++s) {
+            const StageProfile& stage = profile.stages[s];
+            stream << (s > 0 ? "," : "") << "\n        {\"name\": \"" << stage.name << "\", \"wall_seconds\": " << stage.wallSeconds
+                   << ", \"cpu_seconds\": " << stage.cpuSeconds << ", \"overlapped\": " << (stage.overlapped ? "true" : "false") << "}";
+        }
+        stream << "\n      ]\n    }";
+    }
+    stream << "\n  ]\n}\n";
+    stream.close();
+    if (!stream) {
+        std::cout << "Failed to write profile!" << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "field.h"
+
+// Peak resident set size of the process so far.
+double peakResidentMegabytes();
+
+// Accumulates wall and CPU time over one or more start/stop intervals. CPU time is of the whole
+// process, or of the calling thread for work that overlaps other stages.
+class Stopwatch
+{
+public:
+    explicit Stopwatch(bool threadCpu = false): threadCpu(threadCpu), wallSeconds(0.0), cpuSeconds(0.0),
+        wallStart(0.0), cpuStart(0.0) {}
+
+    void start();
+    void stop();
+
+    double getWallSeconds() const { return wallSeconds; }
+    double getCpuSeconds() const { return cpuSeconds; }
+
+private:
+    double cpuNow() const;
+
+    const bool threadCpu;
+    double wallSeconds, cpuSeconds;
+    double wallStart, cpuStart;
+};
+
+struct StageProfile
+{
+    std::string name;
+    double wallSeconds;
+    double cpuSeconds;
+    bool overlapped; // Ran concurrently with other stages (CPU time of its own threads only).
+};
+
+// What --profile reports about the generation of one field. Stages are timed with a few clock
+// reads and the counters are per task, so profiling is always on; only the report is optional.
+struct GenerationProfile
+{
+    GenerationProfile(): size(0), isSigned(false), succeeded(false), cacheHit(false),
+        wallSeconds(0.0), peakMemoryMegabytes(0.0), voxels(0), counters() {}
+
+    void addStage(const std::string& name, const Stopwatch& stopwatch, bool overlapped = false);
+
+    std::string inputPath, outputPath;
+    int size;
+    bool isSigned;
+    bool succeeded;
+    bool cacheHit;
+    double wallSeconds;
+    double peakMemoryMegabytes; // Peak resident memory of the process, when the generation finished.
+    std::vector<StageProfile> stages;
+    uint64_t voxels; // Computed (or copied from the cache) by this run.
+    QueryCounters counters;
+};
+
+// Writes the profiles as JSON. Times are in seconds; in batch runs the CPU time of stages that
+// did not overlap is of the whole process, so it includes the concurrent generations.
+bool writeProfile(const std::string& path, const std::vector<GenerationProfile>& generations,
+                  unsigned int numThreads, double wallSeconds);
@@ -0,0 +1,195 @@
+// dfquery: test client of the point query service (dfgen --serve).
+//
+// Sends batches of random points around a mesh over several connections at once and reports the
+// round trip latency of the batches and the throughput, then the service's own report. Every answer
+// is checked for consistency: the closest point must be at the reported distance from its query.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "queryservice.h"
+
+namespace
+{
+
+const int k_defaultPoints = 65536;
+const int k_defaultBatches = 100;
+const float k_boundsMargin = 0.1f; // Points are taken this fraction of the bounds beyond them.
+const float k_distanceTolerance = 1e-4f; // Of the bounds' diagonal, between the distance and the closest point.
+
+std::string getOption(const std::vector<std::string>& args, const std::string& option)
+{
+    auto it = std::find(args.begin(), args.end(), option);
+    if (it != args.end() && ++it != args.end())
+        return *it;
+    return std::string();
+}
+
+bool hasOption(const std::vector<std::string>& args, const std::string& option)
+{
+    return std::find(args.begin(), args.end(), option) != args.end();
+}
+
+double percentile(const std::vector<double>& sorted, const double fraction)
+{
+    const size_t rank = static_cast<size_t>(std::ceil(fraction * static_cast<double>(sorted.size())));
+    return sorted[std::min(std::max<size_t>(rank, 1), sorted.size()) - 1];
+}
+
+// Batches of one connection, each of points uniform in the enlarged bounds.
+struct ConnectionRun
+{
+    std::vector<double> latencies;
+    uint64_t numInconsistent;
+    bool failed;
+    std::string error;
+};
+
+void runConnection(const std::string& socketPath, const std::string& meshPath, const QueryResponseHeader& mesh, const int numPoints,
+                   const int numBatches, const unsigned int seed, ConnectionRun& run)
+{
+    run.numInconsistent = 0;
+    run.failed = true;
+    QueryClient client;
+    if (!client.connect(socketPath)) {
+        run.error = "Failed to connect to " + socketPath + "!";
+        return;
+    }
+    float low[3], high[3], diagonal = 0.f;
+    for (int axis = 0; axis < 3; ++axis) {
+        const float margin = k_boundsMargin * (mesh.boundsMax[axis] - mesh.boundsMin[axis]);
+        low[axis] = mesh.boundsMin[axis] - margin;
+        high[axis] = mesh.boundsMax[axis] + margin;
+        diagonal += (high[axis] - low[axis]) * (high[axis] - low[axis]);
+    }
+    const float tolerance = k_distanceTolerance * std::sqrt(diagonal);
+
+    std::mt19937 random(seed);
+    std::vector<float> points(3 * static_cast<size_t>(numPoints));
+    std::vector<QueryResultRecord> results;
+    QueryResponseHeader response;
+    for (int batch = 0; batch < numBatches; ++batch) {
+        for (size_t i = 0; i < points.size(); ++i) {
+            std::uniform_real_distribution<float> coordinate(low[i % 3], high[i % 3]);
+            points[i] = coordinate(random);
+        }
+        const auto start = std::chrono::steady_clock::now();
+        if (!client.query(meshPath, points.data(), static_cast<uint32_t>(numPoints), results, response)) {
+            run.error = client.getMessage().empty() ? "The connection broke!" : client.getMessage();
+            return;
+        }
+        const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+        run.latencies.push_back(elapsed.count());
+        for (size_t i = 0; i < results.size(); ++i) {
+            const QueryResultRecord& result = results[i];
+            const float dx = points[3*i] - result.closest[0], dy = points[3*i+1] - result.closest[1], dz = points[3*i+2] - result.closest[2];
+            if (std::fabs(std::sqrt(dx*dx + dy*dy + dz*dz) - std::fabs(result.distance)) > tolerance)
+                run.numInconsistent++;
+        }
+    }
+    run.failed = false;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> args(argv, argv+argc);
+    if (args.size() == 1 || hasOption(args, "-h") || hasOption(args, "--help")) {
+        std::cout << "Example usage: dfquery --socket /tmp/dfgen.sock -i path/to/mesh.obj --points 65536 --batches 100 --connections 4 --shutdown" << std::endl;
+        return args.size() == 1 ? 1 : 0;
+    }
+
+    const std::string socketPath = getOption(args, "--socket");
+    const std::string meshPath = getOption(args, "-i");
+    if (socketPath.empty() || meshPath.empty()) {
+        std::cout << "The service's socket and a mesh must be specified (--socket, -i)!" << std::endl;
+        return 1;
+    }
+    int numPoints = k_defaultPoints, numBatches = k_defaultBatches, numConnections = 1;
+    try {
+        const std::string pointsArg = getOption(args, "--points"), batchesArg = getOption(args, "--batches");
+        const std::string connectionsArg = getOption(args, "--connections");
+        if (!pointsArg.empty())
+            numPoints = std::stoi(pointsArg);
+        if (!batchesArg.empty())
+            numBatches = std::stoi(batchesArg);
+        if (!connectionsArg.empty())
+            numConnections = std::stoi(connectionsArg);
+    } catch (const std::exception&) {
+        std::cout << "Failed to parse arguments!" << std::endl;
+        return 1;
+    }
+    if (numPoints < 1 || static_cast<uint32_t>(numPoints) > k_queryMaxPoints || numBatches < 1 || numConnections < 1) {
+        std::cout << "Points (at most " << k_queryMaxPoints << "), batches and connections must be positive!" << std::endl;
+        return 1;
+    }
+
+    // A query of no points loads the mesh (unless it is resident) and reports its bounds.
+    QueryClient client;
+    if (!client.connect(socketPath)) {
+        std::cout << "Failed to connect to " << socketPath << "!" << std::endl;
+        return 1;
+    }
+    std::vector<QueryResultRecord> results;
+    QueryResponseHeader mesh;
+    const auto loadStart = std::chrono::steady_clock::now();
+    if (!client.query(meshPath, nullptr, 0, results, mesh)) {
+        std::cout << "The service failed to load " << meshPath << ": " << client.getMessage() << std::endl;
+        return 1;
+    }
+    const std::chrono::duration<double> loadElapsed = std::chrono::steady_clock::now() - loadStart;
+    std::printf("Mesh ready in %.3f s, bounds (%g, %g, %g) to (%g, %g, %g).\n", loadElapsed.count(), mesh.boundsMin[0],
+                mesh.boundsMin[1], mesh.boundsMin[2], mesh.boundsMax[0], mesh.boundsMax[1], mesh.boundsMax[2]);
+
+    std::vector<ConnectionRun> runs(static_cast<size_t>(numConnections));
+    std::vector<std::thread> threads;
+    const auto start = std::chrono::steady_clock::now();
+    for (int c = 0; c < numConnections; ++c) {
+        threads.push_back(std::thread(runConnection, socketPath, meshPath, mesh, numPoints, numBatches,
+                                      static_cast<unsigned int>(c + 1), std::ref(runs[static_cast<size_t>(c)])));
+    }
+    for (std::thread& thread : threads)
+        thread.join();
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::vector<double> latencies;
+    uint64_t numInconsistent = 0;
+    for (const ConnectionRun& run : runs) {
+        if (run.failed) {
+            std::cout << run.error << std::endl;
+            return 1;
+        }
+        latencies.insert(latencies.end(), run.latencies.begin(), run.latencies.end());
+        numInconsistent += run.numInconsistent;
+    }
+    std::sort(latencies.begin(), latencies.end());
+    const double totalPoints = static_cast<double>(numPoints) * numBatches * numConnections;
+    std::printf("%d batch(es) of %d points over %d connection(s) in %.3f s: %.4g points/s.\n", numBatches * numConnections,
+                numPoints, numConnections, elapsed.count(), totalPoints / std::max(elapsed.count(), 1e-9));
+    std::printf("Round trip latency (ms): p50 %.3f, p90 %.3f, p99 %.3f, p99.9 %.3f, max %.3f.\n", 1e3*percentile(latencies, 0.5),
+                1e3*percentile(latencies, 0.9), 1e3*percentile(latencies, 0.99), 1e3*percentile(latencies, 0.999), 1e3*latencies.back());
+
+    std::string report;
+    if (client.stats(report))
+        std::cout << "Service: " << report << std::endl;
+    if (hasOption(args, "--shutdown") && !client.shutdown()) {
+        std::cout << "Failed to shut the service down!" << std::endl;
+        return 1;
+    }
+    if (numInconsistent > 0) {
+        std::cout << numInconsistent << " answer(s) inconsistent: the closest point is not at the reported distance!" << std::endl;
+        return 1;
+    }
+    std::cout << "All answers consistent." << std::endl;
+    return 0;
+}
@@ -0,0 +1,197 @@
+#pragma once
+
+// Protocol of the point query service (dfgen --serve): a Unix stream socket on which every
+// request gets one response, any number of them per connection. Header-only, so clients do not
+// link the generator. The service is local, so everything is in host byte order.
+//
+// Request:
+//   QueryRequestHeader
+//   pathBytes bytes: path of the mesh (as dfgen -i takes it, resolved by the service)
+//   numPoints*3 floats: xyz of the query points, in mesh space (Query only)
+// Response:
+//   QueryResponseHeader
+//   messageBytes bytes: the error of a failed request, the report of Stats
+//   numResults QueryResultRecord: one per query point, in the order of the request
+//
+// A Query of a mesh that is not resident loads it and builds its trees first; a Query of no
+// points only does that and reports the mesh's bounds. Meshes are told apart by path and
+// modification time, so a changed file is loaded again.
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+const char k_queryMagic[4] = {'D', 'F', 'Q', 'S'};
+const uint32_t k_queryMaxPathBytes = 4096;
+const uint32_t k_queryMaxPoints = 1u << 24; // Per request.
+
+enum class QueryOp : uint32_t
+{
+    Query = 0,
+    Stats = 1,   // Throughput and latency of the queries answered so far.
+    Shutdown = 2 // Stops the service once the response is sent.
+};
+
+enum class QueryStatus : uint32_t
+{
+    Ok = 0,
+    Failed = 1
+};
+
+struct QueryRequestHeader
+{
+    char magic[4];
+    uint32_t op; // QueryOp
+    uint32_t pathBytes;
+    uint32_t numPoints;
+};
+
+struct QueryResponseHeader
+{
+    char magic[4];
+    uint32_t status; // QueryStatus
+    uint32_t messageBytes;
+    uint32_t numResults;
+    float boundsMin[3], boundsMax[3]; // Of the mesh (Query only).
+};
+
+struct QueryResultRecord
+{
+    float distance;    // Mesh units, negative inside.
+    float closest[3];  // Closest point on the surface.
+    uint32_t triangle; // Index of the triangle it lies on, in the order the mesh was loaded.
+};
+
+static_assert(sizeof(QueryRequestHeader) == 16, "QueryRequestHeader layout");
+static_assert(sizeof(QueryResponseHeader) == 40, "QueryResponseHeader layout");
+static_assert(sizeof(QueryResultRecord) == 20, "QueryResultRecord layout");
+
+inline bool sendAll(const int socket, const void* data, size_t bytes)
+{
+    const char* bytesLeft = static_cast<const char*>(data);
+    while (bytes > 0) {
+        const ssize_t sent = ::send(socket, bytesLeft, bytes, MSG_NOSIGNAL);
+        if (sent <= 0)
+            return false;
+        bytesLeft += sent;
+        bytes -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+// False if the connection ends first.
+inline bool receiveAll(const int socket, void* data, size_t bytes)
+{
+    char* bytesLeft = static_cast<char*>(data);
+    while (bytes > 0) {
+        const ssize_t received = ::recv(socket, bytesLeft, bytes, 0);
+        if (received <= 0)
+            return false;
+        bytesLeft += received;
+        bytes -= static_cast<size_t>(received);
+    }
+    return true;
+}
+
+inline bool makeSocketAddress(const std::string& path, sockaddr_un& address)
+{
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.length() >= sizeof(address.sun_path))
+        return false;
+    std::memcpy(address.sun_path, path.c_str(), path.length());
+    return true;
+}
+
+// One connection to the service. Requests are answered in order, use one client per thread.
+class QueryClient
+{
+public:
+    QueryClient(): socket(-1) {}
+    ~QueryClient() { disconnect(); }
+
+    QueryClient(const QueryClient&) = delete;
+    QueryClient& operator=(const QueryClient&) = delete;
+
+    bool connect(const std::string& socketPath)
+    {
+        disconnect();
+        sockaddr_un address;
+        if (!makeSocketAddress(socketPath, address))
+            return false;
+        socket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if (socket < 0 || ::connect(socket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+            disconnect();
+            return false;
+        }
+        return true;
+    }
+
+    void disconnect()
+    {
+        if (socket >= 0)
+            ::close(socket);
+        socket = -1;
+    }
+
+    // Points are xyz, results get one record per point and response the bounds of the mesh. False
+    // if the service failed the request (getMessage() says why) or the connection broke.
+    bool query(const std::string& meshPath, const float* points, const uint32_t numPoints,
+               std::vector<QueryResultRecord>& results, QueryResponseHeader& response)
+    {
+        message.clear();
+        if (!sendRequest(QueryOp::Query, meshPath, numPoints) || !sendAll(socket, points, 3*sizeof(float)*numPoints)
+            || !receiveResponse(response))
+            return false;
+        const bool succeeded = response.status == static_cast<uint32_t>(QueryStatus::Ok);
+        if (response.numResults != (succeeded ? numPoints : 0))
+            return false;
+        results.resize(response.numResults);
+        return receiveAll(socket, results.data(), results.size()*sizeof(QueryResultRecord)) && succeeded;
+    }
+
+    bool stats(std::string& report)
+    {
+        QueryResponseHeader response;
+        if (!sendRequest(QueryOp::Stats, std::string(), 0) || !receiveResponse(response))
+            return false;
+        report = message;
+        return true;
+    }
+
+    bool shutdown()
+    {
+        QueryResponseHeader response;
+        return sendRequest(QueryOp::Shutdown, std::string(), 0) && receiveResponse(response);
+    }
+
+    // Error (or report) of the last response.
+    const std::string& getMessage() const { return message; }
+
+private:
+    bool sendRequest(const QueryOp op, const std::string& meshPath, const uint32_t numPoints)
+    {
+        QueryRequestHeader request;
+        std::memcpy(request.magic, k_queryMagic, sizeof(request.magic));
+        request.op = static_cast<uint32_t>(op);
+        request.pathBytes = static_cast<uint32_t>(meshPath.length());
+        request.numPoints = numPoints;
+        return socket >= 0 && sendAll(socket, &request, sizeof(request)) && sendAll(socket, meshPath.data(), meshPath.length());
+    }
+
+    bool receiveResponse(QueryResponseHeader& response)
+    {
+        if (!receiveAll(socket, &response, sizeof(response)) || std::memcmp(response.magic, k_queryMagic, sizeof(response.magic)) != 0)
+            return false;
+        message.assign(response.messageBytes, '\0');
+        return receiveAll(socket, &message[0], message.size());
+    }
+
+    int socket;
+    std::string message;
+};
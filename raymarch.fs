@@ -1,5 +1,5 @@
 uniform sampler2D distFieldSam;
-const float distFieldSize = 64.0;
+uniform float distFieldSize;
 uniform vec2 canvasSize;
 uniform vec3 origin;
 uniform float time;
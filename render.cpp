@@ -0,0 +1,422 @@
+// dfrender: headless CPU renderer of a distance field, for thumbnails on machines without a GPU.
+//
+// Renders the view of the example viewer (the orbital camera of drawFrame, the ray setup of
+// raymarch.fs) to PNG or PPM. Unlike the shader's fixed 20 steps, rays are sphere traced: every
+// step advances by the sampled distance, which never overshoots the surface, until the distance
+// falls below a fraction of a voxel. Rays are traced in packets of the SIMD width, the packet's
+// samples taken together by FieldSampler, and the image is split into tiles rendered in parallel.
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "field.h"
+#include "fieldfile.h"
+#include "fieldsampler.h"
+#include "geometry.h"
+#include "output.h"
+#include "profile.h"
+#include "simd.h"
+#include "threadpool.h"
+
+namespace
+{
+
+const float k_pi = 3.14159265358979f;
+const int k_defaultWidth = 1280;
+const int k_defaultHeight = 720;
+const int k_defaultRawSize = 64; // Raw (headerless) fields carry no size.
+const int k_tileSize = 32;
+const int k_maxSteps = 256;
+const float k_hitVoxels = 0.25f;  // A ray hits the surface closer than this.
+const float k_minStepVoxels = 0.05f; // Steps are at least this long, so rays grazing the surface move on.
+
+// As the example viewer's camera: a point on a sphere around the center of the unit cube (of the grid).
+struct OrbitalCamera
+{
+    float radius;
+    float theta;
+    float phi;
+};
+
+struct Image
+{
+    int width, height;
+    std::vector<uint8_t> rgb; // Rows top to bottom.
+};
+
+struct RenderCounters
+{
+    std::atomic<uint64_t> packets;
+    std::atomic<uint64_t> steps; // Of packets.
+    std::atomic<uint64_t> hits;
+};
+
+uint8_t toByte(const float v)
+{
+    return static_cast<uint8_t>(std::lround(std::min(std::max(v, 0.f), 1.f) * 255.f));
+}
+
+Vec3 normalized(const Vec3& v)
+{
+    return v * (1.f / std::max(length(v), 1e-20f));
+}
+
+// Entry and exit distances of a ray through the box [0, extent] (the unit cube, or the part of it a
+// box grid covers), tNear >= tFar if it misses.
+void intersectBox(const Vec3& origin, const Vec3& direction, const Vec3& extent, float& tNear, float& tFar)
+{
+    tNear = 0.f;
+    tFar = 1e30f;
+    for (int axis = 0; axis < 3; ++axis) {
+        const float inverse = 1.f / ((std::fabs(direction[axis]) > 1e-12f) ? direction[axis] : 1e-12f);
+        float t0 = (0.f - origin[axis]) * inverse;
+        float t1 = (extent[axis] - origin[axis]) * inverse;
+        if (t0 > t1)
+            std::swap(t0, t1);
+        tNear = std::max(tNear, t0);
+        tFar = std::min(tFar, t1);
+    }
+}
+
+class Renderer
+{
+public:
+    Renderer(const FieldSampler& sampler, const OrbitalCamera& camera, Image& image):
+        sampler(sampler), image(image), voxel(1.f / static_cast<float>(sampler.getSize())),
+        extent(voxel*sampler.getDim(0), voxel*sampler.getDim(1), voxel*sampler.getDim(2))
+    {
+        // As drawFrame and raymarch.fs (which swaps y and z of the origin), around the grid's center.
+        const Vec3 center = extent * 0.5f;
+        const Vec3 origin(camera.radius * std::sin(camera.theta) * std::cos(camera.phi),
+                          camera.radius * std::sin(camera.theta) * std::sin(camera.phi),
+                          camera.radius * std::cos(camera.theta));
+        rayOrigin = Vec3(origin.x, origin.z, origin.y) + center;
+        forward = normalized(center - rayOrigin);
+        right = normalized(cross(forward, Vec3(0.f, 1.f, 0.f)));
+        up = normalized(cross(right, forward));
+        light = normalized(up + right*0.5f - forward);
+    }
+
+    void renderTile(const int tile, RenderCounters& counters) const
+    {
+        const int tilesX = (image.width + k_tileSize - 1) / k_tileSize;
+        const int x0 = (tile % tilesX) * k_tileSize, y0 = (tile / tilesX) * k_tileSize;
+        const int x1 = std::min(x0 + k_tileSize, image.width), y1 = std::min(y0 + k_tileSize, image.height);
+        for (int row = y0; row < y1; ++row) {
+            for (int x = x0; x < x1; x += k_simdWidth)
+                tracePacket(x, std::min(x + k_simdWidth, x1), row, counters);
+        }
+    }
+
+private:
+    // Traces the pixels [x0, x1) of a row, at most k_simdWidth of them.
+    void tracePacket(const int x0, const int x1, const int row, RenderCounters& counters) const
+    {
+        const float width = static_cast<float>(image.width), height = static_cast<float>(image.height);
+        const float ratio = height / width;
+        float dx[k_simdWidth], dy[k_simdWidth], dz[k_simdWidth], tNear[k_simdWidth], tFar[k_simdWidth];
+        float screenX[k_simdWidth], screenY[k_simdWidth];
+        for (int lane = 0; lane < k_simdWidth; ++lane) {
+            // Lanes past the row end repeat its last pixel and are not stored.
+            const int x = std::min(x0 + lane, x1 - 1);
+            const float fragX = static_cast<float>(x) + 0.5f;
+            const float fragY = static_cast<float>(image.height - 1 - row) + 0.5f; // gl_FragCoord is bottom up.
+            screenX[lane] = (fragX - width*0.5f) / width;
+            screenY[lane] = ratio * (fragY - height*0.5f) / height;
+            const Vec3 direction = normalized(right*screenX[lane] + up*screenY[lane] + forward*2.5f);
+            dx[lane] = direction.x;
+            dy[lane] = direction.y;
+            dz[lane] = direction.z;
+            intersectBox(rayOrigin, direction, extent, tNear[lane], tFar[lane]);
+        }
+
+        // Sphere tracing: every lane advances by its distance until it hits or leaves the cube.
+        const vfloat ox = vbroadcast(rayOrigin.x), oy = vbroadcast(rayOrigin.y), oz = vbroadcast(rayOrigin.z);
+        const vfloat vdx = vload(dx), vdy = vload(dy), vdz = vload(dz), far = vload(tFar);
+        const vfloat hitDistance = vbroadcast(k_hitVoxels * voxel), minStep = vbroadcast(k_minStepVoxels * voxel);
+        vfloat t = vload(tNear);
+        vmask active = t < far;
+        int hitLanes = 0;
+        float px[k_simdWidth], py[k_simdWidth], pz[k_simdWidth], distances[k_simdWidth];
+        int steps = 0;
+        for (; steps < k_maxSteps && vmovemask(active) != 0; ++steps) {
+            vstore(px, ox + vdx*t);
+            vstore(py, oy + vdy*t);
+            vstore(pz, oz + vdz*t);
+            sampler.sample(px, py, pz, k_simdWidth, distances);
+            const vfloat d = vload(distances);
+            hitLanes |= vmovemask(active & (d < hitDistance));
+            active = active & (d >= hitDistance);
+            t = vselect(active, t + vmax(d, minStep), t);
+            active = active & (t < far);
+        }
+
+        // Lambert shading of the hits, the normal is the gradient of the field by central differences.
+        float shade[k_simdWidth];
+        vstore(px, ox + vdx*t);
+        vstore(py, oy + vdy*t);
+        vstore(pz, oz + vdz*t);
+        float gradient[3][k_simdWidth];
+        for (int axis = 0; axis < 3; ++axis) {
+            float lower[3][k_simdWidth], upper[3][k_simdWidth], below[k_simdWidth], above[k_simdWidth];
+            for (int lane = 0; lane < k_simdWidth; ++lane) {
+                const float p[3] = {px[lane], py[lane], pz[lane]};
+                for (int i = 0; i < 3; ++i) {
+                    lower[i][lane] = p[i] - ((i == axis) ? voxel : 0.f);
+                    upper[i][lane] = p[i] + ((i == axis) ? voxel : 0.f);
+                }
+            }
+            sampler.sample(lower[0], lower[1], lower[2], k_simdWidth, below);
+            sampler.sample(upper[0], upper[1], upper[2], k_simdWidth, above);
+            for (int lane = 0; lane < k_simdWidth; ++lane)
+                gradient[axis][lane] = above[lane] - below[lane];
+        }
+        for (int lane = 0; lane < k_simdWidth; ++lane) {
+            const Vec3 normal = normalized(Vec3(gradient[0][lane], gradient[1][lane], gradient[2][lane]));
+            shade[lane] = std::max(dot(normal, light), 0.f);
+        }
+
+        for (int lane = 0; lane < x1 - x0; ++lane) {
+            // The shader's background, without its noise: a vignette.
+            const float xn = screenX[lane] + 0.5f, yn = screenY[lane]/ratio + 0.5f;
+            const float strength = 1.f - ((0.5f - xn)*(0.5f - xn) + (0.5f - yn)*(0.5f - yn));
+            float rgb[3] = {0.1f * strength*strength*strength, 0.1f * strength*strength*strength, 0.1f * strength*strength*strength};
+            if (hitLanes & (1 << lane)) {
+                rgb[0] = 0.1f*shade[lane];
+                rgb[1] = 0.2f + 0.8f*shade[lane];
+                rgb[2] = 0.1f*shade[lane];
+            }
+            uint8_t* pixel = image.rgb.data() + 3*(static_cast<size_t>(row)*static_cast<size_t>(image.width) + static_cast<size_t>(x0 + lane));
+            for (int c = 0; c < 3; ++c)
+                pixel[c] = toByte(rgb[c]);
+        }
+        uint64_t hits = 0;
+        for (int lane = 0; lane < x1 - x0; ++lane)
+            hits += (hitLanes >> lane) & 1;
+        counters.packets++;
+        counters.steps += static_cast<uint64_t>(steps);
+        counters.hits += hits;
+    }
+
+    const FieldSampler& sampler;
+    Image& image;
+    const float voxel; // Unit cube units.
+    const Vec3 extent; // Of the grid in the unit cube.
+    Vec3 rayOrigin, forward, right, up, light;
+};
+
+uint32_t crc32(const uint8_t* data, const size_t bytes, uint32_t crc = 0)
+{
+    crc = ~crc;
+    for (size_t i = 0; i < bytes; ++i) {
+        crc ^= data[i];
+        for (int bit = 0; bit < 8; ++bit)
+            crc = (crc >> 1) ^ (0xedb88320u & (0u - (crc & 1u)));
+    }
+    return ~crc;
+}
+
+void appendBigEndian(std::vector<uint8_t>& bytes, const uint32_t v)
+{
+    for (int shift = 24; shift >= 0; shift -= 8)
+        bytes.push_back(static_cast<uint8_t>(v >> shift));
+}
+
+void appendChunk(std::vector<uint8_t>& png, const char* type, const std::vector<uint8_t>& data)
+{
+    appendBigEndian(png, static_cast<uint32_t>(data.size()));
+    const size_t typeStart = png.size();
+    png.insert(png.end(), type, type + 4);
+    png.insert(png.end(), data.begin(), data.end());
+    appendBigEndian(png, crc32(png.data() + typeStart, png.size() - typeStart));
+}
+
+// 8 bit RGB PNG whose zlib stream holds stored (uncompressed) deflate blocks, so no zlib is needed.
+bool writePng(const std::string& path, const Image& image)
+{
+    std::vector<uint8_t> scanlines;
+    const size_t rowBytes = 3*static_cast<size_t>(image.width);
+    for (int y = 0; y < image.height; ++y) {
+        scanlines.push_back(0); // No filter.
+        scanlines.insert(scanlines.end(), image.rgb.begin() + static_cast<std::ptrdiff_t>(static_cast<size_t>(y)*rowBytes),
+                         image.rgb.begin() + static_cast<std::ptrdiff_t>(static_cast<size_t>(y + 1)*rowBytes));
+    }
+
+    std::vector<uint8_t> zlib = {0x78, 0x01};
+    const size_t k_maxBlock = 65535;
+    for (size_t first = 0; first < scanlines.size(); first += k_maxBlock) {
+        const size_t blockBytes = std::min(k_maxBlock, scanlines.size() - first);
+        zlib.push_back((first + blockBytes >= scanlines.size()) ? 1 : 0);
+        zlib.push_back(static_cast<uint8_t>(blockBytes));
+        zlib.push_back(static_cast<uint8_t>(blockBytes >> 8));
+        zlib.push_back(static_cast<uint8_t>(~blockBytes));
+        zlib.push_back(static_cast<uint8_t>(~blockBytes >> 8));
+        zlib.insert(zlib.end(), scanlines.begin() + static_cast<std::ptrdiff_t>(first),
+                    scanlines.begin() + static_cast<std::ptrdiff_t>(first + blockBytes));
+    }
+    uint32_t a = 1, b = 0;
+    for (const uint8_t byte : scanlines) {
+        a = (a + byte) % 65521;
+        b = (b + a) % 65521;
+    }
+    appendBigEndian(zlib, (b << 16) | a);
+
+    std::vector<uint8_t> header;
+    appendBigEndian(header, static_cast<uint32_t>(image.width));
+    appendBigEndian(header, static_cast<uint32_t>(image.height));
+    header.insert(header.end(), {8, 2, 0, 0, 0}); // 8 bit RGB, no interlacing.
+    std::vector<uint8_t> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    appendChunk(png, "IHDR", header);
+    appendChunk(png, "IDAT", zlib);
+    appendChunk(png, "IEND", std::vector<uint8_t>());
+
+    std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+    stream.write(reinterpret_cast<const char*>(png.data()), static_cast<std::streamsize>(png.size()));
+    return static_cast<bool>(stream);
+}
+
+bool writePpm(const std::string& path, const Image& image)
+{
+    std::ofstream stream(path, std::ios::binary | std::ios::trunc);
+    stream << "P6\n" << image.width << " " << image.height << "\n255\n";
+    stream.write(reinterpret_cast<const char*>(image.rgb.data()), static_cast<std::streamsize>(image.rgb.size()));
+    return static_cast<bool>(stream);
+}
+
+std::string getOption(const std::vector<std::string>& args, const std::string& option)
+{
+    auto it = std::find(args.begin(), args.end(), option);
+    if (it != args.end() && ++it != args.end())
+        return *it;
+    return std::string();
+}
+
+bool hasSuffix(const std::string& text, const std::string& suffix)
+{
+    return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+}
+
+int main(int argc, char** argv)
+{
+    std::vector<std::string> args(argv, argv+argc);
+    if (args.size() == 1 || std::find(args.begin(), args.end(), "-h") != args.end() || std::find(args.begin(), args.end(), "--help") != args.end()) {
+        std::cout << "Example usage: dfrender -i distfield.bin -o thumbnail.png --width 1280 --height 720 --radius 4 --theta 1.5708 --phi 1.3708 --threads 8" << std::endl;
+        std::cout << "Raw fields:    dfrender -i distfield.bin -o thumbnail.ppm --size 64 --precision u8 --layout linear (signed, as written by dfgen)" << std::endl;
+        return args.size() == 1 ? 1 : 0;
+    }
+
+    const std::string inputPath = getOption(args, "-i");
+    const std::string outputPath = getOption(args, "-o");
+    if (inputPath.empty() || outputPath.empty()) {
+        std::cout << "Input field and output image must be specified (-i, -o)!" << std::endl;
+        return 1;
+    }
+
+    // The example viewer's initial view.
+    OrbitalCamera camera = {4.f, k_pi/2.f, k_pi/2.f - 0.2f};
+    Image image = {k_defaultWidth, k_defaultHeight, std::vector<uint8_t>()};
+    int rawSize = k_defaultRawSize;
+    unsigned int numThreads = 0;
+    try {
+        const std::string widthArg = getOption(args, "--width"), heightArg = getOption(args, "--height");
+        if (!widthArg.empty())
+            image.width = std::stoi(widthArg);
+        if (!heightArg.empty())
+            image.height = std::stoi(heightArg);
+        const std::string radiusArg = getOption(args, "--radius"), thetaArg = getOption(args, "--theta"), phiArg = getOption(args, "--phi");
+        if (!radiusArg.empty())
+            camera.radius = std::stof(radiusArg);
+        if (!thetaArg.empty())
+            camera.theta = std::stof(thetaArg);
+        if (!phiArg.empty())
+            camera.phi = std::stof(phiArg);
+        const std::string sizeArg = getOption(args, "--size"), threadsArg = getOption(args, "--threads");
+        if (!sizeArg.empty())
+            rawSize = std::stoi(sizeArg);
+        if (!threadsArg.empty())
+            numThreads = static_cast<unsigned int>(std::stoul(threadsArg));
+    } catch (const std::exception&) {
+        std::cout << "Failed to parse arguments!" << std::endl;
+        return 1;
+    }
+    if (image.width < 1 || image.height < 1 || rawSize < 2) {
+        std::cout << "Image and field sizes must be positive!" << std::endl;
+        return 1;
+    }
+
+    // Containers describe themselves. Raw files are signed by default, as the viewer assumes.
+    Stopwatch loadTime;
+    loadTime.start();
+    DistanceFieldView view;
+    std::vector<uint8_t> raw;
+    FieldSampler sampler;
+    if (view.load(inputPath)) {
+        if (!sampler.attach(view)) {
+            std::cout << "Fields need at least 2 voxels along every axis to be rendered!" << std::endl;
+            return 1;
+        }
+    }
+    else {
+        FieldOptions options = {rawSize, true, true, true, quantizationRange(true), VoxelType::U8, {rawSize, rawSize, rawSize}};
+        VoxelLayout layout = VoxelLayout::Linear;
+        const std::string precisionArg = getOption(args, "--precision"), layoutArg = getOption(args, "--layout");
+        if ((!precisionArg.empty() && !parseVoxelType(precisionArg, options.voxelType))
+            || (!layoutArg.empty() && !parseVoxelLayout(layoutArg, layout))) {
+            std::cout << "Unknown --precision or --layout!" << std::endl;
+            return 1;
+        }
+        options.isSigned = std::find(args.begin(), args.end(), "--unsigned") == args.end();
+        std::ifstream stream(inputPath, std::ios::binary);
+        raw.assign(std::istreambuf_iterator<char>(stream), std::istreambuf_iterator<char>());
+        const uint64_t expectedBytes = static_cast<uint64_t>(rawSize) * rawSize * rawSize * voxelBytes(options.voxelType);
+        if (raw.size() != expectedBytes || !layoutSupportsSize(layout, static_cast<uint32_t>(rawSize))) {
+            std::cout << "Failed to read " << inputPath << " as a container or a raw " << rawSize << "^3 field!" << std::endl;
+            return 1;
+        }
+        float scale, bias;
+        voxelDecoding(options, scale, bias);
+        sampler.attach(raw.data(), rawSize, options.voxelType, layout, scale, bias);
+    }
+    loadTime.stop();
+    std::cout << "Rendering a " << sampler.getDim(0) << "x" << sampler.getDim(1) << "x" << sampler.getDim(2) << " field at " << image.width << "x" << image.height << "." << std::endl;
+
+    ThreadPool pool(numThreads);
+    image.rgb.resize(3 * static_cast<size_t>(image.width) * static_cast<size_t>(image.height));
+    const Renderer renderer(sampler, camera, image);
+    RenderCounters counters;
+    counters.packets = 0;
+    counters.steps = 0;
+    counters.hits = 0;
+    const int numTiles = ((image.width + k_tileSize - 1) / k_tileSize) * ((image.height + k_tileSize - 1) / k_tileSize);
+    Stopwatch renderTime;
+    renderTime.start();
+    parallelFor(pool, static_cast<size_t>(numTiles), [&renderer, &counters](const size_t tile) {
+        renderer.renderTile(static_cast<int>(tile), counters);
+    });
+    renderTime.stop();
+
+    const bool written = hasSuffix(outputPath, ".ppm") ? writePpm(outputPath, image) : writePng(outputPath, image);
+    if (!written) {
+        std::cout << "Failed to write " << outputPath << "!" << std::endl;
+        return 1;
+    }
+
+    const double numRays = static_cast<double>(image.width) * image.height;
+    const double seconds = std::max(renderTime.getWallSeconds(), 1e-9);
+    std::printf("Loaded in %.3f s, rendered in %.3f s on %u thread(s): %.4g rays/s, %.1f steps per packet of %d rays, %.1f%% hits.\n",
+                loadTime.getWallSeconds(), seconds, pool.size(), numRays / seconds,
+                static_cast<double>(counters.steps) / static_cast<double>(std::max<uint64_t>(counters.packets, 1)), k_simdWidth,
+                100.0 * static_cast<double>(counters.hits) / numRays);
+    return 0;
+}
@@ -0,0 +1,400 @@
+#include "scene.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace { // Unnamed namespace.
+
+const int k_maxStackSize = 256;
+
+float boxSquaredDistance(const Vec3& p, const Vec3& boundsMin, const Vec3& boundsMax)
+{
+    const Vec3 d = vmax(vmax(boundsMin - p, p - boundsMax), Vec3(0.f, 0.f, 0.f));
+    return dot(d, d);
+}
+
+} // Unnamed namespace.
+
+size_t Scene::numTriangles() const
+{
+    size_t count = 0;
+    for (const MeshInstance& instance : instances)
+        count += meshes[instance.mesh].numTriangles;
+    return count;
+}
+
+AffineTransform unitCubeAffine(const UnitCubeTransform& transform)
+{
+    AffineTransform affine;
+    for (int r = 0; r < 3; ++r)
+        affine.rows[r] = affine.rows[r] * transform.scale;
+    affine.translation = Vec3(0.5f, 0.5f, 0.5f) - transform.origin*transform.scale;
+    return affine;
+}
+
+TriangleSoup flattenScene(const Scene& scene, std::vector<float>& positions, std::vector<uint32_t>& indices)
+{
+    positions.clear();
+    indices.clear();
+    for (const MeshInstance& instance : scene.instances) {
+        const TriangleSoup& mesh = scene.meshes[instance.mesh];
+        const uint32_t firstVertex = static_cast<uint32_t>(positions.size() / 3);
+        for (size_t v = 0; v < mesh.numVertices; ++v) {
+            const Vec3 p = instance.toUnitCube.apply(mesh.vertex(v));
+            positions.push_back(p.x);
+            positions.push_back(p.y);
+            positions.push_back(p.z);
+        }
+        for (size_t i = 0; i < 3*mesh.numTriangles; ++i)
+            indices.push_back(firstVertex + mesh.indices[i]);
+    }
+    const TriangleSoup soup = {positions.data(), indices.data(), positions.size() / 3, indices.size() / 3};
+    return soup;
+}
+
+InstancedDistance::InstancedDistance(const Scene& scene):
+    numCopied(0)
+{
+    const float Inf = std::numeric_limits<float>::infinity();
+    std::vector<uint32_t> treeOfMesh(scene.meshes.size(), ~0u);
+    std::vector<Vec3> treeMin, treeMax; // Bounds of the trees' meshes, in mesh space.
+    auto addTree = [&](const TriangleSoup& mesh) {
+        Vec3 boundsMin(Inf, Inf, Inf), boundsMax(-Inf, -Inf, -Inf);
+        for (size_t v = 0; v < mesh.numVertices; ++v) {
+            boundsMin = vmin(boundsMin, mesh.vertex(v));
+            boundsMax = vmax(boundsMax, mesh.vertex(v));
+        }
+        treeMin.push_back(boundsMin);
+        treeMax.push_back(boundsMax);
+        treeMeshes.push_back(mesh);
+        trees.emplace_back(new SimdBVH(mesh));
+        return static_cast<uint32_t>(trees.size() - 1);
+    };
+
+    uint32_t firstTriangle = 0;
+    for (const MeshInstance& sceneInstance : scene.instances) {
+        const TriangleSoup& mesh = scene.meshes[sceneInstance.mesh];
+        Instance instance;
+        instance.firstTriangle = firstTriangle;
+        firstTriangle += static_cast<uint32_t>(mesh.numTriangles);
+        instance.scale = sceneInstance.toUnitCube.similarityScale();
+        if (instance.scale > 0.f) {
+            if (treeOfMesh[sceneInstance.mesh] == ~0u)
+                treeOfMesh[sceneInstance.mesh] = addTree(mesh);
+            instance.tree = treeOfMesh[sceneInstance.mesh];
+            instance.toUnitCube = sceneInstance.toUnitCube;
+            instance.toMesh = sceneInstance.toUnitCube.inverse();
+        }
+        else {
+            // Copied into the unit cube, where the instance is its own mesh.
+            copiedPositions.emplace_back();
+            copiedIndices.emplace_back(mesh.indices, mesh.indices + 3*mesh.numTriangles);
+            for (size_t v = 0; v < mesh.numVertices; ++v) {
+                const Vec3 p = sceneInstance.toUnitCube.apply(mesh.vertex(v));
+                copiedPositions.back().insert(copiedPositions.back().end(), {p.x, p.y, p.z});
+            }
+            const TriangleSoup copy = {copiedPositions.back().data(), copiedIndices.back().data(), mesh.numVertices, mesh.numTriangles};
+            instance.tree = addTree(copy);
+            instance.scale = 1.f;
+            numCopied++;
+        }
+
+        // The transformed corners of the mesh bounds bound the instance.
+        const Vec3 localMin = treeMin[instance.tree], localMax = treeMax[instance.tree];
+        instance.boundsMin = Vec3(Inf, Inf, Inf);
+        instance.boundsMax = Vec3(-Inf, -Inf, -Inf);
+        for (int corner = 0; corner < 8; ++corner) {
+            const Vec3 p = instance.toUnitCube.apply(Vec3((corner & 1) ? localMax.x : localMin.x, (corner & 2) ? localMax.y : localMin.y,
+                                                          (corner & 4) ? localMax.z : localMin.z));
+            instance.boundsMin = vmin(instance.boundsMin, p);
+            instance.boundsMax = vmax(instance.boundsMax, p);
+        }
+        instances.push_back(instance);
+    }
+
+    order.resize(instances.size());
+    for (uint32_t i = 0; i < order.size(); ++i)
+        order[i] = i;
+    if (!instances.empty())
+        build(0, static_cast<uint32_t>(instances.size()));
+}
+
+uint32_t InstancedDistance::build(const uint32_t begin, const uint32_t end)
+{
+    const float Inf = std::numeric_limits<float>::infinity();
+    Node node;
+    node.boundsMin = Vec3(Inf, Inf, Inf);
+    node.boundsMax = Vec3(-Inf, -Inf, -Inf);
+    Vec3 centroidMin = node.boundsMin, centroidMax = node.boundsMax;
+    for (uint32_t i = begin; i < end; ++i) {
+        const Instance& instance = instances[order[i]];
+        node.boundsMin = vmin(node.boundsMin, instance.boundsMin);
+        node.boundsMax = vmax(node.boundsMax, instance.boundsMax);
+        const Vec3 centroid = (instance.boundsMin + instance.boundsMax) * 0.5f;
+        centroidMin = vmin(centroidMin, centroid);
+        centroidMax = vmax(centroidMax, centroid);
+    }
+
+    const uint32_t index = static_cast<uint32_t>(nodes.size());
+    nodes.push_back(node);
+    if (end - begin <= k_leafSize) {
+        nodes[index].first = begin;
+        nodes[index].count = end - begin;
+        return index;
+    }
+
+    // Median split along the longest axis of the centroids.
+    const Vec3 extents = centroidMax - centroidMin;
+    const int axis = (extents.x >= extents.y && extents.x >= extents.z) ? 0 : ((extents.y >= extents.z) ? 1 : 2);
+    const uint32_t middle = begin + (end - begin) / 2;
+    std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end, [this, axis](const uint32_t a, const uint32_t b) {
+        return instances[a].boundsMin[axis] + instances[a].boundsMax[axis] < instances[b].boundsMin[axis] + instances[b].boundsMax[axis];
+    });
+    build(begin, middle);
+    const uint32_t right = build(middle, end);
+    nodes[index].first = right;
+    nodes[index].count = 0;
+    return index;
+}
+
+uint32_t InstancedDistance::instanceOfTriangle(const uint32_t triangle) const
+{
+    const auto it = std::upper_bound(instances.begin(), instances.end(), triangle,
+                                     [](const uint32_t t, const Instance& i) { return t < i.firstTriangle; });
+    return static_cast<uint32_t>(it - instances.begin()) - 1;
+}
+
+void InstancedDistance::queryInstance(const uint32_t index, const Vec3& query, const uint32_t seedTriangle, float& best,
+                                      uint32_t& instance, uint32_t& triangle, uint64_t& nodeVisits) const
+{
+    const Instance& candidate = instances[index];
+    const float scale2 = candidate.scale*candidate.scale;
+    float localBest = best / scale2;
+    uint32_t localTriangle = SimdBVH::k_invalidTriangle;
+    trees[candidate.tree]->closestTriangleWithin(candidate.toMesh.apply(query), seedTriangle, localBest, localTriangle, nodeVisits);
+    if (localTriangle != SimdBVH::k_invalidTriangle) {
+        best = localBest*scale2;
+        instance = index;
+        triangle = localTriangle;
+    }
+}
+
+float InstancedDistance::closest(const Vec3& query, const DistanceHint& hint, uint32_t& instance, uint32_t& triangle,
+                                 uint64_t& nodeVisits) const
+{
+    float best = std::numeric_limits<float>::infinity();
+    instance = ~0u;
+    triangle = SimdBVH::k_invalidTriangle;
+    if (instances.empty())
+        return best;
+
+    // The hint's instance is searched first, its closest triangle bounds the rest of the search.
+    uint32_t hintInstance = ~0u;
+    if (hint.valid && hint.triangle != SimdBVH::k_invalidTriangle) {
+        hintInstance = instanceOfTriangle(hint.triangle);
+        queryInstance(hintInstance, query, hint.triangle - instances[hintInstance].firstTriangle, best, instance, triangle, nodeVisits);
+    }
+
+    struct Entry
+    {
+        uint32_t node;
+        float dist;
+    };
+    Entry stack[k_maxStackSize];
+    int stackSize = 0;
+    stack[stackSize++] = Entry{0, 0.f};
+    while (stackSize > 0) {
+        const Entry entry = stack[--stackSize];
+        if (entry.dist >= best)
+            continue;
+        const Node& node = nodes[entry.node];
+        if (node.count > 0) {
+            for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+                const Instance& candidate = instances[order[i]];
+                if (order[i] != hintInstance && boxSquaredDistance(query, candidate.boundsMin, candidate.boundsMax) < best)
+                    queryInstance(order[i], query, SimdBVH::k_invalidTriangle, best, instance, triangle, nodeVisits);
+            }
+            continue;
+        }
+
+        // The closer child is processed first.
+        const uint32_t left = entry.node + 1, right = node.first;
+        const float leftDist = boxSquaredDistance(query, nodes[left].boundsMin, nodes[left].boundsMax);
+        const float rightDist = boxSquaredDistance(query, nodes[right].boundsMin, nodes[right].boundsMax);
+        if (leftDist <= rightDist) {
+            stack[stackSize++] = Entry{right, rightDist};
+            stack[stackSize++] = Entry{left, leftDist};
+        }
+        else {
+            stack[stackSize++] = Entry{left, leftDist};
+            stack[stackSize++] = Entry{right, rightDist};
+        }
+    }
+    return best;
+}
+
+void InstancedDistance::queryInstanceBlock(const uint32_t index, const Vec3* queries, const uint64_t mask, const uint32_t seedTriangle,
+                                           float* best, uint32_t* closestInstances, uint32_t* triangles, uint64_t& nodeVisits) const
+{
+    const Instance& candidate = instances[index];
+    const float scale2 = candidate.scale*candidate.scale;
+    Vec3 local[SimdBVH::k_maxBlockSize];
+    float localBest[SimdBVH::k_maxBlockSize];
+    uint32_t localTriangles[SimdBVH::k_maxBlockSize];
+    size_t slots[SimdBVH::k_maxBlockSize];
+    size_t count = 0;
+    for (uint64_t remaining = mask; remaining != 0; remaining &= remaining - 1) {
+        const size_t q = static_cast<size_t>(__builtin_ctzll(remaining));
+        local[count] = candidate.toMesh.apply(queries[q]);
+        localBest[count] = best[q] / scale2;
+        localTriangles[count] = SimdBVH::k_invalidTriangle;
+        slots[count++] = q;
+    }
+    trees[candidate.tree]->closestTrianglesWithin(local, count, seedTriangle, localBest, localTriangles, nodeVisits);
+    for (size_t i = 0; i < count; ++i) {
+        if (localTriangles[i] != SimdBVH::k_invalidTriangle) {
+            best[slots[i]] = localBest[i]*scale2;
+            closestInstances[slots[i]] = index;
+            triangles[slots[i]] = localTriangles[i];
+        }
+    }
+}
+
+void InstancedDistance::closestBlock(const Vec3* queries, const size_t count, float* best, uint32_t* closestInstances,
+                                     uint32_t* triangles, DistanceHint& hint, uint64_t& nodeVisits) const
+{
+    for (size_t i = 0; i < count; ++i) {
+        best[i] = std::numeric_limits<float>::infinity();
+        closestInstances[i] = ~0u;
+        triangles[i] = SimdBVH::k_invalidTriangle;
+    }
+    if (instances.empty())
+        return;
+
+    // Without a hint, the first query finds one on its own. The whole block then searches the
+    // hint's instance first.
+    if (!hint.valid || hint.triangle == SimdBVH::k_invalidTriangle)
+        hintedSquaredDistance(queries[0], hint, nodeVisits);
+    const uint64_t all = (count == 64) ? ~uint64_t(0) : ((uint64_t(1) << count) - 1);
+    uint32_t hintInstance = ~0u;
+    if (hint.valid) {
+        hintInstance = instanceOfTriangle(hint.triangle);
+        queryInstanceBlock(hintInstance, queries, all, hint.triangle - instances[hintInstance].firstTriangle, best,
+                           closestInstances, triangles, nodeVisits);
+    }
+
+    struct Entry
+    {
+        uint32_t node;
+        uint64_t queryMask; // Queries that reached the node's parent.
+    };
+    Entry stack[k_maxStackSize];
+    int stackSize = 0;
+    stack[stackSize++] = Entry{0, all};
+    while (stackSize > 0) {
+        const Entry entry = stack[--stackSize];
+        const Node& node = nodes[entry.node];
+        uint64_t queryMask = 0;
+        for (uint64_t mask = entry.queryMask; mask != 0; mask &= mask - 1) {
+            const size_t q = static_cast<size_t>(__builtin_ctzll(mask));
+            if (boxSquaredDistance(queries[q], node.boundsMin, node.boundsMax) < best[q])
+                queryMask |= uint64_t(1) << q;
+        }
+        if (queryMask == 0)
+            continue;
+
+        if (node.count > 0) {
+            for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+                if (order[i] == hintInstance)
+                    continue;
+                const Instance& candidate = instances[order[i]];
+                uint64_t instanceMask = 0;
+                for (uint64_t mask = queryMask; mask != 0; mask &= mask - 1) {
+                    const size_t q = static_cast<size_t>(__builtin_ctzll(mask));
+                    if (boxSquaredDistance(queries[q], candidate.boundsMin, candidate.boundsMax) < best[q])
+                        instanceMask |= uint64_t(1) << q;
+                }
+                if (instanceMask != 0)
+                    queryInstanceBlock(order[i], queries, instanceMask, SimdBVH::k_invalidTriangle, best, closestInstances, triangles, nodeVisits);
+            }
+            continue;
+        }
+
+        // The child closer to the first query is processed first.
+        const uint32_t left = entry.node + 1, right = node.first;
+        const Vec3& first = queries[__builtin_ctzll(queryMask)];
+        const bool leftFirst = boxSquaredDistance(first, nodes[left].boundsMin, nodes[left].boundsMax)
+                            <= boxSquaredDistance(first, nodes[right].boundsMin, nodes[right].boundsMax);
+        stack[stackSize++] = Entry{leftFirst ? right : left, queryMask};
+        stack[stackSize++] = Entry{leftFirst ? left : right, queryMask};
+    }
+
+    const size_t last = count - 1;
+    hint.valid = (triangles[last] != SimdBVH::k_invalidTriangle);
+    if (hint.valid) {
+        hint.point = closestPoint(queries[last], closestInstances[last], triangles[last]);
+        hint.triangle = instances[closestInstances[last]].firstTriangle + triangles[last];
+    }
+}
+
+Vec3 InstancedDistance::closestPoint(const Vec3& query, const uint32_t instance, const uint32_t triangle) const
+{
+    const Instance& closestInstance = instances[instance];
+    const TriangleSoup& mesh = treeMeshes[closestInstance.tree];
+    const Vec3 local = closestPointOnTriangle(closestInstance.toMesh.apply(query), mesh.corner(triangle, 0), mesh.corner(triangle, 1),
+                                              mesh.corner(triangle, 2));
+    return closestInstance.toUnitCube.apply(local);
+}
+
+double InstancedDistance::squaredDistance(const Vec3& query) const
+{
+    uint32_t instance, triangle;
+    uint64_t nodeVisits = 0;
+    return static_cast<double>(closest(query, DistanceHint(), instance, triangle, nodeVisits));
+}
+
+double InstancedDistance::hintedSquaredDistance(const Vec3& query, DistanceHint& hint, uint64_t& nodeVisits) const
+{
+    uint32_t instance, triangle;
+    const float best = closest(query, hint, instance, triangle, nodeVisits);
+    hint.valid = (triangle != SimdBVH::k_invalidTriangle);
+    if (hint.valid) {
+        hint.point = closestPoint(query, instance, triangle);
+        hint.triangle = instances[instance].firstTriangle + triangle;
+    }
+    return static_cast<double>(best);
+}
+
+void InstancedDistance::blockSquaredDistances(const Vec3* queries, const size_t count, double* results,
+                                              DistanceHint& hint, uint64_t& nodeVisits) const
+{
+    for (size_t begin = 0; begin < count; begin += SimdBVH::k_maxBlockSize) {
+        const size_t blockSize = std::min(count - begin, SimdBVH::k_maxBlockSize);
+        float best[SimdBVH::k_maxBlockSize];
+        uint32_t closestInstances[SimdBVH::k_maxBlockSize], triangles[SimdBVH::k_maxBlockSize];
+        closestBlock(queries + begin, blockSize, best, closestInstances, triangles, hint, nodeVisits);
+        for (size_t i = 0; i < blockSize; ++i)
+            results[begin + i] = static_cast<double>(best[i]);
+    }
+}
+
+// Triangles are reported in the scene's numbering, closest points in the unit cube.
+void InstancedDistance::blockClosestPoints(const Vec3* queries, const size_t count, double* results, Vec3* points,
+                                           uint32_t* triangles, DistanceHint& hint, uint64_t& nodeVisits) const
+{
+    for (size_t begin = 0; begin < count; begin += SimdBVH::k_maxBlockSize) {
+        const size_t blockSize = std::min(count - begin, SimdBVH::k_maxBlockSize);
+        float best[SimdBVH::k_maxBlockSize];
+        uint32_t closestInstances[SimdBVH::k_maxBlockSize];
+        closestBlock(queries + begin, blockSize, best, closestInstances, triangles + begin, hint, nodeVisits);
+        for (size_t i = begin; i < begin + blockSize; ++i) {
+            results[i] = static_cast<double>(best[i - begin]);
+            if (triangles[i] == SimdBVH::k_invalidTriangle) {
+                points[i] = queries[i];
+                continue;
+            }
+            points[i] = closestPoint(queries[i], closestInstances[i - begin], triangles[i]);
+            triangles[i] += instances[closestInstances[i - begin]].firstTriangle;
+        }
+    }
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "bvh.h"
+#include "distance.h"
+#include "geometry.h"
+
+// Mesh placed in the unit cube by a transform. Several instances may share a mesh.
+struct MeshInstance
+{
+    uint32_t mesh; // Index into Scene::meshes.
+    AffineTransform toUnitCube;
+};
+
+// Meshes in their own space and their instances. Triangles of the scene are numbered instance by
+// instance, each in the order of its mesh (the order flattenScene stores them in).
+struct Scene
+{
+    std::vector<TriangleSoup> meshes;
+    std::vector<MeshInstance> instances;
+
+    size_t numTriangles() const;
+};
+
+AffineTransform unitCubeAffine(const UnitCubeTransform& transform);
+
+// Copies the triangles of every instance into one soup in the unit cube (referencing the buffers).
+TriangleSoup flattenScene(const Scene& scene, std::vector<float>& positions, std::vector<uint32_t>& indices);
+
+// Distance queries against a scene without copying its instances: every mesh has one SimdBVH in
+// its own space, and a binary tree over the bounds of the instances finds the instances that
+// can be closer than the best triangle so far, nearest first. A query is transformed into each
+// such instance's mesh space, where distances scale by the instance's similarity scale. Blocks of
+// queries visit the instance tree together, and the queries that reach an instance traverse its
+// tree as one block, seeded like SimdBVH by the hint's instance. Instances
+// transformed by anything but a similarity (e.g. a non-uniform scale) do not preserve distances;
+// those are copied into the unit cube and get a tree of their own.
+class InstancedDistance : public DistanceEngine
+{
+public:
+    explicit InstancedDistance(const Scene& scene);
+
+    double squaredDistance(const Vec3& query) const override;
+    double hintedSquaredDistance(const Vec3& query, DistanceHint& hint, uint64_t& nodeVisits) const override;
+    void blockSquaredDistances(const Vec3* queries, size_t count, double* results,
+                               DistanceHint& hint, uint64_t& nodeVisits) const override;
+    void blockClosestPoints(const Vec3* queries, size_t count, double* results, Vec3* points,
+                            uint32_t* triangles, DistanceHint& hint, uint64_t& nodeVisits) const override;
+
+    size_t getNumTrees() const { return trees.size(); }
+    size_t getNumCopiedInstances() const { return numCopied; }
+
+private:
+    struct Instance
+    {
+        uint32_t tree;
+        AffineTransform toUnitCube, toMesh;
+        float scale;            // Unit cube units per mesh unit.
+        uint32_t firstTriangle; // In the scene's numbering.
+        Vec3 boundsMin, boundsMax;
+    };
+
+    // Leaves hold instances [first, first+count) of `order`; inner nodes have count 0, their left
+    // child follows them and first is the right child.
+    struct Node
+    {
+        Vec3 boundsMin, boundsMax;
+        uint32_t first, count;
+    };
+
+    uint32_t build(uint32_t begin, uint32_t end);
+    uint32_t instanceOfTriangle(uint32_t triangle) const;
+    // Closest triangle of an instance within best (squared, unit cube), seeded with a triangle of
+    // the instance's mesh if valid. Lowers best and updates instance/triangle when it finds one.
+    void queryInstance(uint32_t index, const Vec3& query, uint32_t seedTriangle, float& best, uint32_t& instance,
+                       uint32_t& triangle, uint64_t& nodeVisits) const;
+    // Same for the queries of a block (up to SimdBVH::k_maxBlockSize) set in mask.
+    void queryInstanceBlock(uint32_t index, const Vec3* queries, uint64_t mask, uint32_t seedTriangle, float* best,
+                            uint32_t* closestInstances, uint32_t* triangles, uint64_t& nodeVisits) const;
+    float closest(const Vec3& query, const DistanceHint& hint, uint32_t& instance, uint32_t& triangle, uint64_t& nodeVisits) const;
+    // Closest instances and triangles of a block, seeded with and updating the hint.
+    void closestBlock(const Vec3* queries, size_t count, float* best, uint32_t* closestInstances, uint32_t* triangles,
+                      DistanceHint& hint, uint64_t& nodeVisits) const;
+    Vec3 closestPoint(const Vec3& query, uint32_t instance, uint32_t triangle) const;
+
+    static const uint32_t k_leafSize = 2;
+
+    std::vector<std::unique_ptr<SimdBVH>> trees; // One per mesh used by a similarity, one per copied instance.
+    std::vector<TriangleSoup> treeMeshes;
+    std::vector<std::vector<float>> copiedPositions;
+    std::vector<std::vector<uint32_t>> copiedIndices;
+    std::vector<Instance> instances;
+    std::vector<uint32_t> order;
+    std::vector<Node> nodes;
+    size_t numCopied;
+};
@@ -0,0 +1,308 @@
+#include "serve.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <thread>
+
+#include <sys/stat.h>
+
+#include "threadpool.h"
+
+static_assert(sizeof(Vec3) == 3*sizeof(float), "Query points are read as Vec3");
+
+namespace { // Unnamed namespace.
+
+const size_t k_latencyWindow = 1 << 16; // Warm queries whose latencies are kept for the percentiles.
+const int k_listenBacklog = 64;
+
+// Latency below which the given fraction of the samples lies (nearest rank).
+double percentile(const std::vector<double>& sorted, const double fraction)
+{
+    const size_t rank = static_cast<size_t>(std::ceil(fraction * static_cast<double>(sorted.size())));
+    return sorted[std::min(std::max<size_t>(rank, 1), sorted.size()) - 1];
+}
+
+QueryResponseHeader makeResponse(const QueryStatus status, const std::string& message, const uint32_t numResults)
+{
+    QueryResponseHeader response;
+    std::memset(&response, 0, sizeof(response));
+    std::memcpy(response.magic, k_queryMagic, sizeof(response.magic));
+    response.status = static_cast<uint32_t>(status);
+    response.messageBytes = static_cast<uint32_t>(message.length());
+    response.numResults = numResults;
+    return response;
+}
+
+bool sendResponse(const int socket, const QueryResponseHeader& response, const std::string& message)
+{
+    return sendAll(socket, &response, sizeof(response)) && sendAll(socket, message.data(), message.length());
+}
+
+} // Unnamed namespace.
+
+QueryService::QueryService(const MeshLoader& loader, ThreadPool& pool, const size_t maxMeshes):
+    loader(loader), pool(pool), maxMeshes(std::max<size_t>(maxMeshes, 1)), log(nullptr), useCounter(0), listenSocket(-1),
+    stopping(false), nextTurn(0), currentTurn(0), nextLatency(0), numQueries(0), numPoints(0), numLoads(0), loadSeconds(0.0),
+    firstQueryTime(0.0), lastQueryTime(0.0), startTime(std::chrono::steady_clock::now())
+{
+}
+
+bool QueryService::run(const std::string& socketPath, std::ostream& logStream)
+{
+    log = &logStream;
+    sockaddr_un address;
+    if (!makeSocketAddress(socketPath, address)) {
+        logStream << "Invalid socket path (at most " << sizeof(address.sun_path) - 1 << " characters)!" << std::endl;
+        return false;
+    }
+    // A socket file left by a service that is gone is replaced, one still answering is not.
+    QueryClient probe;
+    if (probe.connect(socketPath)) {
+        logStream << "A service is already listening on " << socketPath << "!" << std::endl;
+        return false;
+    }
+    ::unlink(socketPath.c_str());
+    listenSocket = ::socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenSocket < 0 || ::bind(listenSocket, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0
+        || ::listen(listenSocket, k_listenBacklog) != 0) {
+        logStream << "Failed to listen on " << socketPath << ": " << std::strerror(errno) << std::endl;
+        if (listenSocket >= 0)
+            ::close(listenSocket);
+        return false;
+    }
+    logStream << "Serving point queries on " << socketPath << " with " << pool.size() << " thread(s), up to "
+              << maxMeshes << " resident mesh(es)." << std::endl;
+
+    while (!stopping) {
+        const int socket = ::accept(listenSocket, nullptr, nullptr);
+        if (socket < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            break; // Shut down (or failed).
+        }
+        std::lock_guard<std::mutex> lock(connectionMutex);
+        if (stopping) {
+            ::close(socket);
+            break;
+        }
+        connections.insert(socket);
+        std::thread([this, socket]() { serveConnection(socket); }).detach();
+    }
+
+    // Wakes the connections waiting for their next request and waits for them to close.
+    {
+        std::unique_lock<std::mutex> lock(connectionMutex);
+        stopping = true;
+        for (const int socket : connections)
+            ::shutdown(socket, SHUT_RDWR);
+        connectionsClosed.wait(lock, [this]() { return connections.empty(); });
+    }
+    ::close(listenSocket);
+    ::unlink(socketPath.c_str());
+    logStream << report() << std::endl;
+    return true;
+}
+
+std::string QueryService::report() const
+{
+    std::lock_guard<std::mutex> lock(statsMutex);
+    std::ostringstream text;
+    const double busySeconds = std::max(lastQueryTime - firstQueryTime, 1e-9);
+    text << "Answered " << numQueries << " warm quer" << (numQueries == 1 ? "y" : "ies") << " of " << numPoints << " point(s)";
+    if (numQueries > 0)
+        text << ", " << static_cast<double>(numPoints) / busySeconds << " points/s";
+    text << "; " << numLoads << " mesh load(s) in " << loadSeconds << " s.";
+    if (!latencies.empty()) {
+        std::vector<double> sorted(latencies);
+        std::sort(sorted.begin(), sorted.end());
+        text << " Latency of the last " << sorted.size() << " (ms): p50 " << 1e3*percentile(sorted, 0.5)
+             << ", p90 " << 1e3*percentile(sorted, 0.9) << ", p99 " << 1e3*percentile(sorted, 0.99)
+             << ", p99.9 " << 1e3*percentile(sorted, 0.999) << ", max " << 1e3*sorted.back() << ".";
+    }
+    return text.str();
+}
+
+std::shared_ptr<QueryService::ResidentMesh> QueryService::acquireMesh(const std::string& path, bool& loaded, std::string& error)
+{
+    loaded = false;
+    struct stat status;
+    if (::stat(path.c_str(), &status) != 0) {
+        error = "Cannot read " + path + "!";
+        return nullptr;
+    }
+    const std::string key = path + "@" + std::to_string(static_cast<long long>(status.st_mtime)) + "@"
+                            + std::to_string(static_cast<long long>(status.st_size));
+    {
+        std::lock_guard<std::mutex> lock(meshMutex);
+        const auto it = meshes.find(key);
+        if (it != meshes.end()) {
+            it->second->lastUse = ++useCounter;
+            return it->second;
+        }
+    }
+
+    // Another connection may have loaded it in the meantime.
+    std::lock_guard<std::mutex> loadLock(loadMutex);
+    {
+        std::lock_guard<std::mutex> lock(meshMutex);
+        const auto it = meshes.find(key);
+        if (it != meshes.end()) {
+            it->second->lastUse = ++useCounter;
+            return it->second;
+        }
+    }
+    std::ostringstream loadLog;
+    std::vector<float> positions;
+    std::vector<uint32_t> indices;
+    if (!loader(path, positions, indices, loadLog) || indices.empty()) {
+        error = loadLog.str().empty() ? "No triangles in " + path + "!" : loadLog.str();
+        return nullptr;
+    }
+    std::shared_ptr<ResidentMesh> mesh = std::make_shared<ResidentMesh>();
+    const float Inf = std::numeric_limits<float>::infinity();
+    mesh->boundsMin = Vec3(Inf, Inf, Inf);
+    mesh->boundsMax = Vec3(-Inf, -Inf, -Inf);
+    for (size_t i = 0; i < positions.size(); i += 3) {
+        const Vec3 p(positions[i], positions[i+1], positions[i+2]);
+        mesh->boundsMin = vmin(mesh->boundsMin, p);
+        mesh->boundsMax = vmax(mesh->boundsMax, p);
+    }
+    // Queries run on the service's pool, the generator needs no threads of its own.
+    mesh->numTriangles = indices.size() / 3;
+    mesh->generator.reset(new DistanceFieldGenerator(positions.data(), positions.size() / 3, indices.data(), mesh->numTriangles, 1));
+    if (!mesh->generator->isValid()) {
+        error = "Invalid mesh " + path + " (an index out of range or a coordinate not finite)!";
+        return nullptr;
+    }
+    // Signs have a tree of their own, built here rather than in the first query's turn.
+    mesh->generator->prepareQueries();
+    loaded = true;
+
+    std::lock_guard<std::mutex> lock(meshMutex);
+    mesh->lastUse = ++useCounter;
+    meshes[key] = mesh;
+    // In-flight queries keep evicted meshes alive until they finish.
+    while (meshes.size() > maxMeshes) {
+        auto oldest = meshes.begin();
+        for (auto it = meshes.begin(); it != meshes.end(); ++it) {
+            if (it->second->lastUse < oldest->second->lastUse)
+                oldest = it;
+        }
+        meshes.erase(oldest);
+    }
+    return mesh;
+}
+
+void QueryService::serveConnection(const int socket)
+{
+    // Buffers reused by every request of the connection.
+    std::vector<float> points;
+    std::vector<PointQueryResult> results;
+    std::vector<QueryResultRecord> records;
+    while (answerRequest(socket, points, results, records)) {}
+    std::lock_guard<std::mutex> lock(connectionMutex);
+    connections.erase(socket);
+    ::close(socket);
+    connectionsClosed.notify_all();
+}
+
+bool QueryService::answerRequest(const int socket, std::vector<float>& points, std::vector<PointQueryResult>& results,
+                                 std::vector<QueryResultRecord>& records)
+{
+    QueryRequestHeader request;
+    if (!receiveAll(socket, &request, sizeof(request)))
+        return false;
+    const auto requestTime = std::chrono::steady_clock::now();
+    if (std::memcmp(request.magic, k_queryMagic, sizeof(request.magic)) != 0 || request.op > static_cast<uint32_t>(QueryOp::Shutdown)
+        || request.pathBytes > k_queryMaxPathBytes || request.numPoints > k_queryMaxPoints) {
+        const std::string error = "Malformed request!";
+        sendResponse(socket, makeResponse(QueryStatus::Failed, error, 0), error);
+        return false;
+    }
+    std::string path(request.pathBytes, '\0');
+    points.resize(3 * static_cast<size_t>(request.numPoints));
+    if (!receiveAll(socket, &path[0], path.size()) || !receiveAll(socket, points.data(), points.size()*sizeof(float)))
+        return false;
+
+    const QueryOp op = static_cast<QueryOp>(request.op);
+    if (op == QueryOp::Stats) {
+        const std::string text = report();
+        return sendResponse(socket, makeResponse(QueryStatus::Ok, text, 0), text);
+    }
+    if (op == QueryOp::Shutdown) {
+        sendResponse(socket, makeResponse(QueryStatus::Ok, std::string(), 0), std::string());
+        std::lock_guard<std::mutex> lock(connectionMutex);
+        stopping = true;
+        ::shutdown(listenSocket, SHUT_RDWR); // Wakes accept().
+        return false;
+    }
+
+    bool loaded;
+    std::string error;
+    const std::shared_ptr<ResidentMesh> mesh = acquireMesh(path, loaded, error);
+    if (!mesh)
+        return sendResponse(socket, makeResponse(QueryStatus::Failed, error, 0), error);
+    if (loaded) {
+        const std::chrono::duration<double> loadElapsed = std::chrono::steady_clock::now() - requestTime;
+        std::lock_guard<std::mutex> lock(logMutex);
+        *log << "Loaded " << path << " (" << mesh->numTriangles << " triangles) and built its trees in "
+             << loadElapsed.count() << " s." << std::endl;
+    }
+
+    const size_t count = request.numPoints;
+    results.resize(count);
+    {
+        std::unique_lock<std::mutex> lock(turnMutex);
+        const uint64_t turn = nextTurn++;
+        turnChanged.wait(lock, [this, turn]() { return currentTurn == turn; });
+    }
+    mesh->generator->query(pool, reinterpret_cast<const Vec3*>(points.data()), count, results.data());
+    {
+        std::lock_guard<std::mutex> lock(turnMutex);
+        currentTurn++;
+    }
+    turnChanged.notify_all();
+    records.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        records[i].distance = results[i].distance;
+        records[i].closest[0] = results[i].closest.x;
+        records[i].closest[1] = results[i].closest.y;
+        records[i].closest[2] = results[i].closest.z;
+        records[i].triangle = results[i].triangle;
+    }
+    QueryResponseHeader response = makeResponse(QueryStatus::Ok, std::string(), request.numPoints);
+    for (int axis = 0; axis < 3; ++axis) {
+        response.boundsMin[axis] = mesh->boundsMin[axis];
+        response.boundsMax[axis] = mesh->boundsMax[axis];
+    }
+    const bool sent = sendAll(socket, &response, sizeof(response)) && sendAll(socket, records.data(), count*sizeof(QueryResultRecord));
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - requestTime;
+    recordQuery(elapsed.count(), request.numPoints, loaded);
+    return sent;
+}
+
+void QueryService::recordQuery(const double seconds, const uint32_t queryPoints, const bool loaded)
+{
+    std::lock_guard<std::mutex> lock(statsMutex);
+    if (loaded) {
+        numLoads++;
+        loadSeconds += seconds;
+        return;
+    }
+    const std::chrono::duration<double> now = std::chrono::steady_clock::now() - startTime;
+    if (numQueries == 0)
+        firstQueryTime = now.count() - seconds;
+    lastQueryTime = now.count();
+    numQueries++;
+    numPoints += queryPoints;
+    if (latencies.size() < k_latencyWindow)
+        latencies.push_back(seconds);
+    else
+        latencies[nextLatency] = seconds;
+    nextLatency = (nextLatency + 1) % k_latencyWindow;
+}
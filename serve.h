@@ -0,0 +1,89 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <iosfwd>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "dfgen.h"
+#include "geometry.h"
+#include "queryservice.h"
+
+class ThreadPool;
+
+// Reads a mesh file as one triangle soup in mesh space: xyz per vertex, three vertex indices per
+// triangle. Errors go to log.
+typedef std::function<bool(const std::string& path, std::vector<float>& positions, std::vector<uint32_t>& indices,
+                           std::ostream& log)> MeshLoader;
+
+// Long running point query service (dfgen --serve, protocol in queryservice.h). Meshes are loaded
+// by the first query naming them and stay resident with their trees, the least recently used
+// evicted beyond maxMeshes. Every connection is served by a thread of its own, the points of its
+// requests on the shared pool. Batches take turns in the order they arrived, each evaluated on the
+// whole pool, so none waits behind more than those before it. Throughput is over the time since
+// the first warm query.
+class QueryService
+{
+public:
+    QueryService(const MeshLoader& loader, ThreadPool& pool, size_t maxMeshes);
+
+    // Serves the socket until a Shutdown request, false if it cannot listen. Progress goes to log.
+    bool run(const std::string& socketPath, std::ostream& log);
+
+    // Throughput and latency of the warm queries so far (those that loaded a mesh are counted apart).
+    std::string report() const;
+
+private:
+    struct ResidentMesh
+    {
+        std::unique_ptr<DistanceFieldGenerator> generator;
+        Vec3 boundsMin, boundsMax;
+        size_t numTriangles;
+        uint64_t lastUse;
+    };
+
+    std::shared_ptr<ResidentMesh> acquireMesh(const std::string& path, bool& loaded, std::string& error);
+    void serveConnection(int socket);
+    // False once the connection should be closed.
+    bool answerRequest(int socket, std::vector<float>& points, std::vector<PointQueryResult>& results,
+                       std::vector<QueryResultRecord>& records);
+    void recordQuery(double seconds, uint32_t numPoints, bool loaded);
+
+    const MeshLoader loader;
+    ThreadPool& pool;
+    const size_t maxMeshes;
+    std::ostream* log;
+    std::mutex logMutex;
+
+    std::map<std::string, std::shared_ptr<ResidentMesh>> meshes; // By path and modification time.
+    uint64_t useCounter;
+    std::mutex meshMutex; // Guards meshes and useCounter.
+    std::mutex loadMutex; // Meshes are loaded one at a time.
+
+    int listenSocket;
+    std::atomic<bool> stopping;
+    std::mutex turnMutex;
+    std::condition_variable turnChanged;
+    uint64_t nextTurn, currentTurn; // Tickets of the batches, in arrival order.
+
+    std::set<int> connections; // Open, each served by a detached thread.
+    std::mutex connectionMutex;
+    std::condition_variable connectionsClosed;
+
+    // Latencies of the last k_latencyWindow warm queries, in a ring.
+    mutable std::mutex statsMutex;
+    std::vector<double> latencies;
+    size_t nextLatency;
+    uint64_t numQueries, numPoints, numLoads;
+    double loadSeconds;
+    double firstQueryTime, lastQueryTime; // Seconds since the service started.
+    std::chrono::steady_clock::time_point startTime;
+};
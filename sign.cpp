@@ -0,0 +1,393 @@
+#include "sign.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <utility>
+
+namespace { // Unnamed namespace.
+
+const double k_fourPi = 4.0 * M_PI;
+const double k_windingBeta = 2.0; // Clusters further away than beta*radius are approximated.
+
+// Twice the signed area of triangle (p, q, t) projected to the yz plane. Endpoints are always
+// used in the same order, so two triangles sharing the edge get exactly opposite values.
+double edgeFunction(const Vec3& p, const Vec3& q, const double y, const double z)
+{
+    if (p.y > q.y || (p.y == q.y && p.z > q.z))
+        return -edgeFunction(q, p, y, z);
+    return (static_cast<double>(q.y) - p.y)*(z - p.z) - (static_cast<double>(q.z) - p.z)*(y - p.y);
+}
+
+// Top-left fill rule: of two triangles sharing an edge (traversed in opposite directions),
+// exactly one owns rows passing exactly through the edge.
+bool ownsEdge(const Vec3& p, const Vec3& q, const bool flipped)
+{
+    double dy = static_cast<double>(q.y) - p.y;
+    double dz = static_cast<double>(q.z) - p.z;
+    if (flipped) {
+        dy = -dy;
+        dz = -dz;
+    }
+    return dy > 0.0 || (dy == 0.0 && dz > 0.0);
+}
+
+struct DVec3
+{
+    double x, y, z;
+};
+
+DVec3 toDVec3(const Vec3& v, const Vec3& origin)
+{
+    return DVec3{static_cast<double>(v.x) - origin.x, static_cast<double>(v.y) - origin.y, static_cast<double>(v.z) - origin.z};
+}
+
+double dot(const DVec3& a, const DVec3& b) { return a.x*b.x + a.y*b.y + a.z*b.z; }
+double length(const DVec3& v) { return std::sqrt(dot(v, v)); }
+DVec3 cross(const DVec3& a, const DVec3& b) { return DVec3{a.y*b.z - a.z*b.y, a.z*b.x - a.x*b.z, a.x*b.y - a.y*b.x}; }
+
+// Signed solid angle of triangle (a, b, c) seen from the origin (Van Oosterom and Strackee).
+double solidAngle(const DVec3& a, const DVec3& b, const DVec3& c)
+{
+    const double la = length(a), lb = length(b), lc = length(c);
+    const double det = dot(a, cross(b, c));
+    const double denom = la*lb*lc + dot(a, b)*lc + dot(a, c)*lb + dot(b, c)*la;
+    return 2.0 * std::atan2(det, denom);
+}
+
+} // Unnamed namespace.
+
+bool parseSignMethod(const std::string& name, SignMethod& method)
+{
+    if (name == "domain")
+        method = SignMethod::Domain;
+    else if (name == "scanline")
+        method = SignMethod::Scanline;
+    else if (name == "winding")
+        method = SignMethod::Winding;
+    else
+        return false;
+    return true;
+}
+
+const char* signMethodName(const SignMethod method)
+{
+    switch (method) {
+    case SignMethod::Domain: return "domain";
+    case SignMethod::Scanline: return "scanline";
+    case SignMethod::Winding: return "winding";
+    }
+    return "";
+}
+
+ScanlineSign::ScanlineSign(const TriangleSoup& mesh, const int size):
+    size(size)
+{
+    const size_t numRows = static_cast<size_t>(size)*static_cast<size_t>(size);
+
+    // Two passes over the triangles: count crossings per row, then store them.
+    rowStart.assign(numRows+1, 0);
+    auto count = [this](const size_t row, const float) { rowStart[row+1]++; };
+    for (size_t t = 0; t < mesh.numTriangles; ++t)
+        rasterizeTriangle(mesh.corner(t, 0), mesh.corner(t, 1), mesh.corner(t, 2), count);
+    for (size_t row = 0; row < numRows; ++row)
+        rowStart[row+1] += rowStart[row];
+
+    crossings.resize(rowStart.back());
+    std::vector<size_t> cursor(rowStart.begin(), rowStart.end()-1);
+    auto store = [this, &cursor](const size_t row, const float x) { crossings[cursor[row]++] = x; };
+    for (size_t t = 0; t < mesh.numTriangles; ++t)
+        rasterizeTriangle(mesh.corner(t, 0), mesh.corner(t, 1), mesh.corner(t, 2), store);
+
+    for (size_t row = 0; row < numRows; ++row)
+        std::sort(crossings.begin() + static_cast<std::ptrdiff_t>(rowStart[row]),
+                  crossings.begin() + static_cast<std::ptrdiff_t>(rowStart[row+1]));
+}
+
+bool ScanlineSign::isInside(const int x, const int y, const int z) const
+{
+    const size_t row = static_cast<size_t>(z)*static_cast<size_t>(size) + static_cast<size_t>(y);
+    const auto begin = crossings.begin() + static_cast<std::ptrdiff_t>(rowStart[row]);
+    const auto end = crossings.begin() + static_cast<std::ptrdiff_t>(rowStart[row+1]);
+    const float center = voxelCenter(x, y, z, size).x;
+    return (std::lower_bound(begin, end, center) - begin) % 2 == 1;
+}
+
+ScanlineSign::ScanlineSign(const Scene& scene, const int size):
+    size(size)
+{
+    const size_t numRows = static_cast<size_t>(size)*static_cast<size_t>(size);
+
+    // As for a single mesh, two passes (count, then store), but every crossing remembers its instance.
+    struct Visitor
+    {
+        std::vector<size_t>& rowStart;
+        std::vector<std::pair<uint32_t, float>>* tagged; // Null while counting.
+        std::vector<size_t>& cursor;
+        uint32_t instance;
+
+        void operator()(const size_t row, const float x)
+        {
+            if (tagged)
+                (*tagged)[cursor[row]++] = std::make_pair(instance, x);
+            else
+                rowStart[row+1]++;
+        }
+    };
+    rowStart.assign(numRows+1, 0);
+    std::vector<std::pair<uint32_t, float>> tagged;
+    std::vector<size_t> cursor;
+    Visitor visitor = {rowStart, nullptr, cursor, 0};
+    for (int pass = 0; pass < 2; ++pass) {
+        if (pass == 1) {
+            for (size_t row = 0; row < numRows; ++row)
+                rowStart[row+1] += rowStart[row];
+            tagged.resize(rowStart.back());
+            cursor.assign(rowStart.begin(), rowStart.end()-1);
+            visitor.tagged = &tagged;
+        }
+        for (uint32_t i = 0; i < scene.instances.size(); ++i) {
+            const MeshInstance& instance = scene.instances[i];
+            const TriangleSoup& mesh = scene.meshes[instance.mesh];
+            visitor.instance = i;
+            for (size_t t = 0; t < mesh.numTriangles; ++t) {
+                rasterizeTriangle(instance.toUnitCube.apply(mesh.corner(t, 0)), instance.toUnitCube.apply(mesh.corner(t, 1)),
+                                  instance.toUnitCube.apply(mesh.corner(t, 2)), visitor);
+            }
+        }
+    }
+
+    // Every instance's crossings bound its inside intervals (the last one open if a row ends inside
+    // an instance cut by the cube). The row keeps the boundaries of their union.
+    crossings.clear();
+    crossings.reserve(tagged.size());
+    std::vector<std::pair<float, float>> intervals;
+    size_t begin = 0;
+    for (size_t row = 0; row < numRows; ++row) {
+        const size_t end = rowStart[row+1];
+        rowStart[row] = crossings.size();
+        std::sort(tagged.begin() + static_cast<std::ptrdiff_t>(begin), tagged.begin() + static_cast<std::ptrdiff_t>(end));
+        if (begin == end || tagged[begin].first == tagged[end-1].first) {
+            for (size_t i = begin; i < end; ++i)
+                crossings.push_back(tagged[i].second);
+            begin = end;
+            continue;
+        }
+
+        intervals.clear();
+        for (size_t i = begin; i < end;) {
+            if (i+1 < end && tagged[i+1].first == tagged[i].first) {
+                intervals.emplace_back(tagged[i].second, tagged[i+1].second);
+                i += 2;
+            }
+            else {
+                intervals.emplace_back(tagged[i].second, std::numeric_limits<float>::infinity());
+                i++;
+            }
+        }
+        std::sort(intervals.begin(), intervals.end());
+        float intervalStart = intervals[0].first, intervalEnd = intervals[0].second;
+        for (size_t i = 1; i < intervals.size(); ++i) {
+            if (intervals[i].first > intervalEnd) {
+                crossings.push_back(intervalStart);
+                crossings.push_back(intervalEnd);
+                intervalStart = intervals[i].first;
+            }
+            intervalEnd = std::max(intervalEnd, intervals[i].second);
+        }
+        crossings.push_back(intervalStart);
+        crossings.push_back(intervalEnd);
+        begin = end;
+    }
+    rowStart[numRows] = crossings.size();
+    crossings.shrink_to_fit();
+}
+
+template <class Visitor>
+void ScanlineSign::rasterizeTriangle(const Vec3& a, const Vec3& b, const Vec3& c, Visitor& visitor) const
+{
+    // Rows only hit the triangle's face, triangles seen edge-on are skipped.
+    const double orientation = (static_cast<double>(b.y) - a.y)*(static_cast<double>(c.z) - a.z)
+                             - (static_cast<double>(b.z) - a.z)*(static_cast<double>(c.y) - a.y);
+    if (orientation == 0.0)
+        return;
+    const bool flipped = orientation < 0.0;
+    const double sign = flipped ? -1.0 : 1.0;
+    const bool ownsBC = ownsEdge(b, c, flipped);
+    const bool ownsCA = ownsEdge(c, a, flipped);
+    const bool ownsAB = ownsEdge(a, b, flipped);
+
+    const float step = 1.f / static_cast<float>(size);
+    const float off = step / 2.f;
+    const int yBegin = std::max(static_cast<int>(std::floor((std::min(a.y, std::min(b.y, c.y)) - off) / step)), 0);
+    const int yEnd = std::min(static_cast<int>(std::ceil((std::max(a.y, std::max(b.y, c.y)) - off) / step)), size-1);
+    const int zBegin = std::max(static_cast<int>(std::floor((std::min(a.z, std::min(b.z, c.z)) - off) / step)), 0);
+    const int zEnd = std::min(static_cast<int>(std::ceil((std::max(a.z, std::max(b.z, c.z)) - off) / step)), size-1);
+
+    for (int z = zBegin; z <= zEnd; ++z) {
+    for (int y = yBegin; y <= yEnd; ++y) {
+        const Vec3 center = voxelCenter(0, y, z, size);
+        const double wa = sign*edgeFunction(b, c, center.y, center.z);
+        const double wb = sign*edgeFunction(c, a, center.y, center.z);
+        const double wc = sign*edgeFunction(a, b, center.y, center.z);
+        if (wa < 0.0 || (wa == 0.0 && !ownsBC)
+            || wb < 0.0 || (wb == 0.0 && !ownsCA)
+            || wc < 0.0 || (wc == 0.0 && !ownsAB))
+            continue;
+
+        const double x = (wa*a.x + wb*b.x + wc*c.x) / (wa + wb + wc);
+        visitor(static_cast<size_t>(z)*static_cast<size_t>(size) + static_cast<size_t>(y), static_cast<float>(x));
+    }
+    }
+}
+
+WindingNumberSign::WindingNumberSign(const TriangleSoup& mesh, const int size):
+    mesh(mesh),
+    size(size)
+{
+    if (mesh.numTriangles == 0)
+        return;
+
+    std::vector<Vec3> centroids(mesh.numTriangles);
+    triangles.resize(mesh.numTriangles);
+    for (size_t t = 0; t < mesh.numTriangles; ++t) {
+        centroids[t] = (mesh.corner(t, 0) + mesh.corner(t, 1) + mesh.corner(t, 2)) * (1.f/3.f);
+        triangles[t] = static_cast<uint32_t>(t);
+    }
+
+    nodes.reserve(2 * mesh.numTriangles / k_leafSize + 1);
+    build(triangles, centroids, 0, static_cast<uint32_t>(mesh.numTriangles));
+}
+
+uint32_t WindingNumberSign::build(std::vector<uint32_t>& order, const std::vector<Vec3>& centroids,
+                                  const uint32_t begin, const uint32_t end)
+{
+    const uint32_t index = static_cast<uint32_t>(nodes.size());
+    nodes.push_back(Node());
+
+    const float Inf = std::numeric_limits<float>::infinity();
+    Vec3 boundsMin(Inf, Inf, Inf), boundsMax(-Inf, -Inf, -Inf);
+    Vec3 centroidMin = boundsMin, centroidMax = boundsMax;
+    DVec3 areaNormal = {0.0, 0.0, 0.0};
+    double weightedCenter[3] = {0.0, 0.0, 0.0};
+    double totalArea = 0.0;
+    for (uint32_t i = begin; i < end; ++i) {
+        const uint32_t t = order[i];
+        const Vec3 a = mesh.corner(t, 0), b = mesh.corner(t, 1), c = mesh.corner(t, 2);
+        boundsMin = vmin(boundsMin, vmin(a, vmin(b, c)));
+        boundsMax = vmax(boundsMax, vmax(a, vmax(b, c)));
+        centroidMin = vmin(centroidMin, centroids[t]);
+        centroidMax = vmax(centroidMax, centroids[t]);
+
+        const Vec3 origin;
+        const DVec3 n = cross(toDVec3(b - a, origin), toDVec3(c - a, origin));
+        const double area = 0.5 * length(n);
+        areaNormal.x += 0.5*n.x;
+        areaNormal.y += 0.5*n.y;
+        areaNormal.z += 0.5*n.z;
+        for (int k = 0; k < 3; ++k)
+            weightedCenter[k] += area*centroids[t][k];
+        totalArea += area;
+    }
+
+    Node node;
+    for (int k = 0; k < 3; ++k) {
+        node.boundsMin[k] = boundsMin[k];
+        node.boundsMax[k] = boundsMax[k];
+    }
+    node.areaNormal[0] = areaNormal.x;
+    node.areaNormal[1] = areaNormal.y;
+    node.areaNormal[2] = areaNormal.z;
+    for (int k = 0; k < 3; ++k)
+        node.center[k] = (totalArea > 0.0) ? weightedCenter[k] / totalArea
+                                           : 0.5 * (static_cast<double>(boundsMin[k]) + boundsMax[k]);
+    node.radius = 0.0;
+    for (int corner = 0; corner < 8; ++corner) {
+        double d2 = 0.0;
+        for (int k = 0; k < 3; ++k) {
+            const double v = ((corner >> k) & 1) ? boundsMax[k] : boundsMin[k];
+            d2 += (v - node.center[k]) * (v - node.center[k]);
+        }
+        node.radius = std::max(node.radius, std::sqrt(d2));
+    }
+    node.first = begin;
+    node.count = end - begin;
+
+    if (end - begin > k_leafSize) {
+        const Vec3 extents = centroidMax - centroidMin;
+        const int axis = (extents.x > extents.y && extents.x > extents.z) ? 0 : ((extents.y > extents.z) ? 1 : 2);
+        const uint32_t mid = begin + (end - begin) / 2;
+        std::nth_element(order.begin() + begin, order.begin() + mid, order.begin() + end,
+                         [&centroids, axis](const uint32_t l, const uint32_t r) { return centroids[l][axis] < centroids[r][axis]; });
+        build(order, centroids, begin, mid);
+        node.first = build(order, centroids, mid, end);
+        node.count = 0;
+    }
+
+    nodes[index] = node;
+    return index;
+}
+
+double WindingNumberSign::windingNumber(const Vec3& query) const
+{
+    if (nodes.empty())
+        return 0.0;
+
+    double omega = 0.0;
+    uint32_t stack[64];
+    int stackSize = 0;
+    stack[stackSize++] = 0;
+    while (stackSize > 0) {
+        const Node& node = nodes[stack[--stackSize]];
+        const double dx = node.center[0] - query.x;
+        const double dy = node.center[1] - query.y;
+        const double dz = node.center[2] - query.z;
+        const double dist = std::sqrt(dx*dx + dy*dy + dz*dz);
+        if (dist > k_windingBeta * node.radius) {
+            // Far field: dipole approximation of the whole cluster.
+            omega += (node.areaNormal[0]*dx + node.areaNormal[1]*dy + node.areaNormal[2]*dz) / (dist*dist*dist);
+            continue;
+        }
+
+        if (node.count > 0) {
+            for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+                const uint32_t t = triangles[i];
+                omega += solidAngle(toDVec3(mesh.corner(t, 0), query),
+                                    toDVec3(mesh.corner(t, 1), query),
+                                    toDVec3(mesh.corner(t, 2), query));
+            }
+            continue;
+        }
+
+        const uint32_t index = static_cast<uint32_t>(&node - nodes.data());
+        stack[stackSize++] = node.first;
+        stack[stackSize++] = index + 1;
+    }
+    return omega / k_fourPi;
+}
+
+bool WindingNumberSign::isInside(const int x, const int y, const int z) const
+{
+    return std::abs(windingNumber(voxelCenter(x, y, z, size))) > 0.5;
+}
+
+InstancedWindingSign::InstancedWindingSign(const Scene& scene, const int size):
+    size(size),
+    meshes(scene.meshes.size())
+{
+    for (const MeshInstance& instance : scene.instances) {
+        if (!meshes[instance.mesh])
+            meshes[instance.mesh].reset(new WindingNumberSign(scene.meshes[instance.mesh], size));
+        instances.push_back(Instance{instance.mesh, instance.toUnitCube.inverse()});
+    }
+}
+
+bool InstancedWindingSign::isInside(const int x, const int y, const int z) const
+{
+    const Vec3 center = voxelCenter(x, y, z, size);
+    for (const Instance& instance : instances) {
+        if (std::abs(meshes[instance.mesh]->windingNumber(instance.toMesh.apply(center))) > 0.5)
+            return true;
+    }
+    return false;
+}
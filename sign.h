@@ -0,0 +1,102 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "geometry.h"
+#include "scene.h"
+
+enum class SignMethod
+{
+    Domain,   // CGAL Polyhedral_mesh_domain_3, one ray shot per voxel.
+    Scanline, // Parity of surface crossings along grid rows.
+    Winding   // Generalized winding number, tolerates holes and self-intersections.
+};
+
+bool parseSignMethod(const std::string& name, SignMethod& method);
+const char* signMethodName(SignMethod method);
+
+// Decides whether voxel centers of a size^3 grid over the unit cube lie inside the mesh.
+// Implementations must be safe to query from several threads at once.
+class SignEvaluator
+{
+public:
+    virtual ~SignEvaluator() {}
+    virtual bool isInside(int x, int y, int z) const = 0;
+};
+
+// Shoots one ray per grid row (along x) through the whole mesh up front. Every triangle is
+// rasterized into the rows its yz projection covers, and each row's crossings are sorted once.
+// A voxel is inside if an odd number of crossings lies before its center. Expects a closed mesh.
+// Scenes are inside where any instance is: rows crossing several instances store the boundaries of
+// the union of the instances' inside intervals instead, so overlapping instances do not cancel.
+class ScanlineSign : public SignEvaluator
+{
+public:
+    ScanlineSign(const TriangleSoup& mesh, int size);
+    ScanlineSign(const Scene& scene, int size);
+    bool isInside(int x, int y, int z) const override;
+
+private:
+    template <class Visitor>
+    void rasterizeTriangle(const Vec3& a, const Vec3& b, const Vec3& c, Visitor& visitor) const;
+
+    int size;
+    std::vector<size_t> rowStart; // Crossings of row (y, z) are [rowStart[z*size+y], rowStart[z*size+y+1]).
+    std::vector<float> crossings;
+};
+
+// Fast generalized winding number (Barill et al. 2018, first order). Clusters of triangles far
+// away from the query point are replaced by their area-weighted normal (a dipole), nearby
+// triangles contribute their exact solid angle. Inside means |winding number| > 0.5, which also
+// gives sensible answers for meshes with holes.
+class WindingNumberSign : public SignEvaluator
+{
+public:
+    WindingNumberSign(const TriangleSoup& mesh, int size);
+    bool isInside(int x, int y, int z) const override;
+
+    double windingNumber(const Vec3& query) const;
+
+private:
+    struct Node
+    {
+        float boundsMin[3], boundsMax[3];
+        double areaNormal[3]; // Sum of area weighted normals of all triangles in the subtree.
+        double center[3];     // Area weighted centroid.
+        double radius;        // Bounds all triangles around the center.
+        uint32_t first, count; // Leaf: range of triangles. Inner node: first = right child, count = 0.
+    };
+
+    uint32_t build(std::vector<uint32_t>& order, const std::vector<Vec3>& centroids, uint32_t begin, uint32_t end);
+
+    static const uint32_t k_leafSize = 8;
+
+    TriangleSoup mesh;
+    int size;
+    std::vector<Node> nodes; // Depth first, left child directly follows its parent.
+    std::vector<uint32_t> triangles;
+};
+
+// Winding numbers of a scene, one WindingNumberSign per mesh in the mesh's own space. The winding
+// number of a closed mesh does not change under its instance's transform (up to the sign), so a
+// voxel center is taken into each instance's mesh space. The scene is the union of its instances:
+// a voxel is inside if it is inside any of them, whatever their orientations.
+class InstancedWindingSign : public SignEvaluator
+{
+public:
+    InstancedWindingSign(const Scene& scene, int size);
+    bool isInside(int x, int y, int z) const override;
+
+private:
+    struct Instance
+    {
+        uint32_t mesh;
+        AffineTransform toMesh;
+    };
+
+    int size;
+    std::vector<std::unique_ptr<WindingNumberSign>> meshes; // Null for meshes without instances.
+    std::vector<Instance> instances;
+};
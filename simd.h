@@ -0,0 +1,95 @@
+#pragma once
+
+// Minimal wrapper over the widest float vector the target supports: 8 lanes with AVX2, 4 lanes
+// with SSE2 and a portable 4 lane fallback otherwise (e.g. Emscripten).
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define DFGEN_SIMD_AVX2 1
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define DFGEN_SIMD_SSE 1
+#else
+#include <algorithm>
+#define DFGEN_SIMD_SCALAR 1
+#endif
+
+#if DFGEN_SIMD_AVX2
+
+const int k_simdWidth = 8;
+
+struct vfloat { __m256 v; };
+struct vmask { __m256 v; };
+
+inline vfloat vbroadcast(const float f) { return vfloat{_mm256_set1_ps(f)}; }
+inline vfloat vload(const float* p) { return vfloat{_mm256_loadu_ps(p)}; }
+inline void vstore(float* p, const vfloat a) { _mm256_storeu_ps(p, a.v); }
+inline vfloat operator+(const vfloat a, const vfloat b) { return vfloat{_mm256_add_ps(a.v, b.v)}; }
+inline vfloat operator-(const vfloat a, const vfloat b) { return vfloat{_mm256_sub_ps(a.v, b.v)}; }
+inline vfloat operator*(const vfloat a, const vfloat b) { return vfloat{_mm256_mul_ps(a.v, b.v)}; }
+inline vfloat vmin(const vfloat a, const vfloat b) { return vfloat{_mm256_min_ps(a.v, b.v)}; }
+inline vfloat vmax(const vfloat a, const vfloat b) { return vfloat{_mm256_max_ps(a.v, b.v)}; }
+inline vmask operator<(const vfloat a, const vfloat b) { return vmask{_mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ)}; }
+inline vmask operator<=(const vfloat a, const vfloat b) { return vmask{_mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ)}; }
+inline vmask operator>(const vfloat a, const vfloat b) { return vmask{_mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ)}; }
+inline vmask operator>=(const vfloat a, const vfloat b) { return vmask{_mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ)}; }
+inline vmask operator&(const vmask a, const vmask b) { return vmask{_mm256_and_ps(a.v, b.v)}; }
+inline vmask operator|(const vmask a, const vmask b) { return vmask{_mm256_or_ps(a.v, b.v)}; }
+inline vfloat vselect(const vmask m, const vfloat a, const vfloat b) { return vfloat{_mm256_blendv_ps(b.v, a.v, m.v)}; }
+inline int vmovemask(const vmask m) { return _mm256_movemask_ps(m.v); }
+
+#elif DFGEN_SIMD_SSE
+
+const int k_simdWidth = 4;
+
+struct vfloat { __m128 v; };
+struct vmask { __m128 v; };
+
+inline vfloat vbroadcast(const float f) { return vfloat{_mm_set1_ps(f)}; }
+inline vfloat vload(const float* p) { return vfloat{_mm_loadu_ps(p)}; }
+inline void vstore(float* p, const vfloat a) { _mm_storeu_ps(p, a.v); }
+inline vfloat operator+(const vfloat a, const vfloat b) { return vfloat{_mm_add_ps(a.v, b.v)}; }
+inline vfloat operator-(const vfloat a, const vfloat b) { return vfloat{_mm_sub_ps(a.v, b.v)}; }
+inline vfloat operator*(const vfloat a, const vfloat b) { return vfloat{_mm_mul_ps(a.v, b.v)}; }
+inline vfloat vmin(const vfloat a, const vfloat b) { return vfloat{_mm_min_ps(a.v, b.v)}; }
+inline vfloat vmax(const vfloat a, const vfloat b) { return vfloat{_mm_max_ps(a.v, b.v)}; }
+inline vmask operator<(const vfloat a, const vfloat b) { return vmask{_mm_cmplt_ps(a.v, b.v)}; }
+inline vmask operator<=(const vfloat a, const vfloat b) { return vmask{_mm_cmple_ps(a.v, b.v)}; }
+inline vmask operator>(const vfloat a, const vfloat b) { return vmask{_mm_cmpgt_ps(a.v, b.v)}; }
+inline vmask operator>=(const vfloat a, const vfloat b) { return vmask{_mm_cmpge_ps(a.v, b.v)}; }
+inline vmask operator&(const vmask a, const vmask b) { return vmask{_mm_and_ps(a.v, b.v)}; }
+inline vmask operator|(const vmask a, const vmask b) { return vmask{_mm_or_ps(a.v, b.v)}; }
+inline vfloat vselect(const vmask m, const vfloat a, const vfloat b) { return vfloat{_mm_or_ps(_mm_and_ps(m.v, a.v), _mm_andnot_ps(m.v, b.v))}; }
+inline int vmovemask(const vmask m) { return _mm_movemask_ps(m.v); }
+
+#else
+
+const int k_simdWidth = 4;
+
+struct vfloat { float v[4]; };
+struct vmask { bool v[4]; };
+
+#define DFGEN_SIMD_LANES(expr) for (int i = 0; i < 4; ++i) { expr; }
+
+inline vfloat vbroadcast(const float f) { vfloat r; DFGEN_SIMD_LANES(r.v[i] = f) return r; }
+inline vfloat vload(const float* p) { vfloat r; DFGEN_SIMD_LANES(r.v[i] = p[i]) return r; }
+inline void vstore(float* p, const vfloat a) { DFGEN_SIMD_LANES(p[i] = a.v[i]) }
+inline vfloat operator+(const vfloat a, const vfloat b) { vfloat r; DFGEN_SIMD_LANES(r.v[i] = a.v[i] + b.v[i]) return r; }
+inline vfloat operator-(const vfloat a, const vfloat b) { vfloat r; DFGEN_SIMD_LANES(r.v[i] = a.v[i] - b.v[i]) return r; }
+inline vfloat operator*(const vfloat a, const vfloat b) { vfloat r; DFGEN_SIMD_LANES(r.v[i] = a.v[i] * b.v[i]) return r; }
+inline vfloat vmin(const vfloat a, const vfloat b) { vfloat r; DFGEN_SIMD_LANES(r.v[i] = std::min(a.v[i], b.v[i])) return r; }
+inline vfloat vmax(const vfloat a, const vfloat b) { vfloat r; DFGEN_SIMD_LANES(r.v[i] = std::max(a.v[i], b.v[i])) return r; }
+inline vmask operator<(const vfloat a, const vfloat b) { vmask r; DFGEN_SIMD_LANES(r.v[i] = a.v[i] < b.v[i]) return r; }
+inline vmask operator<=(const vfloat a, const vfloat b) { vmask r; DFGEN_SIMD_LANES(r.v[i] = a.v[i] <= b.v[i]) return r; }
+inline vmask operator>(const vfloat a, const vfloat b) { vmask r; DFGEN_SIMD_LANES(r.v[i] = a.v[i] > b.v[i]) return r; }
+inline vmask operator>=(const vfloat a, const vfloat b) { vmask r; DFGEN_SIMD_LANES(r.v[i] = a.v[i] >= b.v[i]) return r; }
+inline vmask operator&(const vmask a, const vmask b) { vmask r; DFGEN_SIMD_LANES(r.v[i] = a.v[i] && b.v[i]) return r; }
+inline vmask operator|(const vmask a, const vmask b) { vmask r; DFGEN_SIMD_LANES(r.v[i] = a.v[i] || b.v[i]) return r; }
+inline vfloat vselect(const vmask m, const vfloat a, const vfloat b) { vfloat r; DFGEN_SIMD_LANES(r.v[i] = m.v[i] ? a.v[i] : b.v[i]) return r; }
+inline int vmovemask(const vmask m) { int r = 0; DFGEN_SIMD_LANES(r |= (m.v[i] ? 1 : 0) << i) return r; }
+
+#undef DFGEN_SIMD_LANES
+
+#endif
+
+inline vfloat vclamp01(const vfloat a) { return vmin(vmax(a, vbroadcast(0.f)), vbroadcast(1.f)); }
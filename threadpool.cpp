@@ -0,0 +1,141 @@
+#include "threadpool.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace {
+
+// Identifies the pool (and its queue) the current thread works for.
+thread_local const ThreadPool* t_pool = nullptr;
+thread_local unsigned int t_queueIndex = 0;
+
+} // Unnamed namespace.
+
+ThreadPool::ThreadPool(unsigned int numThreads):
+    queued(0),
+    nextQueue(0),
+    stopping(false)
+{
+    if (numThreads == 0)
+        numThreads = std::max(std::thread::hardware_concurrency(), 1u);
+
+    for (unsigned int i = 0; i < numThreads; ++i)
+        queues.emplace_back(new Queue());
+    for (unsigned int i = 0; i+1 < numThreads; ++i)
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        stopping = true;
+    }
+    wakeUp.notify_all();
+    for (std::thread& worker : workers)
+        worker.join();
+}
+
+void ThreadPool::submit(TaskGroup& group, std::function<void()> task)
+{
+    unsigned int index = static_cast<unsigned int>(queues.size()) - 1;
+    if (t_pool == this)
+        index = t_queueIndex;
+    else if (!workers.empty())
+        index = nextQueue++ % static_cast<unsigned int>(workers.size());
+
+    ++group.pending;
+    ++group.queued;
+    {
+        Queue& queue = *queues[index];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(Task{std::move(task), &group});
+    }
+    ++queued;
+
+    {
+        std::lock_guard<std::mutex> lock(sleepMutex);
+    }
+    wakeUp.notify_one();
+}
+
+void ThreadPool::wait(TaskGroup& group)
+{
+    while (group.pending.load() > 0) {
+        Task task;
+        if (tryPop(task, &group)) {
+            execute(task);
+            continue;
+        }
+
+        // The group's other tasks are running elsewhere (or about to be queued).
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wakeUp.wait(lock, [&group]() { return group.pending.load() == 0 || group.queued.load() > 0; });
+    }
+}
+
+bool ThreadPool::tryPop(Task& task, const TaskGroup* group)
+{
+    const unsigned int numQueues = static_cast<unsigned int>(queues.size());
+    const unsigned int self = (t_pool == this) ? t_queueIndex : numQueues-1;
+    auto matches = [group](const Task& candidate) { return !group || candidate.group == group; };
+
+    // Newest task from our own queue first (it is likely still warm in cache)...
+    {
+        Queue& queue = *queues[self];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        const auto it = std::find_if(queue.tasks.rbegin(), queue.tasks.rend(), matches);
+        if (it != queue.tasks.rend()) {
+            task = std::move(*it);
+            queue.tasks.erase(std::next(it).base());
+            --task.group->queued;
+            --queued;
+            return true;
+        }
+    }
+
+    // ...then steal the oldest task of somebody else.
+    for (unsigned int i = 1; i < numQueues; ++i) {
+        Queue& queue = *queues[(self+i) % numQueues];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        const auto it = std::find_if(queue.tasks.begin(), queue.tasks.end(), matches);
+        if (it != queue.tasks.end()) {
+            task = std::move(*it);
+            queue.tasks.erase(it);
+            --task.group->queued;
+            --queued;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::execute(Task& task)
+{
+    task.function();
+    if (--task.group->pending == 0) {
+        // The group may be destroyed by its waiter from now on, don't touch it.
+        std::lock_guard<std::mutex> lock(sleepMutex);
+        wakeUp.notify_all();
+    }
+}
+
+void ThreadPool::workerLoop(unsigned int index)
+{
+    t_pool = this;
+    t_queueIndex = index;
+
+    while (true) {
+        Task task;
+        if (tryPop(task, nullptr)) {
+            execute(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        wakeUp.wait(lock, [this]() { return stopping || queued.load() > 0; });
+        if (stopping && queued.load() == 0)
+            return;
+    }
+}
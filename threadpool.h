@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Counts tasks submitted to a ThreadPool that have not finished yet.
+// Wait for all of them with ThreadPool::wait().
+class TaskGroup
+{
+public:
+    TaskGroup(): pending(0), queued(0) {}
+    TaskGroup(const TaskGroup&) = delete;
+    TaskGroup& operator=(const TaskGroup&) = delete;
+
+private:
+    friend class ThreadPool;
+    std::atomic<size_t> pending;
+    std::atomic<size_t> queued; // Of the pending tasks, those not started yet.
+};
+
+// Work-stealing thread pool. Every worker owns a deque of tasks: it pops from the back of its own
+// deque and, once that runs dry, steals from the front of the others. Tasks submitted from outside
+// the pool are spread round-robin over the workers. A thread calling wait() executes pending tasks
+// of the group it waits for instead of blocking, so tasks may submit (and wait for) further tasks
+// without deadlocking. It never runs other tasks: those would stack up on its own (a task waiting
+// for its inner tasks would start unrelated outer tasks and only resume once they finished).
+class ThreadPool
+{
+public:
+    // numThreads counts the thread calling wait() as well, 0 means all hardware threads.
+    explicit ThreadPool(unsigned int numThreads = 0);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned int size() const { return static_cast<unsigned int>(workers.size()) + 1; }
+
+    void submit(TaskGroup& group, std::function<void()> task);
+    void wait(TaskGroup& group);
+
+private:
+    struct Task
+    {
+        std::function<void()> function;
+        TaskGroup* group;
+    };
+
+    struct Queue
+    {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    // Any task if group is null, else only one of the group.
+    bool tryPop(Task& task, const TaskGroup* group);
+    void execute(Task& task);
+    void workerLoop(unsigned int index);
+
+    std::vector<std::unique_ptr<Queue>> queues; // One per worker, the last one for external threads.
+    std::vector<std::thread> workers;
+    std::atomic<size_t> queued;
+    std::atomic<unsigned int> nextQueue;
+    std::mutex sleepMutex;
+    std::condition_variable wakeUp;
+    bool stopping;
+};
+
+// Runs function(i) for every i in [0, count) on the pool and returns once all calls finished.
+template <class Function>
+void parallelFor(ThreadPool& pool, size_t count, const Function& function)
+{
+    TaskGroup group;
+    for (size_t i = 0; i < count; ++i)
+        pool.submit(group, [&function, i]() { function(i); });
+    pool.wait(group);
+}